@@ -0,0 +1,43 @@
+#ifndef BENCH_BENCH_H_
+#define BENCH_BENCH_H_
+
+#include "perf.h"
+#include <stddef.h>
+#include <stdio.h>
+
+/* shared by the benchmark programs: generated sources and timing of the
+ * compiler phases */
+
+enum phase {
+/** lexing alone, the parser lexes on demand so parse includes it */
+PHASE_LEX,
+PHASE_PARSE,
+PHASE_SEMANTICS,
+PHASE_CODE,
+PHASE_ASM,
+PHASE_FREE,
+NUM_PHASES,
+};
+
+extern const char *phase_names[NUM_PHASES];
+
+/* kinds of generated programs, each line of bench_kinds_help describes
+ * one */
+extern const char *bench_kinds[];
+extern const char *bench_kinds_help;
+
+/* writes a program of the kind and size to f, the same arguments always
+ * give the same program, returns non-zero if the kind is unknown */
+int bench_generate(FILE *f, const char *kind, size_t n);
+
+/* compiles src once, adding the milliseconds of each phase to t and, if perf
+ * is not NULL, its counters to counts, the assembly is written to null */
+int bench_phases(const char *name, const unsigned char *src, size_t sz,
+                 FILE *null, double t[NUM_PHASES], perf_t *perf,
+                 int64_t counts[NUM_PHASES][NUM_COUNTERS]);
+
+double bench_now_ms(void);
+/* sorts the samples */
+double bench_median(double *samples, size_t n);
+
+#endif /* BENCH_BENCH_H_ */
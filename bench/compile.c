@@ -0,0 +1,284 @@
+#include "bench.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* times each phase of the compiler on the input files over repeated runs and
+ * counts them with the performance counters available, writes the medians as
+ * JSON and compares the times with a baseline */
+
+#define PROGRAM_NAME "compile"
+
+const char *help_str = ""
+"Usage: "PROGRAM_NAME" [option]... file...\n"
+"\n"
+"  -h            print this help message\n"
+"  -n runs       compile each file runs times (default 10)\n"
+"  -o file       write the results as JSON to file\n"
+"  -b file       compare the results with the JSON of an earlier run\n"
+"  -t tolerance  fail if a phase is more than tolerance slower than in the\n"
+"                baseline, as a fraction (default 0.25)\n"
+;
+
+struct result {
+    char name[64];
+    size_t sz;
+    /** median of each phase in milliseconds */
+    double median[NUM_PHASES];
+    /** median of each counter of each phase, -1 if not counted */
+    int64_t counters[NUM_PHASES][NUM_COUNTERS];
+};
+
+static int bench_file(const char *, size_t, FILE *, perf_t *,
+                      struct result *);
+static int read_file(const char *, unsigned char **, size_t *);
+static double mb_s(size_t, double);
+static void print_results(struct result *, size_t, FILE *);
+static void write_json(struct result *, size_t, size_t, FILE *);
+static int compare(struct result *, size_t, const char *, double);
+
+int main(int argc, char *argv[]) {
+    size_t runs = 10;
+    char *outfile = NULL, *baseline = NULL, *end;
+    double tolerance = 0.25;
+
+    int c;
+    while((c = getopt(argc, argv, "hn:o:b:t:")) != -1) {
+        switch(c) {
+        case 'n':
+            if(!(runs = strtoul(optarg, &end, 10)) || *end) {
+                fprintf(stderr, "[Error] Invalid number of runs '%s'\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'o':
+            outfile = optarg;
+            break;
+
+        case 'b':
+            baseline = optarg;
+            break;
+
+        case 't':
+            if((tolerance = strtod(optarg, &end)) < 0 || *end
+            || end == optarg) {
+                fprintf(stderr, "[Error] Invalid tolerance '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        default:
+            fprintf(stderr, "%s", help_str);
+            return EXIT_FAILURE;
+        }
+    }
+    argc -= optind, argv += optind;
+    if(argc < 1) {
+        fprintf(stderr, "%s", help_str);
+        return EXIT_FAILURE;
+    }
+
+    /* the assembly is generated but not kept */
+    FILE *null;
+    if(!(null = fopen("/dev/null", "w"))) {
+        fprintf(stderr, "[Error] /dev/null: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    perf_t perf;
+    int err;
+    if((err = perf_open(&perf, 0)))
+        fprintf(stderr, "[Info] Not every performance counter is available: "
+                "%s\n", strerror(err));
+
+    struct result *results = calloc(argc, sizeof(struct result));
+    int ret = EXIT_SUCCESS;
+    for(int i = 0; i < argc && ret == EXIT_SUCCESS; ++i)
+        if(bench_file(argv[i], runs, null, &perf, &results[i]))
+            ret = EXIT_FAILURE;
+    perf_close(&perf);
+    fclose(null);
+
+    if(ret == EXIT_SUCCESS) {
+        print_results(results, argc, stdout);
+        if(outfile) {
+            FILE *f;
+            if(!(f = fopen(outfile, "w"))) {
+                fprintf(stderr, "[Error] %s: %s\n", outfile, strerror(errno));
+                ret = EXIT_FAILURE;
+            } else {
+                write_json(results, argc, runs, f);
+                if(fclose(f)) {
+                    fprintf(stderr, "[Error] %s: %s\n", outfile,
+                            strerror(errno));
+                    ret = EXIT_FAILURE;
+                }
+            }
+        }
+        if(baseline && compare(results, argc, baseline, tolerance))
+            ret = EXIT_FAILURE;
+    }
+    free(results);
+    return ret;
+}
+
+static int bench_file(const char *path, size_t runs, FILE *null,
+                      perf_t *perf, struct result *res) {
+    unsigned char *src;
+    if(read_file(path, &src, &res->sz)) return 1;
+
+    /* named after the file without its directory and extension */
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    size_t len = strcspn(base, ".");
+    if(len >= sizeof res->name) len = sizeof res->name - 1;
+    memcpy(res->name, base, len);
+    res->name[len] = '\0';
+
+    double *times = calloc(runs * NUM_PHASES, sizeof(double));
+    int64_t (*counts)[NUM_PHASES][NUM_COUNTERS]
+        = calloc(runs, sizeof *counts);
+    int ret = 0;
+    for(size_t r = 0; r < runs && !ret; ++r)
+        ret = bench_phases(path, src, res->sz, null, times + r * NUM_PHASES,
+                           perf, counts[r]);
+
+    if(!ret) {
+        double *samples = malloc(sizeof(double) * runs);
+        int64_t *counters = malloc(sizeof(int64_t) * runs * NUM_COUNTERS);
+        for(size_t p = 0; p < NUM_PHASES; ++p) {
+            for(size_t r = 0; r < runs; ++r) {
+                samples[r] = times[r * NUM_PHASES + p];
+                memcpy(counters + r * NUM_COUNTERS, counts[r][p],
+                       sizeof counts[r][p]);
+            }
+            res->median[p] = bench_median(samples, runs);
+            perf_median(counters, runs, res->counters[p]);
+        }
+        free(counters);
+        free(samples);
+    }
+    free(counts);
+    free(times);
+    free(src);
+    return ret;
+}
+
+static int read_file(const char *path, unsigned char **data, size_t *sz) {
+    FILE *f;
+    if(!(f = fopen(path, "rb"))) {
+        fprintf(stderr, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    size_t cap = 1 << 16, n;
+    *sz = 0;
+    *data = malloc(cap);
+    while((n = fread(*data + *sz, 1, cap - *sz, f)) > 0)
+        if((*sz += n) == cap) *data = realloc(*data, cap *= 2);
+    int ret = ferror(f);
+    if(ret) {
+        fprintf(stderr, "[Error] %s: Failed to read\n", path);
+        free(*data);
+    }
+    fclose(f);
+    return ret;
+}
+
+static double mb_s(size_t sz, double ms) {
+    return ms > 0 ? sz / 1e6 / (ms / 1e3) : 0;
+}
+
+static void print_results(struct result *res, size_t num, FILE *f) {
+    fprintf(f, "%-16s %10s", "benchmark", "bytes");
+    for(size_t p = 0; p < NUM_PHASES; ++p) fprintf(f, " %10s", phase_names[p]);
+    fprintf(f, " %10s\n", "MB/s");
+    for(size_t i = 0; i < num; ++i) {
+        double total = 0;
+        fprintf(f, "%-16s %10zu", res[i].name, res[i].sz);
+        for(size_t p = 0; p < NUM_PHASES; ++p) {
+            fprintf(f, " %10.3f", res[i].median[p]);
+            /* lexing is part of parsing */
+            if(p != PHASE_LEX) total += res[i].median[p];
+        }
+        fprintf(f, " %10.1f\n", mb_s(res[i].sz, total));
+    }
+
+    fprintf(f, "\n%-16s %-10s", "benchmark", "phase");
+    perf_print_header(f);
+    fputc('\n', f);
+    for(size_t i = 0; i < num; ++i)
+        for(size_t p = 0; p < NUM_PHASES; ++p) {
+            fprintf(f, "%-16s %-10s", res[i].name, phase_names[p]);
+            perf_print(res[i].counters[p], f);
+            fputc('\n', f);
+        }
+}
+
+/* one benchmark per line, so compare can read it back line by line */
+static void write_json(struct result *res, size_t num, size_t runs, FILE *f) {
+    fprintf(f, "{\"runs\": %zu, \"benchmarks\": [\n", runs);
+    for(size_t i = 0; i < num; ++i) {
+        fprintf(f, "{\"name\": \"%s\", \"bytes\": %zu, \"phases\": {",
+                res[i].name, res[i].sz);
+        for(size_t p = 0; p < NUM_PHASES; ++p) {
+            fprintf(f, "%s\"%s\": {\"median_ms\": %.6f, \"mb_s\": %.3f, "
+                    "\"counters\": {", p ? ", " : "", phase_names[p],
+                    res[i].median[p], mb_s(res[i].sz, res[i].median[p]));
+            perf_write_json(res[i].counters[p], f);
+            fputs("}}", f);
+        }
+        fprintf(f, "}}%s\n", i + 1 < num ? "," : "");
+    }
+    fputs("]}\n", f);
+}
+
+/* benchmarks missing from either side are skipped, returns non-zero if any
+ * phase is slower than the baseline by more than tolerance */
+static int compare(struct result *res, size_t num, const char *path,
+                   double tolerance) {
+    FILE *f;
+    if(!(f = fopen(path, "r"))) {
+        fprintf(stderr, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    int slower = 0;
+    char *line = NULL, key[80];
+    size_t cap = 0;
+    printf("\n%-16s %-10s %12s %12s %8s\n", "benchmark", "phase",
+           "baseline ms", "median ms", "change");
+    while(getline(&line, &cap, f) != -1) {
+        struct result *r = NULL;
+        for(size_t i = 0; i < num && !r; ++i) {
+            snprintf(key, sizeof key, "{\"name\": \"%s\",", res[i].name);
+            if(!strncmp(line, key, strlen(key))) r = &res[i];
+        }
+        if(!r) continue;
+
+        for(size_t p = 0; p < NUM_PHASES; ++p) {
+            double base;
+            char *at;
+            snprintf(key, sizeof key, "\"%s\": {\"median_ms\": ",
+                     phase_names[p]);
+            if(!(at = strstr(line, key))
+            || sscanf(at + strlen(key), "%lf", &base) != 1 || base <= 0)
+                continue;
+            double change = r->median[p] / base - 1;
+            int bad = change > tolerance;
+            printf("%-16s %-10s %12.3f %12.3f %+7.1f%%%s\n", r->name,
+                   phase_names[p], base, r->median[p], change * 100,
+                   bad ? "  slower" : "");
+            slower += bad;
+        }
+    }
+    free(line);
+    fclose(f);
+
+    if(slower)
+        fprintf(stderr, "[Error] %d phases are more than %.0f%% slower than "
+                "in %s\n", slower, tolerance * 100, path);
+    return slower != 0;
+}
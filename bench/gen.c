@@ -0,0 +1,27 @@
+#include "bench.h"
+#include <stdlib.h>
+
+/* generates dpp programs of a given shape and size for the benchmarks */
+
+#define PROGRAM_NAME "gen"
+
+const char *help_str = ""
+"Usage: "PROGRAM_NAME" kind size\n"
+"\n"
+"Writes a program to standard output, where kind is one of\n"
+;
+
+int main(int argc, char *argv[]) {
+    char *end;
+    size_t n;
+    if(argc != 3 || !(n = strtoul(argv[2], &end, 10)) || *end) {
+        fprintf(stderr, "%s%s", help_str, bench_kinds_help);
+        return EXIT_FAILURE;
+    }
+
+    if(bench_generate(stdout, argv[1], n)) {
+        fprintf(stderr, "[Error] Unknown kind '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    return fflush(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+#include "bench.h"
+#include <string.h>
+
+/* dpp programs of a given shape and size */
+
+const char *bench_kinds[] = {
+    "fns", "calls", "chain", "expr", "nest", "locals", NULL
+};
+
+const char *bench_kinds_help = ""
+"  fns     size functions, each calling the one before it\n"
+"  calls   size calls of 64 functions from one function\n"
+"  chain   an if/else if chain of size branches\n"
+"  expr    an expression of size terms\n"
+"  nest    size nested blocks, each with a local\n"
+"  locals  size locals in one scope\n"
+;
+
+static const char *ops[] = { "+", "-", "*", "^", "|", "&" };
+
+static void gen_fns(FILE *f, size_t n) {
+    fprintf(f, "fn f0(a, b) {\n    return a;\n}\n\n");
+    for(size_t i = 1; i < n; ++i)
+        fprintf(f, "fn f%zu(a, b) {\n"
+                   "    let x = a + b * %zu;\n"
+                   "    if x > 100 {\n"
+                   "        return f%zu(x %% 97, b);\n"
+                   "    }\n"
+                   "    return x;\n"
+                   "}\n\n", i, i % 13, i - 1);
+    fprintf(f, "fn main() {\n    print(f%zu(1, 2));\n    return 0;\n}\n",
+            n ? n - 1 : 0);
+}
+
+static void gen_calls(FILE *f, size_t n) {
+    for(size_t i = 0; i < 64; ++i)
+        fprintf(f, "fn g%zu(a) {\n    return a + %zu;\n}\n\n", i, i);
+    fprintf(f, "fn main() {\n");
+    for(size_t i = 0; i < n; ++i)
+        fprintf(f, "    g%zu(%zu);\n", i * 7 % 64, i);
+    fprintf(f, "    return 0;\n}\n");
+}
+
+static void gen_chain(FILE *f, size_t n) {
+    fprintf(f, "fn pick(x) {\n    if x == 0 {\n        return 1;\n    }");
+    for(size_t i = 1; i < n; ++i)
+        fprintf(f, " else if x == %zu {\n        return %zu;\n    }", i,
+                i * 7);
+    fprintf(f, " else {\n        return 0;\n    }\n}\n\n");
+    fprintf(f, "fn main() {\n    print(pick(input()));\n    return 0;\n}\n");
+}
+
+static void gen_expr(FILE *f, size_t n) {
+    fprintf(f, "fn e(a, b) {\n    return a");
+    for(size_t i = 1; i < n; ++i) {
+        const char *op = ops[i % (sizeof ops / sizeof *ops)];
+        if(i % 5 == 0) fprintf(f, "\n        %s (b * %zu + a)", op, i);
+        else fprintf(f, " %s %zu", op, i);
+    }
+    fprintf(f, ";\n}\n\n");
+    fprintf(f, "fn main() {\n    print(e(input(), 3));\n    return 0;\n}\n");
+}
+
+static void gen_nest(FILE *f, size_t n) {
+    fprintf(f, "fn main() {\n    let v0 = input();\n");
+    /* not indented, or the source would be mostly spaces */
+    for(size_t i = 1; i <= n; ++i)
+        fprintf(f, "    {\n    let v%zu = v%zu + %zu;\n", i, i - 1, i);
+    fprintf(f, "    print(v%zu);\n", n);
+    for(size_t i = n; i > 0; --i) fprintf(f, "    }\n");
+    fprintf(f, "    return 0;\n}\n");
+}
+
+static void gen_locals(FILE *f, size_t n) {
+    fprintf(f, "fn main() {\n    let v0 = input();\n");
+    for(size_t i = 1; i <= n; ++i)
+        fprintf(f, "    let v%zu = v%zu * 3 + v%zu %% %zu;\n", i, i - 1,
+                i / 2, i + 1);
+    fprintf(f, "    print(v%zu);\n    return 0;\n}\n", n);
+}
+
+int bench_generate(FILE *f, const char *kind, size_t n) {
+    static void (*gens[])(FILE *, size_t) = {
+        gen_fns, gen_calls, gen_chain, gen_expr, gen_nest, gen_locals,
+    };
+    for(size_t i = 0; bench_kinds[i]; ++i)
+        if(!strcmp(kind, bench_kinds[i])) {
+            gens[i](f, n);
+            return 0;
+        }
+    return 1;
+}
@@ -0,0 +1,161 @@
+#define _DEFAULT_SOURCE
+#include "perf.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+const char *counter_names[NUM_COUNTERS] = {
+[COUNTER_CYCLES] = "cycles",
+[COUNTER_INSTRUCTIONS] = "instructions",
+[COUNTER_BRANCH_MISSES] = "branch_misses",
+[COUNTER_L1D_MISSES] = "l1d_misses",
+[COUNTER_LLC_MISSES] = "llc_misses",
+[COUNTER_PAGE_FAULTS] = "page_faults",
+};
+
+#define CACHE_READ_MISS(cache) ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 \
+                                | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[NUM_COUNTERS] = {
+[COUNTER_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+[COUNTER_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+[COUNTER_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+[COUNTER_L1D_MISSES] = { PERF_TYPE_HW_CACHE,
+                         CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+[COUNTER_LLC_MISSES] = { PERF_TYPE_HW_CACHE,
+                         CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+[COUNTER_PAGE_FAULTS] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static int read_counter(int, uint64_t[3]);
+static long rusage_faults(int);
+static int cmp_int64(const void *, const void *);
+
+int perf_open(perf_t *perf, pid_t pid) {
+    int ret = 0;
+    perf->who = pid ? RUSAGE_CHILDREN : RUSAGE_SELF;
+    perf->faults = rusage_faults(perf->who);
+    for(size_t c = 0; c < NUM_COUNTERS; ++c) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = events[c].type;
+        attr.config = events[c].config;
+        /* the counters are multiplexed if there are not enough of them */
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                         | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        if(pid) {
+            attr.disabled = 1;
+            attr.enable_on_exec = 1;
+            attr.inherit = 1;
+        }
+        memset(perf->start[c], 0, sizeof perf->start[c]);
+        if((perf->fd[c] = syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+                                  0)) == -1 && !ret)
+            ret = errno;
+    }
+    return ret;
+}
+
+void perf_start(perf_t *perf) {
+    perf->faults = rusage_faults(perf->who);
+    for(size_t c = 0; c < NUM_COUNTERS; ++c)
+        if(perf->fd[c] != -1) read_counter(perf->fd[c], perf->start[c]);
+}
+
+void perf_stop(perf_t *perf, int64_t counts[NUM_COUNTERS]) {
+    uint64_t v[3];
+    for(size_t c = 0; c < NUM_COUNTERS; ++c) {
+        int64_t n = -1;
+        if(perf->fd[c] != -1 && !read_counter(perf->fd[c], v)) {
+            uint64_t *s = perf->start[c];
+            /* scaled up by the time it was not running */
+            if(v[2] > s[2])
+                n = (double)(v[0] - s[0]) * (v[1] - s[1]) / (v[2] - s[2]);
+            else if(v[1] == s[1]) n = 0;
+        } else if(c == COUNTER_PAGE_FAULTS)
+            n = rusage_faults(perf->who) - perf->faults;
+        if(n < 0) counts[c] = -1;
+        else if(counts[c] >= 0) counts[c] += n;
+    }
+}
+
+void perf_close(perf_t *perf) {
+    for(size_t c = 0; c < NUM_COUNTERS; ++c)
+        if(perf->fd[c] != -1) close(perf->fd[c]);
+}
+
+double perf_ipc(const int64_t counts[NUM_COUNTERS]) {
+    return counts[COUNTER_CYCLES] > 0 && counts[COUNTER_INSTRUCTIONS] >= 0
+         ? (double)counts[COUNTER_INSTRUCTIONS] / counts[COUNTER_CYCLES] : 0;
+}
+
+void perf_median(int64_t *samples, size_t runs,
+                 int64_t median[NUM_COUNTERS]) {
+    int64_t *s = malloc(sizeof(int64_t) * runs);
+    for(size_t c = 0; c < NUM_COUNTERS; ++c) {
+        for(size_t r = 0; r < runs; ++r) s[r] = samples[r * NUM_COUNTERS + c];
+        qsort(s, runs, sizeof(int64_t), cmp_int64);
+        /* a run that could not be counted sorts first */
+        median[c] = s[0] < 0 ? -1
+                  : runs % 2 ? s[runs / 2]
+                             : (s[runs / 2 - 1] + s[runs / 2]) / 2;
+    }
+    free(s);
+}
+
+void perf_print_header(FILE *f) {
+    fprintf(f, " %14s %14s %6s %12s %12s %12s %10s", "cycles",
+            "instructions", "IPC", "branch miss", "L1d miss", "LLC miss",
+            "faults");
+}
+
+void perf_print(const int64_t counts[NUM_COUNTERS], FILE *f) {
+    static const int width[NUM_COUNTERS] = { 14, 14, 12, 12, 12, 10 };
+    for(size_t c = 0; c < NUM_COUNTERS; ++c) {
+        if(counts[c] < 0) fprintf(f, " %*s", width[c], "n/a");
+        else fprintf(f, " %*"PRId64, width[c], counts[c]);
+        if(c == COUNTER_INSTRUCTIONS) {
+            double ipc = perf_ipc(counts);
+            if(ipc > 0) fprintf(f, " %6.2f", ipc);
+            else fprintf(f, " %6s", "n/a");
+        }
+    }
+}
+
+void perf_write_json(const int64_t counts[NUM_COUNTERS], FILE *f) {
+    for(size_t c = 0; c < NUM_COUNTERS; ++c) {
+        fprintf(f, "%s\"%s\": ", c ? ", " : "", counter_names[c]);
+        if(counts[c] < 0) fputs("null", f);
+        else fprintf(f, "%"PRId64, counts[c]);
+    }
+    double ipc = perf_ipc(counts);
+    if(ipc > 0) fprintf(f, ", \"ipc\": %.3f", ipc);
+    else fputs(", \"ipc\": null", f);
+}
+
+/* the value and the times enabled and running */
+static int read_counter(int fd, uint64_t v[3]) {
+    return read(fd, v, sizeof(uint64_t) * 3) != sizeof(uint64_t) * 3;
+}
+
+static long rusage_faults(int who) {
+    struct rusage ru;
+    if(getrusage(who, &ru)) return 0;
+    return ru.ru_minflt + ru.ru_majflt;
+}
+
+static int cmp_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
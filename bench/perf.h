@@ -0,0 +1,60 @@
+#ifndef BENCH_PERF_H_
+#define BENCH_PERF_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* performance counters of the caller or of a child, through perf_event_open,
+ * counters the kernel does not provide read as -1 and page faults fall back
+ * to getrusage */
+
+enum counter {
+COUNTER_CYCLES,
+COUNTER_INSTRUCTIONS,
+COUNTER_BRANCH_MISSES,
+/** level 1 data cache read misses */
+COUNTER_L1D_MISSES,
+/** last level cache read misses */
+COUNTER_LLC_MISSES,
+COUNTER_PAGE_FAULTS,
+NUM_COUNTERS,
+};
+
+extern const char *counter_names[NUM_COUNTERS];
+
+typedef struct perf {
+    /** -1 for counters that are not available */
+    int fd[NUM_COUNTERS];
+    /** values and times enabled and running read by perf_start */
+    uint64_t start[NUM_COUNTERS][3];
+    /** RUSAGE_SELF or RUSAGE_CHILDREN, and the page faults they had when
+     * started */
+    int who;
+    long faults;
+} perf_t;
+
+/* counts the caller between perf_start and perf_stop if pid is 0, else
+ * counts pid from its next exec until it is waited for, returns 0 if every
+ * counter is available, else the error of the first one that is not */
+int perf_open(perf_t *, pid_t pid);
+void perf_start(perf_t *);
+/* adds the counts since perf_start, or since exec, to counts, a counter
+ * which is -1 stays -1 */
+void perf_stop(perf_t *, int64_t counts[NUM_COUNTERS]);
+void perf_close(perf_t *);
+
+/* instructions per cycle, 0 if either was not counted */
+double perf_ipc(const int64_t counts[NUM_COUNTERS]);
+/* the median of each counter over runs samples of NUM_COUNTERS, which are
+ * sorted */
+void perf_median(int64_t *samples, size_t runs,
+                 int64_t median[NUM_COUNTERS]);
+
+void perf_print_header(FILE *);
+void perf_print(const int64_t counts[NUM_COUNTERS], FILE *);
+/* writes the counters as the members of a JSON object, null if not
+ * counted */
+void perf_write_json(const int64_t counts[NUM_COUNTERS], FILE *);
+
+#endif /* BENCH_PERF_H_ */
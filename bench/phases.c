@@ -0,0 +1,109 @@
+#include "bench.h"
+#include <parser/code.h>
+#include <parser/lexer.h>
+#include <parser/parser.h>
+#include <parser/semantics.h>
+#include <stdlib.h>
+#include <time.h>
+
+const char *phase_names[NUM_PHASES] = {
+[PHASE_LEX] = "lex",
+[PHASE_PARSE] = "parse",
+[PHASE_SEMANTICS] = "semantics",
+[PHASE_CODE] = "ir",
+[PHASE_ASM] = "asm",
+[PHASE_FREE] = "free",
+};
+
+static double phase_begin(perf_t *);
+static void phase_end(perf_t *, double, enum phase, double[NUM_PHASES],
+                      int64_t[][NUM_COUNTERS]);
+static int cmp_double(const void *, const void *);
+
+int bench_phases(const char *name, const unsigned char *src, size_t sz,
+                 FILE *null, double t[NUM_PHASES], perf_t *perf,
+                 int64_t counts[NUM_PHASES][NUM_COUNTERS]) {
+    lexer_t lexer;
+    parser_t parser;
+    ast_node_tu_t *root;
+    ir_code_t *code;
+    int ret = 0;
+
+    double start = phase_begin(perf);
+    lexer_init(&lexer, src, sz);
+    while(lexer_next(&lexer)->type != TEOF);
+    phase_end(perf, start, PHASE_LEX, t, counts);
+
+    start = phase_begin(perf);
+    lexer_init(&lexer, src, sz);
+    parser_init(&parser, &lexer);
+    parser.err = stderr;
+    root = parser_parse(&parser);
+    phase_end(perf, start, PHASE_PARSE, t, counts);
+    if(!root) {
+        fprintf(stderr, "[Error] %s: Failed to parse\n", name);
+        return 1;
+    }
+
+    start = phase_begin(perf);
+    semantics_ctx_t *ctx = semantics_new();
+    ctx->err = stderr;
+    /* the context is freed with the tree */
+    if(semantics_analyze(ctx, root)) {
+        fprintf(stderr, "[Error] %s: Failed semantic analysis\n", name);
+        ast_free((void *)root);
+        return 1;
+    }
+    phase_end(perf, start, PHASE_SEMANTICS, t, counts);
+
+    start = phase_begin(perf);
+    code = code_new(root);
+    phase_end(perf, start, PHASE_CODE, t, counts);
+    if(!code) {
+        ast_free((void *)root);
+        return 1;
+    }
+
+    start = phase_begin(perf);
+    if(asm_generate(null, code, RT_LIBC) || fflush(null)) {
+        fprintf(stderr, "[Error] %s: Failed to generate assembly\n", name);
+        ret = 1;
+    }
+    phase_end(perf, start, PHASE_ASM, t, counts);
+
+    start = phase_begin(perf);
+    code_free(code);
+    ast_free((void *)root);
+    phase_end(perf, start, PHASE_FREE, t, counts);
+    return ret;
+}
+
+/* the counters are read outside of the time measured */
+static double phase_begin(perf_t *perf) {
+    if(perf) perf_start(perf);
+    return bench_now_ms();
+}
+
+static void phase_end(perf_t *perf, double start, enum phase p,
+                      double t[NUM_PHASES],
+                      int64_t counts[][NUM_COUNTERS]) {
+    t[p] += bench_now_ms() - start;
+    if(perf) perf_stop(perf, counts[p]);
+}
+
+double bench_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+double bench_median(double *samples, size_t n) {
+    qsort(samples, n, sizeof(double), cmp_double);
+    return n % 2 ? samples[n / 2]
+                 : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
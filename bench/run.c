@@ -0,0 +1,448 @@
+#define _DEFAULT_SOURCE
+#include "perf.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* compiles each benchmark program with each mode of the compiler, runs it
+ * on its input, checks its output and records the time and the performance
+ * counters, as JSON which can be compared with a baseline */
+
+#define PROGRAM_NAME "run"
+
+const char *help_str = ""
+"Usage: "PROGRAM_NAME" [option]... program.dpp...\n"
+"\n"
+"The input of program.dpp is read from program.in if it exists, and its\n"
+"output has to match program.out.\n"
+"\n"
+"  -h            print this help message\n"
+"  -c compiler   compiler to benchmark (default ./compiler)\n"
+"  -m modes      comma separated modes to compile with, of native,\n"
+"                syscall and c (default all)\n"
+"  -n runs       run each program runs times (default 5)\n"
+"  -o file       write the results as JSON to file\n"
+"  -b file       compare the results with the JSON of an earlier run\n"
+"  -t tolerance  fail if a program is more than tolerance slower than in\n"
+"                the baseline, as a fraction (default 0.10)\n"
+;
+
+struct mode {
+    const char *name;
+    /** options passed to the compiler */
+    char *flags[2];
+};
+
+static const struct mode modes[] = {
+    { "native", { NULL } },
+    { "syscall", { "-s", NULL } },
+    { "c", { "--via-c", NULL } },
+};
+
+#define NUM_MODES (sizeof modes / sizeof *modes)
+
+struct result {
+    char name[64];
+    const struct mode *mode;
+    /** medians, counters are -1 if they could not be counted */
+    double wall_ms;
+    int64_t counters[NUM_COUNTERS];
+};
+
+static int bench_program(const char *, const char *, const struct mode *,
+                         const char *, size_t, struct result *);
+static int compile(const char *, const struct mode *, const char *,
+                   const char *);
+static int run(const char *, int, int, double *, int64_t[NUM_COUNTERS]);
+static int wait_child(const char *, pid_t);
+static int check_output(const char *, int);
+static char *read_all(int, size_t *);
+static double now_ms(void);
+static int cmp_double(const void *, const void *);
+static void write_json(struct result *, size_t, size_t, FILE *);
+static int compare(struct result *, size_t, const char *, double);
+
+int main(int argc, char *argv[]) {
+    const char *compiler = "./compiler";
+    char *outfile = NULL, *baseline = NULL, *end;
+    size_t runs = 5;
+    double tolerance = 0.10;
+    int use[NUM_MODES];
+    for(size_t i = 0; i < NUM_MODES; ++i) use[i] = 1;
+
+    int c;
+    while((c = getopt(argc, argv, "hc:m:n:o:b:t:")) != -1) {
+        switch(c) {
+        case 'c':
+            compiler = optarg;
+            break;
+
+        case 'm':
+            for(size_t i = 0; i < NUM_MODES; ++i) use[i] = 0;
+            for(char *s = optarg; *s;) {
+                size_t len = strcspn(s, ","), i;
+                for(i = 0; i < NUM_MODES; ++i)
+                    if(strlen(modes[i].name) == len
+                    && !strncmp(s, modes[i].name, len))
+                        break;
+                if(i == NUM_MODES) {
+                    fprintf(stderr, "[Error] Unknown mode '%.*s'\n",
+                            (int)len, s);
+                    return EXIT_FAILURE;
+                }
+                use[i] = 1;
+                s += len + (s[len] == ',');
+            }
+            break;
+
+        case 'n':
+            if(!(runs = strtoul(optarg, &end, 10)) || *end) {
+                fprintf(stderr, "[Error] Invalid number of runs '%s'\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'o':
+            outfile = optarg;
+            break;
+
+        case 'b':
+            baseline = optarg;
+            break;
+
+        case 't':
+            if((tolerance = strtod(optarg, &end)) < 0 || *end
+            || end == optarg) {
+                fprintf(stderr, "[Error] Invalid tolerance '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        default:
+            fprintf(stderr, "%s", help_str);
+            return EXIT_FAILURE;
+        }
+    }
+    argc -= optind, argv += optind;
+    if(argc < 1) {
+        fprintf(stderr, "%s", help_str);
+        return EXIT_FAILURE;
+    }
+
+    char dir[] = P_tmpdir "/dpp_bench_XXXXXX";
+    if(!mkdtemp(dir)) {
+        fprintf(stderr, "[Error] mkdtemp: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct result *results = calloc(argc * NUM_MODES, sizeof(struct result));
+    size_t num = 0;
+    int ret = EXIT_SUCCESS;
+    printf("%-16s %-8s %12s", "benchmark", "mode", "wall ms");
+    perf_print_header(stdout);
+    putchar('\n');
+    for(int i = 0; i < argc; ++i)
+        for(size_t m = 0; m < NUM_MODES; ++m) {
+            if(!use[m]) continue;
+            struct result *r = &results[num];
+            if(bench_program(compiler, argv[i], &modes[m], dir, runs, r)) {
+                ret = EXIT_FAILURE;
+                continue;
+            }
+            ++num;
+            printf("%-16s %-8s %12.3f", r->name, r->mode->name, r->wall_ms);
+            perf_print(r->counters, stdout);
+            putchar('\n');
+        }
+    rmdir(dir);
+
+    if(outfile) {
+        FILE *f;
+        if(!(f = fopen(outfile, "w"))) {
+            fprintf(stderr, "[Error] %s: %s\n", outfile, strerror(errno));
+            ret = EXIT_FAILURE;
+        } else {
+            write_json(results, num, runs, f);
+            if(fclose(f)) {
+                fprintf(stderr, "[Error] %s: %s\n", outfile, strerror(errno));
+                ret = EXIT_FAILURE;
+            }
+        }
+    }
+    if(baseline && compare(results, num, baseline, tolerance))
+        ret = EXIT_FAILURE;
+    free(results);
+    return ret;
+}
+
+static int bench_program(const char *compiler, const char *path,
+                         const struct mode *mode, const char *dir,
+                         size_t runs, struct result *res) {
+    /* program.dpp without .dpp names the input and output */
+    size_t len = strlen(path);
+    if(len > 4 && !strcmp(path + len - 4, ".dpp")) len -= 4;
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    snprintf(res->name, sizeof res->name, "%.*s",
+             (int)(len - (base - path)), base);
+    res->mode = mode;
+
+    char *in_path = malloc(len + 5), *out_path = malloc(len + 5);
+    char *exe = malloc(strlen(dir) + strlen(res->name) + strlen(mode->name)
+                       + 3);
+    sprintf(in_path, "%.*s.in", (int)len, path);
+    sprintf(out_path, "%.*s.out", (int)len, path);
+    sprintf(exe, "%s/%s.%s", dir, res->name, mode->name);
+
+    double *wall = malloc(sizeof(double) * runs);
+    int64_t *counters = calloc(runs * NUM_COUNTERS, sizeof(int64_t));
+    int ret = 1, in = -1;
+    FILE *out = NULL;
+    if(compile(compiler, mode, path, exe)) goto ret;
+    if((in = open(in_path, O_RDONLY)) == -1 && errno != ENOENT) {
+        fprintf(stderr, "[Error] %s: %s\n", in_path, strerror(errno));
+        goto ret;
+    }
+    if(in == -1 && (in = open("/dev/null", O_RDONLY)) == -1) {
+        fprintf(stderr, "[Error] /dev/null: %s\n", strerror(errno));
+        goto ret;
+    }
+    if(!(out = tmpfile())) {
+        fprintf(stderr, "[Error] tmpfile: %s\n", strerror(errno));
+        goto ret;
+    }
+
+    for(size_t r = 0; r < runs; ++r) {
+        lseek(in, 0, SEEK_SET);
+        lseek(fileno(out), 0, SEEK_SET);
+        if(ftruncate(fileno(out), 0)
+        || run(exe, in, fileno(out), &wall[r], counters + r * NUM_COUNTERS))
+            goto ret;
+        /* every run has to give the right output */
+        lseek(fileno(out), 0, SEEK_SET);
+        if(check_output(out_path, fileno(out))) {
+            fprintf(stderr, "[Error] %s: Wrong output with mode %s\n", path,
+                    mode->name);
+            goto ret;
+        }
+    }
+
+    qsort(wall, runs, sizeof(double), cmp_double);
+    res->wall_ms = runs % 2 ? wall[runs / 2]
+                            : (wall[runs / 2 - 1] + wall[runs / 2]) / 2;
+    perf_median(counters, runs, res->counters);
+    ret = 0;
+
+ret:
+    if(out) fclose(out);
+    if(in != -1) close(in);
+    unlink(exe);
+    free(counters);
+    free(wall);
+    free(exe);
+    free(out_path);
+    free(in_path);
+    return ret;
+}
+
+static int compile(const char *compiler, const struct mode *mode,
+                   const char *path, const char *exe) {
+    char *argv[8];
+    size_t argc = 0;
+    argv[argc++] = (char *)compiler;
+    for(size_t i = 0; mode->flags[i]; ++i) argv[argc++] = mode->flags[i];
+    argv[argc++] = "-o";
+    argv[argc++] = (char *)exe;
+    argv[argc++] = (char *)path;
+    argv[argc] = NULL;
+
+    pid_t pid;
+    if((pid = fork()) == -1) {
+        fprintf(stderr, "[Error] fork: %s\n", strerror(errno));
+        return 1;
+    }
+    if(!pid) {
+        execvp(argv[0], argv);
+        fprintf(stderr, "[Error] Failed to run %s: %s\n", argv[0],
+                strerror(errno));
+        _exit(127);
+    }
+    return wait_child(compiler, pid);
+}
+
+/* the child waits for the counter to be attached before it runs exe, so only
+ * the program itself is counted */
+static int run(const char *exe, int in, int out, double *wall,
+               int64_t counters[NUM_COUNTERS]) {
+    static int warned;
+    int sync[2];
+    if(pipe(sync)) {
+        fprintf(stderr, "[Error] pipe: %s\n", strerror(errno));
+        return 1;
+    }
+
+    double start = now_ms();
+    pid_t pid;
+    if((pid = fork()) == -1) {
+        fprintf(stderr, "[Error] fork: %s\n", strerror(errno));
+        close(sync[0]);
+        close(sync[1]);
+        return 1;
+    }
+    if(!pid) {
+        char c;
+        close(sync[1]);
+        if(read(sync[0], &c, 1) == -1) _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        execl(exe, exe, (char *)NULL);
+        _exit(127);
+    }
+
+    perf_t perf;
+    int err;
+    if((err = perf_open(&perf, pid)) && !warned++)
+        fprintf(stderr, "[Info] Not every performance counter is available: "
+                "%s\n", strerror(err));
+    close(sync[0]);
+    close(sync[1]);
+    int ret = wait_child(exe, pid);
+    *wall = now_ms() - start;
+    perf_stop(&perf, counters);
+    perf_close(&perf);
+    return ret;
+}
+
+static int wait_child(const char *name, pid_t pid) {
+    int status;
+    while(waitpid(pid, &status, 0) == -1)
+        if(errno != EINTR) {
+            fprintf(stderr, "[Error] waitpid: %s\n", strerror(errno));
+            return 1;
+        }
+    if(WIFEXITED(status) && !WEXITSTATUS(status)) return 0;
+    else if(WIFEXITED(status))
+        fprintf(stderr, "[Error] %s exited with status %d\n", name,
+                WEXITSTATUS(status));
+    else if(WIFSIGNALED(status))
+        fprintf(stderr, "[Error] %s was killed by signal %d\n", name,
+                WTERMSIG(status));
+    return 1;
+}
+
+static int check_output(const char *path, int out) {
+    int fd;
+    if((fd = open(path, O_RDONLY)) == -1) {
+        fprintf(stderr, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    size_t want_sz, got_sz;
+    char *want = read_all(fd, &want_sz), *got = read_all(out, &got_sz);
+    close(fd);
+    int ret = !want || !got || want_sz != got_sz
+           || memcmp(want, got, want_sz);
+    free(want);
+    free(got);
+    return ret;
+}
+
+static char *read_all(int fd, size_t *sz) {
+    size_t cap = 4096;
+    ssize_t n;
+    char *data = malloc(cap);
+    *sz = 0;
+    while((n = read(fd, data + *sz, cap - *sz)) > 0)
+        if((*sz += n) == cap) data = realloc(data, cap *= 2);
+    if(n == -1) {
+        fprintf(stderr, "[Error] read: %s\n", strerror(errno));
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+/* one result per line, so compare can read it back line by line */
+static void write_json(struct result *res, size_t num, size_t runs, FILE *f) {
+    fprintf(f, "{\"runs\": %zu, \"benchmarks\": [\n", runs);
+    for(size_t i = 0; i < num; ++i) {
+        fprintf(f, "{\"name\": \"%s\", \"mode\": \"%s\", \"wall_ms\": %.6f, ",
+                res[i].name, res[i].mode->name, res[i].wall_ms);
+        perf_write_json(res[i].counters, f);
+        fprintf(f, "}%s\n", i + 1 < num ? "," : "");
+    }
+    fputs("]}\n", f);
+}
+
+/* instructions retired are compared if both runs have them, as they are
+ * much less noisy than the time, returns non-zero if any program is slower
+ * than the baseline by more than tolerance */
+static int compare(struct result *res, size_t num, const char *path,
+                   double tolerance) {
+    FILE *f;
+    if(!(f = fopen(path, "r"))) {
+        fprintf(stderr, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    int slower = 0;
+    char *line = NULL, key[128];
+    size_t cap = 0;
+    printf("\n%-16s %-8s %-12s %16s %16s %8s\n", "benchmark", "mode",
+           "metric", "baseline", "current", "change");
+    while(getline(&line, &cap, f) != -1) {
+        struct result *r = NULL;
+        for(size_t i = 0; i < num && !r; ++i) {
+            snprintf(key, sizeof key, "{\"name\": \"%s\", \"mode\": \"%s\",",
+                     res[i].name, res[i].mode->name);
+            if(!strncmp(line, key, strlen(key))) r = &res[i];
+        }
+        if(!r) continue;
+
+        char *at;
+        double base = 0, cur;
+        const char *metric = "instructions";
+        if(r->counters[COUNTER_INSTRUCTIONS] >= 0
+        && (at = strstr(line, "\"instructions\": "))
+        && sscanf(at + 16, "%lf", &base) == 1 && base > 0)
+            cur = r->counters[COUNTER_INSTRUCTIONS];
+        else if((at = strstr(line, "\"wall_ms\": "))
+             && sscanf(at + 11, "%lf", &base) == 1 && base > 0) {
+            metric = "wall ms";
+            cur = r->wall_ms;
+        } else continue;
+
+        double change = cur / base - 1;
+        int bad = change > tolerance;
+        printf("%-16s %-8s %-12s %16.3f %16.3f %+7.1f%%%s\n", r->name,
+               r->mode->name, metric, base, cur, change * 100,
+               bad ? "  slower" : "");
+        slower += bad;
+    }
+    free(line);
+    fclose(f);
+
+    if(slower)
+        fprintf(stderr, "[Error] %d programs are more than %.0f%% slower "
+                "than in %s\n", slower, tolerance * 100, path);
+    return slower != 0;
+}
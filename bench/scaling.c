@@ -0,0 +1,268 @@
+#include "bench.h"
+#include <errno.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* compiles generated programs of doubling sizes, fits how the time of each
+ * phase grows with the size and fails if it grows faster than n log n */
+
+#define PROGRAM_NAME "scaling"
+
+/* compiles of one size a sample may add up */
+#define MAX_REPS 4096
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+const char *help_str = ""
+"Usage: "PROGRAM_NAME" [option]... [axis]...\n"
+"\n"
+"Axes are kinds of generated programs, of fns, calls, chain, expr, nest and\n"
+"locals (default all).\n"
+"\n"
+"  -h            print this help message\n"
+"  -n runs       compile each size runs times (default 3)\n"
+"  -k sizes      number of doubling sizes (default 5)\n"
+"  -e margin     allowed exponent above that of n log n (default 0.25)\n"
+"  -l ms         repeat the compiles of each size until every phase takes\n"
+"                at least ms, a phase which does not on 3 sizes within\n"
+"                "STR(MAX_REPS)" compiles fails (default 1)\n"
+;
+
+struct axis {
+    const char *kind;
+    /** smallest size */
+    size_t start;
+};
+
+/* large enough that the largest sizes are not dominated by noise, small
+ * enough that the recursion of the parser stays within the stack */
+static const struct axis axes[] = {
+    { "fns", 500 },
+    { "calls", 1000 },
+    { "chain", 500 },
+    { "expr", 2000 },
+    { "nest", 400 },
+    { "locals", 500 },
+};
+
+#define NUM_AXES (sizeof axes / sizeof *axes)
+
+static int measure(const struct axis *, size_t, size_t, double, FILE *,
+                   double *, int *);
+static int compile(const char *, const char *, size_t, FILE *, double *);
+static double fit(const double *, const double *, size_t);
+
+int main(int argc, char *argv[]) {
+    size_t runs = 3, steps = 5;
+    double margin = 0.25, min_ms = 1;
+    char *end;
+
+    int c;
+    while((c = getopt(argc, argv, "hn:k:e:l:")) != -1) {
+        switch(c) {
+        case 'n':
+            if(!(runs = strtoul(optarg, &end, 10)) || *end) {
+                fprintf(stderr, "[Error] Invalid number of runs '%s'\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'k':
+            if((steps = strtoul(optarg, &end, 10)) < 3 || *end) {
+                fprintf(stderr, "[Error] Need at least 3 sizes\n");
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'e':
+            margin = strtod(optarg, &end);
+            if(*end || end == optarg) {
+                fprintf(stderr, "[Error] Invalid margin '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'l':
+            min_ms = strtod(optarg, &end);
+            if(*end || end == optarg) {
+                fprintf(stderr, "[Error] Invalid time '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        default:
+            fprintf(stderr, "%s", help_str);
+            return EXIT_FAILURE;
+        }
+    }
+    argc -= optind, argv += optind;
+
+    int use[NUM_AXES];
+    for(size_t i = 0; i < NUM_AXES; ++i) use[i] = !argc;
+    for(int i = 0; i < argc; ++i) {
+        size_t a;
+        for(a = 0; a < NUM_AXES && strcmp(argv[i], axes[a].kind); ++a);
+        if(a == NUM_AXES) {
+            fprintf(stderr, "[Error] Unknown axis '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        use[a] = 1;
+    }
+
+    FILE *null;
+    if(!(null = fopen("/dev/null", "w"))) {
+        fprintf(stderr, "[Error] /dev/null: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    double *sizes = malloc(sizeof(double) * steps);
+    double *times = malloc(sizeof(double) * steps * NUM_PHASES);
+    double *samples = malloc(sizeof(double) * steps);
+    int *ok = malloc(sizeof(int) * steps * NUM_PHASES);
+    int ret = EXIT_SUCCESS, worse = 0, unfit = 0;
+    printf("%-8s %-10s %10s %10s %8s %8s\n", "axis", "phase", "first ms",
+           "last ms", "exponent", "allowed");
+    for(size_t a = 0; a < NUM_AXES && ret == EXIT_SUCCESS; ++a) {
+        if(!use[a]) continue;
+        for(size_t k = 0; k < steps; ++k) {
+            sizes[k] = (double)(axes[a].start << k);
+            if(measure(&axes[a], axes[a].start << k, runs, min_ms, null,
+                       times + k * NUM_PHASES, ok + k * NUM_PHASES)) {
+                ret = EXIT_FAILURE;
+                break;
+            }
+        }
+        if(ret != EXIT_SUCCESS) break;
+
+        /* the exponent n log n has over the same sizes */
+        for(size_t k = 0; k < steps; ++k)
+            samples[k] = sizes[k] * log(sizes[k]);
+        double allowed = fit(sizes, samples, steps) + margin;
+
+        for(size_t p = 0; p < NUM_PHASES; ++p) {
+            for(size_t k = 0; k < steps; ++k)
+                samples[k] = times[k * NUM_PHASES + p];
+            printf("%-8s %-10s %10.3f %10.3f ", axes[a].kind, phase_names[p],
+                   samples[0], samples[steps - 1]);
+            /* sizes too fast to tell growth from noise are left out */
+            size_t from = 0;
+            while(from < steps && !ok[from * NUM_PHASES + p]) ++from;
+            if(steps - from < 3) {
+                if(p == PHASE_FREE) printf("%8s %8s\n", "-", "-");
+                else {
+                    printf("%8s %8.2f  unfit\n", "-", allowed);
+                    ++unfit;
+                }
+                continue;
+            }
+            double e = fit(sizes + from, samples + from, steps - from);
+            /* freeing is dominated by glibc consolidating its fastbins, which
+             * grows faster than the frees themselves, so it is only shown */
+            if(p == PHASE_FREE) {
+                printf("%8.2f %8s\n", e, "-");
+                continue;
+            }
+            int bad = e > allowed;
+            printf("%8.2f %8.2f%s\n", e, allowed, bad ? "  worse" : "");
+            worse += bad;
+        }
+    }
+    fclose(null);
+    free(ok);
+    free(samples);
+    free(times);
+    free(sizes);
+
+    if(ret == EXIT_SUCCESS && unfit) {
+        fprintf(stderr, "[Error] %d phases take less than %g ms on too many "
+                "sizes to be fitted\n", unfit, min_ms);
+        ret = EXIT_FAILURE;
+    }
+    if(ret == EXIT_SUCCESS && worse) {
+        fprintf(stderr, "[Error] %d phases grow faster than n log n\n",
+                worse);
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
+
+/* medians of each phase over runs samples of a program of size n, a sample
+ * compiles it as many times as every phase needs to take at least min_ms,
+ * ok is set for the phases which do within MAX_REPS compiles */
+static int measure(const struct axis *axis, size_t n, size_t runs,
+                   double min_ms, FILE *null, double *t, int *ok) {
+    char *src;
+    size_t sz;
+    FILE *f;
+    if(!(f = open_memstream(&src, &sz))) {
+        fprintf(stderr, "[Error] open_memstream: %s\n", strerror(errno));
+        return 1;
+    }
+    bench_generate(f, axis->kind, n);
+    fclose(f);
+
+    char name[64];
+    snprintf(name, sizeof name, "%s_%zu", axis->kind, n);
+    double *all = calloc(runs * NUM_PHASES, sizeof(double));
+    size_t reps = 1;
+    int ret = 0;
+    /* doubles the compiles until every phase is measurable */
+    for(;;) {
+        memset(all, 0, sizeof(double) * NUM_PHASES);
+        for(size_t i = 0; i < reps && !ret; ++i)
+            ret = compile(name, src, sz, null, all);
+        if(ret) goto ret_free;
+        size_t p;
+        for(p = 0; p < NUM_PHASES && all[p] >= min_ms; ++p);
+        if(p == NUM_PHASES || reps * 2 > MAX_REPS) break;
+        reps *= 2;
+    }
+    for(size_t p = 0; p < NUM_PHASES; ++p) ok[p] = all[p] >= min_ms;
+
+    memset(all, 0, sizeof(double) * NUM_PHASES);
+    for(size_t r = 0; r < runs && !ret; ++r)
+        for(size_t i = 0; i < reps && !ret; ++i)
+            ret = compile(name, src, sz, null, all + r * NUM_PHASES);
+    if(!ret) {
+        double *samples = malloc(sizeof(double) * runs);
+        for(size_t p = 0; p < NUM_PHASES; ++p) {
+            for(size_t r = 0; r < runs; ++r)
+                samples[r] = all[r * NUM_PHASES + p] / reps;
+            t[p] = bench_median(samples, runs);
+        }
+        free(samples);
+    }
+ret_free:
+    free(all);
+    free(src);
+    return ret;
+}
+
+/* the memory freed by the compile before is given back first, else small
+ * programs would run in memory which is still mapped and cached while large
+ * ones fault in theirs like a new process does */
+static int compile(const char *name, const char *src, size_t sz, FILE *null,
+                   double *t) {
+    malloc_trim(0);
+    return bench_phases(name, (const unsigned char *)src, sz, null, t, NULL,
+                        NULL);
+}
+
+/* least squares slope of log y over log x */
+static double fit(const double *x, const double *y, size_t n) {
+    double mx = 0, my = 0, sxy = 0, sxx = 0;
+    for(size_t i = 0; i < n; ++i) {
+        mx += log(x[i]) / n;
+        my += log(y[i] > 0 ? y[i] : 1e-9) / n;
+    }
+    for(size_t i = 0; i < n; ++i) {
+        double dx = log(x[i]) - mx;
+        sxy += dx * (log(y[i] > 0 ? y[i] : 1e-9) - my);
+        sxx += dx * dx;
+    }
+    return sxy / sxx;
+}
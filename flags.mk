@@ -4,7 +4,7 @@ CPPFLAGS?=
 CPPFLAGS+=-Iinclude -D_POSIX_C_SOURCE=200809L -D_XOPEN_SOURCE=700
 
 CFLAGS?=-O2 -g
-CFLAGS+=-Wall -Wextra -MD -std=c99
+CFLAGS+=-Wall -Wextra -MD -std=c99 -pthread
 
 LDFLAGS?=
 LDFLAGS+=
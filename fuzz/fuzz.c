@@ -0,0 +1,571 @@
+/* MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE
+#include <utils/alloc.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* coverage guided fuzzer of the front end, the library is built with
+ * -fsanitize-coverage=trace-pc so every basic block calls
+ * __sanitizer_cov_trace_pc, and every input runs in a child of its own so
+ * crashes and hangs are told apart from inputs which are only expensive */
+
+#define PROGRAM_NAME "fuzz"
+
+const char *help_str = ""
+"Usage: "PROGRAM_NAME" [option]... [seed]...\n"
+"\n"
+"Seeds are files, or directories whose .dpp files are read.\n"
+"\n"
+"  -h            print this help message\n"
+"  -r            run each seed once and report the findings, without\n"
+"                fuzzing\n"
+"  -T seconds    fuzz for seconds (default 60)\n"
+"  -n runs       stop after runs inputs (default no limit)\n"
+"  -s seed       seed of the random mutations (default the time)\n"
+"  -l bytes      largest input to generate (default 16384)\n"
+"  -c dir        write the inputs that reach new code to dir\n"
+"  -o dir        write the minimized findings to dir\n"
+"  -t ms         inputs running longer are hangs (default 2000)\n"
+"  -u us         inputs taking more than us per byte are slow (default 20)\n"
+"  -U ms         but only if they take at least ms (default 20)\n"
+"  -b bytes      inputs allocating more than bytes per byte at once use too\n"
+"                much memory (default 2048)\n"
+"  -B MiB        but only if they allocate at least MiB (default 32)\n"
+;
+
+#define COV_SZ (1 << 16)
+/* executions and time spent on minimizing one finding */
+#define MINIMIZE_RUNS 4000
+#define MINIMIZE_MS 60000
+
+enum finding {
+FIND_NONE,
+FIND_CRASH,
+FIND_HANG,
+FIND_SLOW,
+FIND_MEMORY,
+NUM_FINDINGS,
+};
+
+static const char *finding_names[NUM_FINDINGS] = {
+[FIND_NONE] = "none",
+[FIND_CRASH] = "crash",
+[FIND_HANG] = "hang",
+[FIND_SLOW] = "slow",
+[FIND_MEMORY] = "memory",
+};
+
+struct options {
+    int replay;
+    double seconds;
+    size_t runs, max_len;
+    uint64_t seed;
+    const char *corpus, *out;
+    unsigned hang_ms;
+    double us_per_byte, min_ms;
+    double mem_per_byte;
+    size_t min_mem;
+};
+
+/** written by the child, read by the parent after it exits */
+struct shared {
+    uint8_t cov[COV_SZ];
+    uint64_t ns;
+    /** most bytes allocated at once by the target */
+    uint64_t peak;
+    int done;
+};
+
+struct input {
+    uint8_t *data;
+    size_t sz;
+};
+
+struct corpus {
+    struct input *inputs;
+    size_t sz, cap;
+};
+
+int LLVMFuzzerTestOneInput(const uint8_t *, size_t);
+
+static struct shared *shm;
+static uintptr_t cov_prev;
+/** bucketed hit counts of each edge seen so far, as bits, by inputs without
+ * findings and by the inputs of each kind of finding */
+static uint8_t cov_seen[NUM_FINDINGS][COV_SZ];
+static uint64_t rng;
+
+/* tokens the mutations insert, so inputs get past the lexer */
+static const char *dict[] = {
+"fn ", "extern fn ", "let ", "if ", "else ", "else if ", "return ", "print(",
+"input()", "(", ")", "{", "}", ";", ",", "=", "==", "!=", "<", "<=", ">",
+">=", "&&", "||", "&", "|", "^", "+", "-", "*", "/", "%", "!", "~", "0",
+"1", "9223372036854775807", "a", "b", "main", "\n",
+};
+
+static int load(struct corpus *, const char *);
+static int load_file(struct corpus *, const char *);
+static void corpus_add(struct corpus *, const uint8_t *, size_t);
+static int replay(const struct options *, struct corpus *);
+static int fuzz(const struct options *, struct corpus *);
+static enum finding run(const struct options *, const uint8_t *, size_t);
+static void child(const struct options *, const uint8_t *, size_t);
+static int new_coverage(enum finding);
+static size_t count_coverage(void);
+static size_t mutate(uint8_t *, size_t, size_t, struct corpus *);
+static size_t minimize(const struct options *, uint8_t *, size_t,
+                       enum finding);
+static int confirm(const struct options *, const uint8_t *, size_t,
+                   enum finding);
+static int report(const struct options *, const uint8_t *, size_t,
+                  enum finding);
+static int write_input(const char *, const char *, const uint8_t *, size_t);
+static uint64_t hash(const uint8_t *, size_t);
+static uint64_t rnd(uint64_t);
+static double now(void);
+
+void __sanitizer_cov_trace_pc(void) {
+    if(!shm) return;
+    uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+    uintptr_t cur = (pc * 0x9e3779b97f4a7c15u) >> (8 * sizeof pc - 16);
+    ++shm->cov[cur ^ cov_prev];
+    cov_prev = cur >> 1;
+}
+
+int main(int argc, char *argv[]) {
+    struct options opt = {
+    .seconds = 60, .max_len = 16384, .seed = time(NULL) ^ getpid(),
+    .hang_ms = 2000, .us_per_byte = 20, .min_ms = 20, .mem_per_byte = 2048,
+    .min_mem = 32 << 20,
+    };
+    char *end;
+
+    int c;
+    while((c = getopt(argc, argv, "hrT:n:s:l:c:o:t:u:U:b:B:")) != -1) {
+        switch(c) {
+        case 'r': opt.replay = 1; break;
+        case 'T': opt.seconds = strtod(optarg, &end); break;
+        case 'n': opt.runs = strtoul(optarg, &end, 10); break;
+        case 's': opt.seed = strtoull(optarg, &end, 10); break;
+        case 'l': opt.max_len = strtoul(optarg, &end, 10); break;
+        case 'c': opt.corpus = optarg; break;
+        case 'o': opt.out = optarg; break;
+        case 't': opt.hang_ms = strtoul(optarg, &end, 10); break;
+        case 'u': opt.us_per_byte = strtod(optarg, &end); break;
+        case 'U': opt.min_ms = strtod(optarg, &end); break;
+        case 'b': opt.mem_per_byte = strtod(optarg, &end); break;
+        case 'B': opt.min_mem = strtoul(optarg, &end, 10) << 20; break;
+        default:
+            fprintf(stderr, "%s", help_str);
+            return EXIT_FAILURE;
+        }
+        if(c != 'r' && c != 'c' && c != 'o' && (*end || end == optarg)) {
+            fprintf(stderr, "[Error] Invalid value '%s' of -%c\n", optarg, c);
+            return EXIT_FAILURE;
+        }
+    }
+    argc -= optind, argv += optind;
+    if(!opt.max_len || !opt.hang_ms) {
+        fprintf(stderr, "%s", help_str);
+        return EXIT_FAILURE;
+    }
+
+    struct corpus corpus = { NULL, 0, 0 };
+    for(int i = 0; i < argc; ++i)
+        if(load(&corpus, argv[i])) return EXIT_FAILURE;
+
+    shm = mmap(NULL, sizeof *shm, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shm == MAP_FAILED) {
+        fprintf(stderr, "[Error] mmap: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    alloc_track();
+    rng = opt.seed ? opt.seed : 1;
+
+    int ret = opt.replay ? replay(&opt, &corpus) : fuzz(&opt, &corpus);
+    for(size_t i = 0; i < corpus.sz; ++i) free(corpus.inputs[i].data);
+    free(corpus.inputs);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int load(struct corpus *corpus, const char *path) {
+    DIR *dir;
+    if(!(dir = opendir(path))) {
+        if(errno == ENOTDIR) return load_file(corpus, path);
+        fprintf(stderr, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    int ret = 0;
+    char file[4096];
+    for(struct dirent *ent; !ret && (ent = readdir(dir));) {
+        size_t len = strlen(ent->d_name);
+        if(len < 4 || strcmp(ent->d_name + len - 4, ".dpp")) continue;
+        snprintf(file, sizeof file, "%s/%s", path, ent->d_name);
+        ret = load_file(corpus, file);
+    }
+    closedir(dir);
+    return ret;
+}
+
+static int load_file(struct corpus *corpus, const char *path) {
+    FILE *f;
+    if(!(f = fopen(path, "rb"))) {
+        fprintf(stderr, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    size_t cap = 4096, sz = 0, n;
+    uint8_t *data = malloc(cap);
+    while((n = fread(data + sz, 1, cap - sz, f)) > 0)
+        if((sz += n) == cap) data = realloc(data, cap *= 2);
+    int ret = ferror(f);
+    if(ret) fprintf(stderr, "[Error] %s: Failed to read\n", path);
+    else corpus_add(corpus, data, sz);
+    free(data);
+    fclose(f);
+    return ret;
+}
+
+static void corpus_add(struct corpus *corpus, const uint8_t *data, size_t sz) {
+    if(corpus->sz == corpus->cap)
+        corpus->inputs = realloc(corpus->inputs, sizeof(struct input)
+                                 * (corpus->cap = corpus->cap * 2 + 16));
+    struct input *in = &corpus->inputs[corpus->sz++];
+    in->data = malloc(sz ? sz : 1);
+    memcpy(in->data, data, sz);
+    in->sz = sz;
+}
+
+/* the regression check, fails if any input is still a finding */
+static int replay(const struct options *opt, struct corpus *corpus) {
+    size_t found = 0;
+    for(size_t i = 0; i < corpus->sz; ++i) {
+        struct input *in = &corpus->inputs[i];
+        enum finding f = run(opt, in->data, in->sz);
+        if(f == FIND_NONE) continue;
+        ++found;
+        printf("%-8s %016llx %8zu bytes %10.3f ms %10llu bytes allocated\n",
+               finding_names[f], (unsigned long long)hash(in->data, in->sz),
+               in->sz, shm->ns / 1e6, (unsigned long long)shm->peak);
+    }
+    printf("[Info] Ran %zu inputs, %zu findings\n", corpus->sz, found);
+    return found != 0;
+}
+
+static int fuzz(const struct options *opt, struct corpus *corpus) {
+    size_t found[NUM_FINDINGS] = { 0 }, runs = 0, seeds = corpus->sz;
+    uint8_t *buf = malloc(opt->max_len);
+    double start = now(), last = start;
+    int ret = 0;
+
+    /* the seeds are run first so only new coverage is kept */
+    for(size_t i = 0; i < seeds; ++i, ++runs) {
+        struct input *in = &corpus->inputs[i];
+        enum finding f = run(opt, in->data, in->sz);
+        if(!new_coverage(f) || f == FIND_NONE || !confirm(opt, in->data,
+                                                          in->sz, f))
+            continue;
+        size_t sz = in->sz < opt->max_len ? in->sz : opt->max_len;
+        memcpy(buf, in->data, sz);
+        ++found[f];
+        if((ret = report(opt, buf, sz, f))) break;
+    }
+    if(!corpus->sz) corpus_add(corpus, (const uint8_t *)"", 0);
+
+    while(!ret && (!opt->runs || runs < opt->runs)
+       && now() - start < opt->seconds * 1e3) {
+        struct input *in = &corpus->inputs[rnd(corpus->sz)];
+        size_t sz = in->sz < opt->max_len ? in->sz : opt->max_len;
+        memcpy(buf, in->data, sz);
+        sz = mutate(buf, sz, opt->max_len, corpus);
+
+        enum finding f = run(opt, buf, sz);
+        ++runs;
+        if(!new_coverage(f));
+        else if(f != FIND_NONE) {
+            if(!confirm(opt, buf, sz, f)) continue;
+            ++found[f];
+            ret = report(opt, buf, sz, f);
+        } else {
+            corpus_add(corpus, buf, sz);
+            if(opt->corpus) ret = write_input(opt->corpus, NULL, buf, sz);
+        }
+
+        if(now() - last >= 1e3 || ret) {
+            last = now();
+            fprintf(stderr, "[Info] %zu runs, %zu edges, %zu inputs, %zu "
+                    "crashes, %zu hangs, %zu slow, %zu memory, %.0f runs/s\n",
+                    runs, count_coverage(), corpus->sz, found[FIND_CRASH],
+                    found[FIND_HANG], found[FIND_SLOW], found[FIND_MEMORY],
+                    runs / ((last - start) / 1e3));
+        }
+    }
+    free(buf);
+
+    size_t total = 0;
+    for(size_t f = FIND_NONE + 1; f < NUM_FINDINGS; ++f) total += found[f];
+    fprintf(stderr, "[Info] %zu runs, %zu edges, %zu inputs, %zu findings\n",
+            runs, count_coverage(), corpus->sz, total);
+    return ret || total;
+}
+
+static enum finding run(const struct options *opt, const uint8_t *data,
+                        size_t sz) {
+    memset(shm->cov, 0, sizeof shm->cov);
+    shm->done = 0;
+    shm->ns = shm->peak = 0;
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        fprintf(stderr, "[Error] fork: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if(!pid) child(opt, data, sz);
+
+    int status;
+    while(waitpid(pid, &status, 0) < 0)
+        if(errno != EINTR) {
+            fprintf(stderr, "[Error] waitpid: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    if(WIFSIGNALED(status))
+        return WTERMSIG(status) == SIGALRM ? FIND_HANG : FIND_CRASH;
+    if(WEXITSTATUS(status) || !shm->done) return FIND_CRASH;
+
+    double ms = shm->ns / 1e6;
+    if(ms >= opt->min_ms && ms > opt->us_per_byte * sz / 1e3)
+        return FIND_SLOW;
+    if(shm->peak >= opt->min_mem && shm->peak > opt->mem_per_byte * sz)
+        return FIND_MEMORY;
+    return FIND_NONE;
+}
+
+static void child(const struct options *opt, const uint8_t *data, size_t sz) {
+    struct itimerval timer = {
+    .it_value = { opt->hang_ms / 1000, opt->hang_ms % 1000 * 1000 },
+    };
+    setitimer(ITIMER_REAL, &timer, NULL);
+#ifndef __SANITIZE_ADDRESS__
+    /* runaway allocations crash instead of taking the machine with them,
+     * the address sanitizer reserves more than this up front */
+    struct rlimit limit = { 4ul << 30, 4ul << 30 };
+    setrlimit(RLIMIT_AS, &limit);
+#endif
+
+    alloc_stats_t stats;
+    alloc_reset();
+    alloc_stats(&stats);
+    uint64_t live = stats.total.live;
+    cov_prev = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    LLVMFuzzerTestOneInput(data, sz);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    alloc_stats(&stats);
+    shm->ns = (end.tv_sec - start.tv_sec) * 1000000000ull
+            + end.tv_nsec - start.tv_nsec;
+    shm->peak = stats.total.peak - live;
+    shm->done = 1;
+    _exit(0);
+}
+
+/* hit counts are bucketed so loops running a few more times are not new,
+ * findings are only new if they reach code others of their kind did not */
+static int new_coverage(enum finding f) {
+    uint8_t *seen = cov_seen[f];
+    int ret = 0;
+    for(size_t i = 0; i < COV_SZ; ++i) {
+        uint8_t n = shm->cov[i];
+        if(!n) continue;
+        uint8_t b = n == 1 ? 1 : n == 2 ? 2 : n == 3 ? 4 : n < 8 ? 8
+                  : n < 16 ? 16 : n < 32 ? 32 : n < 128 ? 64 : 128;
+        if(b & ~seen[i]) {
+            seen[i] |= b;
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+static size_t count_coverage(void) {
+    size_t n = 0;
+    for(size_t i = 0; i < COV_SZ; ++i) n += cov_seen[FIND_NONE][i] != 0;
+    return n;
+}
+
+/* stacks a few random edits, repeating a short range is what builds deep
+ * nesting and long expressions */
+static size_t mutate(uint8_t *buf, size_t sz, size_t max,
+                     struct corpus *corpus) {
+    for(uint64_t n = 1 + rnd(4); n--;) {
+        size_t pos = rnd(sz + 1), len;
+        switch(rnd(8)) {
+        case 0:
+            if(sz) buf[rnd(sz)] ^= 1 << rnd(8);
+            break;
+
+        case 1:
+            if(sz) buf[rnd(sz)] = "(){};,=+-*/%<>!~&|^ \nafnil019"[rnd(29)];
+            break;
+
+        case 2:
+            len = rnd(16) + 1;
+            if(pos + len > sz) len = sz - pos;
+            memmove(buf + pos, buf + pos + len, sz - pos - len);
+            sz -= len;
+            break;
+
+        case 3: {
+            const char *tok = dict[rnd(sizeof dict / sizeof *dict)];
+            len = strlen(tok);
+            if(sz + len > max) break;
+            memmove(buf + pos + len, buf + pos, sz - pos);
+            memcpy(buf + pos, tok, len);
+            sz += len;
+            break;
+        }
+
+        case 4: case 5: {
+            /* a range of this input or of another one */
+            struct input *in = rnd(2) ? &corpus->inputs[rnd(corpus->sz)]
+                                      : NULL;
+            const uint8_t *src = in ? in->data : buf;
+            size_t src_sz = in ? in->sz : sz;
+            if(!src_sz) break;
+            size_t from = rnd(src_sz);
+            len = rnd(src_sz - from < 64 ? src_sz - from : 64) + 1;
+            if(sz + len > max) break;
+            uint8_t tmp[64];
+            memcpy(tmp, src + from, len);
+            memmove(buf + pos + len, buf + pos, sz - pos);
+            memcpy(buf + pos, tmp, len);
+            sz += len;
+            break;
+        }
+
+        case 6: {
+            if(!sz) break;
+            size_t from = rnd(sz);
+            len = rnd(sz - from < 16 ? sz - from : 16) + 1;
+            size_t times = rnd(256) + 2;
+            if(sz + len * times > max) times = (max - sz) / len;
+            uint8_t tmp[16];
+            memcpy(tmp, buf + from, len);
+            memmove(buf + from + len * times, buf + from, sz - from);
+            for(size_t i = 0; i < times; ++i)
+                memcpy(buf + from + len * i, tmp, len);
+            sz += len * times;
+            break;
+        }
+
+        case 7: {
+            /* the end of another input */
+            struct input *in = &corpus->inputs[rnd(corpus->sz)];
+            if(!in->sz) break;
+            size_t from = rnd(in->sz);
+            len = in->sz - from;
+            if(pos + len > max) len = max - pos;
+            memcpy(buf + pos, in->data + from, len);
+            sz = pos + len;
+            break;
+        }
+        }
+    }
+    return sz;
+}
+
+/* removes ever smaller ranges as long as the input stays the same kind of
+ * finding */
+static size_t minimize(const struct options *opt, uint8_t *buf, size_t sz,
+                       enum finding f) {
+    uint8_t *tmp = malloc(sz ? sz : 1);
+    size_t runs = 0;
+    double end = now() + MINIMIZE_MS;
+#define BUDGET (runs < MINIMIZE_RUNS && now() < end)
+    for(size_t len = sz / 2 ? sz / 2 : 1; len && BUDGET; len /= 2) {
+        for(size_t pos = 0; pos + len <= sz && BUDGET; ++runs) {
+            memcpy(tmp, buf, pos);
+            memcpy(tmp + pos, buf + pos + len, sz - pos - len);
+            if(run(opt, tmp, sz - len) == f) {
+                memcpy(buf, tmp, sz -= len);
+            } else pos += len;
+        }
+    }
+#undef BUDGET
+    free(tmp);
+    return sz;
+}
+
+/* timing findings must happen twice */
+static int confirm(const struct options *opt, const uint8_t *data, size_t sz,
+                   enum finding f) {
+    return f != FIND_SLOW || run(opt, data, sz) == f;
+}
+
+/* minimizes and writes a finding */
+static int report(const struct options *opt, const uint8_t *data, size_t sz,
+                  enum finding f) {
+    uint8_t *buf = malloc(sz ? sz : 1);
+    memcpy(buf, data, sz);
+    size_t min = minimize(opt, buf, sz, f);
+    fprintf(stderr, "[Info] Found %s input of %zu bytes, minimized to %zu\n",
+            finding_names[f], sz, min);
+    int ret = opt->out ? write_input(opt->out, finding_names[f], buf, min) : 0;
+    free(buf);
+    return ret;
+}
+
+/* named after the hash of the input so the same input is written once */
+static int write_input(const char *dir, const char *prefix,
+                       const uint8_t *data, size_t sz) {
+    char path[4096];
+    snprintf(path, sizeof path, "%s/%s%s%016llx.dpp", dir,
+             prefix ? prefix : "", prefix ? "-" : "",
+             (unsigned long long)hash(data, sz));
+    FILE *f;
+    if(!(f = fopen(path, "wb"))) {
+        fprintf(stderr, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fwrite(data, 1, sz, f);
+    if(fclose(f)) {
+        fprintf(stderr, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+static uint64_t hash(const uint8_t *data, size_t sz) {
+    uint64_t h = 0xcbf29ce484222325u;
+    for(size_t i = 0; i < sz; ++i) h = (h ^ data[i]) * 0x100000001b3u;
+    return h;
+}
+
+/* xorshift64, uniform enough below n for mutations */
+static uint64_t rnd(uint64_t n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return n ? rng % n : 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
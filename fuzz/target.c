@@ -0,0 +1,36 @@
+#include <parser/code.h>
+#include <parser/lexer.h>
+#include <parser/parser.h>
+#include <parser/semantics.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* runs an input through the front and middle end the way libFuzzer calls a
+ * target, so it can be linked with -fsanitize=fuzzer as well as fuzz.c */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t sz) {
+    static FILE *null;
+    if(!null && !(null = fopen("/dev/null", "w"))) abort();
+
+    lexer_t *lexer = lexer_new(data, sz);
+    parser_t *parser = parser_new(lexer);
+    parser->err = null;
+    ast_node_tu_t *root = parser_parse(parser);
+    if(root) {
+        /* the dumps recurse over the tree as deep as the parser did */
+        ast_print((void *)root, null);
+        ast_print_compact((void *)root, null);
+
+        semantics_ctx_t *ctx = semantics_new();
+        ctx->err = null;
+        /* the context is freed with the tree */
+        if(!semantics_analyze(ctx, root)) {
+            ir_code_t *code = code_new(root);
+            if(code) code_free(code);
+        }
+        ast_free((void *)root);
+    }
+    parser_free(parser);
+    lexer_free(lexer);
+    return 0;
+}
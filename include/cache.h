@@ -0,0 +1,38 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* default size limit of the cache directory */
+#define CACHE_DEFAULT_MAX_SZ (256u << 20)
+
+/* hex digest naming an entry, 128 bits */
+typedef struct cache_key {
+    char hex[33];
+} cache_key_t;
+
+typedef struct cache {
+    char *dir;
+    /** digest of the running compiler, part of every key so entries of
+     * other builds are not used */
+    cache_key_t compiler;
+    /** least recently used entries are evicted above this size */
+    uint64_t max_sz;
+    /** protects the counters, the cache is shared by all jobs */
+    pthread_mutex_t lock;
+    /** counters of this process, added to the stats file by cache_flush */
+    uint64_t hits, misses;
+} cache_t;
+
+int cache_init(cache_t *, const char *, uint64_t, FILE *);
+void cache_destroy(cache_t *);
+void cache_flush(cache_t *);
+
+void cache_key(cache_key_t *, const void *, size_t, const char *);
+int cache_fetch(cache_t *, cache_key_t *, const char *);
+int cache_store(cache_t *, cache_key_t *, const char *, FILE *);
+void cache_print_stats(cache_t *, FILE *);
+
+#endif /* CACHE_H_ */
@@ -0,0 +1,18 @@
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/* subprocesses run from the PATH without a shell, failures are reported to
+ * err */
+
+/* starts argv[0] with in as its standard input unless it is -1 */
+int command_spawn(char *const argv[], int in, pid_t *, FILE *err);
+/* waits for the program name, reporting how it ended unless it exited
+ * successfully */
+int command_wait(const char *name, pid_t, FILE *err);
+/* spawns and waits for argv[0] */
+int command_run(char *const argv[], int in, FILE *err);
+
+#endif /* COMMAND_H_ */
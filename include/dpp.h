@@ -0,0 +1,83 @@
+#ifndef DPP_H_
+#define DPP_H_
+
+/* libdpp - compiles dpp programs to memory
+ *
+ * A dpp_t holds everything needed for compiling and can be reused for any
+ * number of programs. Different contexts can be used from different threads
+ * at the same time, but one context only from one thread at a time.
+ *
+ * The only global state is the accounting of utils/alloc.h and the events of
+ * utils/trace.h, which are process-wide and shared by all contexts. Both are
+ * off unless alloc_track or trace_enable is called, which must happen before
+ * any context is used. Their counters and events then add up the work of
+ * every context, and they are safe to update from several threads. */
+
+#include <stddef.h>
+
+/* changes whenever the generated code may change */
+#define DPP_VERSION "0.1.0"
+
+typedef struct dpp dpp_t;
+
+enum dpp_output {
+/** relocatable ELF64 object file */
+DPP_OUTPUT_OBJ,
+/** static ELF64 executable, only with DPP_RUNTIME_SYSCALL */
+DPP_OUTPUT_EXEC,
+/** NASM assembly */
+DPP_OUTPUT_ASM,
+};
+
+enum dpp_runtime {
+/** print and input call printf and scanf from libc */
+DPP_RUNTIME_LIBC,
+/** print and input use system calls, no libc needed */
+DPP_RUNTIME_SYSCALL,
+};
+
+dpp_t *dpp_new(void);
+void dpp_free(dpp_t *);
+
+/**
+ * @brief Compiles a program.
+ *
+ * @param dpp context to compile with
+ * @param src source code, does not need to be null-terminated
+ * @param sz size of src in bytes
+ * @param output kind of output to produce
+ * @param rt runtime the builtin functions are implemented with
+ *
+ * @return 0 on success, otherwise non-zero and the reason is found in the
+ *         diagnostics
+ */
+int dpp_compile(dpp_t *dpp, const char *src, size_t sz,
+                enum dpp_output output, enum dpp_runtime rt);
+
+/**
+ * @brief Output of the last successful compilation.
+ *
+ * The output is owned by the context and valid until the next call to
+ * dpp_compile or dpp_free.
+ *
+ * @param dpp context
+ * @param sz set to the size of the output in bytes
+ *
+ * @return output image or text, NULL if the last compilation failed
+ */
+const unsigned char *dpp_output(dpp_t *dpp, size_t *sz);
+
+/**
+ * @brief Errors and warnings of the last compilation.
+ *
+ * The diagnostics are owned by the context and valid until the next call to
+ * dpp_compile or dpp_free.
+ *
+ * @param dpp context
+ * @param sz set to the length of the diagnostics, may be NULL
+ *
+ * @return null-terminated diagnostics, empty if there were none
+ */
+const char *dpp_diagnostics(dpp_t *dpp, size_t *sz);
+
+#endif /* DPP_H_ */
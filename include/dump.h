@@ -0,0 +1,33 @@
+#ifndef DUMP_H_
+#define DUMP_H_
+
+#include <parser/code.h>
+#include <stdio.h>
+
+/* output buffer of a dump, large enough that formatting is not dominated by
+ * writes */
+#define DUMP_BUF_SZ (1u << 20)
+
+enum dump_kind {
+DUMP_AST = 1,
+DUMP_SCOPES = 2,
+DUMP_IR = 4,
+};
+
+typedef struct dump {
+    /** enum dump_kind of the dumps to write, 0 if none */
+    unsigned kinds;
+    /** compact machine-readable format instead of the indented one */
+    int compact;
+    /** dumps of file.dpp go to dir/file.ast and so on, NULL for stdout */
+    const char *dir;
+} dump_t;
+
+int dump_parse(dump_t *, const char *, FILE *);
+int dump_parse_format(dump_t *, const char *, FILE *);
+
+int dump_ast(dump_t *, const char *, ast_node_tu_t *, FILE *);
+int dump_scopes(dump_t *, const char *, ast_node_tu_t *, FILE *);
+int dump_ir(dump_t *, const char *, ir_code_t *, FILE *);
+
+#endif /* DUMP_H_ */
@@ -32,3 +32,4 @@ T(TLEQ_OP,         265)
 T(TGEQ_OP,         266)
 T(TEQ_OP,          267)
 T(TNEQ_OP,         268)
+T(TEXTERN,         269)
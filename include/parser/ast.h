@@ -7,12 +7,15 @@
 #include <parser/token.h>
 #include <utils/vector.h>
 #include <stdint.h>
+#include <stdio.h>
 
 /****** types ******/
 
 enum ast_node_type {
 AST_TU,
 AST_FN_DEFN,
+/** extern declaration, an ast_node_fn_defn_t with an empty body */
+AST_FN_DECL,
 AST_STMT_DECL,
 AST_STMT_EXPR,
 AST_STMT_IF,
@@ -53,6 +56,7 @@ EXPR_BITNOT,
 struct semantics_ctx;
 struct scope;
 struct function_ref;
+struct variable_ref;
 
 typedef struct ast_node {
     enum ast_node_type type;
@@ -63,6 +67,8 @@ typedef struct ast_node_tu {
 
     /** vector of ast_node_fn_defn_t */
     vec_t *functions;
+    /** vector of ast_node_fn_defn_t of extern declarations */
+    vec_t *externs;
 
     struct semantics_ctx *ctx;
 } ast_node_tu_t;
@@ -85,6 +91,8 @@ typedef struct ast_node_ident {
 
     char *name;
     size_t name_sz;
+    /** variable it names, set by the semantic analysis */
+    struct variable_ref *ref;
 } ast_node_ident_t;
 
 typedef struct ast_node_const {
@@ -115,6 +123,8 @@ typedef struct ast_node_expr_call {
     struct ast_node_ident *ident;
     /** vector ast_node_t of expression types (or const/ident) */
     vec_t *args;
+    /** function called, set by the semantic analysis */
+    struct function_ref *ref;
 } ast_node_expr_call_t;
 
 typedef struct ast_node_stmt_decl {
@@ -166,7 +176,10 @@ ast_node_expr_binary_t *ast_node_expr_binary_new(
 ast_node_expr_unary_t *ast_node_expr_unary_new(
     ast_node_t *, enum expr_unary_type);
 
-void ast_print(ast_node_t *);
+void ast_print(ast_node_t *, FILE *);
+void ast_print_compact(ast_node_t *, FILE *);
 void ast_free(ast_node_t *);
+uint64_t ast_hash(ast_node_t *);
+size_t ast_count(ast_node_t *);
 
 #endif /* PARSER_AST_H_ */
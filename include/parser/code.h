@@ -10,6 +10,22 @@ enum ir_instr_type {
 #undef T
 };
 
+/* what the builtin functions print and input are implemented with */
+enum runtime {
+/** call printf/scanf from libc */
+RT_LIBC,
+/** raw write/read syscalls and a _start entry point, no libc */
+RT_SYSCALL,
+/** call functions in the compiler process, used by the JIT */
+RT_HOST,
+/** no runtime, every function is global and print, input and extern
+ * functions are left to the linker */
+RT_NONE,
+};
+
+/* bytes of output RT_SYSCALL buffers and of input it reads at a time */
+#define RT_BUF_SZ 4096
+
 typedef struct ir_instr {
     enum ir_instr_type type;
 } ir_instr_t;
@@ -38,6 +54,13 @@ typedef struct ir_instr_func {
     function_ref_t *ref;
 } ir_instr_func_t;
 
+/* the machine code asm_generate emits for an IR instruction */
+typedef struct asm_metrics {
+    uint32_t instructions, pushes, pops, mem_operands;
+    /** instructions after its last label, the epilogue a return jumps to */
+    uint32_t tail;
+} asm_metrics_t;
+
 typedef struct ir_code {
     struct semantics_ctx *ctx;
     /** vector of ir_instr_t */
@@ -46,6 +69,7 @@ typedef struct ir_code {
 } ir_code_t;
 
 ir_instr_t *instr_new(enum ir_instr_type);
+void instr_free(ir_instr_t *);
 ir_instr_label_t *instr_new_label(enum ir_instr_type, size_t);
 ir_instr_if_t *instr_new_if(ir_code_t *, ast_node_stmt_if_t *);
 ir_instr_data_t *instr_new_var(enum ir_instr_type, variable_ref_t *);
@@ -55,9 +79,24 @@ ir_instr_func_t *instr_new_func(enum ir_instr_type, function_ref_t *);
 const char *instr_type_str(enum ir_instr_type);
 
 ir_code_t *code_new(ast_node_tu_t *);
+int code_generate_fn(ir_code_t *, ast_node_fn_defn_t *);
 void code_free(ir_code_t *);
-void code_dump(ir_code_t *);
+void code_dump(ir_code_t *, FILE *);
+void code_dump_compact(ir_code_t *, FILE *);
+
+int asm_generate(FILE *, ir_code_t *, enum runtime);
+/* asm_generate in parts, for code which is generated a piece at a time */
+int asm_generate_begin(FILE *, enum runtime);
+int asm_generate_code(FILE *, ir_code_t *);
+int asm_generate_end(FILE *, ir_code_t *, enum runtime);
+/* the runtime and each function as translation units of their own, fn is
+ * the index of the FUNC instruction of the function */
+int asm_generate_runtime(FILE *, ir_code_t *, enum runtime);
+int asm_generate_fn(FILE *, ir_code_t *, size_t fn);
+/* fills metrics, one per instruction of the code */
+int asm_metrics(ir_code_t *, asm_metrics_t *metrics);
 
-int asm_generate(FILE *, ir_code_t *);
+/* the program as C using libc, to be compiled by a C compiler */
+int c_generate(FILE *, ir_code_t *);
 
 #endif /* PARSER_CODE_H_ */
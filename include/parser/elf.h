@@ -0,0 +1,13 @@
+#ifndef PARSER_ELF_H_
+#define PARSER_ELF_H_
+
+#include <parser/x86.h>
+#include <utils/buffer.h>
+
+/* load address of executables written by elf_write_exec */
+#define ELF_EXEC_BASE 0x400000
+
+int elf_write_obj(buf_t *, x86_obj_t *);
+int elf_write_exec(buf_t *, x86_obj_t *, const char *);
+
+#endif /* PARSER_ELF_H_ */
@@ -0,0 +1,39 @@
+#ifndef PARSER_FNSTREAM_H_
+#define PARSER_FNSTREAM_H_
+
+/* compilation of a program one function at a time
+ *
+ * A scan of the tokens declares every function and extern declaration first,
+ * like semantics_analyze does before it analyzes any body. Each definition is
+ * then parsed, analyzed and lowered on its own and freed when the next one
+ * is read, so only the largest function has to fit in memory instead of the
+ * whole program. */
+
+#include <parser/parser.h>
+#include <parser/code.h>
+#include <stdio.h>
+
+typedef struct fnstream {
+    semantics_ctx_t *ctx;
+    lexer_t lexer;
+    parser_t parser;
+    /** definition being compiled, NULL before the first one is read */
+    ast_node_fn_defn_t *fn;
+    /** IR of the current function only, from its FUNC to its LEAVE */
+    ir_code_t code;
+    /** function_ref_t of every definition and extern declaration in the
+     * order of the source, NULL where the scan found them to disagree */
+    vec_t *refs;
+    /** number of definitions and declarations read */
+    size_t num_fns;
+    /** stream diagnostics are written to */
+    FILE *err;
+} fnstream_t;
+
+fnstream_t *fnstream_new(const unsigned char *, size_t, FILE *);
+void fnstream_free(fnstream_t *);
+ast_node_fn_defn_t *fnstream_next(fnstream_t *);
+int fnstream_analyze(fnstream_t *);
+int fnstream_generate(fnstream_t *);
+
+#endif /* PARSER_FNSTREAM_H_ */
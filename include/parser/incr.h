@@ -0,0 +1,44 @@
+#ifndef PARSER_INCR_H_
+#define PARSER_INCR_H_
+
+/* incremental compilation of a program that is compiled over and over
+ *
+ * A function whose syntax tree hashes the same as in the previous compilation
+ * keeps its scopes, IR and machine code, as long as every function it calls
+ * is still defined with the same number of arguments. Only the other
+ * functions are analyzed and generated again. */
+
+#include <parser/code.h>
+#include <parser/x86.h>
+#include <stdio.h>
+
+struct incr_fn;
+
+typedef struct incr {
+    semantics_ctx_t *ctx;
+    /** IR of the whole program, the instructions belong to the functions */
+    ir_code_t code;
+    /** hash table of struct incr_fn by name */
+    struct incr_fn **table;
+    size_t table_sz, num_fns;
+    /** struct incr_fn in the order of the last compiled source */
+    vec_t *order;
+    /** struct incr_fn of functions defined more than once, never reused */
+    vec_t *scratch;
+    /** function_ref_t of the extern declarations of the last compilation
+     * which are not defined by it */
+    vec_t *externs;
+    /** number of the current compilation */
+    size_t gen;
+    /** functions analyzed and generated by the last compilation */
+    size_t num_compiled;
+    /** stream diagnostics are written to */
+    FILE *err;
+} incr_t;
+
+incr_t *incr_new(FILE *);
+void incr_free(incr_t *);
+int incr_compile(incr_t *, const unsigned char *, size_t);
+x86_obj_t *incr_link(incr_t *, enum runtime);
+
+#endif /* PARSER_INCR_H_ */
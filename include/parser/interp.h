@@ -0,0 +1,44 @@
+#ifndef PARSER_INTERP_H_
+#define PARSER_INTERP_H_
+
+#include <parser/code.h>
+#include <stdint.h>
+
+/* size of the interpreter stack in 64-bit words */
+#define INTERP_STACK_WORDS (1 << 20)
+
+typedef struct interp_op {
+    /** enum interp_opcode */
+    uint16_t op;
+    /** stack slot relative to the frame, or an argument count */
+    int32_t a;
+    /** immediate, second stack slot or required stack space of a call */
+    int64_t b;
+    union {
+        /** jump or call target, only valid after decoding */
+        const struct interp_op *target;
+        /** IR label or function_ref_t::idx while decoding */
+        size_t idx;
+    };
+} interp_op_t;
+
+typedef struct interp {
+    /** decoded bytecode, starts with a call to main, with the number of
+     * its arguments in a, followed by a halt */
+    interp_op_t *ops;
+    size_t num_ops;
+    /** index of the first IR instruction decoded into every op, SIZE_MAX
+     * for the call of main and the halt */
+    size_t *ir;
+    /** stream runtime errors are written to */
+    FILE *err;
+} interp_t;
+
+interp_t *interp_new(ir_code_t *);
+void interp_free(interp_t *);
+int interp_run(interp_t *, int64_t *);
+/* interp_run which also counts how often every op is executed in counts,
+ * which has num_ops entries */
+int interp_run_counted(interp_t *, int64_t *, uint64_t *counts);
+
+#endif /* PARSER_INTERP_H_ */
@@ -0,0 +1,17 @@
+#ifndef PARSER_JIT_H_
+#define PARSER_JIT_H_
+
+#include <parser/code.h>
+
+typedef struct jit {
+    /** executable mapping holding .text followed by .rodata */
+    void *mem;
+    size_t sz;
+    int64_t (*enter)(void);
+} jit_t;
+
+jit_t *jit_new(ir_code_t *);
+void jit_free(jit_t *);
+int64_t jit_run(jit_t *);
+
+#endif /* PARSER_JIT_H_ */
@@ -4,13 +4,32 @@
 #include <stdio.h>
 #include <parser/token.h>
 
+/* initial size of the window a streamed source is lexed in */
+#define LEXER_STREAM_SZ (1u<<16)
+
+/* reads up to sz bytes into buf, returns 0 at the end of the input */
+typedef size_t (*lexer_read_t)(void *arg, unsigned char *buf, size_t sz);
+
 typedef struct lexer {
     const unsigned char *start, *end;
     int unget;
     token_t token;
+    /** tokens read, not counting ungotten ones twice */
+    size_t num_tokens;
+    /** source of a streamed input, NULL once it ends or for a buffer */
+    lexer_read_t read;
+    void *read_arg;
+    /** window of a streamed input, only the current token stays valid
+     * when it is refilled */
+    unsigned char *buf;
+    size_t buf_sz;
 } lexer_t;
 
 lexer_t *lexer_new(const unsigned char *, size_t);
+void lexer_init(lexer_t *, const unsigned char *, size_t);
+void lexer_init_stream(lexer_t *, lexer_read_t, void *);
+/* frees the window of a lexer initialized with lexer_init_stream */
+void lexer_destroy(lexer_t *);
 void lexer_free(lexer_t *);
 
 token_t *lexer_next(lexer_t *);
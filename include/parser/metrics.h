@@ -0,0 +1,42 @@
+#ifndef PARSER_METRICS_H_
+#define PARSER_METRICS_H_
+
+#include <parser/code.h>
+#include <parser/interp.h>
+
+/* quality of the generated code of each function, printed by
+ * -fcodegen-report */
+
+typedef struct fn_metrics {
+    /** IR instructions of the function, first is SIZE_MAX if it is not
+     * defined by the code */
+    size_t first, last;
+    /** machine code asm_generate emits for the function */
+    uint64_t instructions, pushes, pops, mem_operands;
+    /** machine instructions the code of the function executes in a counted
+     * run, leaving out print and input, and the calls it makes and gets */
+    uint64_t executed, calls, called;
+} fn_metrics_t;
+
+typedef struct metrics {
+    ir_code_t *code;
+    /** the machine code of every IR instruction */
+    asm_metrics_t *ir;
+    /** function_ref_t::idx of the function of every IR instruction */
+    size_t *fn_of;
+    /** by function_ref_t::idx */
+    fn_metrics_t *fns;
+    /** the executed and call counts are valid */
+    int counted;
+} metrics_t;
+
+metrics_t *metrics_new(ir_code_t *);
+void metrics_free(metrics_t *);
+/* runs the program with the interpreter, counting the instructions the
+ * machine code would execute */
+int metrics_run(metrics_t *, interp_t *, int64_t *);
+
+void metrics_print(metrics_t *, FILE *);
+void metrics_json(metrics_t *, FILE *);
+
+#endif /* PARSER_METRICS_H_ */
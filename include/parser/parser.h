@@ -4,14 +4,26 @@
 #include <parser/lexer.h>
 #include <parser/ast.h>
 
+/* deepest tree the parser builds, a chain of binary operators is as deep as
+ * it is long */
+#define PARSER_MAX_DEPTH 10000
+
 typedef struct parser {
     lexer_t *lexer;
     ast_node_t *root;
+    /** stream diagnostics are written to */
+    FILE *err;
     int error;
+    /** blocks and expressions being parsed */
+    size_t depth;
+    /** height of the expression parsed last */
+    size_t height;
 } parser_t;
 
 parser_t *parser_new(lexer_t *);
+void parser_init(parser_t *, lexer_t *);
 ast_node_tu_t *parser_parse(parser_t *);
+ast_node_fn_defn_t *parser_parse_fn(parser_t *);
 void parser_free(parser_t *);
 
 int parser_eat(parser_t *, enum token_type);
@@ -8,12 +8,22 @@ typedef struct function_ref {
     size_t name_sz;
     char *name;
     size_t num_args;
+    /** index in semantics_ctx_t::functions */
+    size_t idx;
+    /** declared extern and not defined by this module */
+    int external;
 } function_ref_t;
 
 typedef struct variable_ref {
     size_t name_sz;
     char *name;
+    /** 0 for a local until its declaration is analyzed */
     ssize_t bp_offset;
+    /** scope the variable is declared in */
+    struct scope *scope;
+    /** a variable of the same name declared in an enclosing scope is visible
+     * before this one is declared */
+    int shadows;
 } variable_ref_t;
 
 typedef struct semantics_ctx {
@@ -21,8 +31,26 @@ typedef struct semantics_ctx {
 
     /** vector of function_ref_t */
     vec_t *functions;
+    /** open addressing index of the first fn_indexed functions by name,
+     * holding their index in functions plus one */
+    size_t *fn_table;
+    size_t fn_table_sz, fn_indexed;
 
+    /** open addressing table of the variables visible in the scope being
+     * analyzed by name */
+    struct variable_ref **var_table;
+    size_t var_table_sz, var_table_used;
+    /** pairs of a variable bound and the one it shadows, NULL if none, undone
+     * when the scope of the variable ends */
+    vec_t *var_undo;
+
+    /** stream diagnostics are written to */
+    FILE *err;
     int error;
+    /** extern functions may be defined by other modules */
+    int module;
+    /** scopes and variables created, for -ftime-report */
+    size_t num_scopes, num_variables;
 } semantics_ctx_t;
 
 typedef struct scope {
@@ -38,7 +66,10 @@ typedef struct scope {
 function_ref_t *function_ref_new(char *, size_t, size_t);
 function_ref_t *function_ref_new_node(ast_node_fn_defn_t *);
 void function_ref_free(function_ref_t *);
+function_ref_t *function_ref_add(semantics_ctx_t *, function_ref_t *);
 function_ref_t *function_ref_find(semantics_ctx_t *, ast_node_ident_t *);
+function_ref_t *function_ref_declare(semantics_ctx_t *, char *, size_t, size_t,
+                                     int);
 
 variable_ref_t *variable_ref_new(char *, size_t, ssize_t);
 variable_ref_t *variable_ref_new_scope(scope_t *, ast_node_ident_t *);
@@ -52,7 +83,10 @@ void scope_free(scope_t *);
 semantics_ctx_t *semantics_new(void);
 void semantics_free(semantics_ctx_t *);
 int semantics_analyze(semantics_ctx_t *, ast_node_tu_t *);
+int semantics_analyze_fn(semantics_ctx_t *, ast_node_fn_defn_t *);
+int semantics_check_externs(semantics_ctx_t *);
 
-void semantics_dump_tables(ast_node_tu_t *);
+void semantics_dump_tables(ast_node_tu_t *, FILE *);
+void semantics_dump_compact(ast_node_tu_t *, FILE *);
 
 #endif /* PARSER_SEMANTICS_H_ */
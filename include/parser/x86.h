@@ -0,0 +1,90 @@
+#ifndef PARSER_X86_H_
+#define PARSER_X86_H_
+
+#include <parser/code.h>
+#include <utils/buffer.h>
+#include <utils/vector.h>
+
+enum x86_section {
+X86_SECT_UNDEF,
+X86_SECT_TEXT,
+X86_SECT_RODATA,
+/** zero-initialized data, which takes no space in the object */
+X86_SECT_BSS,
+};
+
+enum x86_reloc_type {
+/** 32-bit PC-relative call target (R_X86_64_PLT32) */
+X86_RELOC_PLT32,
+/** 32-bit zero-extended absolute address (R_X86_64_32) */
+X86_RELOC_32,
+/** 64-bit absolute address (R_X86_64_64) */
+X86_RELOC_64,
+};
+
+typedef struct x86_sym {
+    char *name;
+    size_t name_sz;
+    /** X86_SECT_UNDEF for external symbols */
+    enum x86_section section;
+    size_t offset, size;
+    int global;
+} x86_sym_t;
+
+typedef struct x86_reloc {
+    enum x86_reloc_type type;
+    /** offset in .text of the field to patch */
+    size_t offset;
+    /** index into x86_obj_t::symbols */
+    size_t sym;
+    int64_t addend;
+} x86_reloc_t;
+
+typedef struct x86_obj {
+    buf_t text, rodata;
+    /** .bss only has a size */
+    size_t bss_sz;
+    /** vector of x86_sym_t, the first entries map to semantics_ctx_t::functions
+     * by function_ref_t::idx */
+    vec_t *symbols;
+    /** vector of x86_reloc_t, all relocations apply to .text */
+    vec_t *relocs;
+    /** stream diagnostics are written to */
+    FILE *err;
+} x86_obj_t;
+
+/* call from a function to another, patched when the function is linked */
+struct x86_call {
+    /** offset of the rel32 field from the start of the function */
+    size_t offset;
+    function_ref_t *ref;
+};
+
+/* machine code of one function, independent of where it is placed */
+typedef struct x86_fn {
+    function_ref_t *ref;
+    buf_t text;
+    /** struct x86_call for every call in the function */
+    buf_t calls;
+} x86_fn_t;
+
+/* resolves the address of an external symbol, returns non-zero on failure */
+typedef int (*x86_resolve_t)(void *, x86_sym_t *, uint64_t *);
+
+x86_obj_t *x86_generate(ir_code_t *, enum runtime);
+x86_fn_t *x86_generate_fn(ir_instr_t **, size_t, FILE *);
+void x86_fn_free(x86_fn_t *);
+x86_obj_t *x86_link(semantics_ctx_t *, x86_fn_t **, size_t, enum runtime);
+x86_obj_t *x86_link_begin(semantics_ctx_t *, size_t);
+void x86_link_fn(x86_obj_t *, semantics_ctx_t *, x86_fn_t *, enum runtime);
+int x86_link_end(x86_obj_t *, semantics_ctx_t *, enum runtime);
+x86_obj_t *x86_generate_runtime(enum runtime, FILE *);
+void x86_free(x86_obj_t *);
+int x86_relocate(x86_obj_t *, uint64_t, uint64_t, uint64_t, x86_resolve_t,
+                 void *);
+
+size_t x86_sym_add(x86_obj_t *, const char *, size_t, enum x86_section,
+                   size_t, int);
+ssize_t x86_sym_find(x86_obj_t *, const char *, size_t);
+
+#endif /* PARSER_X86_H_ */
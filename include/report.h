@@ -0,0 +1,74 @@
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* where compile time and memory go, printed by -ftime-report and
+ * -fmem-report */
+
+enum report_phase {
+REPORT_READ,
+/** lexing happens on demand while parsing */
+REPORT_PARSE,
+REPORT_SEMANTICS,
+REPORT_CODE,
+/** parsing, analysis and IR of the changed functions with --watch */
+REPORT_INCR,
+REPORT_ASM,
+/** lowering to C with --via-c */
+REPORT_C,
+REPORT_X86,
+REPORT_ELF,
+REPORT_WRITE,
+/** NASM subprocess */
+REPORT_NASM,
+/** gcc compiling the C of --via-c */
+REPORT_CC,
+/** gcc or ld subprocess */
+REPORT_LINK,
+/** the program itself with -r and -i */
+REPORT_RUN,
+/** freeing the tree and IR */
+REPORT_FREE,
+REPORT_NUM_PHASES,
+};
+
+enum report_counter {
+REPORT_SRC_BYTES,
+REPORT_TOKENS,
+REPORT_AST_NODES,
+REPORT_SCOPES,
+REPORT_VARIABLES,
+REPORT_IR_INSTRS,
+REPORT_ASM_BYTES,
+REPORT_TEXT_BYTES,
+REPORT_OUT_BYTES,
+REPORT_NUM_COUNTERS,
+};
+
+typedef struct report {
+    /** which reports are printed and whether as JSON */
+    int show_time, show_mem, json;
+    /** jobs of a batch add to the same report */
+    pthread_mutex_t lock;
+    /** milliseconds spent in each phase, summed over all jobs */
+    double time[REPORT_NUM_PHASES];
+    uint64_t counters[REPORT_NUM_COUNTERS];
+    /** milliseconds from report_init to the summary */
+    double start;
+} report_t;
+
+void report_init(report_t *);
+void report_destroy(report_t *);
+void report_reset(report_t *);
+
+double report_now(void);
+double report_begin(report_t *, enum report_phase);
+void report_time(report_t *, enum report_phase, double);
+void report_count(report_t *, enum report_counter, uint64_t);
+
+void report_print(report_t *, FILE *);
+
+#endif /* REPORT_H_ */
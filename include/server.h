@@ -0,0 +1,47 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <dpp.h>
+#include <utils/buffer.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* "dpp\0" */
+#define SERVER_MAGIC 0x00707064u
+/* largest source accepted by the server */
+#define SERVER_MAX_SRC (64u << 20)
+/* number of compilation results kept by the server */
+#define SERVER_CACHE_SZ 64
+/* seconds the server waits for a client to send or read */
+#define SERVER_TIMEOUT 30
+
+/* requests and responses are sent in host byte order, both ends of a Unix
+ * domain socket are on the same machine */
+
+/** followed by src_sz bytes of source code */
+struct server_request {
+    uint32_t magic;
+    /** enum dpp_output, DPP_OUTPUT_EXEC with DPP_RUNTIME_LIBC is linked by
+     * the server */
+    uint8_t output;
+    /** enum dpp_runtime */
+    uint8_t runtime;
+    uint16_t reserved;
+    uint64_t src_sz;
+};
+
+/** followed by out_sz bytes of output and diag_sz bytes of diagnostics */
+struct server_response {
+    uint32_t magic;
+    /** 0 if the compilation succeeded */
+    int32_t status;
+    uint64_t out_sz, diag_sz;
+};
+
+int server_run(const char *);
+
+int client_connect(const char *, FILE *);
+int client_compile(int, enum dpp_output, enum dpp_runtime, const void *,
+                   size_t, buf_t *, FILE *);
+
+#endif /* SERVER_H_ */
@@ -0,0 +1,149 @@
+/**
+ * @file
+ *
+ * @brief Allocation functions which account memory by type and phase
+ *
+ * Accounting is off until `alloc_track` is called, until then the functions
+ * are inlined calls of their libc counterparts. Sizes are the usable sizes
+ * reported by the allocator, so they include its rounding.
+ */
+#ifndef CBASE_UTILS_ALLOC_H_
+#define CBASE_UTILS_ALLOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** What an allocation is used for */
+enum alloc_type {
+ALLOC_OTHER,
+ALLOC_AST,
+ALLOC_VEC,
+ALLOC_BUF,
+ALLOC_SCOPE,
+ALLOC_VARIABLE,
+ALLOC_FUNCTION,
+ALLOC_IR,
+ALLOC_X86,
+ALLOC_NUM_TYPES,
+};
+
+/** Maximum number of phases, which are numbered by the caller */
+#define ALLOC_MAX_PHASES 16
+
+/** Allocation counters of a type or phase */
+struct alloc_count {
+    /** Number of allocations and frees */
+    uint64_t allocs, frees;
+    /** Bytes allocated in total */
+    uint64_t bytes;
+    /** Bytes allocated and not yet freed, for a phase all live bytes when
+     * the phase last allocated or freed */
+    uint64_t live;
+    /** Highest value of `live` */
+    uint64_t peak;
+};
+
+/** A snapshot of all counters */
+typedef struct alloc_stats {
+    struct alloc_count types[ALLOC_NUM_TYPES];
+    struct alloc_count phases[ALLOC_MAX_PHASES];
+    struct alloc_count total;
+} alloc_stats_t;
+
+/**
+ * @brief Starts accounting, must be called before anything is allocated.
+ */
+void alloc_track(void);
+
+/**
+ * @brief Sets the phase the allocations of the calling thread belong to.
+ *
+ * @param[in] phase  Phase, less than `ALLOC_MAX_PHASES`
+ */
+void alloc_phase(unsigned phase);
+
+/**
+ * @brief Copies the counters.
+ *
+ * @param[out] stats  Snapshot
+ */
+void alloc_stats(alloc_stats_t *stats);
+
+/**
+ * @brief Clears the counters of the phases and the totals of the types, the
+ * peaks start over from the bytes currently live.
+ */
+void alloc_reset(void);
+
+/** Non-zero once `alloc_track` is called */
+extern int alloc_tracking;
+
+void *alloc_malloc_tracked(enum alloc_type, size_t);
+void *alloc_calloc_tracked(enum alloc_type, size_t, size_t);
+void *alloc_realloc_tracked(enum alloc_type, void *, size_t);
+void alloc_free_tracked(enum alloc_type, void *);
+
+/**
+ * @brief Allocates memory like `malloc`.
+ *
+ * @param[in] type  Type of the allocation
+ * @param[in] sz    Amount of bytes
+ * @return Memory, free it with `alloc_free` of the same type
+ */
+static inline void *alloc_malloc(enum alloc_type type, size_t sz) {
+    if(__builtin_expect(alloc_tracking, 0))
+        return alloc_malloc_tracked(type, sz);
+    return malloc(sz);
+}
+
+/**
+ * @brief Allocates zeroed memory like `calloc`.
+ *
+ * @param[in] type  Type of the allocation
+ * @param[in] n     Number of elements
+ * @param[in] sz    Size of an element
+ * @return Memory, free it with `alloc_free` of the same type
+ */
+static inline void *alloc_calloc(enum alloc_type type, size_t n, size_t sz) {
+    if(__builtin_expect(alloc_tracking, 0))
+        return alloc_calloc_tracked(type, n, sz);
+    return calloc(n, sz);
+}
+
+/**
+ * @brief Resizes memory like `realloc`.
+ *
+ * @param[in] type  Type of the allocation
+ * @param[in] p     Memory of the same type, or `NULL`
+ * @param[in] sz    New amount of bytes
+ * @return Memory
+ */
+static inline void *alloc_realloc(enum alloc_type type, void *p, size_t sz) {
+    if(__builtin_expect(alloc_tracking, 0))
+        return alloc_realloc_tracked(type, p, sz);
+    return realloc(p, sz);
+}
+
+/**
+ * @brief Copies `sz` bytes of a string and terminates the copy.
+ *
+ * @param[in] type  Type of the allocation
+ * @param[in] s     String
+ * @param[in] sz    Length of the string
+ * @return Null-terminated copy
+ */
+char *alloc_strndup(enum alloc_type type, const char *s, size_t sz);
+
+/**
+ * @brief Frees memory like `free`.
+ *
+ * @param[in] type  Type the memory was allocated with
+ * @param[in] p     Memory, or `NULL`
+ */
+static inline void alloc_free(enum alloc_type type, void *p) {
+    if(__builtin_expect(alloc_tracking, 0)) alloc_free_tracked(type, p);
+    else free(p);
+}
+
+#endif /* CBASE_UTILS_ALLOC_H_ */
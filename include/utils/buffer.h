@@ -0,0 +1,111 @@
+/**
+ * @file
+ *
+ * @brief Implementation of a basic growable byte buffer
+ */
+#ifndef CBASE_UTILS_BUFFER_H_
+#define CBASE_UTILS_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A dynamically sized array of bytes */
+typedef struct buf {
+    /** Internal array of bytes */
+    unsigned char *data;
+    /** The current amount of bytes in the buffer */
+    size_t sz;
+    /** The capacity of the buffer */
+    size_t capacity;
+} buf_t;
+
+/**
+ * @brief Initializes a buffer.
+ *
+ * @param[out] b   Buffer
+ * @param[in]  n   Capacity
+ * @return Buffer
+ */
+buf_t *buf_init(buf_t *b, size_t n);
+
+/**
+ * @brief Frees the contents of a buffer. Does not free the buffer.
+ *
+ * @param[in] b   Buffer
+ */
+void buf_destroy(buf_t *b);
+
+/**
+ * @brief Increases the capacity of the buffer to at least `n`.
+ *
+ * @param[in] b   Buffer
+ * @param[in] n   New capacity
+ * @return New capacity
+ */
+size_t buf_reserve(buf_t *b, size_t n);
+
+/**
+ * @brief Appends bytes to the end of the buffer.
+ *
+ * @param[in] b     Buffer
+ * @param[in] data  Bytes to append, or `NULL` to append zeroes
+ * @param[in] sz    Amount of bytes
+ * @return Offset of the appended bytes in the buffer
+ */
+size_t buf_push(buf_t *b, const void *data, size_t sz);
+
+/**
+ * @brief Appends zeroes to the buffer until its size is a multiple of `align`.
+ *
+ * @param[in] b      Buffer
+ * @param[in] align  Alignment, must be a power of two
+ * @return New size of the buffer
+ */
+size_t buf_align(buf_t *b, size_t align);
+
+/**
+ * @brief Appends a byte to the end of the buffer.
+ *
+ * @param[in] b   Buffer
+ * @param[in] c   Byte
+ * @return Offset of the appended byte in the buffer
+ */
+size_t buf_push_u8(buf_t *b, uint8_t c);
+
+/**
+ * @brief Appends a little-endian 32-bit integer to the end of the buffer.
+ *
+ * @param[in] b   Buffer
+ * @param[in] v   Value
+ * @return Offset of the appended integer in the buffer
+ */
+size_t buf_push_u32(buf_t *b, uint32_t v);
+
+/**
+ * @brief Appends a little-endian 64-bit integer to the end of the buffer.
+ *
+ * @param[in] b   Buffer
+ * @param[in] v   Value
+ * @return Offset of the appended integer in the buffer
+ */
+size_t buf_push_u64(buf_t *b, uint64_t v);
+
+/**
+ * @brief Overwrites a little-endian 32-bit integer in the buffer.
+ *
+ * @param[in] b     Buffer
+ * @param[in] off   Offset of the integer
+ * @param[in] v     Value
+ */
+void buf_set_u32(buf_t *b, size_t off, uint32_t v);
+
+/**
+ * @brief Overwrites a little-endian 64-bit integer in the buffer.
+ *
+ * @param[in] b     Buffer
+ * @param[in] off   Offset of the integer
+ * @param[in] v     Value
+ */
+void buf_set_u64(buf_t *b, size_t off, uint64_t v);
+
+#endif /* CBASE_UTILS_BUFFER_H_ */
@@ -0,0 +1,78 @@
+/**
+ * @file
+ *
+ * @brief Recording of timed events in the Chrome trace-event format
+ *
+ * Events are only recorded after `trace_enable` is called, until then
+ * `trace_begin` and `trace_end` are inlined no-ops.
+ */
+#ifndef CBASE_UTILS_TRACE_H_
+#define CBASE_UTILS_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** Non-zero once `trace_enable` is called */
+extern int trace_enabled;
+
+/**
+ * @brief Starts recording, must be called before any other thread starts.
+ */
+void trace_enable(void);
+
+/**
+ * @brief Reads the clock events are timed with.
+ *
+ * @return Monotonic time in microseconds
+ */
+uint64_t trace_clock(void);
+
+/**
+ * @brief Records an event which started at `start` and ends now.
+ *
+ * @param[in] cat      Category, shown by the viewer and used for filtering
+ * @param[in] name     Name of the event
+ * @param[in] name_sz  Length of the name
+ * @param[in] start    Time from `trace_clock` the event started at
+ */
+void trace_event(const char *cat, const char *name, size_t name_sz,
+                 uint64_t start);
+
+/**
+ * @brief Writes all events recorded so far as a JSON trace.
+ *
+ * @param[in] f  Stream
+ * @return Non-zero on write errors
+ */
+int trace_write(FILE *f);
+
+/**
+ * @brief Drops the events recorded so far, keeping the memory they took.
+ */
+void trace_reset(void);
+
+/**
+ * @brief Starts an event.
+ *
+ * @return Start time to pass to `trace_end`
+ */
+static inline uint64_t trace_begin(void) {
+    return __builtin_expect(trace_enabled, 0) ? trace_clock() : 0;
+}
+
+/**
+ * @brief Ends an event started by `trace_begin`.
+ *
+ * @param[in] cat      Category
+ * @param[in] name     Name of the event
+ * @param[in] name_sz  Length of the name
+ * @param[in] start    Value returned by `trace_begin`
+ */
+static inline void trace_end(const char *cat, const char *name,
+                             size_t name_sz, uint64_t start) {
+    if(__builtin_expect(trace_enabled, 0))
+        trace_event(cat, name, name_sz, start);
+}
+
+#endif /* CBASE_UTILS_TRACE_H_ */
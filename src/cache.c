@@ -0,0 +1,298 @@
+#include <cache.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_STATS "stats"
+
+struct cache_entry {
+    char name[sizeof(cache_key_t)];
+    off_t sz;
+    struct timespec mtime;
+};
+
+static int cache_mkdirs(char *);
+static int cache_hash_self(cache_key_t *);
+static int cache_copy(int, int);
+static char *cache_path(cache_t *, const char *);
+static void cache_evict(cache_t *);
+static int cache_entry_compar(const void *, const void *);
+static int cache_is_key(const char *);
+static void cache_read_stats(int, uint64_t *, uint64_t *);
+
+int cache_init(cache_t *cache, const char *dir, uint64_t max_sz, FILE *err) {
+    cache->dir = strdup(dir);
+    cache->max_sz = max_sz;
+    cache->hits = cache->misses = 0;
+    if(cache_mkdirs(cache->dir)) {
+        fprintf(err, "[Error] %s: %s\n", dir, strerror(errno));
+        free(cache->dir);
+        return 1;
+    }
+    if(cache_hash_self(&cache->compiler)) {
+        fprintf(err, "[Error] Failed to read the compiler: %s\n",
+                strerror(errno));
+        free(cache->dir);
+        return 1;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    return 0;
+}
+
+void cache_destroy(cache_t *cache) {
+    cache_flush(cache);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->dir);
+}
+
+/* moves the counters of this process to the stats file */
+void cache_flush(cache_t *cache) {
+    char *path = cache_path(cache, CACHE_STATS);
+    int fd;
+    if((cache->hits || cache->misses)
+    && (fd = open(path, O_RDWR | O_CREAT, 0666)) != -1) {
+        if(!lockf(fd, F_LOCK, 0)) {
+            uint64_t hits, misses;
+            cache_read_stats(fd, &hits, &misses);
+            char buf[64];
+            int n = snprintf(buf, sizeof buf, "%"PRIu64" %"PRIu64"\n",
+                             hits + cache->hits, misses + cache->misses);
+            if(ftruncate(fd, 0) || pwrite(fd, buf, n, 0) != n)
+                fprintf(stderr, "[Error] Failed to update cache stats\n");
+            lockf(fd, F_ULOCK, 0);
+        }
+        close(fd);
+        cache->hits = cache->misses = 0;
+    }
+    free(path);
+}
+
+/* 128-bit FNV-1a of the options followed by the source */
+void cache_key(cache_key_t *key, const void *src, size_t sz, const char *opts) {
+    const unsigned __int128 prime = ((unsigned __int128)1 << 88) + 0x13b;
+    unsigned __int128 h = ((unsigned __int128)0x6c62272e07bb0142u << 64)
+                        | 0x62b821756295c58du;
+    /* the terminating null separates the options from the source */
+    for(const char *p = opts;; ++p) {
+        h = (h ^ (unsigned char)*p) * prime;
+        if(!*p) break;
+    }
+    for(size_t i = 0; i < sz; ++i)
+        h = (h ^ ((const unsigned char *)src)[i]) * prime;
+
+    snprintf(key->hex, sizeof key->hex, "%016"PRIx64"%016"PRIx64,
+             (uint64_t)(h >> 64), (uint64_t)h);
+}
+
+/* digest of the executable of the process */
+static int cache_hash_self(cache_key_t *key) {
+    int fd, ret = 1;
+    struct stat st;
+    void *p;
+    if((fd = open("/proc/self/exe", O_RDONLY)) == -1) return 1;
+    if(!fstat(fd, &st)
+    && (p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+       != MAP_FAILED) {
+        cache_key(key, p, st.st_size, "");
+        munmap(p, st.st_size);
+        ret = 0;
+    }
+    close(fd);
+    return ret;
+}
+
+/* copies a cached output to path, returns 0 on a hit */
+int cache_fetch(cache_t *cache, cache_key_t *key, const char *path) {
+    int ret = 1, fd, out;
+    char *entry = cache_path(cache, key->hex);
+    struct stat st;
+    if((fd = open(entry, O_RDONLY)) == -1) goto ret;
+    if(fstat(fd, &st)) goto ret_close;
+
+    if((out = open(path, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777))
+       == -1)
+        goto ret_close;
+    /* an existing file keeps its mode otherwise */
+    if(!fchmod(out, st.st_mode & 0777) && !cache_copy(fd, out)) ret = 0;
+    close(out);
+
+    /* the modification time orders entries for eviction */
+    if(!ret) futimens(fd, NULL);
+ret_close:
+    close(fd);
+ret:
+    free(entry);
+    pthread_mutex_lock(&cache->lock);
+    if(ret) ++cache->misses;
+    else ++cache->hits;
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+
+/* adds the output at path to the cache */
+int cache_store(cache_t *cache, cache_key_t *key, const char *path,
+                FILE *err) {
+    int ret = 1, fd, in;
+    char *tmp = cache_path(cache, "tmp.XXXXXX");
+    char *entry = cache_path(cache, key->hex);
+    struct stat st;
+
+    if((in = open(path, O_RDONLY)) == -1 || fstat(in, &st)) {
+        fprintf(err, "[Error] %s: %s\n", path, strerror(errno));
+        goto ret;
+    }
+    if((fd = mkstemp(tmp)) == -1) {
+        fprintf(err, "[Error] %s: %s\n", tmp, strerror(errno));
+        goto ret;
+    }
+
+    /* entries appear atomically for other jobs and processes */
+    if(fchmod(fd, st.st_mode & 0777) || cache_copy(in, fd)
+    || rename(tmp, entry)) {
+        fprintf(err, "[Error] Failed to add '%s' to the cache\n", path);
+        unlink(tmp);
+    } else ret = 0;
+    close(fd);
+
+    if(!ret) cache_evict(cache);
+ret:
+    if(in != -1) close(in);
+    free(tmp);
+    free(entry);
+    return ret;
+}
+
+void cache_print_stats(cache_t *cache, FILE *f) {
+    uint64_t hits = 0, misses = 0, sz = 0, entries = 0;
+    char *path = cache_path(cache, CACHE_STATS);
+    int fd;
+    if((fd = open(path, O_RDONLY)) != -1) {
+        cache_read_stats(fd, &hits, &misses);
+        close(fd);
+    }
+    free(path);
+
+    DIR *dir;
+    struct dirent *d;
+    if((dir = opendir(cache->dir))) {
+        while((d = readdir(dir))) {
+            struct stat st;
+            if(!cache_is_key(d->d_name)
+            || fstatat(dirfd(dir), d->d_name, &st, 0))
+                continue;
+            ++entries;
+            sz += st.st_size;
+        }
+        closedir(dir);
+    }
+
+    fprintf(f, "Cache directory: %s\n", cache->dir);
+    fprintf(f, "Entries:         %"PRIu64"\n", entries);
+    fprintf(f, "Size:            %"PRIu64" of %"PRIu64" bytes\n",
+            sz, cache->max_sz);
+    fprintf(f, "Hits:            %"PRIu64"\n", hits);
+    fprintf(f, "Misses:          %"PRIu64"\n", misses);
+    if(hits + misses)
+        fprintf(f, "Hit rate:        %.1f%%\n",
+                100.0 * hits / (hits + misses));
+}
+
+/* removes the least recently used entries until the cache fits */
+static void cache_evict(cache_t *cache) {
+    DIR *dir;
+    if(!(dir = opendir(cache->dir))) return;
+
+    struct entries {
+        struct cache_entry *data;
+        size_t sz, capacity;
+    } e = { malloc(sizeof(struct cache_entry) * 64), 0, 64 };
+    uint64_t total = 0;
+    struct dirent *d;
+    while((d = readdir(dir))) {
+        struct stat st;
+        if(!cache_is_key(d->d_name) || fstatat(dirfd(dir), d->d_name, &st, 0))
+            continue;
+        if(e.sz == e.capacity)
+            e.data = realloc(e.data, sizeof *e.data * (e.capacity *= 2));
+        strcpy(e.data[e.sz].name, d->d_name);
+        e.data[e.sz].sz = st.st_size;
+        e.data[e.sz++].mtime = st.st_mtim;
+        total += st.st_size;
+    }
+
+    if(total > cache->max_sz) {
+        qsort(e.data, e.sz, sizeof *e.data, cache_entry_compar);
+        for(size_t i = 0; i < e.sz && total > cache->max_sz; ++i)
+            if(!unlinkat(dirfd(dir), e.data[i].name, 0))
+                total -= e.data[i].sz;
+    }
+    closedir(dir);
+    free(e.data);
+}
+
+/* oldest first */
+static int cache_entry_compar(const void *lv, const void *rv) {
+    const struct cache_entry *l = lv, *r = rv;
+    if(l->mtime.tv_sec != r->mtime.tv_sec)
+        return l->mtime.tv_sec < r->mtime.tv_sec ? -1 : 1;
+    if(l->mtime.tv_nsec != r->mtime.tv_nsec)
+        return l->mtime.tv_nsec < r->mtime.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+static int cache_is_key(const char *name) {
+    size_t i;
+    for(i = 0; name[i]; ++i)
+        if(!((name[i] >= '0' && name[i] <= '9')
+          || (name[i] >= 'a' && name[i] <= 'f')))
+            return 0;
+    return i == sizeof(cache_key_t) - 1;
+}
+
+/* mkdir -p, the path is modified temporarily */
+static int cache_mkdirs(char *path) {
+    for(char *p = path + 1;; ++p) {
+        if(*p && *p != '/') continue;
+        char c = *p;
+        *p = '\0';
+        int r = mkdir(path, 0777);
+        *p = c;
+        if(r && errno != EEXIST) return 1;
+        if(!c) return 0;
+    }
+}
+
+static int cache_copy(int in, int out) {
+    char buf[1 << 16];
+    ssize_t n;
+    while((n = read(in, buf, sizeof buf)) > 0)
+        for(ssize_t off = 0; off < n;) {
+            ssize_t w = write(out, buf + off, n - off);
+            if(w < 0) return 1;
+            off += w;
+        }
+    return n < 0;
+}
+
+static char *cache_path(cache_t *cache, const char *name) {
+    size_t len = strlen(cache->dir);
+    char *path = malloc(len + strlen(name) + 2);
+    memcpy(path, cache->dir, len);
+    path[len] = '/';
+    strcpy(path + len + 1, name);
+    return path;
+}
+
+static void cache_read_stats(int fd, uint64_t *hits, uint64_t *misses) {
+    char buf[64];
+    ssize_t n = pread(fd, buf, sizeof buf - 1, 0);
+    buf[n > 0 ? n : 0] = '\0';
+    *hits = *misses = 0;
+    sscanf(buf, "%"SCNu64" %"SCNu64, hits, misses);
+}
@@ -0,0 +1,46 @@
+#include <command.h>
+#include <errno.h>
+#include <spawn.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* passed on to the programs */
+extern char **environ;
+
+int command_spawn(char *const argv[], int in, pid_t *pid, FILE *err) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if(in != -1) posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    int ret = posix_spawnp(pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(ret) {
+        fprintf(err, "[Error] Failed to run %s: %s\n", argv[0],
+                strerror(ret));
+        return 1;
+    }
+    return 0;
+}
+
+int command_wait(const char *name, pid_t pid, FILE *err) {
+    int status;
+    while(waitpid(pid, &status, 0) == -1)
+        if(errno != EINTR) {
+            fprintf(err, "[Error] waitpid: %s\n", strerror(errno));
+            return 1;
+        }
+    if(WIFEXITED(status) && !WEXITSTATUS(status)) return 0;
+    else if(WIFEXITED(status))
+        fprintf(err, "[Error] %s exited with status %d\n", name,
+                WEXITSTATUS(status));
+    else if(WIFSIGNALED(status))
+        fprintf(err, "[Error] %s was killed by signal %d\n", name,
+                WTERMSIG(status));
+    return 1;
+}
+
+int command_run(char *const argv[], int in, FILE *err) {
+    pid_t pid;
+    return command_spawn(argv, in, &pid, err)
+        || command_wait(argv[0], pid, err);
+}
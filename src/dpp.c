@@ -0,0 +1,144 @@
+#include <dpp.h>
+#include <parser/lexer.h>
+#include <parser/parser.h>
+#include <parser/semantics.h>
+#include <parser/code.h>
+#include <parser/x86.h>
+#include <parser/elf.h>
+#include <utils/buffer.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct dpp {
+    lexer_t lexer;
+    parser_t parser;
+
+    /** object file or executable of the last compilation */
+    buf_t image;
+
+    /** assembly of the last compilation, opened on first use */
+    FILE *asm_f;
+    char *asm_data;
+    size_t asm_sz;
+
+    /** diagnostics of the last compilation, ends with a null byte */
+    FILE *err;
+    char *err_data;
+    size_t err_sz;
+
+    /** points into image or asm_data */
+    const unsigned char *out;
+    size_t out_sz;
+};
+
+static int dpp_generate(dpp_t *, ir_code_t *, enum dpp_output, enum runtime);
+
+dpp_t *dpp_new(void) {
+    dpp_t *dpp = malloc(sizeof(dpp_t));
+    dpp->asm_f = NULL;
+    dpp->asm_data = NULL;
+    dpp->asm_sz = 0;
+    dpp->err_data = NULL;
+    dpp->err_sz = 0;
+    dpp->out = NULL;
+    dpp->out_sz = 0;
+    if(!(dpp->err = open_memstream(&dpp->err_data, &dpp->err_sz))) {
+        free(dpp);
+        return NULL;
+    }
+    buf_init(&dpp->image, 4096);
+    return dpp;
+}
+
+void dpp_free(dpp_t *dpp) {
+    if(dpp->asm_f) fclose(dpp->asm_f);
+    free(dpp->asm_data);
+    fclose(dpp->err);
+    free(dpp->err_data);
+    buf_destroy(&dpp->image);
+    free(dpp);
+}
+
+int dpp_compile(dpp_t *dpp, const char *src, size_t sz,
+                enum dpp_output output, enum dpp_runtime rt) {
+    int ret = 1;
+    enum runtime runtime = rt == DPP_RUNTIME_SYSCALL ? RT_SYSCALL : RT_LIBC;
+
+    /* keep the memory of the streams from earlier compilations */
+    rewind(dpp->err);
+    dpp->out = NULL;
+    dpp->out_sz = 0;
+
+    if(output == DPP_OUTPUT_EXEC && runtime != RT_SYSCALL) {
+        fprintf(dpp->err, "[Error] Executables can only be written without a "
+                "linker for the syscall runtime\n");
+        goto ret;
+    }
+
+    lexer_init(&dpp->lexer, (const unsigned char *)src, sz);
+    parser_init(&dpp->parser, &dpp->lexer);
+    dpp->parser.err = dpp->err;
+
+    ast_node_tu_t *root;
+    if(!(root = parser_parse(&dpp->parser))) goto ret;
+
+    semantics_ctx_t *ctx = semantics_new();
+    ctx->err = dpp->err;
+    /* the context is freed with the tree */
+    if(semantics_analyze(ctx, root)) goto ret_free_tree;
+
+    ir_code_t *code;
+    if(!(code = code_new(root))) goto ret_free_tree;
+    ret = dpp_generate(dpp, code, output, runtime);
+    code_free(code);
+
+ret_free_tree:
+    ast_free((void *)root);
+ret:
+    fputc('\0', dpp->err);
+    fflush(dpp->err);
+    return ret;
+}
+
+static int dpp_generate(dpp_t *dpp, ir_code_t *code, enum dpp_output output,
+                        enum runtime rt) {
+    int ret = 0;
+
+    if(output == DPP_OUTPUT_ASM) {
+        if(dpp->asm_f) rewind(dpp->asm_f);
+        else if(!(dpp->asm_f = open_memstream(&dpp->asm_data, &dpp->asm_sz))) {
+            fprintf(dpp->err, "[Error] Failed to open assembly stream\n");
+            return 1;
+        }
+        if((ret = asm_generate(dpp->asm_f, code, rt))) return ret;
+        fflush(dpp->asm_f);
+        dpp->out = (unsigned char *)dpp->asm_data;
+        dpp->out_sz = dpp->asm_sz;
+        return 0;
+    }
+
+    x86_obj_t *obj;
+    if(!(obj = x86_generate(code, rt))) return 1;
+    if(output == DPP_OUTPUT_EXEC)
+        ret = elf_write_exec(&dpp->image, obj, "_start");
+    else
+        ret = elf_write_obj(&dpp->image, obj);
+    x86_free(obj);
+
+    if(!ret) {
+        dpp->out = dpp->image.data;
+        dpp->out_sz = dpp->image.sz;
+    }
+    return ret;
+}
+
+const unsigned char *dpp_output(dpp_t *dpp, size_t *sz) {
+    *sz = dpp->out_sz;
+    return dpp->out;
+}
+
+const char *dpp_diagnostics(dpp_t *dpp, size_t *sz) {
+    /* without the null byte */
+    if(sz) *sz = dpp->err_sz ? dpp->err_sz - 1 : 0;
+    return dpp->err_data ? dpp->err_data : "";
+}
@@ -0,0 +1,116 @@
+#include <dump.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+    const char *name;
+    enum dump_kind kind;
+} dump_kinds[] = {
+{ "ast", DUMP_AST },
+{ "scopes", DUMP_SCOPES },
+{ "ir", DUMP_IR },
+};
+
+static FILE *dump_open(dump_t *, const char *, const char *, char **, FILE *);
+static int dump_close(FILE *, char *, FILE *);
+
+/* parses a comma separated list of dumps */
+int dump_parse(dump_t *d, const char *spec, FILE *err) {
+    while(*spec) {
+        size_t len = strcspn(spec, ","), i;
+        for(i = 0; i < sizeof dump_kinds / sizeof *dump_kinds; ++i)
+            if(strlen(dump_kinds[i].name) == len
+            && !strncmp(dump_kinds[i].name, spec, len))
+                break;
+        if(i == sizeof dump_kinds / sizeof *dump_kinds) {
+            fprintf(err, "[Error] Unknown dump '%.*s', expected ast, scopes "
+                    "or ir\n", (int)len, spec);
+            return 1;
+        }
+        d->kinds |= dump_kinds[i].kind;
+        spec += len + !!spec[len];
+    }
+    return 0;
+}
+
+int dump_parse_format(dump_t *d, const char *format, FILE *err) {
+    if(!strcmp(format, "text")) d->compact = 0;
+    else if(!strcmp(format, "compact")) d->compact = 1;
+    else {
+        fprintf(err, "[Error] Unknown dump format '%s', expected text or "
+                "compact\n", format);
+        return 1;
+    }
+    return 0;
+}
+
+int dump_ast(dump_t *d, const char *infile, ast_node_tu_t *root, FILE *err) {
+    char *path;
+    FILE *f;
+    if(!(f = dump_open(d, infile, ".ast", &path, err))) return 1;
+    if(d->compact) ast_print_compact((void *)root, f);
+    else ast_print((void *)root, f);
+    return dump_close(f, path, err);
+}
+
+int dump_scopes(dump_t *d, const char *infile, ast_node_tu_t *root,
+                FILE *err) {
+    char *path;
+    FILE *f;
+    if(!(f = dump_open(d, infile, ".scopes", &path, err))) return 1;
+    if(d->compact) semantics_dump_compact(root, f);
+    else semantics_dump_tables(root, f);
+    return dump_close(f, path, err);
+}
+
+int dump_ir(dump_t *d, const char *infile, ir_code_t *code, FILE *err) {
+    char *path;
+    FILE *f;
+    if(!(f = dump_open(d, infile, ".ir", &path, err))) return 1;
+    if(d->compact) code_dump_compact(code, f);
+    else code_dump(code, f);
+    return dump_close(f, path, err);
+}
+
+/* file.dpp is dumped to dir/file.ext, path is NULL for stdout which is made
+ * fully buffered by main */
+static FILE *dump_open(dump_t *d, const char *infile, const char *ext,
+                       char **path, FILE *err) {
+    *path = NULL;
+    if(!d->dir) return stdout;
+
+    const char *base = strrchr(infile, '/');
+    base = base ? base + 1 : infile;
+    size_t len = strlen(base);
+    if(len > 4 && !strcmp(base + len - 4, ".dpp")) len -= 4;
+
+    size_t sz = strlen(d->dir) + len + strlen(ext) + 2;
+    *path = malloc(sz);
+    snprintf(*path, sz, "%s/%.*s%s", d->dir, (int)len, base, ext);
+
+    FILE *f;
+    if(!(f = fopen(*path, "w"))) {
+        fprintf(err, "[Error] %s: %s\n", *path, strerror(errno));
+        free(*path);
+        return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, DUMP_BUF_SZ);
+    return f;
+}
+
+static int dump_close(FILE *f, char *path, FILE *err) {
+    int ret = 0;
+    if(!path) {
+        /* the program run by -r or -i writes to stdout as well */
+        if(fflush(f)) ret = 1;
+    } else {
+        ret = ferror(f);
+        if(fclose(f)) ret = 1;
+    }
+    if(ret)
+        fprintf(err, "[Error] Failed to write dump to %s\n",
+                path ? path : "standard output");
+    free(path);
+    return ret;
+}
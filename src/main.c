@@ -1,58 +1,427 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include <parser/token.h>
 #include <parser/lexer.h>
 #include <parser/parser.h>
 #include <parser/semantics.h>
 #include <parser/code.h>
+#include <parser/x86.h>
+#include <parser/elf.h>
+#include <parser/jit.h>
+#include <parser/interp.h>
+#include <parser/metrics.h>
+#include <parser/incr.h>
+#include <parser/fnstream.h>
+#include <server.h>
+#include <command.h>
+#include <cache.h>
+#include <report.h>
+#include <dump.h>
+#include <utils/alloc.h>
+#include <utils/trace.h>
 
 #define MAX(a, b) ((a)>(b)?(a):(b))
+#define MIN(a, b) ((a)<(b)?(a):(b))
 
 #define PROGRAM_NAME "compiler"
 
 const char *help_str = ""
-"Usage: "PROGRAM_NAME" [option]... infile\n"
+"Usage: "PROGRAM_NAME" [option]... infile...\n"
+"       "PROGRAM_NAME" -r|-i infile\n"
+"       "PROGRAM_NAME" [-s] [-n] [-o outfile] module.o...\n"
+"       "PROGRAM_NAME" --server socket\n"
 "\n"
 "  -h            print this help message\n"
-"  -c            only transpile to assembly\n"
+"  -S            only compile to assembly\n"
+"  -c            only compile to an object file\n"
+"  -n            assemble with NASM instead of the built-in encoder\n"
+"  -s            freestanding static executable without libc\n"
+"  -r            compile in memory and run the program\n"
+"  -i            run the program with the interpreter\n"
 "  -o outfile    output program to outfile\n"
 "  -a file       output assembly to file\n"
+"  -j jobs       compile up to jobs input files at the same time, and run\n"
+"                up to jobs assemblers with --split-asm\n"
+"  -ftime-report[=json]\n"
+"                print the time spent in each phase and the amount of\n"
+"                source, tokens, nodes and code processed, as a table\n"
+"                or as JSON\n"
+"  -fmem-report[=json]\n"
+"                print the allocations, live and peak bytes of each phase\n"
+"                and each kind of data, as a table or as JSON\n"
+"  -fcodegen-report[=json]\n"
+"                print the machine instructions, pushes, pops and memory\n"
+"                operands of each function, with -i also the instructions\n"
+"                it executes and the calls it makes and gets\n"
+"  --server socket\n"
+"                serve compile requests on a Unix domain socket\n"
+"  --client socket\n"
+"                compile using the server listening on socket\n"
+"  --cache-dir dir\n"
+"                copy outputs of unchanged files from a cache in dir,\n"
+"                also enabled by setting DPP_CACHE_DIR\n"
+"  --cache-size size\n"
+"                evict least recently used entries above size bytes\n"
+"                (suffixes K, M and G, default 256M)\n"
+"  --cache-stats print statistics of the cache\n"
+"  --watch       compile again whenever infile changes, only the functions\n"
+"                that changed are compiled again\n"
+"  --split-asm   with -n assemble the runtime and each function separately\n"
+"                and at the same time, then link the objects\n"
+"  --module      compile to an object without the runtime, whose functions\n"
+"                can be called from other modules declaring them with\n"
+"                extern fn, and link the objects with the second form\n"
+"  --stream      compile one function at a time, so only the largest\n"
+"                function has to fit in memory\n"
+"  --via-c       lower the program to C and compile it with gcc -O2, -S\n"
+"                and -a write the C instead of assembly\n"
+"  --trace file  write the time spent in each phase and on each function\n"
+"                to file in the Chrome trace-event format\n"
+"  --dump=kinds  print the comma separated dumps ast, scopes and ir\n"
+"  --dump-dir dir\n"
+"                write the dumps of file.dpp to dir/file.ast, file.scopes\n"
+"                and file.ir instead of standard output\n"
+"  --dump-format=text|compact\n"
+"                indented dumps, or one record per line for tools\n"
+"\n"
+"An infile of - reads the program from standard input.\n"
+"With several input files the output of file.dpp is written to file, file.o\n"
+"or file.asm and -o and -a can not be used.\n"
 ;
 
+enum output {
+OUTPUT_EXEC,
+OUTPUT_OBJ,
+OUTPUT_ASM,
+OUTPUT_RUN,
+OUTPUT_INTERP,
+};
+
 struct options {
-    char *infile, *outfile, *asmfile;
-    int compile, saveasm;
-} options;
+    char *outfile, *asmfile;
+    /** Unix domain socket to serve on or compile with */
+    char *server, *client;
+    enum output output;
+    enum runtime runtime;
+    int nasm;
+    /** assemble each function with a NASM of its own */
+    int split_asm;
+    /** parse, analyze and lower one function at a time */
+    int stream;
+    /** compile to an object without the runtime, to be linked with others */
+    int module;
+    /** lower to C and compile it with gcc instead of generating machine
+     * code */
+    int via_c;
+    /** maximum number of files compiled at the same time */
+    long jobs;
+    /** NULL if caching is disabled */
+    cache_t *cache;
+    /** NULL unless -ftime-report or -fmem-report is given */
+    report_t *report;
+    /** -fcodegen-report, and whether as JSON */
+    int codegen_report, codegen_json;
+    /** file the trace is written to, NULL if not tracing */
+    char *trace;
+    dump_t dump;
+};
 
-int main(int argc, char *argv[]) {
-    int ret = EXIT_SUCCESS;
+/* compilation of one of several input files */
+struct job {
+    const char *infile;
+    char *outfile;
+    /** diagnostics, printed in the order of the input files */
+    char *err_data;
+    size_t err_sz;
+    int ret, done;
+};
+
+/* an input file, mapped if it is a regular file and read while it is lexed
+ * if it is a pipe which does not have to be kept */
+struct source {
+    /** whole input, unless it is streamed */
+    buf_t buf;
+    /** buf is a mapping of the file */
+    int mapped;
+    /** descriptor it is streamed from, -1 if it is not */
+    int fd;
+};
+
+/* state of stream_read */
+struct stream {
+    int fd;
+    /** bytes read so far */
+    size_t sz;
+    int error;
+    const char *path;
+    FILE *err;
+};
 
-    options = (struct options){
-        .outfile = "./a.out",
+struct batch {
+    struct options *options;
+    struct job *jobs;
+    size_t num_jobs;
+    /** next job to start */
+    size_t next;
+    pthread_mutex_t lock;
+    /** signaled when a job is done */
+    pthread_cond_t cond;
+};
+
+static int compile_file(struct options *, const char *, const char *, FILE *);
+static int compile_src(struct options *, const char *, struct source *,
+                       const char *, FILE *);
+static int compile_stream(struct options *, struct source *, const char *,
+                          FILE *);
+static int generate(struct options *, ir_code_t *, x86_obj_t *, const char *,
+                    FILE *);
+static int codegen_report(struct options *, ir_code_t *, FILE *);
+static int link_exec(struct options *, const char *, const char *, FILE *);
+static int run_link(struct options *, char **, size_t);
+static int write_runtime(struct options *, const char *, FILE *);
+static int is_object(const char *);
+static void cache_key_for(cache_key_t *, struct options *, buf_t *,
+                          enum output);
+static int run_batch(struct options *, char **, size_t);
+static void *batch_worker(void *);
+static char *batch_outfile(struct options *, const char *);
+static int run_watch(struct options *, const char *);
+static int watch_build(struct options *, incr_t *, const char *);
+static int watch_wait(int, const char *);
+
+static int read_source(const char *, struct source *, int, FILE *);
+static void source_destroy(struct source *);
+static size_t stream_read(void *, unsigned char *, size_t);
+static int write_asm(struct options *, const char *, ir_code_t *, FILE *);
+static int write_asm_stream(struct options *, FILE *, ir_code_t *, FILE *);
+static int write_obj(struct options *, const char *, ir_code_t *, x86_obj_t *,
+                     int, FILE *);
+static int generate_c(struct options *, ir_code_t *, const char *, FILE *);
+static int write_c(struct options *, FILE *, ir_code_t *, FILE *);
+static int generate_split(struct options *, ir_code_t *, const char *,
+                          FILE *);
+static int run_command(struct options *, enum report_phase, char *const [],
+                       int, FILE *);
+static int write_trace(const char *);
+static int write_file(const char *, buf_t *, mode_t, FILE *);
+static int run_client(struct options *, const char *, buf_t *, FILE *);
+static int make_temp(char *, FILE *);
+
+int main(int argc, char *argv[]) {
+    struct options options = {
+        .outfile = NULL,
         .asmfile = NULL,
-        .compile = 1,
-        .saveasm = 0,
+        .server = NULL,
+        .client = NULL,
+        .output = OUTPUT_EXEC,
+        .runtime = RT_LIBC,
+        .nasm = 0,
+        .split_asm = 0,
+        .stream = 0,
+        .module = 0,
+        .via_c = 0,
+        .jobs = 1,
+        .cache = NULL,
+        .report = NULL,
+        .codegen_report = 0,
+        .codegen_json = 0,
+        .trace = NULL,
+        .dump = { .kinds = 0, .compact = 0, .dir = NULL },
+    };
+    char *cache_dir = getenv("DPP_CACHE_DIR");
+    uint64_t cache_max_sz = CACHE_DEFAULT_MAX_SZ;
+    int cache_stats = 0, watch = 0;
+    report_t report;
+
+    enum {
+    OPT_SERVER = 256,
+    OPT_CLIENT,
+    OPT_CACHE_DIR,
+    OPT_CACHE_SIZE,
+    OPT_CACHE_STATS,
+    OPT_WATCH,
+    OPT_TRACE,
+    OPT_DUMP,
+    OPT_DUMP_DIR,
+    OPT_DUMP_FORMAT,
+    OPT_SPLIT_ASM,
+    OPT_STREAM,
+    OPT_MODULE,
+    OPT_VIA_C,
+    };
+    static const struct option long_options[] = {
+        {"server", required_argument, NULL, OPT_SERVER},
+        {"client", required_argument, NULL, OPT_CLIENT},
+        {"cache-dir", required_argument, NULL, OPT_CACHE_DIR},
+        {"cache-size", required_argument, NULL, OPT_CACHE_SIZE},
+        {"cache-stats", no_argument, NULL, OPT_CACHE_STATS},
+        {"watch", no_argument, NULL, OPT_WATCH},
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {"dump", required_argument, NULL, OPT_DUMP},
+        {"dump-dir", required_argument, NULL, OPT_DUMP_DIR},
+        {"dump-format", required_argument, NULL, OPT_DUMP_FORMAT},
+        {"split-asm", no_argument, NULL, OPT_SPLIT_ASM},
+        {"stream", no_argument, NULL, OPT_STREAM},
+        {"module", no_argument, NULL, OPT_MODULE},
+        {"via-c", no_argument, NULL, OPT_VIA_C},
+        {0},
     };
 
     int c;
-    while((c = getopt(argc, argv, "hco:a:")) != -1) {
+    while((c = getopt_long(argc, argv, "hScnsrio:a:j:f:", long_options, NULL))
+          != -1) {
         switch(c) {
+        case OPT_SERVER:
+            options.server = optarg;
+            break;
+
+        case OPT_CLIENT:
+            options.client = optarg;
+            break;
+
+        case OPT_CACHE_DIR:
+            cache_dir = optarg;
+            break;
+
+        case OPT_CACHE_SIZE: {
+            char *end;
+            cache_max_sz = strtoull(optarg, &end, 10);
+            switch(*end) {
+            case 'G': cache_max_sz <<= 10; __attribute__((fallthrough));
+            case 'M': cache_max_sz <<= 10; __attribute__((fallthrough));
+            case 'K': cache_max_sz <<= 10; ++end; break;
+            }
+            if(*end || end == optarg) {
+                fprintf(stderr, "[Error] Invalid cache size '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+
+        case OPT_CACHE_STATS:
+            cache_stats = 1;
+            break;
+
+        case OPT_WATCH:
+            watch = 1;
+            break;
+
+        case OPT_TRACE:
+            options.trace = optarg;
+            break;
+
+        case OPT_DUMP:
+            if(dump_parse(&options.dump, optarg, stderr)) exit(EXIT_FAILURE);
+            break;
+
+        case OPT_DUMP_DIR:
+            options.dump.dir = optarg;
+            break;
+
+        case OPT_DUMP_FORMAT:
+            if(dump_parse_format(&options.dump, optarg, stderr))
+                exit(EXIT_FAILURE);
+            break;
+
+        case OPT_SPLIT_ASM:
+            options.split_asm = 1;
+            break;
+
+        case OPT_STREAM:
+            options.stream = 1;
+            break;
+
+        case OPT_MODULE:
+            options.module = 1;
+            break;
+
+        case OPT_VIA_C:
+            options.via_c = 1;
+            break;
+
         case 'o':
             options.outfile = optarg;
             break;
 
+        case 'S':
+            options.output = OUTPUT_ASM;
+            break;
+
         case 'c':
-            options.compile = 0;
+            options.output = OUTPUT_OBJ;
+            break;
+
+        case 'n':
+            options.nasm = 1;
+            break;
+
+        case 's':
+            options.runtime = RT_SYSCALL;
+            break;
+
+        case 'r':
+            options.output = OUTPUT_RUN;
+            break;
+
+        case 'i':
+            options.output = OUTPUT_INTERP;
             break;
 
         case 'a':
             options.asmfile = optarg;
-            options.saveasm = 1;
             break;
 
+        case 'j': {
+            char *end;
+            if((options.jobs = strtol(optarg, &end, 10)) < 1 || *end
+            || end == optarg) {
+                fprintf(stderr, "[Error] Invalid number of jobs '%s'\n",
+                        optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+
+        case 'f': {
+            size_t len = strcspn(optarg, "=");
+            int *which = NULL;
+            if(len == 11 && !strncmp(optarg, "time-report", len))
+                which = &report.show_time;
+            else if(len == 10 && !strncmp(optarg, "mem-report", len))
+                which = &report.show_mem;
+            else if(len == 14 && !strncmp(optarg, "codegen-report", len))
+                which = &options.codegen_report;
+            if(!which || (optarg[len] && strcmp(optarg + len, "=json"))) {
+                fprintf(stderr, "[Error] Unknown option '-f%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            /* printed with each file rather than at the end */
+            if(which == &options.codegen_report) {
+                options.codegen_report = 1;
+                options.codegen_json = optarg[len] != '\0';
+                break;
+            }
+            if(!options.report) report_init(options.report = &report);
+            if(optarg[len]) report.json = 1;
+            *which = 1;
+            /* before anything is allocated */
+            if(report.show_mem) alloc_track();
+            break;
+        }
+
         default:
             fprintf(stderr, "%s", help_str);
             exit(EXIT_FAILURE);
@@ -60,102 +429,1204 @@ int main(int argc, char *argv[]) {
     }
     argc -= optind, argv += optind;
 
+    if(options.server)
+        exit(server_run(options.server) ? EXIT_FAILURE : EXIT_SUCCESS);
+    if(options.trace) trace_enable();
+
+    cache_t cache;
+    if(cache_dir && *cache_dir) {
+        if(cache_init(&cache, cache_dir, cache_max_sz, stderr))
+            exit(EXIT_FAILURE);
+        options.cache = &cache;
+    }
+    if(cache_stats) {
+        if(!options.cache) {
+            fprintf(stderr, "[Error] No cache directory given\n");
+            exit(EXIT_FAILURE);
+        }
+        if(argc < 1) {
+            cache_print_stats(options.cache, stdout);
+            cache_destroy(options.cache);
+            exit(EXIT_SUCCESS);
+        }
+    }
+
     if(argc < 1) {
         fprintf(stderr, "%s", help_str);
         exit(EXIT_FAILURE);
     }
-    options.infile = argv[0];
 
-    FILE *f;
-    if(!(f = fopen(options.infile, "r"))) {
-        perror("fopen");
+    if(options.split_asm && !options.nasm) {
+        fprintf(stderr, "[Error] --split-asm can only be used with -n\n");
         exit(EXIT_FAILURE);
     }
 
-    fseek(f, 0, SEEK_END);
-    size_t sz = ftell(f);
-    rewind(f);
-    unsigned char *buf = malloc(sz);
-    if(fread(buf, 1, sz, f) != sz) {
-        fprintf(stderr, "Failed to read entire file\n");
-        fclose(f);
-        ret = EXIT_FAILURE;
-        goto ret_free;
+    if(options.module) {
+        if(options.stream || options.split_asm || watch || options.client
+        || options.output == OUTPUT_RUN || options.output == OUTPUT_INTERP) {
+            fprintf(stderr, "[Error] --module can not be used with -r, -i, "
+                    "--client, --watch, --split-asm or --stream\n");
+            exit(EXIT_FAILURE);
+        }
+        /* the runtime is added when the modules are linked */
+        if(options.output == OUTPUT_EXEC) options.output = OUTPUT_OBJ;
+        options.runtime = RT_NONE;
     }
-    fclose(f);
 
-    lexer_t *lexer = lexer_new(buf, sz - 1);
-    parser_t *parser = parser_new(lexer);
-    ast_node_tu_t *root = parser_parse(parser);
+    if(options.via_c && (options.nasm || options.module || options.stream
+                      || options.split_asm || options.client
+                      || options.runtime == RT_SYSCALL
+                      || options.output == OUTPUT_RUN
+                      || options.output == OUTPUT_INTERP)) {
+        fprintf(stderr, "[Error] --via-c can not be used with -n, -s, -r, -i, "
+                "--client, --split-asm, --module or --stream\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(options.stream && (options.split_asm || options.dump.kinds || watch
+                       || options.client || options.output == OUTPUT_RUN
+                       || options.output == OUTPUT_INTERP)) {
+        fprintf(stderr, "[Error] --stream can not be used with -r, -i, "
+                "--client, --watch, --split-asm or --dump\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(options.codegen_report && (options.stream || options.client)) {
+        fprintf(stderr, "[Error] -fcodegen-report can not be used with "
+                "--client or --stream\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(options.dump.kinds) {
+        if(watch) {
+            fprintf(stderr, "[Error] --dump can not be used with --watch\n");
+            exit(EXIT_FAILURE);
+        }
+        if(argc > 1 && !options.dump.dir) {
+            fprintf(stderr, "[Error] --dump needs --dump-dir with several "
+                    "input files\n");
+            exit(EXIT_FAILURE);
+        }
+        if(!options.dump.dir) setvbuf(stdout, NULL, _IOFBF, DUMP_BUF_SZ);
+    }
+
+    if(watch && !strcmp(argv[0], "-")) {
+        fprintf(stderr, "[Error] Standard input can not be watched\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t num_objects = 0;
+    for(int i = 0; i < argc; ++i) num_objects += is_object(argv[i]);
+
+    int ret;
+    if(num_objects) {
+        if(num_objects != (size_t)argc || options.output != OUTPUT_EXEC
+        || options.asmfile || watch || options.client || options.split_asm
+        || options.stream || options.dump.kinds) {
+            fprintf(stderr, "[Error] Objects can only be linked on their own, "
+                    "with -s, -n and -o\n");
+            exit(EXIT_FAILURE);
+        }
+        if(!options.outfile) options.outfile = "./a.out";
+        ret = run_link(&options, argv, argc);
+    } else if(argc > 1) {
+        if(options.outfile || options.asmfile || watch
+        || options.output == OUTPUT_RUN || options.output == OUTPUT_INTERP) {
+            fprintf(stderr, "[Error] -o, -a, -r, -i and --watch can only be "
+                    "used with a single input file\n");
+            exit(EXIT_FAILURE);
+        }
+        ret = run_batch(&options, argv, argc);
+    } else {
+        if(!options.outfile)
+            options.outfile = options.output == OUTPUT_ASM
+                            ? options.via_c ? "./a.c" : "./a.asm"
+                            : options.output == OUTPUT_OBJ ? "./a.o"
+                            : "./a.out";
+        if(watch) ret = run_watch(&options, argv[0]);
+        else ret = compile_file(&options, argv[0], options.outfile, stderr);
+    }
+
+    /* the batch sums the times of all jobs, wall is the elapsed time */
+    if(options.report) {
+        report_print(options.report, stderr);
+        report_destroy(options.report);
+    }
+    if(options.trace && write_trace(options.trace)) ret = EXIT_FAILURE;
+
+    if(options.cache) {
+        if(cache_stats) {
+            cache_flush(options.cache);
+            cache_print_stats(options.cache, stdout);
+        }
+        cache_destroy(options.cache);
+    }
+    exit(ret);
+}
+
+/* compiles a file and returns the exit status of the compiler, or of the
+ * program when it is run */
+static int compile_file(struct options *o, const char *infile,
+                        const char *outfile, FILE *err) {
+    int ret;
+    struct source src;
+    uint64_t trace_start = trace_begin();
+    double start = report_begin(o->report, REPORT_READ);
+    /* the cache, the server and --stream need all of the source at once */
+    if(read_source(infile, &src, !o->cache && !o->client && !o->stream, err))
+        return EXIT_FAILURE;
+    report_time(o->report, REPORT_READ, start);
+
+    /* outputs of unchanged files are copied from the cache */
+    cache_key_t key, asm_key;
+    /* a hit skips the compilation, so nothing would be dumped or
+     * reported */
+    int cached = o->cache && o->output != OUTPUT_RUN
+              && o->output != OUTPUT_INTERP && !o->dump.kinds
+              && !o->codegen_report;
+    if(cached) {
+        cache_key_for(&key, o, &src.buf, o->output);
+        if(o->asmfile) cache_key_for(&asm_key, o, &src.buf, OUTPUT_ASM);
+        if(!cache_fetch(o->cache, &key, outfile)
+        && (!o->asmfile || !cache_fetch(o->cache, &asm_key, o->asmfile))) {
+            ret = EXIT_SUCCESS;
+            goto ret_free;
+        }
+    }
+
+    if(o->client)
+        ret = run_client(o, outfile, &src.buf, err)
+            ? EXIT_FAILURE : EXIT_SUCCESS;
+    else ret = compile_src(o, infile, &src, outfile, err);
+
+    if(cached && ret == EXIT_SUCCESS) {
+        cache_store(o->cache, &key, outfile, err);
+        if(o->asmfile) cache_store(o->cache, &asm_key, o->asmfile, err);
+    }
+
+ret_free:
+    source_destroy(&src);
+    trace_end("file", infile, strlen(infile), trace_start);
+    return ret;
+}
+
+/* hashes everything which affects the output */
+static void cache_key_for(cache_key_t *key, struct options *o, buf_t *src,
+                          enum output output) {
+    char opts[128];
+    snprintf(opts, sizeof opts, DPP_VERSION " %s output=%d runtime=%d nasm=%d "
+             "via_c=%d stream=%d module=%d", o->cache->compiler.hex, output,
+             o->runtime, o->nasm, o->via_c, o->stream, o->module);
+    cache_key(key, src->data, src->sz, opts);
+}
+
+/* infile only names the dumps */
+static int compile_src(struct options *o, const char *infile,
+                       struct source *src, const char *outfile, FILE *err) {
+    if(o->stream) return compile_stream(o, src, outfile, err);
+
+    int ret = EXIT_FAILURE;
+    lexer_t lexer;
+    parser_t parser;
+    struct stream stream = {
+    .fd = src->fd,
+    .sz = 0,
+    .error = 0,
+    .path = infile,
+    .err = err,
+    };
+    if(src->fd != -1) lexer_init_stream(&lexer, stream_read, &stream);
+    else lexer_init(&lexer, src->buf.data, src->buf.sz);
+    parser_init(&parser, &lexer);
+    parser.err = err;
+
+    ast_node_tu_t *root;
     ir_code_t *code;
-    if(!parser->error) ast_print((void *)root);
-    else goto ret_free_parser;
-
-    semantics_analyze(semantics_new(), (void *)root);
-    if(!root->ctx->error) putchar('\n'), semantics_dump_tables((void *)root);
-    else goto ret_free_parser;
-
-    code = code_new(root);
-    if(code) puts("\nCode:"), code_dump(code);
-    else goto ret_free_parser;
-
-    char asm_path[] = P_tmpdir "/dpp_XXXXXX";
-    if(!options.asmfile) {
-        int fd;
-        if((fd = mkstemp(asm_path)) == -1) {
-            perror("mkstemp");
+    /* a streamed source is read while it is parsed */
+    double start = report_begin(o->report, REPORT_PARSE);
+    root = parser_parse(&parser);
+    lexer_destroy(&lexer);
+    if(!root) return EXIT_FAILURE;
+    if(stream.error) {
+        ast_free((void *)root);
+        return EXIT_FAILURE;
+    }
+    report_time(o->report, REPORT_PARSE, start);
+    if(o->report) {
+        report_count(o->report, REPORT_SRC_BYTES,
+                     src->fd != -1 ? stream.sz : src->buf.sz);
+        report_count(o->report, REPORT_TOKENS, lexer.num_tokens);
+        report_count(o->report, REPORT_AST_NODES, ast_count((void *)root));
+    }
+    if((o->dump.kinds & DUMP_AST) && dump_ast(&o->dump, infile, root, err))
+        goto ret_free_tree;
+
+    semantics_ctx_t *ctx = semantics_new();
+    ctx->err = err;
+    ctx->module = o->module;
+    /* the context is freed with the tree */
+    start = report_begin(o->report, REPORT_SEMANTICS);
+    if(semantics_analyze(ctx, root)) goto ret_free_tree;
+    report_time(o->report, REPORT_SEMANTICS, start);
+    report_count(o->report, REPORT_SCOPES, ctx->num_scopes);
+    report_count(o->report, REPORT_VARIABLES, ctx->num_variables);
+    if((o->dump.kinds & DUMP_SCOPES)
+    && dump_scopes(&o->dump, infile, root, err))
+        goto ret_free_tree;
+
+    start = report_begin(o->report, REPORT_CODE);
+    if(!(code = code_new(root))) goto ret_free_tree;
+    report_time(o->report, REPORT_CODE, start);
+    report_count(o->report, REPORT_IR_INSTRS, code->instructions->sz);
+    if(!(o->dump.kinds & DUMP_IR) || !dump_ir(&o->dump, infile, code, err))
+        ret = generate(o, code, NULL, outfile, err);
+    start = report_begin(o->report, REPORT_FREE);
+    code_free(code);
+    report_time(o->report, REPORT_FREE, start);
+
+ret_free_tree:
+    start = report_begin(o->report, REPORT_FREE);
+    ast_free((void *)root);
+    report_time(o->report, REPORT_FREE, start);
+    return ret;
+}
+
+/* writes the assembly and generates the machine code of each function as it
+ * is lowered, so the tree and IR of only one function are kept */
+static int compile_stream(struct options *o, struct source *src,
+                          const char *outfile, FILE *err) {
+    int ret = EXIT_FAILURE;
+    /* out is the assembly output, or the input of NASM */
+    FILE *asm_f = NULL, *out_f = NULL;
+    x86_obj_t *obj = NULL;
+    char tmp_path[] = P_tmpdir "/dpp_XXXXXX";
+    const char *obj_path = tmp_path;
+
+    fnstream_t *s = fnstream_new(src->buf.data, src->buf.sz, err);
+    if(o->asmfile && !(asm_f = fopen(o->asmfile, "w"))) {
+        fprintf(err, "[Error] %s: %s\n", o->asmfile, strerror(errno));
+        goto ret_free;
+    }
+    if(o->output == OUTPUT_ASM) {
+        if(!(out_f = fopen(outfile, "w"))) {
+            fprintf(err, "[Error] %s: %s\n", outfile, strerror(errno));
+            goto ret_free;
+        }
+    } else if(o->nasm) {
+        if(!(out_f = tmpfile())) {
+            fprintf(err, "[Error] tmpfile: %s\n", strerror(errno));
+            goto ret_free;
+        }
+    } else obj = x86_link_begin(s->ctx, 4096);
+    if((asm_f && asm_generate_begin(asm_f, o->runtime))
+    || (out_f && asm_generate_begin(out_f, o->runtime)))
+        goto ret_free;
+
+    for(;;) {
+        double start = report_begin(o->report, REPORT_PARSE);
+        if(!fnstream_next(s)) break;
+        report_time(o->report, REPORT_PARSE, start);
+        report_count(o->report, REPORT_AST_NODES, ast_count((void *)s->fn));
+
+        start = report_begin(o->report, REPORT_SEMANTICS);
+        if(fnstream_analyze(s)) goto ret_free;
+        report_time(o->report, REPORT_SEMANTICS, start);
+
+        start = report_begin(o->report, REPORT_CODE);
+        if(fnstream_generate(s)) goto ret_free;
+        report_time(o->report, REPORT_CODE, start);
+        report_count(o->report, REPORT_IR_INSTRS, s->code.instructions->sz);
+
+        start = report_begin(o->report, REPORT_ASM);
+        if((asm_f && asm_generate_code(asm_f, &s->code))
+        || (out_f && asm_generate_code(out_f, &s->code)))
+            goto ret_free;
+        report_time(o->report, REPORT_ASM, start);
+
+        /* only the object is kept, not the code of every function */
+        if(obj) {
+            vec_t *ins = s->code.instructions;
+            x86_fn_t *fn;
+            start = report_begin(o->report, REPORT_X86);
+            if(!(fn = x86_generate_fn((ir_instr_t **)ins->items, ins->sz,
+                                      err))) {
+                fprintf(err, "[Error] Failed to generate machine code\n");
+                goto ret_free;
+            }
+            x86_link_fn(obj, s->ctx, fn, o->runtime);
+            x86_fn_free(fn);
+            report_time(o->report, REPORT_X86, start);
+        }
+    }
+    if(s->parser.error || s->ctx->error) goto ret_free;
+    if(o->report) {
+        report_count(o->report, REPORT_SRC_BYTES, src->buf.sz);
+        report_count(o->report, REPORT_TOKENS, s->lexer.num_tokens);
+        report_count(o->report, REPORT_SCOPES, s->ctx->num_scopes);
+        report_count(o->report, REPORT_VARIABLES, s->ctx->num_variables);
+    }
+
+    if((asm_f && asm_generate_end(asm_f, &s->code, o->runtime))
+    || (out_f && asm_generate_end(out_f, &s->code, o->runtime)))
+        goto ret_free;
+    if(out_f) report_count(o->report, REPORT_ASM_BYTES, ftell(out_f));
+    if(asm_f) {
+        int fail = fclose(asm_f);
+        asm_f = NULL;
+        if(fail) {
+            fprintf(err, "[Error] %s: %s\n", o->asmfile, strerror(errno));
+            goto ret_free;
+        }
+    }
+
+    if(o->output == OUTPUT_ASM) {
+        int fail = fclose(out_f);
+        out_f = NULL;
+        if(fail) fprintf(err, "[Error] %s: %s\n", outfile, strerror(errno));
+        else ret = EXIT_SUCCESS;
+        goto ret_free;
+    }
+
+    if(obj) {
+        double start = report_begin(o->report, REPORT_X86);
+        if(x86_link_end(obj, s->ctx, o->runtime)) {
+            fprintf(err, "[Error] Failed to generate machine code\n");
+            goto ret_free;
+        }
+        report_time(o->report, REPORT_X86, start);
+
+        /* a freestanding executable needs no linker */
+        if(o->output == OUTPUT_EXEC && o->runtime == RT_SYSCALL) {
+            if(!write_obj(o, outfile, NULL, obj, 1, err)) ret = EXIT_SUCCESS;
+            goto ret_free;
+        }
+    }
+
+    if(o->output == OUTPUT_OBJ) obj_path = outfile;
+    else if(make_temp(tmp_path, err)) goto ret_free;
+
+    int fail;
+    if(out_f) {
+        char *argv[] = {
+            "nasm", "-felf64", "-o", (char *)obj_path, "/dev/stdin", NULL
+        };
+        if((fail = fflush(out_f)))
+            fprintf(err, "[Error] Failed to write assembly: %s\n",
+                    strerror(errno));
+        rewind(out_f);
+        fail = fail || run_command(o, REPORT_NASM, argv, fileno(out_f), err);
+    } else fail = write_obj(o, obj_path, NULL, obj, 0, err);
+
+    if(!fail && (o->output == OUTPUT_OBJ || !link_exec(o, obj_path, outfile,
+                                                       err)))
+        ret = EXIT_SUCCESS;
+    if(o->output != OUTPUT_OBJ) unlink(obj_path);
+
+ret_free:
+    if(asm_f) fclose(asm_f);
+    if(out_f) fclose(out_f);
+    /* the assembly is written before all of the program is checked */
+    if(ret != EXIT_SUCCESS) {
+        if(o->asmfile) unlink(o->asmfile);
+        if(o->output == OUTPUT_ASM) unlink(outfile);
+    }
+    if(obj) x86_free(obj);
+    double start = report_begin(o->report, REPORT_FREE);
+    fnstream_free(s);
+    report_time(o->report, REPORT_FREE, start);
+    return ret;
+}
+
+/* obj is the machine code of the program if it is already generated */
+static int generate(struct options *o, ir_code_t *code, x86_obj_t *obj,
+                    const char *outfile, FILE *err) {
+    int ret = EXIT_SUCCESS;
+
+    /* -i reports after the counted run */
+    if(o->codegen_report && o->output != OUTPUT_INTERP
+    && codegen_report(o, code, err))
+        return EXIT_FAILURE;
+
+    if(o->via_c) return generate_c(o, code, outfile, err);
+
+    if(o->asmfile && write_asm(o, o->asmfile, code, err))
+        return EXIT_FAILURE;
+
+    if(o->output == OUTPUT_RUN) {
+        double start = report_begin(o->report, REPORT_X86);
+        jit_t *jit;
+        if(!(jit = jit_new(code))) {
+            fprintf(err, "[Error] Failed to generate machine code\n");
+            return EXIT_FAILURE;
+        }
+        report_time(o->report, REPORT_X86, start);
+        report_count(o->report, REPORT_TEXT_BYTES, jit->sz);
+        /* exit with the return value of main like a compiled program */
+        start = report_begin(o->report, REPORT_RUN);
+        ret = jit_run(jit) & 0xff;
+        report_time(o->report, REPORT_RUN, start);
+        jit_free(jit);
+        return ret;
+    }
+
+    if(o->output == OUTPUT_INTERP) {
+        double start = report_begin(o->report, REPORT_RUN);
+        interp_t *it;
+        metrics_t *m = NULL;
+        int64_t result;
+        if(!(it = interp_new(code))) return EXIT_FAILURE;
+        if(o->codegen_report && !(m = metrics_new(code))) ret = EXIT_FAILURE;
+        else if(m ? metrics_run(m, it, &result) : interp_run(it, &result))
             ret = EXIT_FAILURE;
-            goto ret_free_code;
+        else ret = result & 0xff;
+        report_time(o->report, REPORT_RUN, start);
+        if(m) {
+            if(o->codegen_json) metrics_json(m, err);
+            else metrics_print(m, err);
+            metrics_free(m);
         }
-        if(!(f = fdopen(fd, "w"))) {
-            perror("fdopen");
+        interp_free(it);
+        return ret;
+    }
+
+    /* a freestanding executable needs no linker */
+    if(o->output == OUTPUT_EXEC && o->runtime == RT_SYSCALL && !o->nasm)
+        return write_obj(o, outfile, code, obj, 1, err)
+             ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    if(o->output == OUTPUT_ASM)
+        return write_asm(o, outfile, code, err)
+             ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    if(o->split_asm)
+        return generate_split(o, code, outfile, err)
+             ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    char tmp_path[] = P_tmpdir "/dpp_XXXXXX";
+    const char *obj_path = tmp_path;
+    if(o->output == OUTPUT_OBJ) obj_path = outfile;
+    else if(make_temp(tmp_path, err)) return EXIT_FAILURE;
+
+    if(o->nasm) {
+        /* assemble the text output with NASM, which reads its input again
+         * on every pass so it gets an unlinked file as /dev/stdin instead
+         * of a pipe */
+        FILE *f;
+        char *argv[] = {
+            "nasm", "-felf64", "-o", (char *)obj_path, "/dev/stdin", NULL
+        };
+        if(!(f = tmpfile())) {
+            fprintf(err, "[Error] tmpfile: %s\n", strerror(errno));
             ret = EXIT_FAILURE;
-            goto ret_free_code;
+        } else {
+            if(write_asm_stream(o, f, code, err)
+            || run_command(o, REPORT_NASM, argv, fileno(f), err))
+                ret = EXIT_FAILURE;
+            fclose(f);
         }
-        options.asmfile = asm_path;
-    } else if(!(f = fopen(options.asmfile, "w"))) {
-        perror("fopen");
+    } else if(write_obj(o, obj_path, code, obj, 0, err))
+        ret = EXIT_FAILURE;
+
+    if(ret == EXIT_SUCCESS && o->output == OUTPUT_EXEC
+    && link_exec(o, obj_path, outfile, err))
         ret = EXIT_FAILURE;
-        goto ret_free_code;
+    if(o->output != OUTPUT_OBJ) unlink(obj_path);
+    return ret;
+}
+
+/* the static half of the report, -i adds the counts of its run */
+static int codegen_report(struct options *o, ir_code_t *code, FILE *err) {
+    metrics_t *m;
+    if(!(m = metrics_new(code))) return 1;
+    if(o->codegen_json) metrics_json(m, err);
+    else metrics_print(m, err);
+    metrics_free(m);
+    return 0;
+}
+
+/* -S and -a write the C instead of assembly */
+static int generate_c(struct options *o, ir_code_t *code, const char *outfile,
+                      FILE *err) {
+    FILE *f;
+    if(o->asmfile) {
+        if(!(f = fopen(o->asmfile, "w"))) {
+            fprintf(err, "[Error] %s: %s\n", o->asmfile, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        int ret = write_c(o, f, code, err);
+        if(fclose(f) && !ret) {
+            fprintf(err, "[Error] %s: %s\n", o->asmfile, strerror(errno));
+            ret = 1;
+        }
+        if(ret) return EXIT_FAILURE;
+    }
+
+    if(o->output == OUTPUT_ASM) {
+        if(!(f = fopen(outfile, "w"))) {
+            fprintf(err, "[Error] %s: %s\n", outfile, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        int ret = write_c(o, f, code, err);
+        if(fclose(f) && !ret) {
+            fprintf(err, "[Error] %s: %s\n", outfile, strerror(errno));
+            ret = 1;
+        }
+        return ret ? EXIT_FAILURE : EXIT_SUCCESS;
     }
 
-    if(asm_generate(f, code))
-        fprintf(stderr, "[Error] Failed to generate assembly\n");
-    fclose(f);
+    /* gcc links the libc runtime itself */
+    char *argv[] = {
+        "gcc", "-O2", "-x", "c", "-o", (char *)outfile, "-", NULL, NULL
+    };
+    if(o->output == OUTPUT_OBJ) argv[6] = "-c", argv[7] = "-";
+    int ret = 1;
+    if(!(f = tmpfile()))
+        fprintf(err, "[Error] tmpfile: %s\n", strerror(errno));
+    else {
+        if(!write_c(o, f, code, err))
+            ret = run_command(o, REPORT_CC, argv, fileno(f), err);
+        fclose(f);
+    }
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
-    if(options.compile) {
-        /* assemble with NASM */
-        char cmd[512];
-        snprintf(cmd, sizeof cmd, "nasm -felf64 %s", options.asmfile);
-        system(cmd);
+/* leaves f flushed and rewound */
+static int write_c(struct options *o, FILE *f, ir_code_t *code, FILE *err) {
+    int ret = 0;
+    double start = report_begin(o->report, REPORT_C);
+    if((ret = c_generate(f, code)))
+        fprintf(err, "[Error] Failed to generate C\n");
+    report_count(o->report, REPORT_ASM_BYTES, ftell(f));
+    if(fflush(f) && !ret) {
+        fprintf(err, "[Error] Failed to write C: %s\n", strerror(errno));
+        ret = 1;
+    }
+    rewind(f);
+    report_time(o->report, REPORT_C, start);
+    return ret;
+}
 
-        /* handle the case where NASM changes extensions to *.o */
-        char *asmext = strrchr(options.asmfile, '.');
-        if(asmext) *asmext = '\0';
+static int link_exec(struct options *o, const char *obj_path,
+                     const char *outfile, FILE *err) {
+    char *ld[] = {
+        "ld", "-static", "-o", (char *)outfile, (char *)obj_path, NULL
+    };
+    /* link using GCC (for easier libc integration) */
+    char *gcc[] = {
+        "gcc", "-no-pie", "-o", (char *)outfile, (char *)obj_path, NULL
+    };
+    return run_command(o, REPORT_LINK, o->runtime == RT_SYSCALL ? ld : gcc,
+                       -1, err);
+}
 
-        /* link using GCC (for easier libc integration) */
-        {
-            char buf[strlen(options.asmfile)+3];
-            sprintf(buf, "%s.o", options.asmfile);
+/* links objects compiled with --module and the runtime into an executable */
+static int run_link(struct options *o, char **files, size_t num_files) {
+    char rt_path[] = P_tmpdir "/dpp_XXXXXX";
+    if(make_temp(rt_path, stderr)) return EXIT_FAILURE;
 
-            snprintf(cmd, sizeof cmd, "gcc -no-pie -o '%s' '%s'",
-                     options.outfile, buf);
-            system(cmd);
-            unlink(buf);
+    int ret = write_runtime(o, rt_path, stderr);
+    if(!ret) {
+        char **argv = malloc(sizeof(char *) * (num_files + 6));
+        size_t argc = 0;
+        if(o->runtime == RT_SYSCALL) {
+            argv[argc++] = "ld";
+            argv[argc++] = "-static";
+        } else {
+            argv[argc++] = "gcc";
+            argv[argc++] = "-no-pie";
         }
+        argv[argc++] = "-o";
+        argv[argc++] = o->outfile;
+        argv[argc++] = rt_path;
+        for(size_t i = 0; i < num_files; ++i) argv[argc++] = files[i];
+        argv[argc] = NULL;
+        ret = run_command(o, REPORT_LINK, argv, -1, stderr);
+        free(argv);
+    }
+    unlink(rt_path);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
-        /* delete temporary assembly file */
-        if(asmext) *asmext = '.';
-        if(!options.saveasm)
-            unlink(options.asmfile);
+/* the object of the runtime is generated for every link, which is no slower
+ * than reading it from a file */
+static int write_runtime(struct options *o, const char *path, FILE *err) {
+    if(!o->nasm) {
+        x86_obj_t *obj;
+        double start = report_begin(o->report, REPORT_X86);
+        if(!(obj = x86_generate_runtime(o->runtime, err))) return 1;
+        report_time(o->report, REPORT_X86, start);
+        int ret = write_obj(o, path, NULL, obj, 0, err);
+        x86_free(obj);
+        return ret;
     }
 
-ret_free_code:
-    code_free(code);
-ret_free_parser:
-    lexer_free(lexer);
-    parser_free(parser);
-ret_free:
-    free(buf);
-    exit(ret);
+    /* the code is only used for its diagnostics stream */
+    semantics_ctx_t *ctx = semantics_new();
+    ctx->err = err;
+    ir_code_t code = { .ctx = ctx, .instructions = NULL, .num_label = 0 };
+    char *argv[] = {
+        "nasm", "-felf64", "-o", (char *)path, "/dev/stdin", NULL
+    };
+    int ret = 1;
+    FILE *f;
+    if(!(f = tmpfile()))
+        fprintf(err, "[Error] tmpfile: %s\n", strerror(errno));
+    else {
+        double start = report_begin(o->report, REPORT_ASM);
+        if(!asm_generate_runtime(f, &code, o->runtime) && !fflush(f)) {
+            rewind(f);
+            report_time(o->report, REPORT_ASM, start);
+            ret = run_command(o, REPORT_NASM, argv, fileno(f), err);
+        }
+        fclose(f);
+    }
+    semantics_free(ctx);
+    return ret;
+}
+
+static int is_object(const char *path) {
+    size_t len = strlen(path);
+    return len > 2 && !strcmp(path + len - 2, ".o");
+}
+
+/* compiles every file on a pool of threads, diagnostics are printed in the
+ * order of the files no matter which finishes first */
+static int run_batch(struct options *o, char **files, size_t num_files) {
+    struct batch b = {
+    .options = o,
+    .jobs = calloc(num_files, sizeof(struct job)),
+    .num_jobs = num_files,
+    .next = 0,
+    };
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.cond, NULL);
+    for(size_t i = 0; i < num_files; ++i) {
+        b.jobs[i].infile = files[i];
+        b.jobs[i].outfile = batch_outfile(o, files[i]);
+    }
+
+    size_t num_threads = MIN((size_t)o->jobs, num_files);
+    pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+    for(size_t i = 0; i < num_threads; ++i)
+        if(pthread_create(&threads[i], NULL, batch_worker, &b)) {
+            fprintf(stderr, "[Error] Failed to create thread\n");
+            /* the threads already started finish the batch */
+            if(!(num_threads = i)) batch_worker(&b);
+            break;
+        }
+
+    size_t failed = 0;
+    for(size_t i = 0; i < num_files; ++i) {
+        struct job *job = &b.jobs[i];
+        pthread_mutex_lock(&b.lock);
+        while(!job->done) pthread_cond_wait(&b.cond, &b.lock);
+        pthread_mutex_unlock(&b.lock);
+
+        if(job->err_sz) {
+            fprintf(stderr, "In %s:\n", job->infile);
+            fwrite(job->err_data, 1, job->err_sz, stderr);
+        }
+        if(job->ret != EXIT_SUCCESS) ++failed;
+    }
+
+    for(size_t i = 0; i < num_threads; ++i) pthread_join(threads[i], NULL);
+    if(failed)
+        fprintf(stderr, "[Error] %zu of %zu files failed to compile\n",
+                failed, num_files);
+
+    for(size_t i = 0; i < num_files; ++i) {
+        free(b.jobs[i].outfile);
+        free(b.jobs[i].err_data);
+    }
+    free(b.jobs);
+    free(threads);
+    pthread_mutex_destroy(&b.lock);
+    pthread_cond_destroy(&b.cond);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void *batch_worker(void *arg) {
+    struct batch *b = arg;
+    for(;;) {
+        pthread_mutex_lock(&b->lock);
+        size_t i = b->next < b->num_jobs ? b->next++ : b->num_jobs;
+        pthread_mutex_unlock(&b->lock);
+        if(i == b->num_jobs) break;
+
+        struct job *job = &b->jobs[i];
+        FILE *err;
+        if((err = open_memstream(&job->err_data, &job->err_sz))) {
+            job->ret = compile_file(b->options, job->infile, job->outfile,
+                                    err);
+            fclose(err);
+        } else job->ret = EXIT_FAILURE;
+
+        pthread_mutex_lock(&b->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&b->cond);
+        pthread_mutex_unlock(&b->lock);
+    }
+    return NULL;
+}
+
+/* file.dpp is compiled to file, file.o or file.asm */
+static char *batch_outfile(struct options *o, const char *infile) {
+    size_t len = strlen(infile);
+    if(len > 4 && !strcmp(infile + len - 4, ".dpp")) len -= 4;
+    const char *ext = o->output == OUTPUT_ASM ? o->via_c ? ".c" : ".asm"
+                    : o->output == OUTPUT_OBJ ? ".o"
+                    /* never overwrite the input */
+                    : len == strlen(infile) ? ".out" : "";
+
+    char *outfile = malloc(len + strlen(ext) + 1);
+    memcpy(outfile, infile, len);
+    strcpy(outfile + len, ext);
+    return outfile;
+}
+
+/* compiles the file again whenever it changes, only returns on errors */
+static int run_watch(struct options *o, const char *infile) {
+    if(o->client || o->output == OUTPUT_RUN || o->output == OUTPUT_INTERP) {
+        fprintf(stderr, "[Error] --client, -r and -i can not be used with "
+                "--watch\n");
+        return EXIT_FAILURE;
+    }
+
+    int fd;
+    if((fd = inotify_init1(IN_CLOEXEC)) == -1) {
+        fprintf(stderr, "[Error] inotify_init1: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    /* editors often replace the file instead of writing it, so the directory
+     * is watched */
+    const char *base = strrchr(infile, '/');
+    char *dir = base ? strndup(infile, base - infile + 1) : strdup(".");
+    base = base ? base + 1 : infile;
+    if(inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        fprintf(stderr, "[Error] %s: %s\n", dir, strerror(errno));
+        free(dir);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    free(dir);
+
+    incr_t *incr = incr_new(stderr);
+    do watch_build(o, incr, infile);
+    while(!watch_wait(fd, base));
+
+    incr_free(incr);
+    close(fd);
+    return EXIT_FAILURE;
+}
+
+static int watch_build(struct options *o, incr_t *incr, const char *infile) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if(o->report) report_reset(o->report);
+
+    struct source src;
+    double t = report_begin(o->report, REPORT_READ);
+    if(read_source(infile, &src, 0, stderr)) return EXIT_FAILURE;
+    report_time(o->report, REPORT_READ, t);
+    report_count(o->report, REPORT_SRC_BYTES, src.buf.sz);
+    t = report_begin(o->report, REPORT_INCR);
+    int ret = incr_compile(incr, src.buf.data, src.buf.sz)
+            ? EXIT_FAILURE : EXIT_SUCCESS;
+    report_time(o->report, REPORT_INCR, t);
+    source_destroy(&src);
+
+    /* the machine code of unchanged functions is reused as well */
+    if(ret == EXIT_SUCCESS) {
+        report_count(o->report, REPORT_IR_INSTRS, incr->code.instructions->sz);
+        x86_obj_t *obj = NULL;
+        t = report_begin(o->report, REPORT_X86);
+        if(!o->nasm && !o->via_c && o->output != OUTPUT_ASM
+        && !(obj = incr_link(incr, o->runtime)))
+            ret = EXIT_FAILURE;
+        else {
+            if(obj) report_time(o->report, REPORT_X86, t);
+            ret = generate(o, &incr->code, obj, o->outfile, stderr);
+        }
+        if(obj) x86_free(obj);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3
+              + (end.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "[Info] %s %s in %.1f ms, compiled %zu of %zu "
+            "functions\n", ret == EXIT_SUCCESS ? "Built" : "Failed to build",
+            o->outfile, ms, incr->num_compiled, incr->order->sz);
+    if(o->report) report_print(o->report, stderr);
+    /* watching only ends on errors, so the trace is kept up to date, with
+     * the events of the last build only */
+    if(o->trace) {
+        write_trace(o->trace);
+        trace_reset();
+    }
+    return ret;
+}
+
+/* waits until the file named name is written, returns non-zero on errors */
+static int watch_wait(int fd, const char *name) {
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    /* a save often causes several events, they are handled together */
+    while(!changed || poll(&(struct pollfd){ fd, POLLIN, 0 }, 1, 50) > 0) {
+        ssize_t n = read(fd, buf, sizeof buf);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) continue;
+            fprintf(stderr, "[Error] inotify: %s\n",
+                    n ? strerror(errno) : "end of file");
+            return 1;
+        }
+        for(char *p = buf; p < buf + n;) {
+            struct inotify_event *ev = (void *)p;
+            if(ev->len && !strcmp(ev->name, name)) changed = 1;
+            p += sizeof *ev + ev->len;
+        }
+    }
+    return 0;
+}
+
+/* path is - for standard input, pipes are only left to be read while they
+ * are lexed if stream is non-zero */
+static int read_source(const char *path, struct source *src, int stream,
+                       FILE *err) {
+    int fd = STDIN_FILENO;
+    struct stat st;
+    src->mapped = 0;
+    src->fd = -1;
+    if(strcmp(path, "-") && (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        fprintf(err, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if(fstat(fd, &st) == -1) {
+        fprintf(err, "[Error] %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    /* the lexer works on the page cache directly */
+    if(S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p != MAP_FAILED) {
+            posix_madvise(p, st.st_size, POSIX_MADV_SEQUENTIAL);
+            src->buf.data = p;
+            src->buf.sz = src->buf.capacity = st.st_size;
+            src->mapped = 1;
+            if(fd != STDIN_FILENO) close(fd);
+            return 0;
+        }
+        /* read it like a pipe on file systems that can not map */
+    }
+
+    if(stream) {
+        src->buf.data = NULL;
+        src->buf.sz = src->buf.capacity = 0;
+        src->fd = fd;
+        return 0;
+    }
+
+    buf_init(&src->buf, S_ISREG(st.st_mode) ? st.st_size + 1 : 1u<<16);
+    for(;;) {
+        if(src->buf.sz == src->buf.capacity)
+            buf_reserve(&src->buf, 2 * src->buf.capacity);
+        ssize_t n = read(fd, src->buf.data + src->buf.sz,
+                         src->buf.capacity - src->buf.sz);
+        if(n == 0) break;
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1) {
+            fprintf(err, "[Error] %s: %s\n", path, strerror(errno));
+            buf_destroy(&src->buf);
+            goto fail;
+        }
+        src->buf.sz += n;
+    }
+    if(fd != STDIN_FILENO) close(fd);
+    return 0;
+
+fail:
+    if(fd != STDIN_FILENO) close(fd);
+    return 1;
+}
+
+static void source_destroy(struct source *src) {
+    if(src->mapped) munmap(src->buf.data, src->buf.sz);
+    else buf_destroy(&src->buf);
+    if(src->fd > STDIN_FILENO) close(src->fd);
+}
+
+static size_t stream_read(void *arg, unsigned char *buf, size_t sz) {
+    struct stream *s = arg;
+    ssize_t n;
+    while((n = read(s->fd, buf, sz)) == -1)
+        if(errno != EINTR) {
+            fprintf(s->err, "[Error] %s: %s\n", s->path, strerror(errno));
+            s->error = 1;
+            return 0;
+        }
+    s->sz += n;
+    return n;
+}
+
+static int write_asm(struct options *o, const char *path, ir_code_t *code,
+                     FILE *err) {
+    FILE *f;
+    if(!(f = fopen(path, "w"))) {
+        fprintf(err, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    int ret = write_asm_stream(o, f, code, err);
+    if(fclose(f) && !ret) {
+        fprintf(err, "[Error] %s: %s\n", path, strerror(errno));
+        ret = 1;
+    }
+    return ret;
+}
+
+/* leaves f flushed and rewound */
+static int write_asm_stream(struct options *o, FILE *f, ir_code_t *code,
+                            FILE *err) {
+    int ret = 0;
+    double start = report_begin(o->report, REPORT_ASM);
+    if((ret = asm_generate(f, code, o->runtime)))
+        fprintf(err, "[Error] Failed to generate assembly\n");
+    report_count(o->report, REPORT_ASM_BYTES, ftell(f));
+    /* includes writing the buffered text */
+    if(fflush(f) && !ret) {
+        fprintf(err, "[Error] Failed to write assembly: %s\n",
+                strerror(errno));
+        ret = 1;
+    }
+    rewind(f);
+    report_time(o->report, REPORT_ASM, start);
+    return ret;
+}
+
+static int write_obj(struct options *o, const char *path, ir_code_t *code,
+                     x86_obj_t *obj, int exec, FILE *err) {
+    int ret = 0;
+    x86_obj_t *gen = NULL;
+    double start = report_begin(o->report, REPORT_X86);
+    if(!obj && !(obj = gen = x86_generate(code, o->runtime))) {
+        fprintf(err, "[Error] Failed to generate machine code\n");
+        return 1;
+    }
+    if(gen) report_time(o->report, REPORT_X86, start);
+    report_count(o->report, REPORT_TEXT_BYTES, obj->text.sz);
+
+    buf_t img;
+    buf_init(&img, obj->text.sz + 4096);
+    start = report_begin(o->report, REPORT_ELF);
+    if(exec) ret = elf_write_exec(&img, obj, "_start");
+    else ret = elf_write_obj(&img, obj);
+    report_time(o->report, REPORT_ELF, start);
+
+    if(!ret) {
+        start = report_begin(o->report, REPORT_WRITE);
+        ret = write_file(path, &img, exec ? 0777 : 0666, err);
+        report_time(o->report, REPORT_WRITE, start);
+        report_count(o->report, REPORT_OUT_BYTES, img.sz);
+    }
+
+    buf_destroy(&img);
+    if(gen) x86_free(gen);
+    return ret;
+}
+
+static int write_file(const char *path, buf_t *b, mode_t mode, FILE *err) {
+    int fd;
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode)) == -1) {
+        fprintf(err, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    int ret = 0;
+    for(size_t off = 0; off < b->sz;) {
+        ssize_t n = write(fd, b->data + off, b->sz - off);
+        if(n < 0) {
+            fprintf(err, "[Error] %s: %s\n", path, strerror(errno));
+            ret = 1;
+            break;
+        }
+        off += n;
+    }
+    close(fd);
+    return ret;
+}
+
+/* does what the options ask for through a compile server */
+static int run_client(struct options *o, const char *outfile, buf_t *src,
+                      FILE *err) {
+    if(o->nasm || o->output == OUTPUT_RUN || o->output == OUTPUT_INTERP) {
+        fprintf(err, "[Error] -n, -r and -i can not be used with "
+                "--client\n");
+        return 1;
+    }
+
+    int fd;
+    if((fd = client_connect(o->client, err)) == -1) return 1;
+
+    enum dpp_runtime rt = o->runtime == RT_SYSCALL ? DPP_RUNTIME_SYSCALL
+                                                   : DPP_RUNTIME_LIBC;
+    enum dpp_output output = o->output == OUTPUT_ASM ? DPP_OUTPUT_ASM
+                           : o->output == OUTPUT_OBJ ? DPP_OUTPUT_OBJ
+                           : DPP_OUTPUT_EXEC;
+    buf_t out;
+    buf_init(&out, 4096);
+
+    int ret = 0;
+    if(o->asmfile)
+        ret = client_compile(fd, DPP_OUTPUT_ASM, rt, src->data, src->sz,
+                             &out, err)
+           || write_file(o->asmfile, &out, 0666, err);
+    if(!ret)
+        ret = client_compile(fd, output, rt, src->data, src->sz, &out, err)
+           || write_file(outfile, &out,
+                         output == DPP_OUTPUT_EXEC ? 0777 : 0666, err);
+
+    buf_destroy(&out);
+    close(fd);
+    return ret;
+}
+
+/* one translation unit of generate_split */
+struct unit {
+    char obj_path[sizeof P_tmpdir "/dpp_XXXXXX"];
+    /** assembly, open until NASM is done with it */
+    FILE *f;
+    pid_t pid;
+};
+
+/* generates the runtime and every function as translation units of their
+ * own and assembles them while the next are generated, then links the
+ * objects into an executable or combines them into one object */
+static int generate_split(struct options *o, ir_code_t *code,
+                          const char *outfile, FILE *err) {
+    int ret = 0;
+    vec_t *ins = code->instructions;
+    /* unit 0 is the runtime, fns are the indices of the FUNC instructions */
+    size_t num_units = 1;
+    for(size_t i = 0; i < ins->sz; ++i)
+        if(((ir_instr_t *)vec_get(ins, i))->type == IR_FUNC) ++num_units;
+    size_t *fns = malloc(sizeof(size_t) * num_units);
+    struct unit *units = calloc(num_units, sizeof(struct unit));
+    for(size_t i = 0, n = 1; i < ins->sz; ++i)
+        if(((ir_instr_t *)vec_get(ins, i))->type == IR_FUNC) fns[n++] = i;
+
+    size_t spawned = 0, waited = 0, made = 0;
+    for(; spawned < num_units; ++spawned) {
+        struct unit *u = &units[spawned];
+        strcpy(u->obj_path, P_tmpdir "/dpp_XXXXXX");
+        if(make_temp(u->obj_path, err)) goto fail;
+        ++made;
+        if(!(u->f = tmpfile())) {
+            fprintf(err, "[Error] tmpfile: %s\n", strerror(errno));
+            goto fail;
+        }
+
+        double start = report_begin(o->report, REPORT_ASM);
+        if(spawned ? asm_generate_fn(u->f, code, fns[spawned])
+                   : asm_generate_runtime(u->f, code, o->runtime))
+            goto fail;
+        report_count(o->report, REPORT_ASM_BYTES, ftell(u->f));
+        if(fflush(u->f)) {
+            fprintf(err, "[Error] Failed to write assembly: %s\n",
+                    strerror(errno));
+            goto fail;
+        }
+        rewind(u->f);
+        report_time(o->report, REPORT_ASM, start);
+
+        /* the oldest is the most likely to be done */
+        if(spawned - waited == (size_t)o->jobs) {
+            start = report_begin(o->report, REPORT_NASM);
+            if(command_wait("nasm", units[waited].pid, err)) ret = 1;
+            report_time(o->report, REPORT_NASM, start);
+            fclose(units[waited].f);
+            units[waited++].f = NULL;
+            if(ret) goto fail;
+        }
+
+        char *argv[] = {
+            "nasm", "-felf64", "-o", u->obj_path, "/dev/stdin", NULL
+        };
+        if(command_spawn(argv, fileno(u->f), &u->pid, err)) goto fail;
+    }
+    goto wait;
+
+fail:
+    ret = 1;
+wait:
+    for(; waited < spawned; ++waited) {
+        double start = report_begin(o->report, REPORT_NASM);
+        if(command_wait("nasm", units[waited].pid, err)) ret = 1;
+        report_time(o->report, REPORT_NASM, start);
+    }
+
+    if(!ret) {
+        char **argv = malloc(sizeof(char *) * (num_units + 5));
+        size_t argc = 0;
+        if(o->output == OUTPUT_OBJ) {
+            argv[argc++] = "ld";
+            argv[argc++] = "-r";
+        } else if(o->runtime == RT_SYSCALL) {
+            argv[argc++] = "ld";
+            argv[argc++] = "-static";
+        } else {
+            argv[argc++] = "gcc";
+            argv[argc++] = "-no-pie";
+        }
+        argv[argc++] = "-o";
+        argv[argc++] = (char *)outfile;
+        for(size_t i = 0; i < num_units; ++i)
+            argv[argc++] = units[i].obj_path;
+        argv[argc] = NULL;
+        ret = run_command(o, REPORT_LINK, argv, -1, err);
+        free(argv);
+    }
+
+    for(size_t i = 0; i < num_units; ++i)
+        if(units[i].f) fclose(units[i].f);
+    for(size_t i = 0; i < made; ++i) unlink(units[i].obj_path);
+    free(units);
+    free(fns);
+    return ret;
+}
+
+/* runs argv[0] with in as its standard input unless it is -1, the time is
+ * added to phase */
+static int run_command(struct options *o, enum report_phase phase,
+                       char *const argv[], int in, FILE *err) {
+    double start = report_begin(o->report, phase);
+    int ret = command_run(argv, in, err);
+    report_time(o->report, phase, start);
+    return ret;
+}
+
+static int write_trace(const char *path) {
+    FILE *f;
+    if(!(f = fopen(path, "w"))) {
+        fprintf(stderr, "[Error] %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    int ret = trace_write(f);
+    if(fclose(f) || ret) {
+        fprintf(stderr, "[Error] Failed to write trace '%s'\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+static int make_temp(char *template, FILE *err) {
+    int fd;
+    if((fd = mkstemp(template)) == -1) {
+        fprintf(err, "[Error] mkstemp: %s\n", strerror(errno));
+        return 1;
+    }
+    close(fd);
+    return 0;
 }
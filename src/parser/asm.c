@@ -1,17 +1,43 @@
 #include <parser/code.h>
+#include <utils/trace.h>
+#include <utils/alloc.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 
-static inline const char *data_str(ir_instr_data_t *);
+/* large enough for any operand printed by data_str */
+#define DATA_STR_SZ 32
 
-static int asm_generate_instr(FILE *, ir_instr_t *);
+#define STR_(x) #x
+#define STR(x) STR_(x)
 
-static const char asm_pre[] = ""
+static inline const char *data_str(char *, ir_instr_data_t *);
+
+static int asm_write(FILE *, const char *, size_t);
+static int asm_generate_module(FILE *, ir_code_t *);
+static int asm_generate_instr(FILE *, ir_code_t *, ir_instr_t *);
+static void asm_count(const char *, size_t, asm_metrics_t *);
+
+static const char asm_head[] = ""
 "bits 64\n"
 "extern printf\n"
 "extern scanf\n"
 "global main\n"
 "section .text\n"
+;
+
+/* the runtime on its own, linked with the functions assembled separately */
+static const char asm_head_split[] = ""
+"bits 64\n"
+"extern printf\n"
+"extern scanf\n"
+"global print\n"
+"global input\n"
+"section .text\n"
+;
+
+static const char asm_pre[] = ""
 "print:\n"
 "  push rbp\n"
 "  mov rbp, rsp\n"
@@ -36,49 +62,358 @@ static const char asm_pre[] = ""
 "  ret\n"
 ;
 
+static const char asm_head_sys[] = ""
+"bits 64\n"
+"global _start\n"
+"section .text\n"
+;
+
+static const char asm_head_sys_split[] = ""
+"bits 64\n"
+"global _start\n"
+"global print\n"
+"global input\n"
+"extern main\n"
+"section .text\n"
+;
+
+/* the same code as the runtime of x86_generate, print buffers its output in
+ * .out and input reads ahead into .in */
+static const char asm_pre_sys[] = ""
+"_start:\n"
+"  xor ebp, ebp\n"
+"  call main\n"
+"  push rax\n"
+"  call .flush\n"
+"  pop rdi\n"
+"  mov eax, 60\n"
+"  syscall\n"
+".flush:\n"
+"  mov esi, .out\n"
+"  mov rdx, [rsi]\n"
+"  mov qword [rsi], 0\n"
+"  add rsi, 8\n"
+".loop:\n"
+"  test rdx, rdx\n"
+"  jz .ret\n"
+"  mov eax, 1\n"
+"  mov edi, 1\n"
+"  syscall\n"
+"  test rax, rax\n"
+"  jle .ret\n"
+"  add rsi, rax\n"
+"  sub rdx, rax\n"
+"  jmp .loop\n"
+".ret:\n"
+"  ret\n"
+"section .bss\n"
+"alignb 16\n"
+".out: resb 8+" STR(RT_BUF_SZ) "\n"
+".in: resb 16+" STR(RT_BUF_SZ) "\n"
+"section .text\n"
+"print:\n"
+"  push rbp\n"
+"  mov rbp, rsp\n"
+"  sub rsp, 0x20\n"
+"  mov rax, [rbp+0x10]\n"
+"  mov rcx, rax\n"
+"  lea rsi, [rbp-0x1]\n"
+"  mov byte [rsi], 0xa\n"
+"  mov r8d, 10\n"
+"  test rax, rax\n"
+"  jns .digit\n"
+"  neg rax\n"
+".digit:\n"
+"  xor edx, edx\n"
+"  div r8\n"
+"  add dl, '0'\n"
+"  dec rsi\n"
+"  mov [rsi], dl\n"
+"  test rax, rax\n"
+"  jnz .digit\n"
+"  test rcx, rcx\n"
+"  jns .buffer\n"
+"  dec rsi\n"
+"  mov byte [rsi], '-'\n"
+".buffer:\n"
+"  mov rdx, rbp\n"
+"  sub rdx, rsi\n"
+"  mov r8d, _start.out\n"
+"  mov rax, [r8]\n"
+"  add rax, rdx\n"
+"  cmp rax, " STR(RT_BUF_SZ) "\n"
+"  jbe .copy\n"
+"  push rsi\n"
+"  push rdx\n"
+"  call _start.flush\n"
+"  pop rdx\n"
+"  pop rsi\n"
+"  mov rax, rdx\n"
+".copy:\n"
+"  mov [r8], rax\n"
+"  lea rdi, [r8+rax+8]\n"
+"  sub rdi, rdx\n"
+"  mov rcx, rdx\n"
+"  rep movsb\n"
+"  xor eax, eax\n"
+"  leave\n"
+"  ret\n"
+"input:\n"
+"  push rbp\n"
+"  mov rbp, rsp\n"
+"  mov r10d, _start.in\n"
+"  xor r8d, r8d\n"
+"  xor r9d, r9d\n"
+".skip:\n"
+"  call .getc\n"
+"  test eax, eax\n"
+"  js .done\n"
+"  cmp al, ' '\n"
+"  je .skip\n"
+"  lea ecx, [rax-9]\n"
+"  cmp ecx, 4\n"
+"  jbe .skip\n"
+"  cmp al, '-'\n"
+"  jne .plus\n"
+"  mov r9d, 1\n"
+"  jmp .next\n"
+".plus:\n"
+"  cmp al, '+'\n"
+"  jne .num\n"
+".next:\n"
+"  call .getc\n"
+"  test eax, eax\n"
+"  js .done\n"
+".num:\n"
+"  sub eax, '0'\n"
+"  cmp eax, 9\n"
+"  ja .done\n"
+"  imul r8, r8, 10\n"
+"  add r8, rax\n"
+"  jmp .next\n"
+".done:\n"
+"  mov rax, r8\n"
+"  test r9d, r9d\n"
+"  jz .ret\n"
+"  neg rax\n"
+".ret:\n"
+"  leave\n"
+"  ret\n"
+".getc:\n"
+"  mov rax, [r10]\n"
+"  cmp rax, [r10+8]\n"
+"  jb .byte\n"
+"  call _start.flush\n"
+"  xor eax, eax\n"
+"  xor edi, edi\n"
+"  lea rsi, [r10+16]\n"
+"  mov edx, " STR(RT_BUF_SZ) "\n"
+"  syscall\n"
+"  test rax, rax\n"
+"  jle .eof\n"
+"  mov [r10+8], rax\n"
+"  xor eax, eax\n"
+".byte:\n"
+"  movzx ecx, byte [r10+rax+16]\n"
+"  inc rax\n"
+"  mov [r10], rax\n"
+"  mov eax, ecx\n"
+"  ret\n"
+".eof:\n"
+"  mov eax, -1\n"
+"  ret\n"
+;
+
 static const char asm_post[] = ""
 "section .rodata\n"
 "pri_int: db \"%lld\",0xa,0\n"
 "scn_int: db \"%lld\",0\n"
 ;
 
-static inline const char *data_str(ir_instr_data_t *data) {
-    static char buf[128];
-    if(data->variable) snprintf(buf, sizeof buf, "qword [rbp%c%#zx]",
+static inline const char *data_str(char *buf, ir_instr_data_t *data) {
+    if(data->variable) snprintf(buf, DATA_STR_SZ, "qword [rbp%c%#zx]",
                        data->ref->bp_offset < 0 ? '-' : '+',
                        (size_t)llabs(data->ref->bp_offset));
-    else snprintf(buf, sizeof buf, "%"PRId64, data->imm);
+    else snprintf(buf, DATA_STR_SZ, "%"PRId64, data->imm);
     return buf;
 }
 
-int asm_generate(FILE *f, ir_code_t *code) {
+static int asm_write(FILE *f, const char *s, size_t sz) {
+    return fwrite(s, 1, sz, f) != sz;
+}
+
+int asm_generate(FILE *f, ir_code_t *code, enum runtime rt) {
+    return (rt == RT_NONE ? asm_generate_module(f, code)
+                          : asm_generate_begin(f, rt))
+        || asm_generate_code(f, code)
+        || asm_generate_end(f, code, rt);
+}
+
+/* the runtime, followed by any number of asm_generate_code */
+int asm_generate_begin(FILE *f, enum runtime rt) {
+    if(rt == RT_SYSCALL)
+        return asm_write(f, asm_head_sys, sizeof asm_head_sys - 1)
+            || asm_write(f, asm_pre_sys, sizeof asm_pre_sys - 1);
+    else
+        return asm_write(f, asm_head, sizeof asm_head - 1)
+            || asm_write(f, asm_pre, sizeof asm_pre - 1);
+}
+
+int asm_generate_code(FILE *f, ir_code_t *code) {
     int ret = 0;
-    if(fwrite(asm_pre, 1, sizeof asm_pre - 1, f) != sizeof asm_pre - 1) {
-        perror("fwrite");
+    /* each function is traced from its FUNC to the next */
+    function_ref_t *fn = NULL;
+    uint64_t start = 0;
+    for(size_t i = 0; i < code->instructions->sz; ++i) {
+        ir_instr_t *in = vec_get(code->instructions, i);
+        if(in->type == IR_FUNC) {
+            if(fn) trace_end("asm", fn->name, fn->name_sz, start);
+            fn = ((ir_instr_func_t *)in)->ref;
+            start = trace_begin();
+        }
+        if((ret = asm_generate_instr(f, code, in))) goto ret;
+    }
+    if(fn) trace_end("asm", fn->name, fn->name_sz, start);
+
+ret:
+    if(ferror(f)) {
+        fprintf(code->ctx->err, "[Error] Failed to write assembly\n");
         ret = 1;
-        goto ret;
     }
+    return ret;
+}
 
-    for(size_t i = 0; i < code->instructions->sz; ++i)
-        if((ret = asm_generate_instr(f, vec_get(code->instructions, i))))
-            goto ret;
+int asm_generate_end(FILE *f, ir_code_t *code, enum runtime rt) {
+    if((rt == RT_LIBC && asm_write(f, asm_post, sizeof asm_post - 1))
+    || ferror(f)) {
+        fprintf(code->ctx->err, "[Error] Failed to write assembly\n");
+        return 1;
+    }
+    return 0;
+}
 
-    if(fwrite(asm_post, 1, sizeof asm_post - 1, f) != sizeof asm_post - 1) {
-        perror("fwrite");
+int asm_generate_runtime(FILE *f, ir_code_t *code, enum runtime rt) {
+    int ret;
+    if(rt == RT_SYSCALL)
+        ret = asm_write(f, asm_head_sys_split, sizeof asm_head_sys_split - 1)
+           || asm_write(f, asm_pre_sys, sizeof asm_pre_sys - 1);
+    else
+        ret = asm_write(f, asm_head_split, sizeof asm_head_split - 1)
+           || asm_write(f, asm_pre, sizeof asm_pre - 1)
+           || asm_write(f, asm_post, sizeof asm_post - 1);
+    if(ret || ferror(f)) {
+        fprintf(code->ctx->err, "[Error] Failed to write assembly\n");
         ret = 1;
-        goto ret;
     }
+    return ret;
+}
+
+/* exports the functions of a module and imports every other function */
+static int asm_generate_module(FILE *f, ir_code_t *code) {
+    vec_t *ins = code->instructions;
+    size_t num_fns = code->ctx->functions->sz;
+    char *defined = alloc_calloc(ALLOC_OTHER, num_fns, 1);
+    fputs("bits 64\n", f);
+    for(size_t i = 0; i < ins->sz; ++i) {
+        ir_instr_func_t *in = vec_get(ins, i);
+        if(in->hdr.type != IR_FUNC || defined[in->ref->idx]) continue;
+        defined[in->ref->idx] = 1;
+        fprintf(f, "global %.*s\n", (int)in->ref->name_sz, in->ref->name);
+    }
+    for(size_t i = 0; i < num_fns; ++i) {
+        function_ref_t *ref = vec_get(code->ctx->functions, i);
+        if(!defined[i])
+            fprintf(f, "extern %.*s\n", (int)ref->name_sz, ref->name);
+    }
+    alloc_free(ALLOC_OTHER, defined);
+    fputs("section .text\n", f);
+    return ferror(f);
+}
+
+int asm_generate_fn(FILE *f, ir_code_t *code, size_t first) {
+    int ret = 0;
+    vec_t *ins = code->instructions;
+    function_ref_t *fn = ((ir_instr_func_t *)vec_get(ins, first))->ref;
+    size_t last = first;
+    while(((ir_instr_t *)vec_get(ins, last))->type != IR_LEAVE) ++last;
+
+    uint64_t start = trace_begin();
+    fprintf(f, "bits 64\nglobal %.*s\n", (int)fn->name_sz, fn->name);
+    /* every function called is declared once, functions are numbered by
+     * their index in the context */
+    size_t num_fns = code->ctx->functions->sz;
+    char *declared = alloc_calloc(ALLOC_OTHER, num_fns, 1);
+    declared[fn->idx] = 1;
+    for(size_t i = first; i <= last; ++i) {
+        ir_instr_func_t *in = vec_get(ins, i);
+        if(in->hdr.type != IR_CALL || declared[in->ref->idx]) continue;
+        declared[in->ref->idx] = 1;
+        fprintf(f, "extern %.*s\n", (int)in->ref->name_sz, in->ref->name);
+    }
+    alloc_free(ALLOC_OTHER, declared);
+    fputs("section .text\n", f);
+
+    for(size_t i = first; i <= last; ++i)
+        if((ret = asm_generate_instr(f, code, vec_get(ins, i)))) goto ret;
+
 ret:
+    trace_end("asm", fn->name, fn->name_sz, start);
+    if(ferror(f)) {
+        fprintf(code->ctx->err, "[Error] Failed to write assembly\n");
+        ret = 1;
+    }
     return ret;
 }
 
+/* counts the lines of the assembly each instruction is written as */
+int asm_metrics(ir_code_t *code, asm_metrics_t *metrics) {
+    char *text = NULL;
+    size_t sz = 0, at = 0;
+    FILE *f;
+    if(!(f = open_memstream(&text, &sz))) {
+        fprintf(code->ctx->err, "[Error] open_memstream: %s\n",
+                strerror(errno));
+        return 1;
+    }
+    int ret = 0;
+    for(size_t i = 0; i < code->instructions->sz && !ret; ++i) {
+        if(!(ret = asm_generate_instr(f, code,
+                                      vec_get(code->instructions, i))
+                || fflush(f)))
+            asm_count(text + at, sz - at, &metrics[i]);
+        at = sz;
+    }
+    fclose(f);
+    free(text);
+    return ret;
+}
+
+/* instructions are indented, labels are not */
+static void asm_count(const char *s, size_t sz, asm_metrics_t *m) {
+    memset(m, 0, sizeof *m);
+    for(const char *end = s + sz, *eol; s < end; s = eol + 1) {
+        if(!(eol = memchr(s, '\n', end - s))) eol = end;
+        if(*s != ' ') {
+            m->tail = 0;
+            continue;
+        }
+        while(*s == ' ') ++s;
+        ++m->instructions;
+        ++m->tail;
+        if(!strncmp(s, "push ", 5)) ++m->pushes;
+        else if(!strncmp(s, "pop ", 4)) ++m->pops;
+        if(memchr(s, '[', eol - s)) ++m->mem_operands;
+    }
+}
+
 #define BINOP_PRE "  pop rbx\n  pop rax\n"
 #define UNOP_PRE "  pop rax\n"
 #define CMP_PRE "  pop rbx\n  pop rax\n  cmp rax, rbx\n"
 #define SET_POST "  movzx rax, al\n"
 
-static int asm_generate_instr(FILE *f, ir_instr_t *in_) {
+static int asm_generate_instr(FILE *f, ir_code_t *code, ir_instr_t *in_) {
     int ret = 0;
+    char buf[DATA_STR_SZ];
     union {
         ir_instr_t *i;
         ir_instr_data_t *data;
@@ -91,15 +426,15 @@ static int asm_generate_instr(FILE *f, ir_instr_t *in_) {
     case IR_NOP: break;
 
     case IR_PUSH:
-        fprintf(f, "  push %s\n", data_str(in.data));
+        fprintf(f, "  push %s\n", data_str(buf, in.data));
         break;
 
     case IR_POP:
-        fprintf(f, "  pop %s\n", data_str(in.data));
+        fprintf(f, "  pop %s\n", data_str(buf, in.data));
         break;
 
     case IR_ASSIGN:
-        fprintf(f, "  pop rax\n  mov %s, rax\n", data_str(in.data));
+        fprintf(f, "  pop rax\n  mov %s, rax\n", data_str(buf, in.data));
         break;
 
     case IR_SAVE:
@@ -127,11 +462,11 @@ static int asm_generate_instr(FILE *f, ir_instr_t *in_) {
         break;
 
     case IR_DIV:
-        fprintf(f, BINOP_PRE "  div rbx\n");
+        fprintf(f, BINOP_PRE "  cqo\n  idiv rbx\n");
         break;
 
     case IR_MOD:
-        fprintf(f, BINOP_PRE "  div rbx\n  mov rax, rdx");
+        fprintf(f, BINOP_PRE "  cqo\n  idiv rbx\n  mov rax, rdx\n");
         break;
 
     case IR_BITOR:
@@ -151,7 +486,7 @@ static int asm_generate_instr(FILE *f, ir_instr_t *in_) {
         break;
 
     case IR_LNOT:
-        fprintf(f, UNOP_PRE "  cmp rax, 0\n  setne al\n" SET_POST);
+        fprintf(f, UNOP_PRE "  test rax, rax\n  sete al\n" SET_POST);
         break;
 
     case IR_CALL:
@@ -172,7 +507,7 @@ static int asm_generate_instr(FILE *f, ir_instr_t *in_) {
 
     case IR_LOR:
         fprintf(f, BINOP_PRE "  or rax, rbx\n"
-                             "  text rax, rax\n"
+                             "  test rax, rax\n"
                              "  setnz al\n" SET_POST);
         break;
 
@@ -225,7 +560,7 @@ static int asm_generate_instr(FILE *f, ir_instr_t *in_) {
         break;
 
     default:
-        fprintf(stderr, "[Error] Invalid instruction in IR code\n");
+        fprintf(code->ctx->err, "[Error] Invalid instruction in IR code\n");
         ret = 1;
         goto ret;
     }
@@ -1,39 +1,46 @@
 #include <parser/parser.h>
 #include <parser/semantics.h>
+#include <utils/alloc.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <inttypes.h>
 #include <string.h>
 #include <errno.h>
 
-static void pad_printf(size_t, const char *restrict, ...);
-static void ast_print_internal(ast_node_t *root, size_t n);
+static void pad_printf(FILE *, size_t, const char *restrict, ...);
+static void ast_print_internal(FILE *, ast_node_t *, size_t);
+static void ast_print_compact_vec(FILE *, vec_t *);
+static uint64_t ast_hash_internal(uint64_t, ast_node_t *);
+static uint64_t ast_hash_vec(uint64_t, vec_t *);
+static uint64_t ast_hash_bytes(uint64_t, const void *, size_t);
+static size_t ast_count_vec(vec_t *);
 
 ast_node_ident_t *ast_node_ident_new(token_t *token) {
-    ast_node_ident_t *node = malloc(sizeof(ast_node_ident_t));
+    ast_node_ident_t *node = alloc_malloc(ALLOC_AST, sizeof(ast_node_ident_t));
     node->hdr.type = AST_IDENT;
     node->name_sz = token->sz;
-    node->name = strndup((char *)token->start, token->sz);
+    node->name = alloc_strndup(ALLOC_AST, (char *)token->start, token->sz);
+    node->ref = NULL;
     return node;
 }
 
 ast_node_const_t *ast_node_const_new(token_t *token) {
-    ast_node_const_t *node = malloc(sizeof(ast_node_ident_t));
+    ast_node_const_t *node = alloc_malloc(ALLOC_AST, sizeof(ast_node_ident_t));
     node->hdr.type = AST_CONST;
     {
         char buf[token->sz+1];
         memcpy(buf, token->start, token->sz);
         buf[token->sz] = '\0';
-        errno = 0;
+        /* errno is left for the caller to report out of range constants */
         node->value = strtoll(buf, NULL, 10);
-        if(errno) perror("strtoll");
     }
     return node;
 }
 
 ast_node_expr_binary_t *ast_node_expr_binary_new(
     ast_node_t *left, ast_node_t *right, enum expr_binary_type type) {
-    ast_node_expr_binary_t *node = malloc(sizeof(ast_node_expr_binary_t));
+    ast_node_expr_binary_t *node = alloc_malloc(ALLOC_AST,
+                                                sizeof(ast_node_expr_binary_t));
     node->hdr.type = AST_EXPR_BINARY;
     node->left = left;
     node->right = right;
@@ -43,7 +50,8 @@ ast_node_expr_binary_t *ast_node_expr_binary_new(
 
 ast_node_expr_unary_t *ast_node_expr_unary_new(
     ast_node_t *op, enum expr_unary_type type) {
-    ast_node_expr_unary_t *node = malloc(sizeof(ast_node_expr_unary_t));
+    ast_node_expr_unary_t *node = alloc_malloc(ALLOC_AST,
+                                               sizeof(ast_node_expr_unary_t));
     node->hdr.type = AST_EXPR_UNARY;
     node->op = op;
     node->type = type;
@@ -55,10 +63,12 @@ void ast_free(ast_node_t *root) {
     case AST_TU: {
         ast_node_tu_t *node = (void *)root;
         vec_free(node->functions);
+        vec_free(node->externs);
         if(node->ctx) semantics_free(node->ctx);
         break;
     }
 
+    case AST_FN_DECL:
     case AST_FN_DEFN: {
         ast_node_fn_defn_t *node = (void *)root;
         vec_free(node->arguments);
@@ -125,101 +135,105 @@ void ast_free(ast_node_t *root) {
 
     case AST_IDENT: {
         ast_node_ident_t *node = (void *)root;
-        free(node->name);
+        alloc_free(ALLOC_AST, node->name);
         break;
     }
 
     case AST_CONST: break;
     }
-    free(root);
+    alloc_free(ALLOC_AST, root);
 }
 
-static void pad_printf(size_t n, const char *restrict fmt, ...) {
+static void pad_printf(FILE *f, size_t n, const char *restrict fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
 
-    for(size_t i = 0; i < 2*n; ++i) putchar(' ');
-    vprintf(fmt, ap);
+    fprintf(f, "%*s", (int)(2*n), "");
+    vfprintf(f, fmt, ap);
     va_end(ap);
 }
 
-void ast_print(ast_node_t *root) {
-    ast_print_internal(root, 0);
+void ast_print(ast_node_t *root, FILE *f) {
+    ast_print_internal(f, root, 0);
 }
 
-static void ast_print_internal(ast_node_t *root, size_t n) {
-    char pad[2*n+1];
-    memset(pad, ' ', 2*n);
-    pad[2*n] = '\0';
+static void ast_print_internal(FILE *f, ast_node_t *root, size_t n) {
+    /* a buffer of the indent in every frame would take stack quadratic in
+     * the depth */
+    int pad = 2*n;
 
     switch(root->type) {
     case AST_TU: {
         ast_node_tu_t *node = (void *)root;
-        printf("%sTranslationUnit\n", pad);
+        fprintf(f, "%*sTranslationUnit\n", pad, "");
+        for(size_t i = 0; i < node->externs->sz; ++i)
+            ast_print_internal(f, vec_get(node->externs, i), n+1);
         for(size_t i = 0; i < node->functions->sz; ++i)
-            ast_print_internal(vec_get(node->functions, i), n+1);
+            ast_print_internal(f, vec_get(node->functions, i), n+1);
         break;
     }
 
+    case AST_FN_DECL:
     case AST_FN_DEFN: {
         ast_node_fn_defn_t *node = (void *)root;
-        printf("%sFunction[%.*s(",
-               pad, (int)node->ident->name_sz, node->ident->name);
+        fprintf(f, "%*s%s[%.*s(", pad, "",
+                root->type == AST_FN_DECL ? "Extern" : "Function",
+                (int)node->ident->name_sz, node->ident->name);
         for(size_t i = 0; i < node->arguments->sz; ++i) {
             ast_node_ident_t *arg = vec_get(node->arguments, i);
-            printf("%.*s,", (int)arg->name_sz, arg->name);
+            fprintf(f, "%.*s,", (int)arg->name_sz, arg->name);
         }
-        printf(")]\n");
+        fprintf(f, ")]\n");
         for(size_t i = 0; i < node->body->sz; ++i)
-            ast_print_internal(vec_get(node->body, i), n+1);
+            ast_print_internal(f, vec_get(node->body, i), n+1);
         break;
     }
 
     case AST_STMT_DECL: {
         ast_node_stmt_decl_t *node = (void *)root;
-        printf("%sDeclaration[%.*s]\n",
-               pad, (int)node->ident->name_sz, node->ident->name);
-        ast_print_internal(node->expr, n+1);
+        fprintf(f, "%*sDeclaration[%.*s]\n",
+                pad, "", (int)node->ident->name_sz, node->ident->name);
+        ast_print_internal(f, node->expr, n+1);
         break;
     }
 
     case AST_STMT_EXPR: {
         ast_node_stmt_expr_t *node = (void *)root;
-        printf("%sExpressionStatement\n", pad);
-        ast_print_internal(node->expr, n+1);
+        fprintf(f, "%*sExpressionStatement\n", pad, "");
+        ast_print_internal(f, node->expr, n+1);
         break;
     }
 
     case AST_STMT_IF: {
         ast_node_stmt_if_t *node = (void *)root;
-        printf("%sIfStatement\n", pad);
+        fprintf(f, "%*sIfStatement\n", pad, "");
 
-        pad_printf(n+1, "Condition\n");
-        ast_print_internal(node->condition, n+2);
+        pad_printf(f, n+1, "Condition\n");
+        ast_print_internal(f, node->condition, n+2);
 
-        pad_printf(n+1, "TrueBranch\n");
+        pad_printf(f, n+1, "TrueBranch\n");
         for(size_t i = 0; i < node->branch_true->sz; ++i)
-            ast_print_internal(vec_get(node->branch_true, i), n+2);
+            ast_print_internal(f, vec_get(node->branch_true, i), n+2);
 
-        pad_printf(n+1, "FalseBranch\n");
+        pad_printf(f, n+1, "FalseBranch\n");
         for(size_t i = 0; i < node->branch_false->sz; ++i)
-            ast_print_internal(vec_get(node->branch_false, i), n+2);
+            ast_print_internal(f, vec_get(node->branch_false, i), n+2);
 
         break;
     }
 
     case AST_STMT_RET: {
         ast_node_stmt_ret_t *node = (void *)root;
-        printf("%sReturnStatement\n", pad);
-        ast_print_internal(node->expr, n+1);
+        fprintf(f, "%*sReturnStatement\n", pad, "");
+        ast_print_internal(f, node->expr, n+1);
         break;
     }
 
     case AST_STMT_BLOCK: {
         ast_node_stmt_block_t *node = (void *)root;
-        printf("%sBlockStatement\n", pad);
+        fprintf(f, "%*sBlockStatement\n", pad, "");
         for(size_t i = 0; i < node->stmts->sz; ++i)
-            ast_print_internal(vec_get(node->stmts, i), n+1);
+            ast_print_internal(f, vec_get(node->stmts, i), n+1);
         break;
     }
 
@@ -243,13 +257,13 @@ static void ast_print_internal(ast_node_t *root, size_t n) {
         [EXPR_DIV] = "/",
         [EXPR_MOD] = "%",
         };
-        printf("%sBinaryOperation[%s]\n", pad, ops[node->type]);
+        fprintf(f, "%*sBinaryOperation[%s]\n", pad, "", ops[node->type]);
 
-        pad_printf(n+1, "Left\n");
-        ast_print_internal(node->left, n+2);
+        pad_printf(f, n+1, "Left\n");
+        ast_print_internal(f, node->left, n+2);
 
-        pad_printf(n+1, "Right\n");
-        ast_print_internal(node->right, n+2);
+        pad_printf(f, n+1, "Right\n");
+        ast_print_internal(f, node->right, n+2);
         break;
     }
 
@@ -259,34 +273,365 @@ static void ast_print_internal(ast_node_t *root, size_t n) {
         [EXPR_LNOT] = "!",
         [EXPR_BITNOT] = "~",
         };
-        printf("%sUnaryOperation[%s]\n", pad, ops[node->type]);
-        ast_print_internal(node->op, n+1);
+        fprintf(f, "%*sUnaryOperation[%s]\n", pad, "", ops[node->type]);
+        ast_print_internal(f, node->op, n+1);
         break;
     }
 
     case AST_EXPR_CALL: {
         ast_node_expr_call_t *node = (void *)root;
-        printf("%sFunctionCall[%.*s]\n",
-               pad, (int)node->ident->name_sz, node->ident->name);
+        fprintf(f, "%*sFunctionCall[%.*s]\n",
+                pad, "", (int)node->ident->name_sz, node->ident->name);
         for(size_t i = 0; i < node->args->sz; ++i)
-            ast_print_internal(vec_get(node->args, i), n+1);
+            ast_print_internal(f, vec_get(node->args, i), n+1);
         break;
     }
 
     case AST_IDENT: {
         ast_node_ident_t *node = (void *)root;
-        printf("%sIdentifier[%.*s]\n", pad, (int)node->name_sz, node->name);
+        fprintf(f, "%*sIdentifier[%.*s]\n", pad, "", (int)node->name_sz,
+                node->name);
         break;
     }
 
     case AST_CONST: {
         ast_node_const_t *node = (void *)root;
-        printf("%sConstant[%"PRId64"]\n", pad, node->value);
+        fprintf(f, "%*sConstant[%"PRId64"]\n", pad, "", node->value);
         break;
     }
 
     default:
-        printf("%sUnknownNode\n", pad);
+        fprintf(f, "%*sUnknownNode\n", pad, "");
         break;
     }
 }
+
+/* one S-expression per function and line, identifiers are bare and constants
+ * are numbers */
+void ast_print_compact(ast_node_t *root, FILE *f) {
+    switch(root->type) {
+    case AST_TU: {
+        ast_node_tu_t *node = (void *)root;
+        for(size_t i = 0; i < node->externs->sz; ++i) {
+            ast_print_compact(vec_get(node->externs, i), f);
+            fputc('\n', f);
+        }
+        for(size_t i = 0; i < node->functions->sz; ++i) {
+            ast_print_compact(vec_get(node->functions, i), f);
+            fputc('\n', f);
+        }
+        return;
+    }
+
+    case AST_FN_DECL:
+    case AST_FN_DEFN: {
+        ast_node_fn_defn_t *node = (void *)root;
+        fputs(root->type == AST_FN_DECL ? "(extern " : "(fn ", f);
+        ast_print_compact((void *)node->ident, f);
+        fputs(" (", f);
+        for(size_t i = 0; i < node->arguments->sz; ++i) {
+            if(i) fputc(' ', f);
+            ast_print_compact(vec_get(node->arguments, i), f);
+        }
+        fputc(')', f);
+        ast_print_compact_vec(f, node->body);
+        break;
+    }
+
+    case AST_STMT_DECL: {
+        ast_node_stmt_decl_t *node = (void *)root;
+        fputs("(let ", f);
+        ast_print_compact((void *)node->ident, f);
+        fputc(' ', f);
+        ast_print_compact(node->expr, f);
+        break;
+    }
+
+    case AST_STMT_EXPR: {
+        ast_node_stmt_expr_t *node = (void *)root;
+        fputs("(expr ", f);
+        ast_print_compact(node->expr, f);
+        break;
+    }
+
+    case AST_STMT_IF: {
+        ast_node_stmt_if_t *node = (void *)root;
+        fputs("(if ", f);
+        ast_print_compact(node->condition, f);
+        fputs(" (then", f);
+        ast_print_compact_vec(f, node->branch_true);
+        fputs(") (else", f);
+        ast_print_compact_vec(f, node->branch_false);
+        fputc(')', f);
+        break;
+    }
+
+    case AST_STMT_RET: {
+        ast_node_stmt_ret_t *node = (void *)root;
+        fputs("(ret ", f);
+        ast_print_compact(node->expr, f);
+        break;
+    }
+
+    case AST_STMT_BLOCK: {
+        ast_node_stmt_block_t *node = (void *)root;
+        fputs("(block", f);
+        ast_print_compact_vec(f, node->stmts);
+        break;
+    }
+
+    case AST_EXPR_BINARY: {
+        ast_node_expr_binary_t *node = (void *)root;
+        static const char *ops[] = {
+        [EXPR_LOR] = "||",
+        [EXPR_LAND] = "&&",
+        [EXPR_BITOR] = "|",
+        [EXPR_BITXOR] = "^",
+        [EXPR_BITAND] = "&",
+        [EXPR_EQ] = "==",
+        [EXPR_NEQ] = "!=",
+        [EXPR_LT] = "<",
+        [EXPR_GT] = ">",
+        [EXPR_LEQ] = "<=",
+        [EXPR_GEQ] = ">=",
+        [EXPR_ADD] = "+",
+        [EXPR_SUB] = "-",
+        [EXPR_MULT] = "*",
+        [EXPR_DIV] = "/",
+        [EXPR_MOD] = "%",
+        };
+        fprintf(f, "(%s ", ops[node->type]);
+        ast_print_compact(node->left, f);
+        fputc(' ', f);
+        ast_print_compact(node->right, f);
+        break;
+    }
+
+    case AST_EXPR_UNARY: {
+        ast_node_expr_unary_t *node = (void *)root;
+        fputs(node->type == EXPR_LNOT ? "(! " : "(~ ", f);
+        ast_print_compact(node->op, f);
+        break;
+    }
+
+    case AST_EXPR_CALL: {
+        ast_node_expr_call_t *node = (void *)root;
+        fputs("(call ", f);
+        ast_print_compact((void *)node->ident, f);
+        ast_print_compact_vec(f, node->args);
+        break;
+    }
+
+    case AST_IDENT: {
+        ast_node_ident_t *node = (void *)root;
+        fwrite(node->name, 1, node->name_sz, f);
+        return;
+    }
+
+    case AST_CONST: {
+        ast_node_const_t *node = (void *)root;
+        fprintf(f, "%"PRId64, node->value);
+        return;
+    }
+    }
+    fputc(')', f);
+}
+
+/* the nodes each preceded by a space */
+static void ast_print_compact_vec(FILE *f, vec_t *v) {
+    for(size_t i = 0; i < v->sz; ++i) {
+        fputc(' ', f);
+        ast_print_compact(vec_get(v, i), f);
+    }
+}
+
+/* 64-bit FNV-1a of a tree, what semantic analysis adds is not included */
+uint64_t ast_hash(ast_node_t *root) {
+    return ast_hash_internal(0xcbf29ce484222325u, root);
+}
+
+static uint64_t ast_hash_internal(uint64_t h, ast_node_t *root) {
+    h = ast_hash_bytes(h, &root->type, sizeof root->type);
+
+    switch(root->type) {
+    case AST_TU: {
+        ast_node_tu_t *node = (void *)root;
+        h = ast_hash_vec(h, node->externs);
+        h = ast_hash_vec(h, node->functions);
+        break;
+    }
+
+    case AST_FN_DECL:
+    case AST_FN_DEFN: {
+        ast_node_fn_defn_t *node = (void *)root;
+        h = ast_hash_internal(h, (void *)node->ident);
+        h = ast_hash_vec(h, node->arguments);
+        h = ast_hash_vec(h, node->body);
+        break;
+    }
+
+    case AST_STMT_DECL: {
+        ast_node_stmt_decl_t *node = (void *)root;
+        h = ast_hash_internal(h, (void *)node->ident);
+        h = ast_hash_internal(h, node->expr);
+        break;
+    }
+
+    case AST_STMT_EXPR: {
+        ast_node_stmt_expr_t *node = (void *)root;
+        h = ast_hash_internal(h, node->expr);
+        break;
+    }
+
+    case AST_STMT_IF: {
+        ast_node_stmt_if_t *node = (void *)root;
+        h = ast_hash_internal(h, node->condition);
+        h = ast_hash_vec(h, node->branch_true);
+        h = ast_hash_vec(h, node->branch_false);
+        break;
+    }
+
+    case AST_STMT_RET: {
+        ast_node_stmt_ret_t *node = (void *)root;
+        h = ast_hash_internal(h, node->expr);
+        break;
+    }
+
+    case AST_STMT_BLOCK: {
+        ast_node_stmt_block_t *node = (void *)root;
+        h = ast_hash_vec(h, node->stmts);
+        break;
+    }
+
+    case AST_EXPR_BINARY: {
+        ast_node_expr_binary_t *node = (void *)root;
+        h = ast_hash_bytes(h, &node->type, sizeof node->type);
+        h = ast_hash_internal(h, node->left);
+        h = ast_hash_internal(h, node->right);
+        break;
+    }
+
+    case AST_EXPR_UNARY: {
+        ast_node_expr_unary_t *node = (void *)root;
+        h = ast_hash_bytes(h, &node->type, sizeof node->type);
+        h = ast_hash_internal(h, node->op);
+        break;
+    }
+
+    case AST_EXPR_CALL: {
+        ast_node_expr_call_t *node = (void *)root;
+        h = ast_hash_internal(h, (void *)node->ident);
+        h = ast_hash_vec(h, node->args);
+        break;
+    }
+
+    case AST_IDENT: {
+        ast_node_ident_t *node = (void *)root;
+        h = ast_hash_bytes(h, &node->name_sz, sizeof node->name_sz);
+        h = ast_hash_bytes(h, node->name, node->name_sz);
+        break;
+    }
+
+    case AST_CONST: {
+        ast_node_const_t *node = (void *)root;
+        h = ast_hash_bytes(h, &node->value, sizeof node->value);
+        break;
+    }
+    }
+    return h;
+}
+
+/* the size keeps neighbouring lists from hashing the same */
+static uint64_t ast_hash_vec(uint64_t h, vec_t *v) {
+    h = ast_hash_bytes(h, &v->sz, sizeof v->sz);
+    for(size_t i = 0; i < v->sz; ++i)
+        h = ast_hash_internal(h, vec_get(v, i));
+    return h;
+}
+
+static uint64_t ast_hash_bytes(uint64_t h, const void *data, size_t sz) {
+    for(size_t i = 0; i < sz; ++i)
+        h = (h ^ ((const unsigned char *)data)[i]) * 0x100000001b3u;
+    return h;
+}
+
+/* number of nodes in the tree */
+size_t ast_count(ast_node_t *root) {
+    size_t n = 1;
+    switch(root->type) {
+    case AST_TU: {
+        ast_node_tu_t *node = (void *)root;
+        n += ast_count_vec(node->externs);
+        n += ast_count_vec(node->functions);
+        break;
+    }
+
+    case AST_FN_DECL:
+    case AST_FN_DEFN: {
+        ast_node_fn_defn_t *node = (void *)root;
+        n += ast_count((void *)node->ident);
+        n += ast_count_vec(node->arguments);
+        n += ast_count_vec(node->body);
+        break;
+    }
+
+    case AST_STMT_DECL: {
+        ast_node_stmt_decl_t *node = (void *)root;
+        n += ast_count((void *)node->ident) + ast_count(node->expr);
+        break;
+    }
+
+    case AST_STMT_EXPR: {
+        ast_node_stmt_expr_t *node = (void *)root;
+        n += ast_count(node->expr);
+        break;
+    }
+
+    case AST_STMT_IF: {
+        ast_node_stmt_if_t *node = (void *)root;
+        n += ast_count(node->condition);
+        n += ast_count_vec(node->branch_true);
+        n += ast_count_vec(node->branch_false);
+        break;
+    }
+
+    case AST_STMT_RET: {
+        ast_node_stmt_ret_t *node = (void *)root;
+        n += ast_count(node->expr);
+        break;
+    }
+
+    case AST_STMT_BLOCK: {
+        ast_node_stmt_block_t *node = (void *)root;
+        n += ast_count_vec(node->stmts);
+        break;
+    }
+
+    case AST_EXPR_BINARY: {
+        ast_node_expr_binary_t *node = (void *)root;
+        n += ast_count(node->left) + ast_count(node->right);
+        break;
+    }
+
+    case AST_EXPR_UNARY: {
+        ast_node_expr_unary_t *node = (void *)root;
+        n += ast_count(node->op);
+        break;
+    }
+
+    case AST_EXPR_CALL: {
+        ast_node_expr_call_t *node = (void *)root;
+        n += ast_count((void *)node->ident) + ast_count_vec(node->args);
+        break;
+    }
+
+    case AST_IDENT: case AST_CONST: break;
+    }
+    return n;
+}
+
+static size_t ast_count_vec(vec_t *v) {
+    size_t n = 0;
+    for(size_t i = 0; i < v->sz; ++i) n += ast_count(vec_get(v, i));
+    return n;
+}
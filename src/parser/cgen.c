@@ -0,0 +1,301 @@
+#include <parser/code.h>
+#include <utils/alloc.h>
+#include <utils/trace.h>
+#include <inttypes.h>
+#include <string.h>
+
+/* lowering of the stack IR to C
+ *
+ * The depth of the stack is known at every instruction, so each depth is a
+ * local s<n> of the function, variables are locals l<n> and arguments a<n>.
+ * Evaluation happens in the order of the IR through those locals, which the
+ * C compiler turns back into registers. Functions of the program are named
+ * f_<name> and those of the runtime rt_<name>, so neither can clash. */
+
+/* large enough for any operand printed by c_operand */
+#define OPERAND_SZ 32
+
+/* wraps around like the machine code does, and traps on division by zero and
+ * overflow where idiv would */
+static const char c_head[] = ""
+"#include <inttypes.h>\n"
+"#include <signal.h>\n"
+"#include <stdint.h>\n"
+"#include <stdio.h>\n"
+"\n"
+"#define WRAP(a, op, b) ((int64_t)((uint64_t)(a) op (uint64_t)(b)))\n"
+"\n"
+"static int64_t rt_div(int64_t a, int64_t b) {\n"
+"    if(b == 0 || (a == INT64_MIN && b == -1)) return raise(SIGFPE), 0;\n"
+"    return a / b;\n"
+"}\n"
+"\n"
+"static int64_t rt_mod(int64_t a, int64_t b) {\n"
+"    if(b == 0 || (a == INT64_MIN && b == -1)) return raise(SIGFPE), 0;\n"
+"    return a % b;\n"
+"}\n"
+"\n"
+"static int64_t rt_print(int64_t v) {\n"
+"    printf(\"%\" PRId64 \"\\n\", v);\n"
+"    return 0;\n"
+"}\n"
+"\n"
+"static int64_t rt_input(void) {\n"
+"    int64_t v;\n"
+"    return scanf(\"%\" SCNd64, &v) == 1 ? v : 0;\n"
+"}\n"
+;
+
+static const char *c_binops[] = {
+[IR_ADD] = "WRAP(%s, +, %s)",
+[IR_SUB] = "WRAP(%s, -, %s)",
+[IR_MUL] = "WRAP(%s, *, %s)",
+[IR_DIV] = "rt_div(%s, %s)",
+[IR_MOD] = "rt_mod(%s, %s)",
+[IR_BITOR] = "%s | %s",
+[IR_BITAND] = "%s & %s",
+[IR_BITXOR] = "%s ^ %s",
+[IR_LOR] = "(%s | %s) != 0",
+[IR_LAND] = "%s && %s",
+[IR_LT] = "%s < %s",
+[IR_GT] = "%s > %s",
+[IR_LEQ] = "%s <= %s",
+[IR_GEQ] = "%s >= %s",
+[IR_EQ] = "%s == %s",
+[IR_NEQ] = "%s != %s",
+};
+
+static void c_signature(FILE *, function_ref_t *);
+static int c_generate_fn(FILE *, ir_code_t *, size_t, size_t);
+
+/* an argument is at [rbp+8*(1+n-i)], a local at a negative offset */
+static const char *c_variable(char *buf, function_ref_t *fn,
+                              variable_ref_t *ref) {
+    if(ref->bp_offset > 0)
+        snprintf(buf, OPERAND_SZ, "a%zu",
+                 fn->num_args + 1 - (size_t)ref->bp_offset / 8);
+    else snprintf(buf, OPERAND_SZ, "l%zu", (size_t)-ref->bp_offset / 8);
+    return buf;
+}
+
+static const char *c_operand(char *buf, function_ref_t *fn,
+                             ir_instr_data_t *data) {
+    if(data->variable) return c_variable(buf, fn, data->ref);
+    /* INT64_MIN can not be written as a negated constant */
+    if(data->imm == INT64_MIN) snprintf(buf, OPERAND_SZ, "INT64_MIN");
+    else snprintf(buf, OPERAND_SZ, "INT64_C(%"PRId64")", data->imm);
+    return buf;
+}
+
+/* the program as a C translation unit with the libc runtime, functions are
+ * static so the C compiler sees every caller */
+int c_generate(FILE *f, ir_code_t *code) {
+    int ret = 0;
+    function_ref_t *main_ref = NULL;
+    vec_t *ins = code->instructions;
+    fputs(c_head, f);
+
+    /* every function is declared before any calls it */
+    fputc('\n', f);
+    for(size_t i = 0; i < ins->sz; ++i) {
+        ir_instr_func_t *in = vec_get(ins, i);
+        if(in->hdr.type != IR_FUNC) continue;
+        c_signature(f, in->ref);
+        fputs(";\n", f);
+        if(in->ref->name_sz == 4 && !memcmp(in->ref->name, "main", 4))
+            main_ref = in->ref;
+    }
+    if(!main_ref) {
+        fprintf(code->ctx->err, "[Error] No main function to start from\n");
+        return 1;
+    }
+
+    for(size_t i = 0, end; i < ins->sz; i = end) {
+        for(end = i + 1; end < ins->sz
+            && ((ir_instr_t *)vec_get(ins, end))->type != IR_FUNC; ++end);
+        if((ret = c_generate_fn(f, code, i, end))) return ret;
+    }
+
+    /* main is called with its arguments 0 */
+    fputs("\nint main(void) {\n    return (int)f_main(", f);
+    for(size_t i = 0; i < main_ref->num_args; ++i)
+        fprintf(f, "%s0", i ? ", " : "");
+    fputs(");\n}\n", f);
+    if(ferror(f)) {
+        fprintf(code->ctx->err, "[Error] Failed to write C\n");
+        ret = 1;
+    }
+    return ret;
+}
+
+static void c_signature(FILE *f, function_ref_t *ref) {
+    fprintf(f, "static int64_t f_%.*s(", (int)ref->name_sz, ref->name);
+    for(size_t i = 0; i < ref->num_args; ++i)
+        fprintf(f, "%sint64_t a%zu", i ? ", " : "", i);
+    if(!ref->num_args) fputs("void", f);
+    fputc(')', f);
+}
+
+/* the instructions from first up to end are one function */
+static int c_generate_fn(FILE *f, ir_code_t *code, size_t first,
+                         size_t end) {
+    vec_t *ins = code->instructions;
+    ir_instr_func_t *func = vec_get(ins, first);
+    if(func->hdr.type != IR_FUNC) {
+        fprintf(code->ctx->err, "[Error] Function code does not start with "
+                "FUNC\n");
+        return 1;
+    }
+    function_ref_t *fn = func->ref;
+    uint64_t start = trace_begin();
+
+    /* the deepest the stack and the lowest the locals get */
+    size_t depth = 0, max_depth = 0, num_locals = 0;
+    for(size_t i = first; i < end; ++i) {
+        ir_instr_data_t *in = vec_get(ins, i);
+        switch(in->hdr.type) {
+        case IR_PUSH: case IR_SAVE:
+            if(++depth > max_depth) max_depth = depth;
+            break;
+        case IR_POP: case IR_ASSIGN: case IR_IF: case IR_RET: case IR_LNOT:
+        case IR_BITNOT:
+            --depth;
+            break;
+        case IR_CALL:
+            depth -= ((ir_instr_func_t *)in)->ref->num_args;
+            break;
+        default:
+            if(in->hdr.type < sizeof c_binops / sizeof *c_binops
+            && c_binops[in->hdr.type])
+                depth -= 2;
+            break;
+        }
+        if((in->hdr.type == IR_PUSH || in->hdr.type == IR_POP
+         || in->hdr.type == IR_ASSIGN) && in->variable
+        && in->ref->bp_offset < 0
+        && (size_t)-in->ref->bp_offset / 8 > num_locals)
+            num_locals = -in->ref->bp_offset / 8;
+    }
+
+    fputc('\n', f);
+    c_signature(f, fn);
+    fputs(" {\n    int64_t acc = 0;\n", f);
+    for(size_t i = 1; i <= num_locals; ++i)
+        fprintf(f, "    int64_t l%zu = 0;\n", i);
+    for(size_t i = 0; i < max_depth; ++i)
+        fprintf(f, "    int64_t s%zu;\n", i);
+    fputs("    (void)acc;\n", f);
+
+    /* depth at each label, taken from the jumps to it */
+    size_t *labels = alloc_malloc(ALLOC_OTHER,
+                                  sizeof(size_t) * (code->num_label + 1));
+    for(size_t i = 0; i <= code->num_label; ++i) labels[i] = SIZE_MAX;
+
+    int ret = 0;
+    char a[OPERAND_SZ], b[OPERAND_SZ];
+    depth = 0;
+    for(size_t i = first + 1; i < end; ++i) {
+        union {
+            ir_instr_t *i;
+            ir_instr_data_t *data;
+            ir_instr_func_t *func;
+            ir_instr_if_t *iif;
+            ir_instr_label_t *label;
+        } in = { .i = vec_get(ins, i) };
+        enum ir_instr_type type = in.i->type;
+
+        switch(type) {
+        case IR_NOP: case IR_SCOPEBEGIN: case IR_SCOPEEND: break;
+
+        case IR_PUSH:
+            fprintf(f, "    s%zu = %s;\n", depth++, c_operand(a, fn, in.data));
+            break;
+
+        case IR_POP:
+            fprintf(f, "    %s = s%zu;\n", c_variable(a, fn, in.data->ref),
+                    --depth);
+            break;
+
+        case IR_ASSIGN:
+            fprintf(f, "    %s = acc = s%zu;\n",
+                    c_variable(a, fn, in.data->ref), --depth);
+            break;
+
+        case IR_SAVE:
+            fprintf(f, "    s%zu = acc;\n", depth++);
+            break;
+
+        case IR_BITNOT:
+            --depth;
+            fprintf(f, "    acc = ~s%zu;\n", depth);
+            break;
+
+        case IR_LNOT:
+            --depth;
+            fprintf(f, "    acc = !s%zu;\n", depth);
+            break;
+
+        case IR_CALL: {
+            function_ref_t *ref = in.func->ref;
+            depth -= ref->num_args;
+            /* calls of print and input go to the runtime */
+            int rt = ref->name_sz == 5 && (!memcmp(ref->name, "print", 5)
+                                        || !memcmp(ref->name, "input", 5));
+            fprintf(f, "    acc = %s_%.*s(", rt ? "rt" : "f",
+                    (int)ref->name_sz, ref->name);
+            for(size_t j = 0; j < ref->num_args; ++j)
+                fprintf(f, "%ss%zu", j ? ", " : "", depth + j);
+            fputs(");\n", f);
+            break;
+        }
+
+        case IR_LEAVE:
+            /* implicit return 0 */
+            fputs("    return 0;\n", f);
+            break;
+
+        case IR_IF:
+            labels[in.iif->false_label] = --depth;
+            fprintf(f, "    if(!s%zu) goto L%zu;\n", depth,
+                    in.iif->false_label);
+            break;
+
+        case IR_LABEL:
+            if(labels[in.label->id] != SIZE_MAX)
+                depth = labels[in.label->id];
+            fprintf(f, "L%zu:;\n", in.label->id);
+            break;
+
+        case IR_RET:
+            fprintf(f, "    return s%zu;\n", --depth);
+            break;
+
+        case IR_JMP:
+            labels[in.label->id] = depth;
+            fprintf(f, "    goto L%zu;\n", in.label->id);
+            break;
+
+        default:
+            if((size_t)type >= sizeof c_binops / sizeof *c_binops
+            || !c_binops[type]) {
+                fprintf(code->ctx->err, "[Error] Invalid instruction in IR "
+                        "code\n");
+                ret = 1;
+                goto ret;
+            }
+            depth -= 2;
+            snprintf(a, sizeof a, "s%zu", depth);
+            snprintf(b, sizeof b, "s%zu", depth + 1);
+            fputs("    acc = ", f);
+            fprintf(f, c_binops[type], a, b);
+            fputs(";\n", f);
+            break;
+        }
+    }
+    fputs("}\n", f);
+
+ret:
+    alloc_free(ALLOC_OTHER, labels);
+    trace_end("c", fn->name, fn->name_sz, start);
+    return ret;
+}
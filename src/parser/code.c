@@ -1,13 +1,8 @@
 #include <parser/code.h>
+#include <utils/alloc.h>
+#include <utils/trace.h>
 #include <stdlib.h>
 
-static inline ir_instr_data_t *instr_new_var_find(enum ir_instr_type, scope_t *,
-                                                  ast_node_ident_t *);
-static inline ir_instr_func_t *instr_new_func_find(enum ir_instr_type,
-                                                   ir_code_t *,
-                                                   ast_node_ident_t *);
-
-static int code_generate_fn(ir_code_t *, ast_node_fn_defn_t *);
 static int code_generate_block(ir_code_t *, scope_t *, vec_t *);
 static int code_generate_stmt(ir_code_t *, scope_t *, ast_node_t *);
 static int code_generate_expr(ir_code_t *, scope_t *, ast_node_t *, int);
@@ -29,48 +24,42 @@ static const unsigned short instrtypeidx[] = {
 };
 
 ir_instr_t *instr_new(enum ir_instr_type type) {
-    ir_instr_t *instr = malloc(sizeof(ir_instr_t));
+    ir_instr_t *instr = alloc_malloc(ALLOC_IR, sizeof(ir_instr_t));
     instr->type = type;
     return instr;
 }
 
+void instr_free(ir_instr_t *instr) {
+    alloc_free(ALLOC_IR, instr);
+}
+
 ir_instr_label_t *instr_new_label(enum ir_instr_type type, size_t id) {
-    ir_instr_label_t *instr = malloc(sizeof(ir_instr_label_t));
+    ir_instr_label_t *instr = alloc_malloc(ALLOC_IR, sizeof(ir_instr_label_t));
     instr->hdr.type = type;
     instr->id = id;
     return instr;
 }
 
 ir_instr_if_t *instr_new_if(ir_code_t *code, ast_node_stmt_if_t *stmt) {
-    ir_instr_if_t *instr = malloc(sizeof(ir_instr_if_t));
+    ir_instr_if_t *instr = alloc_malloc(ALLOC_IR, sizeof(ir_instr_if_t));
     instr->hdr.type = IR_IF;
-    instr->false_label = stmt->branch_false->sz ? code->num_label++ : 0;
     instr->end_label = code->num_label++;
+    /* without an else branch a false condition jumps straight to the end */
+    instr->false_label = stmt->branch_false->sz ? code->num_label++
+                                                : instr->end_label;
     return instr;
 }
 
 ir_instr_data_t *instr_new_var(enum ir_instr_type type, variable_ref_t *ref) {
-    ir_instr_data_t *instr = malloc(sizeof(ir_instr_data_t));
+    ir_instr_data_t *instr = alloc_malloc(ALLOC_IR, sizeof(ir_instr_data_t));
     instr->hdr.type = type;
     instr->variable = 1;
     instr->ref = ref;
     return instr;
 }
 
-static inline ir_instr_data_t *instr_new_var_find(enum ir_instr_type type,
-                                                  scope_t *scope,
-                                                  ast_node_ident_t *ident) {
-    return instr_new_var(type, variable_ref_find(scope, ident));
-}
-
-static inline ir_instr_func_t *instr_new_func_find(enum ir_instr_type type,
-                                                   ir_code_t *code,
-                                                   ast_node_ident_t *ident) {
-    return instr_new_func(type, function_ref_find(code->ctx, ident));
-}
-
 ir_instr_data_t *instr_new_imm(enum ir_instr_type type, int64_t imm) {
-    ir_instr_data_t *instr = malloc(sizeof(ir_instr_data_t));
+    ir_instr_data_t *instr = alloc_malloc(ALLOC_IR, sizeof(ir_instr_data_t));
     instr->hdr.type = type;
     instr->variable = 0;
     instr->imm = imm;
@@ -78,7 +67,7 @@ ir_instr_data_t *instr_new_imm(enum ir_instr_type type, int64_t imm) {
 }
 
 ir_instr_func_t *instr_new_func(enum ir_instr_type type, function_ref_t *ref) {
-    ir_instr_func_t *instr = malloc(sizeof(ir_instr_func_t));
+    ir_instr_func_t *instr = alloc_malloc(ALLOC_IR, sizeof(ir_instr_func_t));
     instr->hdr.type = type;
     instr->ref = ref;
     return instr;
@@ -90,10 +79,10 @@ const char *instr_type_str(enum ir_instr_type type) {
 }
 
 ir_code_t *code_new(ast_node_tu_t *tu) {
-    ir_code_t *code = malloc(sizeof(ir_code_t));
+    ir_code_t *code = alloc_malloc(ALLOC_IR, sizeof(ir_code_t));
     code->ctx = tu->ctx;
     code->num_label = 0;
-    code->instructions = vec_new_free(1, free);
+    code->instructions = vec_new_free(1, (vec_free_t)instr_free);
 
     for(size_t i = 0; i < tu->functions->sz; ++i)
         if(code_generate_fn(code, vec_get(tu->functions, i)))
@@ -104,17 +93,20 @@ ir_code_t *code_new(ast_node_tu_t *tu) {
 
 void code_free(ir_code_t *code) {
     vec_free(code->instructions);
-    free(code);
+    alloc_free(ALLOC_IR, code);
 }
 
-static int code_generate_fn(ir_code_t *code, ast_node_fn_defn_t *fn) {
+/* appends the code of an analyzed function to the instructions */
+int code_generate_fn(ir_code_t *code, ast_node_fn_defn_t *fn) {
     int ret = 0;
+    uint64_t start = trace_begin();
     vec_t *ins = code->instructions;
     vec_push(ins, instr_new_func(IR_FUNC, fn->ref));
     if((ret = code_generate_block(code, fn->scope, fn->body)))
         goto ret;
     vec_push(ins, instr_new(IR_LEAVE));
 ret:
+    trace_end("ir", fn->ident->name, fn->ident->name_sz, start);
     return ret;
 }
 
@@ -147,7 +139,7 @@ static int code_generate_stmt(ir_code_t *code, scope_t *scope, ast_node_t *root)
         ast_node_stmt_decl_t *stmt = (void *)root;
         if((ret = code_generate_expr(code, scope, stmt->expr, 1)))
             goto ret;
-        vec_push(ins, instr_new_var_find(IR_ASSIGN, scope, stmt->ident));
+        vec_push(ins, instr_new_var(IR_ASSIGN, stmt->ident->ref));
         break;
     }
 
@@ -201,8 +193,8 @@ static int code_generate_stmt(ir_code_t *code, scope_t *scope, ast_node_t *root)
     }
 
     default:
-        fprintf(stderr, "[Error] Non-statement node type '%d' in a statement"
-                "list!\n", root->type);
+        fprintf(code->ctx->err, "[Error] Non-statement node type '%d' in a "
+                "statement list!\n", root->type);
         ret = 1;
         goto ret;
     }
@@ -267,7 +259,7 @@ static int code_generate_expr(ir_code_t *code, scope_t *scope, ast_node_t *root,
             if((ret = code_generate_expr(code, scope,
                                          vec_get(expr->args, i), 1)))
                 goto ret;
-        vec_push(ins, instr_new_func_find(IR_CALL, code, expr->ident));
+        vec_push(ins, instr_new_func(IR_CALL, expr->ref));
         break;
     }
 
@@ -279,12 +271,12 @@ static int code_generate_expr(ir_code_t *code, scope_t *scope, ast_node_t *root,
 
     case AST_IDENT: {
         ast_node_ident_t *ident = (void *)root;
-        if(save) vec_push(ins, instr_new_var_find(IR_PUSH, scope, ident));
+        if(save) vec_push(ins, instr_new_var(IR_PUSH, ident->ref));
         goto ret;
     }
 
     default:
-        fprintf(stderr, "[Error] Invalid node type '%d' found in an"
+        fprintf(code->ctx->err, "[Error] Invalid node type '%d' found in an"
                 "expression!\n", root->type);
         ret = 1;
         goto ret;
@@ -295,72 +287,113 @@ ret:
     return ret;
 }
 
-void code_dump(ir_code_t *code) {
+void code_dump(ir_code_t *code, FILE *f) {
     for(size_t i = 0; i < code->instructions->sz; ++i) {
         ir_instr_t *in = vec_get(code->instructions, i);
         switch(in->type) {
         case IR_PUSH:
-            printf("PUSH ");
+            fputs("PUSH ", f);
             if(0) {
         case IR_POP:
-            printf("POP ");
+            fputs("POP ", f);
             } if(0) {
         case IR_ASSIGN:
-            printf("ASSIGN ");
+            fputs("ASSIGN ", f);
             } if(0) {
         case IR_SCOPEBEGIN:
-            printf("SCOPEBEGIN ");
+            fputs("SCOPEBEGIN ", f);
             } if(0) {
         case IR_SCOPEEND:
-            printf("SCOPEEND ");
+            fputs("SCOPEEND ", f);
             }
             {
                 ir_instr_data_t *data = (void *)in;
                 if(data->variable)
-                    printf("%.*s [rbp%c%#zx]\n",
-                           (int)data->ref->name_sz, data->ref->name,
-                           data->ref->bp_offset < 0 ? '-' : '+',
-                           (size_t)llabs(data->ref->bp_offset));
+                    fprintf(f, "%.*s [rbp%c%#zx]\n",
+                            (int)data->ref->name_sz, data->ref->name,
+                            data->ref->bp_offset < 0 ? '-' : '+',
+                            (size_t)llabs(data->ref->bp_offset));
                 else
-                    printf("%zd\n", data->imm);
+                    fprintf(f, "%zd\n", data->imm);
             }
             break;
 
         case IR_CALL:
-            printf("CALL ");
+            fputs("CALL ", f);
             if(0) {
         case IR_FUNC:
-            printf("FUNC ");
+            fputs("FUNC ", f);
             }
             {
                 ir_instr_func_t *func = (void *)in;
-                printf("%.*s[%zu]\n", (int)func->ref->name_sz, func->ref->name,
-                    func->ref->num_args);
+                fprintf(f, "%.*s[%zu]\n", (int)func->ref->name_sz,
+                        func->ref->name, func->ref->num_args);
                 break;
             }
 
         case IR_IF: {
             ir_instr_if_t *iif = (void *)in;
-            printf("IF false:%zu end:%zu\n",
-                   iif->false_label, iif->end_label);
+            fprintf(f, "IF false:%zu end:%zu\n",
+                    iif->false_label, iif->end_label);
             break;
         }
 
         case IR_LABEL:
-            printf("LABEL ");
+            fputs("LABEL ", f);
             if(0) {
         case IR_JMP:
-            printf("JMP ");
+            fputs("JMP ", f);
             }
             {
                 ir_instr_label_t *label = (void *)in;
-                printf("%zu\n", label->id);
+                fprintf(f, "%zu\n", label->id);
                 break;
             }
 
         default:
-            printf("%s\n", instr_type_str(in->type));
+            fprintf(f, "%s\n", instr_type_str(in->type));
             break;
         }
     }
 }
+
+/* one instruction per line, the name and its operands separated by tabs:
+ * variables as name:offset, functions as name/arguments and labels as
+ * numbers */
+void code_dump_compact(ir_code_t *code, FILE *f) {
+    for(size_t i = 0; i < code->instructions->sz; ++i) {
+        ir_instr_t *in = vec_get(code->instructions, i);
+        fputs(instr_type_str(in->type), f);
+        switch(in->type) {
+        case IR_PUSH: case IR_POP: case IR_ASSIGN:
+        case IR_SCOPEBEGIN: case IR_SCOPEEND: {
+            ir_instr_data_t *data = (void *)in;
+            if(data->variable)
+                fprintf(f, "\t%.*s:%zd", (int)data->ref->name_sz,
+                        data->ref->name, data->ref->bp_offset);
+            else fprintf(f, "\t%zd", data->imm);
+            break;
+        }
+
+        case IR_CALL: case IR_FUNC: {
+            ir_instr_func_t *func = (void *)in;
+            fprintf(f, "\t%.*s/%zu", (int)func->ref->name_sz,
+                    func->ref->name, func->ref->num_args);
+            break;
+        }
+
+        case IR_IF: {
+            ir_instr_if_t *iif = (void *)in;
+            fprintf(f, "\t%zu\t%zu", iif->false_label, iif->end_label);
+            break;
+        }
+
+        case IR_LABEL: case IR_JMP:
+            fprintf(f, "\t%zu", ((ir_instr_label_t *)in)->id);
+            break;
+
+        default: break;
+        }
+        fputc('\n', f);
+    }
+}
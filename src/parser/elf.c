@@ -0,0 +1,298 @@
+#include <parser/elf.h>
+#include <utils/alloc.h>
+#include <elf.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+SH_NULL,
+SH_TEXT,
+SH_RODATA,
+SH_BSS,
+SH_RELA_TEXT,
+SH_SYMTAB,
+SH_STRTAB,
+SH_SHSTRTAB,
+SH_NOTE_STACK,
+SH_NUM,
+};
+
+static const struct shstrtab {
+    char null[1];
+    char text[sizeof ".text"];
+    char rodata[sizeof ".rodata"];
+    char bss[sizeof ".bss"];
+    char rela_text[sizeof ".rela.text"];
+    char symtab[sizeof ".symtab"];
+    char strtab[sizeof ".strtab"];
+    char shstrtab[sizeof ".shstrtab"];
+    char note_stack[sizeof ".note.GNU-stack"];
+} shstrtab = {
+    "", ".text", ".rodata", ".bss", ".rela.text", ".symtab", ".strtab",
+    ".shstrtab", ".note.GNU-stack",
+};
+
+#define SHNAME(f) offsetof(struct shstrtab, f)
+
+static const unsigned elf_reloc_type[] = {
+[X86_RELOC_PLT32] = R_X86_64_PLT32,
+[X86_RELOC_32] = R_X86_64_32,
+[X86_RELOC_64] = R_X86_64_64,
+};
+
+static void elf_push_sym(buf_t *symtab, buf_t *strtab, x86_sym_t *sym) {
+    Elf64_Sym s = {0};
+    if(sym) {
+        s.st_name = buf_push(strtab, sym->name, sym->name_sz);
+        buf_push_u8(strtab, '\0');
+
+        int bind = sym->global || sym->section == X86_SECT_UNDEF
+                 ? STB_GLOBAL : STB_LOCAL;
+        switch(sym->section) {
+        case X86_SECT_UNDEF:
+            s.st_info = ELF64_ST_INFO(bind, STT_NOTYPE);
+            s.st_shndx = SHN_UNDEF;
+            break;
+
+        case X86_SECT_TEXT:
+            s.st_info = ELF64_ST_INFO(bind, STT_FUNC);
+            s.st_shndx = SH_TEXT;
+            break;
+
+        case X86_SECT_RODATA:
+            s.st_info = ELF64_ST_INFO(bind, STT_OBJECT);
+            s.st_shndx = SH_RODATA;
+            break;
+
+        case X86_SECT_BSS:
+            s.st_info = ELF64_ST_INFO(bind, STT_OBJECT);
+            s.st_shndx = SH_BSS;
+            break;
+        }
+        s.st_value = sym->offset;
+        s.st_size = sym->size;
+    }
+    buf_push(symtab, &s, sizeof s);
+}
+
+int elf_write_obj(buf_t *out, x86_obj_t *obj) {
+    vec_t *syms = obj->symbols;
+    size_t *map = alloc_malloc(ALLOC_OTHER, sizeof(size_t) * (syms->sz + 1));
+    buf_t symtab, strtab, rela;
+    buf_init(&symtab, sizeof(Elf64_Sym) * (syms->sz + 3));
+    buf_init(&strtab, 16 * (syms->sz + 1));
+    buf_init(&rela, sizeof(Elf64_Rela) * (obj->relocs->sz + 1));
+
+    /* null symbol, then section symbols, then locals before all globals */
+    buf_push_u8(&strtab, '\0');
+    elf_push_sym(&symtab, &strtab, NULL);
+    for(size_t i = SH_TEXT; i <= SH_BSS; ++i) {
+        Elf64_Sym s = {
+        .st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION),
+        .st_shndx = i,
+        };
+        buf_push(&symtab, &s, sizeof s);
+    }
+
+    size_t first_global = 0;
+    for(int global = 0; global < 2; ++global) {
+        /* sh_info of .symtab is the index of the first global */
+        if(global) first_global = symtab.sz / sizeof(Elf64_Sym);
+        for(size_t i = 0; i < syms->sz; ++i) {
+            x86_sym_t *sym = vec_get(syms, i);
+            int is_global = sym->global || sym->section == X86_SECT_UNDEF;
+            if(is_global != global) continue;
+            map[i] = symtab.sz / sizeof(Elf64_Sym);
+            elf_push_sym(&symtab, &strtab, sym);
+        }
+    }
+
+    for(size_t i = 0; i < obj->relocs->sz; ++i) {
+        x86_reloc_t *rel = vec_get(obj->relocs, i);
+        Elf64_Rela r = {
+        .r_offset = rel->offset,
+        .r_info = ELF64_R_INFO(map[rel->sym], elf_reloc_type[rel->type]),
+        .r_addend = rel->addend,
+        };
+        buf_push(&rela, &r, sizeof r);
+    }
+
+    Elf64_Shdr sh[SH_NUM] = {0};
+
+    out->sz = 0;
+    buf_push(out, NULL, sizeof(Elf64_Ehdr));
+
+    buf_align(out, 16);
+    sh[SH_TEXT] = (Elf64_Shdr){
+    .sh_name = SHNAME(text),
+    .sh_type = SHT_PROGBITS,
+    .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+    .sh_offset = buf_push(out, obj->text.data, obj->text.sz),
+    .sh_size = obj->text.sz,
+    .sh_addralign = 16,
+    };
+
+    sh[SH_RODATA] = (Elf64_Shdr){
+    .sh_name = SHNAME(rodata),
+    .sh_type = SHT_PROGBITS,
+    .sh_flags = SHF_ALLOC,
+    .sh_offset = buf_push(out, obj->rodata.data, obj->rodata.sz),
+    .sh_size = obj->rodata.sz,
+    .sh_addralign = 1,
+    };
+
+    sh[SH_BSS] = (Elf64_Shdr){
+    .sh_name = SHNAME(bss),
+    .sh_type = SHT_NOBITS,
+    .sh_flags = SHF_ALLOC | SHF_WRITE,
+    .sh_offset = out->sz,
+    .sh_size = obj->bss_sz,
+    .sh_addralign = 16,
+    };
+
+    buf_align(out, 8);
+    sh[SH_RELA_TEXT] = (Elf64_Shdr){
+    .sh_name = SHNAME(rela_text),
+    .sh_type = SHT_RELA,
+    .sh_flags = SHF_INFO_LINK,
+    .sh_offset = buf_push(out, rela.data, rela.sz),
+    .sh_size = rela.sz,
+    .sh_link = SH_SYMTAB,
+    .sh_info = SH_TEXT,
+    .sh_addralign = 8,
+    .sh_entsize = sizeof(Elf64_Rela),
+    };
+
+    sh[SH_SYMTAB] = (Elf64_Shdr){
+    .sh_name = SHNAME(symtab),
+    .sh_type = SHT_SYMTAB,
+    .sh_offset = buf_push(out, symtab.data, symtab.sz),
+    .sh_size = symtab.sz,
+    .sh_link = SH_STRTAB,
+    .sh_info = first_global,
+    .sh_addralign = 8,
+    .sh_entsize = sizeof(Elf64_Sym),
+    };
+
+    sh[SH_STRTAB] = (Elf64_Shdr){
+    .sh_name = SHNAME(strtab),
+    .sh_type = SHT_STRTAB,
+    .sh_offset = buf_push(out, strtab.data, strtab.sz),
+    .sh_size = strtab.sz,
+    .sh_addralign = 1,
+    };
+
+    sh[SH_SHSTRTAB] = (Elf64_Shdr){
+    .sh_name = SHNAME(shstrtab),
+    .sh_type = SHT_STRTAB,
+    .sh_offset = buf_push(out, &shstrtab, sizeof shstrtab),
+    .sh_size = sizeof shstrtab,
+    .sh_addralign = 1,
+    };
+
+    /* marks the stack as non-executable */
+    sh[SH_NOTE_STACK] = (Elf64_Shdr){
+    .sh_name = SHNAME(note_stack),
+    .sh_type = SHT_PROGBITS,
+    .sh_offset = out->sz,
+    .sh_addralign = 1,
+    };
+
+    buf_align(out, 8);
+    Elf64_Ehdr eh = {
+    .e_ident = {
+        ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3,
+        ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV,
+    },
+    .e_type = ET_REL,
+    .e_machine = EM_X86_64,
+    .e_version = EV_CURRENT,
+    .e_shoff = buf_push(out, sh, sizeof sh),
+    .e_ehsize = sizeof(Elf64_Ehdr),
+    .e_shentsize = sizeof(Elf64_Shdr),
+    .e_shnum = SH_NUM,
+    .e_shstrndx = SH_SHSTRTAB,
+    };
+    memcpy(out->data, &eh, sizeof eh);
+
+    alloc_free(ALLOC_OTHER, map);
+    buf_destroy(&symtab);
+    buf_destroy(&strtab);
+    buf_destroy(&rela);
+    return 0;
+}
+
+int elf_write_exec(buf_t *out, x86_obj_t *obj, const char *entry) {
+    ssize_t entry_sym = x86_sym_find(obj, entry, strlen(entry));
+    if(entry_sym < 0) {
+        fprintf(obj->err, "[Error] Undefined entry point '%s'\n", entry);
+        return 1;
+    }
+
+    /* headers, .text and .rodata are all mapped by a single segment, and
+     * .bss by a writable one on the next page */
+    size_t text_off = sizeof(Elf64_Ehdr) + 3*sizeof(Elf64_Phdr);
+    text_off = (text_off + 15) & ~(size_t)15;
+    size_t rodata_off = text_off + obj->text.sz;
+    size_t bss_off = (rodata_off + obj->rodata.sz + 0xfff) & ~(size_t)0xfff;
+    if(x86_relocate(obj, ELF_EXEC_BASE + text_off, ELF_EXEC_BASE + rodata_off,
+                    ELF_EXEC_BASE + bss_off, NULL, NULL))
+        return 1;
+
+    out->sz = 0;
+    buf_push(out, NULL, text_off);
+    buf_push(out, obj->text.data, obj->text.sz);
+    buf_push(out, obj->rodata.data, obj->rodata.sz);
+
+    x86_sym_t *sym = vec_get(obj->symbols, entry_sym);
+    Elf64_Ehdr eh = {
+    .e_ident = {
+        ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3,
+        ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV,
+    },
+    .e_type = ET_EXEC,
+    .e_machine = EM_X86_64,
+    .e_version = EV_CURRENT,
+    .e_entry = ELF_EXEC_BASE + text_off + sym->offset,
+    .e_phoff = sizeof(Elf64_Ehdr),
+    .e_ehsize = sizeof(Elf64_Ehdr),
+    .e_phentsize = sizeof(Elf64_Phdr),
+    .e_phnum = 3,
+    .e_shentsize = sizeof(Elf64_Shdr),
+    .e_shstrndx = SHN_UNDEF,
+    };
+
+    Elf64_Phdr ph[3] = {
+    {
+        .p_type = PT_LOAD,
+        .p_flags = PF_R | PF_X,
+        .p_offset = 0,
+        .p_vaddr = ELF_EXEC_BASE,
+        .p_paddr = ELF_EXEC_BASE,
+        .p_filesz = out->sz,
+        .p_memsz = out->sz,
+        .p_align = 0x1000,
+    },
+    {
+        /* zero-filled by the kernel as nothing of it is in the file */
+        .p_type = PT_LOAD,
+        .p_flags = PF_R | PF_W,
+        .p_offset = 0,
+        .p_vaddr = ELF_EXEC_BASE + bss_off,
+        .p_paddr = ELF_EXEC_BASE + bss_off,
+        .p_filesz = 0,
+        .p_memsz = obj->bss_sz,
+        .p_align = 0x1000,
+    },
+    {
+        /* non-executable stack */
+        .p_type = PT_GNU_STACK,
+        .p_flags = PF_R | PF_W,
+        .p_align = 16,
+    },
+    };
+
+    memcpy(out->data, &eh, sizeof eh);
+    memcpy(out->data + sizeof eh, ph, sizeof ph);
+    return 0;
+}
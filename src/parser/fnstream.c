@@ -0,0 +1,124 @@
+#include <parser/fnstream.h>
+#include <utils/alloc.h>
+#include <string.h>
+
+static void fnstream_declare(fnstream_t *, const unsigned char *, size_t);
+static void fnstream_release(fnstream_t *);
+
+/* the source must stay valid until the stream is freed */
+fnstream_t *fnstream_new(const unsigned char *src, size_t sz, FILE *err) {
+    fnstream_t *s = alloc_malloc(ALLOC_OTHER, sizeof(fnstream_t));
+    s->ctx = semantics_new();
+    s->ctx->err = err;
+    lexer_init(&s->lexer, src, sz);
+    parser_init(&s->parser, &s->lexer);
+    s->parser.err = err;
+    s->fn = NULL;
+    s->code = (ir_code_t) {
+    .ctx = s->ctx,
+    .instructions = vec_new_free(64, (vec_free_t)instr_free),
+    .num_label = 0,
+    };
+    s->refs = vec_new(16);
+    s->num_fns = 0;
+    s->err = err;
+    fnstream_declare(s, src, sz);
+    return s;
+}
+
+void fnstream_free(fnstream_t *s) {
+    fnstream_release(s);
+    vec_free(s->code.instructions);
+    vec_free(s->refs);
+    semantics_free(s->ctx);
+    alloc_free(ALLOC_OTHER, s);
+}
+
+/* frees the previous definition and parses the next, NULL at the end of the
+ * input or if parser.error or ctx->error is set */
+ast_node_fn_defn_t *fnstream_next(fnstream_t *s) {
+    fnstream_release(s);
+    for(;;) {
+        if(!(s->fn = parser_parse_fn(&s->parser))) {
+            if(!s->parser.error) semantics_check_externs(s->ctx);
+            return NULL;
+        }
+
+        /* the scan found the same functions unless the syntax is wrong,
+         * which the parser reports first */
+        size_t idx = s->num_fns++;
+        function_ref_t *ref = NULL;
+        if(idx < s->refs->sz && !(ref = vec_get(s->refs, idx))) {
+            fnstream_release(s);
+            return NULL;
+        }
+        if(!ref || ref->num_args != s->fn->arguments->sz
+        || ref->name_sz != s->fn->ident->name_sz
+        || memcmp(ref->name, s->fn->ident->name, ref->name_sz)) {
+            fprintf(s->err, "[Error] Function '%.*s' was not declared\n",
+                    (int)s->fn->ident->name_sz, s->fn->ident->name);
+            s->parser.error = 1;
+            fnstream_release(s);
+            return NULL;
+        }
+        s->fn->ref = ref;
+        if(s->fn->hdr.type == AST_FN_DEFN) return s->fn;
+        /* nothing is compiled for a declaration */
+        fnstream_release(s);
+    }
+}
+
+int fnstream_analyze(fnstream_t *s) {
+    return s->ctx->error = semantics_analyze_fn(s->ctx, s->fn);
+}
+
+/* replaces the IR with the code of the current definition */
+int fnstream_generate(fnstream_t *s) {
+    while(s->code.instructions->sz) vec_pop_free(s->code.instructions);
+    return code_generate_fn(&s->code, s->fn);
+}
+
+/* adds the name and number of arguments of every function defined or
+ * declared at the top level to the context */
+static void fnstream_declare(fnstream_t *s, const unsigned char *src,
+                             size_t sz) {
+    lexer_t lexer;
+    lexer_init(&lexer, src, sz);
+    size_t depth = 0;
+    int external = 0;
+    for(token_t *t; (t = lexer_next(&lexer))->type != TEOF;) {
+        if(t->type == '{') ++depth;
+        else if(t->type == '}' && depth) --depth;
+        if(t->type == TEXTERN) {
+            external = 1;
+            continue;
+        }
+        if(t->type != TFN || depth) {
+            external = 0;
+            continue;
+        }
+
+        if(lexer_next(&lexer)->type != TIDENTIFIER) {
+            lexer_unget(&lexer);
+            continue;
+        }
+        const unsigned char *name = lexer.token.start;
+        size_t name_sz = lexer.token.sz, num_args = 0;
+        if(lexer_next(&lexer)->type == '(')
+            while((t = lexer_next(&lexer))->type == TIDENTIFIER
+               || t->type == ',')
+                num_args += t->type == TIDENTIFIER;
+        /* the token ending the signature may be the opening brace */
+        lexer_unget(&lexer);
+        vec_push(s->refs, function_ref_declare(s->ctx, (char *)name, name_sz,
+                                               num_args, external));
+        external = 0;
+    }
+}
+
+/* the IR refers to the variables in the scopes of the definition */
+static void fnstream_release(fnstream_t *s) {
+    while(s->code.instructions->sz) vec_pop_free(s->code.instructions);
+    if(s->fn) ast_free((void *)s->fn);
+    s->fn = NULL;
+}
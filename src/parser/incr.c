@@ -0,0 +1,452 @@
+#include <parser/incr.h>
+#include <utils/alloc.h>
+#include <parser/parser.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* print and input stay first in the function table of the context */
+#define INCR_NUM_BUILTINS 2
+
+/* function called by a compiled function */
+struct incr_dep {
+    function_ref_t *ref;
+    size_t num_args;
+};
+
+/* what is kept of a function between compilations */
+struct incr_fn {
+    /** hash of the syntax tree, 0 if the function must be compiled again */
+    uint64_t hash;
+    /** source of the definition, NULL if it shared its chunk */
+    unsigned char *src;
+    size_t src_sz;
+    /** the definition owns the scopes of the function */
+    ast_node_fn_defn_t *defn;
+    function_ref_t *ref;
+    /** vector of ir_instr_t from FUNC to LEAVE */
+    vec_t *code;
+    /** NULL until the machine code is needed */
+    x86_fn_t *x86;
+    /** struct incr_dep for every call in the function */
+    buf_t deps;
+    /** last compilation the function was defined in */
+    size_t gen;
+    struct incr_fn *next;
+};
+
+/* function definition in the source being compiled */
+struct incr_item {
+    struct incr_fn *fn;
+    /** NULL if the source of the function is unchanged */
+    ast_node_fn_defn_t *defn;
+    /** chunk of the source the function was found in */
+    const unsigned char *src;
+    size_t src_sz;
+    /** whether the chunk holds nothing but this function */
+    int alone;
+};
+
+static int incr_add_chunk(incr_t *, buf_t *, vec_t *, const unsigned char *,
+                          size_t);
+static int incr_declare(incr_t *, vec_t *, ast_node_fn_defn_t *);
+static size_t incr_next_chunk(const unsigned char *, size_t, size_t);
+static void incr_claim(incr_t *, struct incr_fn *, ast_node_fn_defn_t *);
+
+static struct incr_fn *incr_fn_new(ast_node_fn_defn_t *);
+static void incr_fn_clear(struct incr_fn *);
+static void incr_fn_free(struct incr_fn *);
+static void incr_fn_set_src(struct incr_fn *, struct incr_item *);
+static int incr_fn_reusable(incr_t *, struct incr_fn *, uint64_t);
+static int incr_fn_compile(incr_t *, struct incr_fn *);
+
+static struct incr_fn **incr_lookup(incr_t *, const char *, size_t);
+static void incr_grow(incr_t *);
+static void incr_sweep(incr_t *);
+static size_t incr_name_hash(const char *, size_t);
+
+incr_t *incr_new(FILE *err) {
+    incr_t *incr = alloc_malloc(ALLOC_OTHER, sizeof(incr_t));
+    incr->ctx = semantics_new();
+    incr->ctx->err = err;
+    /* the function table is rebuilt by every compilation from the functions
+     * kept here, only the builtins belong to the context */
+    incr->ctx->functions->free_fn = NULL;
+    incr->code = (ir_code_t) {
+    .ctx = incr->ctx,
+    .instructions = vec_new(64),
+    .num_label = 0,
+    };
+    incr->table_sz = 64;
+    incr->table = alloc_calloc(ALLOC_OTHER,
+                               incr->table_sz, sizeof *incr->table);
+    incr->num_fns = 0;
+    incr->order = vec_new(64);
+    incr->scratch = vec_new_free(1, (vec_free_t)incr_fn_free);
+    incr->externs = vec_new_free(1, (vec_free_t)function_ref_free);
+    incr->gen = 0;
+    incr->num_compiled = 0;
+    incr->err = err;
+    return incr;
+}
+
+void incr_free(incr_t *incr) {
+    for(size_t i = 0; i < incr->table_sz; ++i)
+        for(struct incr_fn *fn = incr->table[i], *next; fn; fn = next) {
+            next = fn->next;
+            incr_fn_free(fn);
+        }
+    alloc_free(ALLOC_OTHER, incr->table);
+    vec_free(incr->scratch);
+    vec_free(incr->externs);
+    vec_free(incr->order);
+    vec_free(incr->code.instructions);
+
+    incr->ctx->functions->sz = INCR_NUM_BUILTINS;
+    incr->ctx->functions->free_fn = (vec_free_t)function_ref_free;
+    semantics_free(incr->ctx);
+    alloc_free(ALLOC_OTHER, incr);
+}
+
+/* compiles the next version of the program, returns non-zero on errors */
+int incr_compile(incr_t *incr, const unsigned char *src, size_t sz) {
+    int ret = 0;
+    buf_t items;
+    buf_init(&items, 64 * sizeof(struct incr_item));
+    vec_t *decls = vec_new_free(4, (vec_free_t)ast_free);
+    vec_t *externs = vec_new_free(1, (vec_free_t)function_ref_free);
+
+    ++incr->gen;
+    incr->num_compiled = 0;
+    incr->order->sz = 0;
+    while(incr->scratch->sz) vec_pop_free(incr->scratch);
+    incr->ctx->functions->sz = INCR_NUM_BUILTINS;
+
+    /* all functions are in the table before any is analyzed so they can see
+     * each other */
+    for(size_t off = 0, end; off < sz; off = end) {
+        end = incr_next_chunk(src, sz, off);
+        if((ret = incr_add_chunk(incr, &items, decls, src + off,
+                                 end - off)))
+            break;
+    }
+    /* extern declarations go to the definitions of the same name */
+    for(size_t i = 0; !ret && i < decls->sz; ++i)
+        ret = incr_declare(incr, externs, vec_get(decls, i));
+
+    struct incr_item *it = (void *)items.data;
+    size_t num_items = items.sz / sizeof *it;
+    if(ret) {
+        for(size_t i = 0; i < num_items; ++i)
+            if(it[i].defn) ast_free((void *)it[i].defn);
+        goto ret;
+    }
+
+    for(size_t i = 0; i < num_items; ++i) {
+        struct incr_fn *fn = it[i].fn;
+        ast_node_fn_defn_t *defn = it[i].defn;
+        /* 0 is reserved for functions which must be compiled again */
+        uint64_t hash;
+
+        if(!defn) {
+            if(incr_fn_reusable(incr, fn, fn->hash)) continue;
+            /* the same definition is analyzed again in its new
+             * surroundings */
+            defn = fn->defn;
+            fn->defn = NULL;
+            if(defn->scope) scope_free(defn->scope);
+            defn->scope = NULL;
+            hash = ast_hash((void *)defn) | 1;
+        } else {
+            hash = ast_hash((void *)defn) | 1;
+            /* the source changed, but not in a way that matters */
+            if(incr_fn_reusable(incr, fn, hash)) {
+                ast_free((void *)defn);
+                incr_fn_set_src(fn, &it[i]);
+                continue;
+            }
+        }
+
+        incr_fn_clear(fn);
+        fn->defn = defn;
+        incr_fn_set_src(fn, &it[i]);
+        ++incr->num_compiled;
+        if(incr_fn_compile(incr, fn)) ret = 1;
+        else fn->hash = hash;
+    }
+    incr_sweep(incr);
+    if(!ret) ret = semantics_check_externs(incr->ctx);
+
+    incr->code.instructions->sz = 0;
+    for(size_t i = 0; i < incr->order->sz; ++i) {
+        struct incr_fn *fn = vec_get(incr->order, i);
+        if(!fn->code) continue;
+        for(size_t j = 0; j < fn->code->sz; ++j)
+            vec_push(incr->code.instructions, vec_get(fn->code, j));
+    }
+
+ret:
+    /* the reused functions have been checked against the table, so the
+     * declarations of the previous compilation are no longer referred to */
+    vec_free(incr->externs);
+    incr->externs = externs;
+    vec_free(decls);
+    buf_destroy(&items);
+    return ret;
+}
+
+/* links the machine code of the last compilation, only the functions without
+ * machine code are generated */
+x86_obj_t *incr_link(incr_t *incr, enum runtime rt) {
+    x86_obj_t *obj = NULL;
+    size_t n = incr->order->sz;
+    x86_fn_t **fns = alloc_malloc(ALLOC_OTHER, sizeof(x86_fn_t *) * (n + 1));
+
+    for(size_t i = 0; i < n; ++i) {
+        struct incr_fn *fn = vec_get(incr->order, i);
+        if(!fn->code) {
+            fprintf(incr->err, "[Error] Function '%.*s' has errors\n",
+                    (int)fn->ref->name_sz, fn->ref->name);
+            goto ret;
+        }
+        if(!fn->x86
+        && !(fn->x86 = x86_generate_fn((ir_instr_t **)fn->code->items,
+                                       fn->code->sz, incr->err)))
+            goto ret;
+        fns[i] = fn->x86;
+    }
+    obj = x86_link(incr->ctx, fns, n, rt);
+
+ret:
+    alloc_free(ALLOC_OTHER, fns);
+    return obj;
+}
+
+/* adds the functions defined in one chunk of the source, its extern
+ * declarations are moved to decls */
+static int incr_add_chunk(incr_t *incr, buf_t *items, vec_t *decls,
+                          const unsigned char *src, size_t sz) {
+    lexer_t lexer;
+    lexer_init(&lexer, src, sz);
+
+    /* a function whose source is unchanged is not parsed again */
+    if(lexer_next(&lexer)->type == TFN
+    && lexer_next(&lexer)->type == TIDENTIFIER) {
+        struct incr_fn *fn = *incr_lookup(incr, (char *)lexer.token.start,
+                                          lexer.token.sz);
+        if(fn && fn->gen != incr->gen && fn->defn && fn->src
+        && fn->src_sz == sz && !memcmp(fn->src, src, sz)) {
+            incr_claim(incr, fn, fn->defn);
+            struct incr_item it = { fn, NULL, src, sz, 1 };
+            buf_push(items, &it, sizeof it);
+            return 0;
+        }
+    }
+
+    parser_t parser;
+    lexer_init(&lexer, src, sz);
+    parser_init(&parser, &lexer);
+    parser.err = incr->err;
+    ast_node_tu_t *tu;
+    if(!(tu = parser_parse(&parser))) return 1;
+
+    for(size_t i = 0; i < tu->functions->sz; ++i) {
+        ast_node_fn_defn_t *defn = vec_get(tu->functions, i);
+        struct incr_fn **slot = incr_lookup(incr, defn->ident->name,
+                                            defn->ident->name_sz);
+        struct incr_fn *fn = *slot;
+        if(!fn) {
+            fn = *slot = incr_fn_new(defn);
+            if(++incr->num_fns > incr->table_sz) incr_grow(incr);
+        } else if(fn->gen == incr->gen) {
+            /* calls go to the first definition, so later ones are never
+             * depended on */
+            fn = vec_push(incr->scratch, incr_fn_new(defn));
+        }
+        incr_claim(incr, fn, defn);
+        struct incr_item it = { fn, defn, src, sz,
+                                tu->functions->sz == 1 && !tu->externs->sz };
+        buf_push(items, &it, sizeof it);
+    }
+    for(size_t i = 0; i < tu->externs->sz; ++i)
+        vec_push(decls, vec_get(tu->externs, i));
+
+    /* the definitions belong to the items now */
+    tu->functions->free_fn = NULL;
+    tu->externs->free_fn = NULL;
+    ast_free((void *)tu);
+    return 0;
+}
+
+/* declares an extern function after every definition is in the table, the
+ * reference is added to externs unless the function is defined */
+static int incr_declare(incr_t *incr, vec_t *externs,
+                        ast_node_fn_defn_t *decl) {
+    size_t num_fns = incr->ctx->functions->sz;
+    if(!(decl->ref = function_ref_declare(incr->ctx, decl->ident->name,
+                                          decl->ident->name_sz,
+                                          decl->arguments->sz, 1)))
+        return 1;
+    if(incr->ctx->functions->sz != num_fns) vec_push(externs, decl->ref);
+    return 0;
+}
+
+/* the source is split after every closing brace at the top level, so a chunk
+ * is one function definition and the whitespace before it */
+static size_t incr_next_chunk(const unsigned char *src, size_t sz,
+                              size_t off) {
+    size_t depth = 0;
+    for(size_t i = off; i < sz; ++i) {
+        if(src[i] == '{') ++depth;
+        else if(src[i] == '}' && depth && !--depth) return i + 1;
+    }
+    return sz;
+}
+
+/* adds a function to the program being compiled */
+static void incr_claim(incr_t *incr, struct incr_fn *fn,
+                       ast_node_fn_defn_t *defn) {
+    fn->gen = incr->gen;
+    fn->ref->num_args = defn->arguments->sz;
+    function_ref_add(incr->ctx, fn->ref);
+    vec_push(incr->order, fn);
+}
+
+static struct incr_fn *incr_fn_new(ast_node_fn_defn_t *defn) {
+    struct incr_fn *fn = alloc_malloc(ALLOC_OTHER, sizeof(struct incr_fn));
+    fn->hash = 0;
+    fn->src = NULL;
+    fn->src_sz = 0;
+    fn->defn = NULL;
+    fn->ref = function_ref_new_node(defn);
+    fn->code = NULL;
+    fn->x86 = NULL;
+    buf_init(&fn->deps, 4 * sizeof(struct incr_dep));
+    fn->gen = 0;
+    fn->next = NULL;
+    return fn;
+}
+
+static void incr_fn_clear(struct incr_fn *fn) {
+    if(fn->defn) ast_free((void *)fn->defn);
+    if(fn->code) vec_free(fn->code);
+    if(fn->x86) x86_fn_free(fn->x86);
+    fn->defn = NULL;
+    fn->code = NULL;
+    fn->x86 = NULL;
+    fn->deps.sz = 0;
+    fn->hash = 0;
+}
+
+static void incr_fn_free(struct incr_fn *fn) {
+    incr_fn_clear(fn);
+    alloc_free(ALLOC_OTHER, fn->src);
+    buf_destroy(&fn->deps);
+    function_ref_free(fn->ref);
+    alloc_free(ALLOC_OTHER, fn);
+}
+
+static void incr_fn_set_src(struct incr_fn *fn, struct incr_item *it) {
+    alloc_free(ALLOC_OTHER, fn->src);
+    fn->src = NULL;
+    fn->src_sz = 0;
+    if(!it->alone) return;
+    fn->src = alloc_malloc(ALLOC_OTHER, it->src_sz);
+    memcpy(fn->src, it->src, fn->src_sz = it->src_sz);
+}
+
+/* whether the function is unchanged and everything it calls is still there,
+ * must be called after the function table is rebuilt */
+static int incr_fn_reusable(incr_t *incr, struct incr_fn *fn, uint64_t hash) {
+    if(!fn->hash || fn->hash != hash) return 0;
+
+    vec_t *functions = incr->ctx->functions;
+    struct incr_dep *dep = (void *)fn->deps.data;
+    for(size_t i = 0; i < fn->deps.sz / sizeof *dep; ++i) {
+        function_ref_t *ref = dep[i].ref;
+        /* references of removed functions are only freed after this, and
+         * they are no longer in the table */
+        if(ref->idx >= functions->sz || vec_get(functions, ref->idx) != ref
+        || ref->num_args != dep[i].num_args)
+            return 0;
+    }
+    return 1;
+}
+
+static int incr_fn_compile(incr_t *incr, struct incr_fn *fn) {
+    fn->defn->ref = fn->ref;
+    if(semantics_analyze_fn(incr->ctx, fn->defn)) return 1;
+
+    /* labels are never reused, the code of other functions keeps its own */
+    ir_code_t code = {
+    .ctx = incr->ctx,
+    .instructions = vec_new_free(16, (vec_free_t)instr_free),
+    .num_label = incr->code.num_label,
+    };
+    int ret = code_generate_fn(&code, fn->defn);
+    incr->code.num_label = code.num_label;
+    if(ret) {
+        vec_free(code.instructions);
+        return 1;
+    }
+    fn->code = code.instructions;
+
+    for(size_t i = 0; i < fn->code->sz; ++i) {
+        ir_instr_func_t *in = vec_get(fn->code, i);
+        if(in->hdr.type != IR_CALL) continue;
+        struct incr_dep dep = { in->ref, in->ref->num_args };
+        buf_push(&fn->deps, &dep, sizeof dep);
+    }
+    return 0;
+}
+
+static struct incr_fn **incr_lookup(incr_t *incr, const char *name,
+                                    size_t name_sz) {
+    struct incr_fn **slot = &incr->table[incr_name_hash(name, name_sz)
+                                         & (incr->table_sz - 1)];
+    for(; *slot; slot = &(*slot)->next)
+        if((*slot)->ref->name_sz == name_sz
+        && !memcmp((*slot)->ref->name, name, name_sz))
+            break;
+    return slot;
+}
+
+static void incr_grow(incr_t *incr) {
+    size_t old_sz = incr->table_sz;
+    struct incr_fn **old = incr->table;
+    incr->table_sz *= 2;
+    incr->table = alloc_calloc(ALLOC_OTHER,
+                               incr->table_sz, sizeof *incr->table);
+
+    for(size_t i = 0; i < old_sz; ++i)
+        for(struct incr_fn *fn = old[i], *next; fn; fn = next) {
+            next = fn->next;
+            struct incr_fn **slot = &incr->table[
+                incr_name_hash(fn->ref->name, fn->ref->name_sz)
+                & (incr->table_sz - 1)];
+            fn->next = *slot;
+            *slot = fn;
+        }
+    alloc_free(ALLOC_OTHER, old);
+}
+
+/* frees the functions which were not defined by the last compilation */
+static void incr_sweep(incr_t *incr) {
+    for(size_t i = 0; i < incr->table_sz; ++i)
+        for(struct incr_fn **slot = &incr->table[i]; *slot;) {
+            struct incr_fn *fn = *slot;
+            if(fn->gen == incr->gen) {
+                slot = &fn->next;
+                continue;
+            }
+            *slot = fn->next;
+            incr_fn_free(fn);
+            --incr->num_fns;
+        }
+}
+
+static size_t incr_name_hash(const char *name, size_t name_sz) {
+    size_t h = 0xcbf29ce484222325u;
+    for(size_t i = 0; i < name_sz; ++i)
+        h = (h ^ (unsigned char)name[i]) * 0x100000001b3u;
+    return h;
+}
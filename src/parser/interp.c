@@ -0,0 +1,618 @@
+#include <parser/interp.h>
+#include <utils/alloc.h>
+#include <utils/buffer.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* binary operators as expressions of the operands a and b, wrapping around
+ * like the generated machine code does */
+#define BINOPS(X) \
+X(ADD,    (int64_t)((uint64_t)a + (uint64_t)b)) \
+X(SUB,    (int64_t)((uint64_t)a - (uint64_t)b)) \
+X(MUL,    (int64_t)((uint64_t)a * (uint64_t)b)) \
+X(BITOR,  a | b) \
+X(BITAND, a & b) \
+X(BITXOR, a ^ b) \
+X(LOR,    (a | b) != 0) \
+X(LAND,   a && b)
+
+#define UNOPS(X) \
+X(BITNOT, ~a) \
+X(LNOT,   !a)
+
+/* comparisons can also be fused with a following IF */
+#define CMPS(X) \
+X(LT,  <) \
+X(GT,  >) \
+X(LEQ, <=) \
+X(GEQ, >=) \
+X(EQ,  ==) \
+X(NEQ, !=)
+
+enum interp_opcode {
+OP_HALT,
+OP_PUSH_IMM,
+OP_PUSH_VAR,
+OP_POP_VAR,
+OP_ASSIGN,
+OP_SAVE,
+OP_SP_SUB,
+OP_SP_ADD,
+/* every operator has a variant which also pushes its result (OP_x_S) */
+#define X(n, e) OP_##n, OP_##n##_S,
+BINOPS(X)
+UNOPS(X)
+X(DIV, 0)
+X(MOD, 0)
+CMPS(X)
+#undef X
+/* jumps taken when a comparison is false, comparing the two values on top of
+ * the stack (OP_Jx), a variable and an immediate (OP_Jx_VI), or two variables
+ * (OP_Jx_VV) */
+#define X(n, o) OP_J##n, OP_J##n##_VI, OP_J##n##_VV,
+CMPS(X)
+#undef X
+OP_CALL,
+OP_PRINT,
+OP_INPUT,
+OP_RET,
+OP_RET_ACC,
+OP_RET_IMM,
+OP_RET_VAR,
+OP_LEAVE,
+OP_IF,
+OP_JMP,
+/* pushes a variable plus an immediate */
+OP_ADD_VI,
+/* assigns an immediate or a variable to a variable */
+OP_MOV_VI,
+OP_MOV_VV,
+OP_NUM,
+};
+
+/* operators by IR instruction type */
+static const uint16_t interp_ops[] = {
+#define X(n, e) [IR_##n] = OP_##n,
+BINOPS(X)
+UNOPS(X)
+X(DIV, 0)
+X(MOD, 0)
+CMPS(X)
+#undef X
+};
+
+/* fused compare-and-jump by IR instruction type */
+static const uint16_t interp_jcmps[] = {
+#define X(n, o) [IR_##n] = OP_J##n,
+CMPS(X)
+#undef X
+};
+
+typedef struct interp_decoder {
+    vec_t *ins;
+    /** interp_op_t */
+    buf_t ops;
+    /** size_t, first IR instruction of every op */
+    buf_t ir;
+    /** op index of every IR label */
+    size_t *labels;
+    /** op index of every function body by function_ref_t::idx */
+    size_t *entries;
+    /** stack words needed by the frame of every function */
+    int64_t *need;
+    FILE *err;
+} interp_decoder_t;
+
+#define NO_ENTRY SIZE_MAX
+
+static int interp_peek(interp_decoder_t *, size_t);
+static void interp_stack_need(interp_decoder_t *);
+static int interp_decode(interp_decoder_t *);
+static size_t interp_decode_one(interp_decoder_t *, size_t, function_ref_t *,
+                                interp_op_t *);
+static int interp_link(interp_decoder_t *, ir_code_t *);
+static int interp_exec(interp_t *, int64_t *, uint64_t *);
+
+static inline int interp_is_op(int type) {
+    return type >= 0 && (size_t)type < sizeof interp_ops / sizeof *interp_ops
+        && interp_ops[type];
+}
+
+static inline int interp_is_cmp(int type) {
+    return type >= 0
+        && (size_t)type < sizeof interp_jcmps / sizeof *interp_jcmps
+        && interp_jcmps[type];
+}
+
+static inline int interp_is_jump(int op) {
+    switch(op) {
+#define X(n, o) case OP_J##n: case OP_J##n##_VI: case OP_J##n##_VV:
+    CMPS(X)
+#undef X
+    case OP_IF: case OP_JMP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* stack slot in words relative to the frame pointer */
+static inline int32_t interp_slot(ir_instr_data_t *data) {
+    return data->ref->bp_offset / 8;
+}
+
+/* type of the instruction at i, or -1 past the end */
+static int interp_peek(interp_decoder_t *d, size_t i) {
+    return i < d->ins->sz ? (int)((ir_instr_t *)vec_get(d->ins, i))->type : -1;
+}
+
+interp_t *interp_new(ir_code_t *code) {
+    size_t num_fns = code->ctx->functions->sz;
+    interp_decoder_t d = {
+    .ins = code->instructions,
+    .labels = alloc_malloc(ALLOC_OTHER, sizeof(size_t) * (code->num_label + 1)),
+    .entries = alloc_malloc(ALLOC_OTHER, sizeof(size_t) * num_fns),
+    .need = alloc_calloc(ALLOC_OTHER, num_fns, sizeof(int64_t)),
+    .err = code->ctx->err,
+    };
+    buf_init(&d.ops, sizeof(interp_op_t) * (d.ins->sz + 2));
+    buf_init(&d.ir, sizeof(size_t) * (d.ins->sz + 2));
+    for(size_t i = 0; i < num_fns; ++i) d.entries[i] = NO_ENTRY;
+
+    interp_t *it = NULL;
+    interp_stack_need(&d);
+    if(interp_decode(&d) || interp_link(&d, code)) goto ret;
+
+    it = alloc_malloc(ALLOC_OTHER, sizeof(interp_t));
+    it->num_ops = d.ops.sz / sizeof(interp_op_t);
+    it->ops = (void *)d.ops.data;
+    it->ir = (void *)d.ir.data;
+    it->err = d.err;
+    d.ops.data = d.ir.data = NULL;
+
+ret:
+    buf_destroy(&d.ops);
+    buf_destroy(&d.ir);
+    alloc_free(ALLOC_OTHER, d.labels);
+    alloc_free(ALLOC_OTHER, d.entries);
+    alloc_free(ALLOC_OTHER, d.need);
+    return it;
+}
+
+void interp_free(interp_t *it) {
+    alloc_free(ALLOC_BUF, it->ops);
+    alloc_free(ALLOC_BUF, it->ir);
+    alloc_free(ALLOC_OTHER, it);
+}
+
+/* the deepest the stack gets within each function, for overflow checks */
+static void interp_stack_need(interp_decoder_t *d) {
+    int64_t depth = 0, max = 0;
+    size_t fn = 0;
+    for(size_t i = 0; i < d->ins->sz; ++i) {
+        union {
+            ir_instr_t *i;
+            ir_instr_data_t *data;
+            ir_instr_func_t *func;
+        } in = { .i = vec_get(d->ins, i) };
+
+        switch(in.i->type) {
+        case IR_FUNC:
+            fn = in.func->ref->idx;
+            depth = max = 0;
+            break;
+        case IR_LEAVE: d->need[fn] = max; break;
+        case IR_PUSH: case IR_SAVE: ++depth; break;
+        case IR_POP: case IR_ASSIGN: case IR_IF: case IR_RET: --depth; break;
+        case IR_SCOPEBEGIN: depth += in.data->imm; break;
+        case IR_SCOPEEND: depth -= in.data->imm; break;
+        case IR_BITNOT: case IR_LNOT: --depth; break;
+        case IR_CALL: depth -= in.func->ref->num_args; break;
+        default:
+            if(interp_is_op(in.i->type)) depth -= 2;
+            break;
+        }
+        if(depth > max) max = depth;
+    }
+}
+
+static int interp_decode(interp_decoder_t *d) {
+    /* call main and halt when it returns */
+    interp_op_t op = { .op = OP_CALL, .idx = NO_ENTRY };
+    size_t ir = SIZE_MAX;
+    buf_push(&d->ops, &op, sizeof op);
+    buf_push(&d->ir, &ir, sizeof ir);
+    op = (interp_op_t){ .op = OP_HALT };
+    buf_push(&d->ops, &op, sizeof op);
+    buf_push(&d->ir, &ir, sizeof ir);
+
+    function_ref_t *fn = NULL;
+    for(size_t i = 0; i < d->ins->sz;) {
+        ir_instr_t *in = vec_get(d->ins, i);
+        switch(in->type) {
+        case IR_NOP: ++i; continue;
+
+        case IR_FUNC:
+            fn = ((ir_instr_func_t *)in)->ref;
+            d->entries[fn->idx] = d->ops.sz / sizeof(interp_op_t);
+            if(fn->name_sz == 4 && !memcmp(fn->name, "main", 4)) {
+                ((interp_op_t *)d->ops.data)[0].idx = fn->idx;
+                ((interp_op_t *)d->ops.data)[0].a = fn->num_args;
+            }
+            ++i;
+            continue;
+
+        case IR_LABEL:
+            d->labels[((ir_instr_label_t *)in)->id]
+                = d->ops.sz / sizeof(interp_op_t);
+            ++i;
+            continue;
+
+        default: break;
+        }
+
+        if(!fn) {
+            fprintf(d->err, "[Error] Instruction outside of a function\n");
+            return 1;
+        }
+        memset(&op, 0, sizeof op);
+        size_t used = interp_decode_one(d, i, fn, &op);
+        if(!used) {
+            fprintf(d->err, "[Error] Invalid instruction in IR code\n");
+            return 1;
+        }
+        buf_push(&d->ops, &op, sizeof op);
+        buf_push(&d->ir, &i, sizeof i);
+        i += used;
+    }
+    return 0;
+}
+
+/* decodes the instruction at i, possibly fused with the ones following it,
+ * and returns the amount of instructions used */
+static size_t interp_decode_one(interp_decoder_t *d, size_t i,
+                                function_ref_t *fn, interp_op_t *op) {
+#define IN(k) ((void *)vec_get(d->ins, i + (k)))
+#define PEEK(k) interp_peek(d, i + (k))
+    ir_instr_t *in = IN(0);
+
+    switch(in->type) {
+    case IR_PUSH: {
+        ir_instr_data_t *data = IN(0), *next;
+        int t1 = PEEK(1), t2 = PEEK(2);
+
+        /* PUSH var; PUSH x; CMP; SAVE; IF */
+        if(data->variable && t1 == IR_PUSH && interp_is_cmp(t2)
+        && PEEK(3) == IR_SAVE && PEEK(4) == IR_IF) {
+            next = IN(1);
+            op->op = interp_jcmps[t2] + (next->variable ? 2 : 1);
+            op->a = interp_slot(data);
+            op->b = next->variable ? interp_slot(next) : next->imm;
+            op->idx = ((ir_instr_if_t *)IN(4))->false_label;
+            return 5;
+        }
+
+        /* PUSH var; PUSH imm; ADD/SUB; SAVE */
+        if(data->variable && t1 == IR_PUSH && (t2 == IR_ADD || t2 == IR_SUB)
+        && PEEK(3) == IR_SAVE && !(next = IN(1))->variable
+        && next->imm != INT64_MIN) {
+            op->op = OP_ADD_VI;
+            op->a = interp_slot(data);
+            op->b = t2 == IR_ADD ? next->imm : -next->imm;
+            return 4;
+        }
+
+        /* PUSH x; ASSIGN var */
+        if(t1 == IR_ASSIGN) {
+            op->op = data->variable ? OP_MOV_VV : OP_MOV_VI;
+            op->a = interp_slot(IN(1));
+            op->b = data->variable ? interp_slot(data) : data->imm;
+            return 2;
+        }
+
+        /* PUSH x; RET */
+        if(t1 == IR_RET) {
+            op->op = data->variable ? OP_RET_VAR : OP_RET_IMM;
+            op->a = fn->num_args;
+            op->b = data->variable ? interp_slot(data) : data->imm;
+            return 2;
+        }
+
+        op->op = data->variable ? OP_PUSH_VAR : OP_PUSH_IMM;
+        if(data->variable) op->a = interp_slot(data);
+        else op->b = data->imm;
+        return 1;
+    }
+
+    case IR_POP:
+        op->op = OP_POP_VAR;
+        op->a = interp_slot(IN(0));
+        return 1;
+
+    case IR_ASSIGN:
+        op->op = OP_ASSIGN;
+        op->a = interp_slot(IN(0));
+        return 1;
+
+    case IR_SAVE:
+        /* SAVE; RET returns the value that was just calculated */
+        if(PEEK(1) == IR_RET) {
+            op->op = OP_RET_ACC;
+            op->a = fn->num_args;
+            return 2;
+        }
+        op->op = OP_SAVE;
+        return 1;
+
+    case IR_SCOPEBEGIN:
+    case IR_SCOPEEND:
+        op->op = in->type == IR_SCOPEBEGIN ? OP_SP_SUB : OP_SP_ADD;
+        op->b = ((ir_instr_data_t *)IN(0))->imm;
+        return 1;
+
+    case IR_CALL: {
+        function_ref_t *ref = ((ir_instr_func_t *)IN(0))->ref;
+        if(ref->name_sz == 5 && !memcmp(ref->name, "print", 5))
+            op->op = OP_PRINT;
+        else if(ref->name_sz == 5 && !memcmp(ref->name, "input", 5))
+            op->op = OP_INPUT;
+        else {
+            op->op = OP_CALL;
+            op->idx = ref->idx;
+        }
+        return 1;
+    }
+
+    case IR_RET:
+    case IR_LEAVE:
+        op->op = in->type == IR_RET ? OP_RET : OP_LEAVE;
+        op->a = fn->num_args;
+        return 1;
+
+    case IR_IF:
+        op->op = OP_IF;
+        op->idx = ((ir_instr_if_t *)IN(0))->false_label;
+        return 1;
+
+    case IR_JMP:
+        op->op = OP_JMP;
+        op->idx = ((ir_instr_label_t *)IN(0))->id;
+        return 1;
+
+    default:
+        if(!interp_is_op(in->type)) return 0;
+
+        /* CMP; SAVE; IF */
+        if(interp_is_cmp(in->type) && PEEK(1) == IR_SAVE && PEEK(2) == IR_IF) {
+            op->op = interp_jcmps[in->type];
+            op->idx = ((ir_instr_if_t *)IN(2))->false_label;
+            return 3;
+        }
+
+        /* OP; SAVE */
+        if(PEEK(1) == IR_SAVE && PEEK(2) != IR_RET) {
+            op->op = interp_ops[in->type] + 1;
+            return 2;
+        }
+
+        op->op = interp_ops[in->type];
+        return 1;
+    }
+#undef IN
+#undef PEEK
+}
+
+/* turns label and function indices into pointers */
+static int interp_link(interp_decoder_t *d, ir_code_t *code) {
+    interp_op_t *ops = (void *)d->ops.data;
+    size_t num_ops = d->ops.sz / sizeof(interp_op_t);
+
+    for(size_t i = 0; i < num_ops; ++i) {
+        if(ops[i].op == OP_CALL) {
+            size_t fn = ops[i].idx;
+            if(fn == NO_ENTRY || d->entries[fn] == NO_ENTRY) {
+                function_ref_t *ref = fn == NO_ENTRY ? NULL
+                                    : vec_get(code->ctx->functions, fn);
+                fprintf(d->err, "[Error] Undefined reference to '%.*s'\n",
+                        ref ? (int)ref->name_sz : 4, ref ? ref->name : "main");
+                return 1;
+            }
+            /* the frame also holds the return address and frame pointer */
+            ops[i].b = d->need[fn] + 2;
+            ops[i].target = &ops[d->entries[fn]];
+        } else if(interp_is_jump(ops[i].op)) {
+            if(ops[i].idx >= code->num_label) {
+                fprintf(d->err, "[Error] Jump to undefined label %zu\n",
+                        ops[i].idx);
+                return 1;
+            }
+            ops[i].target = &ops[d->labels[ops[i].idx]];
+        }
+    }
+    return 0;
+}
+
+int interp_run(interp_t *it, int64_t *result) {
+    return interp_exec(it, result, NULL);
+}
+
+int interp_run_counted(interp_t *it, int64_t *result, uint64_t *counts) {
+    return interp_exec(it, result, counts);
+}
+
+/* counts every op before it is dispatched if counts is not NULL, through a
+ * second table so the uncounted run does not pay for it */
+static int interp_exec(interp_t *it, int64_t *result, uint64_t *counts) {
+    static const void *const dispatch[OP_NUM] = {
+    [OP_HALT] = &&op_HALT,
+    [OP_PUSH_IMM] = &&op_PUSH_IMM,
+    [OP_PUSH_VAR] = &&op_PUSH_VAR,
+    [OP_POP_VAR] = &&op_POP_VAR,
+    [OP_ASSIGN] = &&op_ASSIGN,
+    [OP_SAVE] = &&op_SAVE,
+    [OP_SP_SUB] = &&op_SP_SUB,
+    [OP_SP_ADD] = &&op_SP_ADD,
+#define X(n, e) [OP_##n] = &&op_##n, [OP_##n##_S] = &&op_##n##_S,
+    BINOPS(X)
+    UNOPS(X)
+    X(DIV, 0)
+    X(MOD, 0)
+    CMPS(X)
+#undef X
+#define X(n, o) [OP_J##n] = &&op_J##n, [OP_J##n##_VI] = &&op_J##n##_VI, \
+                [OP_J##n##_VV] = &&op_J##n##_VV,
+    CMPS(X)
+#undef X
+    [OP_CALL] = &&op_CALL,
+    [OP_PRINT] = &&op_PRINT,
+    [OP_INPUT] = &&op_INPUT,
+    [OP_RET] = &&op_RET,
+    [OP_RET_ACC] = &&op_RET_ACC,
+    [OP_RET_IMM] = &&op_RET_IMM,
+    [OP_RET_VAR] = &&op_RET_VAR,
+    [OP_LEAVE] = &&op_LEAVE,
+    [OP_IF] = &&op_IF,
+    [OP_JMP] = &&op_JMP,
+    [OP_ADD_VI] = &&op_ADD_VI,
+    [OP_MOV_VI] = &&op_MOV_VI,
+    [OP_MOV_VV] = &&op_MOV_VV,
+    };
+    static const void *const counted[OP_NUM] = {
+    [0 ... OP_NUM - 1] = &&op_COUNT,
+    };
+    const void *const *table = counts ? counted : dispatch;
+
+    int ret = 0;
+    int64_t *stack = alloc_malloc(ALLOC_OTHER,
+                                  sizeof(int64_t) * INTERP_STACK_WORDS);
+    /* the stack grows downwards with the same frame layout as the generated
+     * machine code: [bp] is the caller's bp, [bp+1] the return address and
+     * the arguments follow */
+    int64_t *sp = stack + INTERP_STACK_WORDS, *bp = sp;
+    int64_t acc = 0, a, b;
+    int32_t n;
+    const interp_op_t *ip = it->ops;
+
+#define DISPATCH() goto *table[ip->op]
+#define NEXT() do { ++ip; DISPATCH(); } while(0)
+#define JUMP() do { ip = ip->target; DISPATCH(); } while(0)
+#define PUSH(v) (*--sp = (v))
+#define POP() (*sp++)
+
+    /* main is called with its arguments 0 */
+    for(n = 0; n < it->ops[0].a; ++n) PUSH(0);
+    DISPATCH();
+
+op_COUNT:
+    ++counts[ip - it->ops];
+    goto *dispatch[ip->op];
+
+op_HALT:
+    *result = acc;
+    goto ret;
+
+op_PUSH_IMM: PUSH(ip->b); NEXT();
+op_PUSH_VAR: PUSH(bp[ip->a]); NEXT();
+op_POP_VAR: bp[ip->a] = POP(); NEXT();
+op_ASSIGN: bp[ip->a] = acc = POP(); NEXT();
+op_SAVE: PUSH(acc); NEXT();
+op_SP_SUB: sp -= ip->b; NEXT();
+op_SP_ADD: sp += ip->b; NEXT();
+
+#define X(n, e) \
+op_##n: b = POP(); a = POP(); acc = (e); NEXT(); \
+op_##n##_S: b = POP(); a = *sp; *sp = acc = (e); NEXT();
+BINOPS(X)
+#undef X
+
+#define X(n, e) \
+op_##n: a = POP(); acc = (e); NEXT(); \
+op_##n##_S: a = *sp; *sp = acc = (e); NEXT();
+UNOPS(X)
+#undef X
+
+#define X(n, o) \
+op_##n: b = POP(); a = POP(); acc = a o b; NEXT(); \
+op_##n##_S: b = POP(); a = *sp; *sp = acc = a o b; NEXT(); \
+op_J##n: b = POP(); a = POP(); if(!(a o b)) JUMP(); NEXT(); \
+op_J##n##_VI: if(!(bp[ip->a] o ip->b)) JUMP(); NEXT(); \
+op_J##n##_VV: if(!(bp[ip->a] o bp[ip->b])) JUMP(); NEXT();
+CMPS(X)
+#undef X
+
+op_DIV: b = POP(); a = POP();
+    if(b == 0 || (a == INT64_MIN && b == -1)) goto div_error;
+    acc = a / b;
+    NEXT();
+op_DIV_S: b = POP(); a = *sp;
+    if(b == 0 || (a == INT64_MIN && b == -1)) goto div_error;
+    *sp = acc = a / b;
+    NEXT();
+op_MOD: b = POP(); a = POP();
+    if(b == 0 || (a == INT64_MIN && b == -1)) goto div_error;
+    acc = a % b;
+    NEXT();
+op_MOD_S: b = POP(); a = *sp;
+    if(b == 0 || (a == INT64_MIN && b == -1)) goto div_error;
+    *sp = acc = a % b;
+    NEXT();
+
+op_CALL:
+    if(sp - ip->b < stack) goto overflow;
+    PUSH((intptr_t)(ip + 1));
+    PUSH((intptr_t)bp);
+    bp = sp;
+    JUMP();
+
+op_PRINT:
+    printf("%"PRId64"\n", POP());
+    acc = 0;
+    NEXT();
+
+op_INPUT:
+    if(scanf("%"SCNd64, &acc) != 1) acc = 0;
+    NEXT();
+
+op_RET: acc = POP(); goto leave;
+op_RET_ACC: goto leave;
+op_RET_IMM: acc = ip->b; goto leave;
+op_RET_VAR: acc = bp[ip->b]; goto leave;
+op_LEAVE:
+    /* implicit return 0 */
+    acc = 0;
+leave:
+    /* pop the arguments like the caller does after a call */
+    n = ip->a;
+    sp = bp;
+    bp = (int64_t *)(intptr_t)POP();
+    ip = (const interp_op_t *)(intptr_t)POP();
+    sp += n;
+    DISPATCH();
+
+op_IF: if(!POP()) JUMP(); NEXT();
+op_JMP: JUMP();
+
+op_ADD_VI: PUSH(acc = (int64_t)((uint64_t)bp[ip->a] + (uint64_t)ip->b)); NEXT();
+op_MOV_VI: bp[ip->a] = acc = ip->b; NEXT();
+op_MOV_VV: bp[ip->a] = acc = bp[ip->b]; NEXT();
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef PUSH
+#undef POP
+
+overflow:
+    fprintf(it->err, "[Error] Stack overflow\n");
+    ret = 1;
+    goto ret;
+
+div_error:
+    fprintf(it->err, "[Error] Division by zero or overflow\n");
+    ret = 1;
+
+ret:
+    alloc_free(ALLOC_OTHER, stack);
+    return ret;
+}
@@ -0,0 +1,97 @@
+/* MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE
+
+#include <parser/jit.h>
+#include <utils/alloc.h>
+#include <parser/x86.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static int64_t jit_host_print(int64_t);
+static int64_t jit_host_input(void);
+static int jit_resolve(void *, x86_sym_t *, uint64_t *);
+
+static const struct {
+    const char *name;
+    void *fn;
+} jit_host_syms[] = {
+{"dpp_host_print", (void *)jit_host_print},
+{"dpp_host_input", (void *)jit_host_input},
+};
+
+static int64_t jit_host_print(int64_t v) {
+    printf("%"PRId64"\n", v);
+    return 0;
+}
+
+static int64_t jit_host_input(void) {
+    int64_t v = 0;
+    if(scanf("%"SCNd64, &v) != 1) v = 0;
+    return v;
+}
+
+static int jit_resolve(void *data, x86_sym_t *sym, uint64_t *addr) {
+    (void)data;
+    for(size_t i = 0; i < sizeof jit_host_syms / sizeof *jit_host_syms; ++i)
+        if(strlen(jit_host_syms[i].name) == sym->name_sz
+        && !memcmp(jit_host_syms[i].name, sym->name, sym->name_sz)) {
+            *addr = (uintptr_t)jit_host_syms[i].fn;
+            return 0;
+        }
+    return 1;
+}
+
+jit_t *jit_new(ir_code_t *code) {
+    x86_obj_t *obj;
+    if(!(obj = x86_generate(code, RT_HOST))) return NULL;
+
+    jit_t *jit = alloc_malloc(ALLOC_OTHER, sizeof(jit_t));
+    size_t page = sysconf(_SC_PAGESIZE);
+    jit->sz = (obj->text.sz + obj->rodata.sz + page - 1) & ~(page - 1);
+    jit->mem = mmap(NULL, jit->sz, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(jit->mem == MAP_FAILED) {
+        fprintf(code->ctx->err, "[Error] mmap: %s\n", strerror(errno));
+        goto ret_free;
+    }
+
+    uintptr_t text = (uintptr_t)jit->mem;
+    uintptr_t rodata = text + obj->text.sz;
+    /* the host runtime keeps no data of its own, so there is no .bss */
+    if(x86_relocate(obj, text, rodata, 0, jit_resolve, NULL))
+        goto ret_unmap;
+    memcpy((void *)text, obj->text.data, obj->text.sz);
+    memcpy((void *)rodata, obj->rodata.data, obj->rodata.sz);
+
+    /* never writable and executable at the same time */
+    if(mprotect(jit->mem, jit->sz, PROT_READ | PROT_EXEC)) {
+        fprintf(code->ctx->err, "[Error] mprotect: %s\n", strerror(errno));
+        goto ret_unmap;
+    }
+
+    x86_sym_t *enter = vec_get(obj->symbols, x86_sym_find(obj, "_enter", 6));
+    *(void **)&jit->enter = (void *)(text + enter->offset);
+
+    x86_free(obj);
+    return jit;
+
+ret_unmap:
+    munmap(jit->mem, jit->sz);
+ret_free:
+    alloc_free(ALLOC_OTHER, jit);
+    x86_free(obj);
+    return NULL;
+}
+
+void jit_free(jit_t *jit) {
+    munmap(jit->mem, jit->sz);
+    alloc_free(ALLOC_OTHER, jit);
+}
+
+int64_t jit_run(jit_t *jit) {
+    return jit->enter();
+}
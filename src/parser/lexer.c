@@ -1,29 +1,73 @@
 #include <parser/lexer.h>
+#include <utils/alloc.h>
 
 #include <stdlib.h>
 #include <string.h>
 
 /* #define LEXER_DEBUG */
 
+static int lexer_fill(lexer_t *l, const unsigned char *keep);
 static token_t *lexer_read_identifier(lexer_t *l);
 static token_t *lexer_read_constant(lexer_t *l);
 
 lexer_t *lexer_new(const unsigned char *buf, size_t sz) {
-    lexer_t *lexer = malloc(sizeof(lexer_t));
+    lexer_t *lexer = alloc_malloc(ALLOC_OTHER, sizeof(lexer_t));
+    lexer_init(lexer, buf, sz);
+    return lexer;
+}
+
+void lexer_init(lexer_t *lexer, const unsigned char *buf, size_t sz) {
     lexer->start = buf;
     lexer->end = buf + sz;
     lexer->unget = 0;
+    lexer->num_tokens = 0;
     memset(&lexer->token, 0, sizeof(token_t));
-    return lexer;
+    lexer->read = NULL;
+    lexer->read_arg = NULL;
+    lexer->buf = NULL;
+    lexer->buf_sz = 0;
+}
+
+void lexer_init_stream(lexer_t *lexer, lexer_read_t read, void *arg) {
+    unsigned char *buf = alloc_malloc(ALLOC_BUF, LEXER_STREAM_SZ);
+    lexer_init(lexer, buf, 0);
+    lexer->buf = buf;
+    lexer->buf_sz = LEXER_STREAM_SZ;
+    lexer->read = read;
+    lexer->read_arg = arg;
+}
+
+void lexer_destroy(lexer_t *l) {
+    alloc_free(ALLOC_BUF, l->buf);
+    l->buf = NULL;
 }
 
 void lexer_free(lexer_t *l) {
-    free(l);
+    lexer_destroy(l);
+    alloc_free(ALLOC_OTHER, l);
+}
+
+/* reads more of a stream once the end of the window is reached, the bytes
+ * from keep on are moved to the start of the window first */
+static int lexer_fill(lexer_t *l, const unsigned char *keep) {
+    if(!l->read) return 0;
+    size_t keep_sz = l->end - keep, off = l->start - keep;
+    memmove(l->buf, keep, keep_sz);
+    /* tokens longer than half the window grow it */
+    if(keep_sz > l->buf_sz / 2)
+        l->buf = alloc_realloc(ALLOC_BUF, l->buf, l->buf_sz *= 2);
+
+    size_t n = l->read(l->read_arg, l->buf + keep_sz, l->buf_sz - keep_sz);
+    if(!n) l->read = NULL;
+    l->start = l->buf + off;
+    l->end = l->buf + keep_sz + n;
+    return n != 0;
 }
 
 int lexer_peek(lexer_t *l, size_t off) {
-    if(l->start + off < l->end) return l->start[off];
-    else return -1;
+    while(l->start + off >= l->end)
+        if(!lexer_fill(l, l->start)) return -1;
+    return l->start[off];
 }
 
 /* UB to call multiple times */
@@ -40,7 +84,8 @@ token_t *lexer_next(lexer_t *l) {
         l->unget = 0;
         return &l->token;
     }
-    for(; l->start < l->end; l->start++) {
+    ++l->num_tokens;
+    for(; l->start < l->end || lexer_fill(l, l->start); l->start++) {
         unsigned char c = *l->start;
         if(('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_')
             return lexer_read_identifier(l);
@@ -104,6 +149,7 @@ T("if", TIF)
 T("else", TELSE)
 T("fn", TFN)
 T("return", TRETURN)
+T("extern", TEXTERN)
 #undef T
 };
 
@@ -112,14 +158,16 @@ T("return", TRETURN)
 #else
 #define T(tk, type) token_init(tk, orig, sz, type)
 #endif
+/* the token is found from its end since filling the window may move it */
 static token_t *lexer_read_identifier(lexer_t *l) {
     size_t sz = 1;
-    const unsigned char *orig = l->start++;
-    for(; l->start < l->end &&
+    l->start++;
+    for(; (l->start < l->end || lexer_fill(l, l->start - sz)) &&
          (('a' <= *l->start && *l->start <= 'z')
        || ('A' <= *l->start && *l->start <= 'Z')
        || ('0' <= *l->start && *l->start <= '9')
        || (*l->start == '_')); l->start++, sz++);
+    const unsigned char *orig = l->start - sz;
 
     /* check if identifier is actually a keyword */
     for(size_t i = 0; i < sizeof keywords / sizeof *keywords; i++)
@@ -131,9 +179,10 @@ static token_t *lexer_read_identifier(lexer_t *l) {
 
 static token_t *lexer_read_constant(lexer_t *l) {
     size_t sz = 1;
-    const unsigned char *orig = l->start++;
-    for(; l->start < l->end
+    l->start++;
+    for(; (l->start < l->end || lexer_fill(l, l->start - sz))
        && ('0' <= *l->start && *l->start <= '9'); l->start++, sz++);
+    const unsigned char *orig = l->start - sz;
 
     return T(&l->token, TCONSTANT);
 }
@@ -0,0 +1,174 @@
+#include <parser/metrics.h>
+#include <utils/alloc.h>
+#include <inttypes.h>
+#include <string.h>
+
+static void metrics_add(fn_metrics_t *, const fn_metrics_t *);
+static void metrics_call(metrics_t *, size_t, uint64_t);
+static void metrics_exec(metrics_t *, size_t, uint64_t);
+static void metrics_print_fn(metrics_t *, const char *, int,
+                             const fn_metrics_t *, FILE *);
+static void metrics_json_fn(metrics_t *, const fn_metrics_t *, FILE *);
+
+metrics_t *metrics_new(ir_code_t *code) {
+    vec_t *ins = code->instructions;
+    size_t num_fns = code->ctx->functions->sz;
+    metrics_t *m = alloc_malloc(ALLOC_OTHER, sizeof(metrics_t));
+    m->code = code;
+    m->ir = alloc_malloc(ALLOC_OTHER, sizeof(asm_metrics_t) * (ins->sz + 1));
+    m->fn_of = alloc_malloc(ALLOC_OTHER, sizeof(size_t) * (ins->sz + 1));
+    m->fns = alloc_calloc(ALLOC_OTHER, num_fns + 1, sizeof(fn_metrics_t));
+    m->counted = 0;
+    for(size_t i = 0; i < num_fns; ++i) m->fns[i].first = SIZE_MAX;
+    if(asm_metrics(code, m->ir)) {
+        metrics_free(m);
+        return NULL;
+    }
+
+    size_t fn = SIZE_MAX;
+    for(size_t i = 0; i < ins->sz; ++i) {
+        ir_instr_func_t *in = vec_get(ins, i);
+        if(in->hdr.type == IR_FUNC) m->fns[fn = in->ref->idx].first = i;
+        if((m->fn_of[i] = fn) == SIZE_MAX) continue;
+        fn_metrics_t *f = &m->fns[fn];
+        if(in->hdr.type == IR_LEAVE) f->last = i;
+        f->instructions += m->ir[i].instructions;
+        f->pushes += m->ir[i].pushes;
+        f->pops += m->ir[i].pops;
+        f->mem_operands += m->ir[i].mem_operands;
+    }
+    return m;
+}
+
+void metrics_free(metrics_t *m) {
+    alloc_free(ALLOC_OTHER, m->ir);
+    alloc_free(ALLOC_OTHER, m->fn_of);
+    alloc_free(ALLOC_OTHER, m->fns);
+    alloc_free(ALLOC_OTHER, m);
+}
+
+/* the instructions of every op executed are those of the IR instructions it
+ * was decoded from, up to the first IR instruction of the next op */
+int metrics_run(metrics_t *m, interp_t *it, int64_t *result) {
+    size_t num_ir = m->code->instructions->sz;
+    uint64_t *counts = alloc_calloc(ALLOC_OTHER, it->num_ops + 1,
+                                    sizeof(uint64_t));
+    int ret = interp_run_counted(it, result, counts);
+    if(!ret) {
+        /* the first op calls main */
+        metrics_call(m, m->fn_of[it->ir[it->ops[0].target - it->ops]],
+                     counts[0]);
+        for(size_t i = 0; i < it->num_ops; ++i) {
+            if(!counts[i] || it->ir[i] == SIZE_MAX) continue;
+            size_t end = i + 1 < it->num_ops ? it->ir[i + 1] : num_ir;
+            for(size_t j = it->ir[i]; j < end; ++j)
+                metrics_exec(m, j, counts[i]);
+        }
+        m->counted = 1;
+    }
+    alloc_free(ALLOC_OTHER, counts);
+    return ret;
+}
+
+/* the prologue is executed with the call */
+static void metrics_call(metrics_t *m, size_t fn, uint64_t n) {
+    fn_metrics_t *f = &m->fns[fn];
+    f->called += n;
+    if(f->first != SIZE_MAX) f->executed += n * m->ir[f->first].instructions;
+}
+
+static void metrics_exec(metrics_t *m, size_t i, uint64_t n) {
+    ir_instr_func_t *in = vec_get(m->code->instructions, i);
+    fn_metrics_t *f = &m->fns[m->fn_of[i]];
+    switch(in->hdr.type) {
+    case IR_FUNC: return;
+
+    case IR_CALL:
+        f->calls += n;
+        metrics_call(m, in->ref->idx, n);
+        break;
+
+    case IR_RET:
+        /* jumps to the epilogue of the LEAVE */
+        f->executed += n * m->ir[f->last].tail;
+        break;
+
+    default: break;
+    }
+    f->executed += n * m->ir[i].instructions;
+}
+
+static void metrics_add(fn_metrics_t *sum, const fn_metrics_t *f) {
+    sum->instructions += f->instructions;
+    sum->pushes += f->pushes;
+    sum->pops += f->pops;
+    sum->mem_operands += f->mem_operands;
+    sum->executed += f->executed;
+    sum->calls += f->calls;
+    sum->called += f->called;
+}
+
+/* functions in the order they are defined */
+void metrics_print(metrics_t *m, FILE *f) {
+    vec_t *ins = m->code->instructions;
+    fn_metrics_t total;
+    memset(&total, 0, sizeof total);
+
+    fprintf(f, "%-20s %10s %8s %8s %8s", "Function", "Instrs", "Push", "Pop",
+            "Mem");
+    if(m->counted)
+        fprintf(f, " %14s %12s %12s", "Executed", "Calls", "Called");
+    fputc('\n', f);
+    for(size_t i = 0; i < ins->sz; ++i) {
+        ir_instr_func_t *in = vec_get(ins, i);
+        if(in->hdr.type != IR_FUNC) continue;
+        fn_metrics_t *fn = &m->fns[in->ref->idx];
+        metrics_print_fn(m, in->ref->name, in->ref->name_sz, fn, f);
+        metrics_add(&total, fn);
+    }
+    metrics_print_fn(m, "total", 5, &total, f);
+}
+
+static void metrics_print_fn(metrics_t *m, const char *name, int name_sz,
+                             const fn_metrics_t *fn, FILE *f) {
+    fprintf(f, "%-20.*s %10"PRIu64" %8"PRIu64" %8"PRIu64" %8"PRIu64, name_sz,
+            name, fn->instructions, fn->pushes, fn->pops, fn->mem_operands);
+    if(m->counted)
+        fprintf(f, " %14"PRIu64" %12"PRIu64" %12"PRIu64, fn->executed,
+                fn->calls, fn->called);
+    fputc('\n', f);
+}
+
+/* the dynamic counts are null without a counted run */
+void metrics_json(metrics_t *m, FILE *f) {
+    vec_t *ins = m->code->instructions;
+    fn_metrics_t total;
+    memset(&total, 0, sizeof total);
+    int first = 1;
+
+    fputs("{\"codegen\": {\"functions\": [", f);
+    for(size_t i = 0; i < ins->sz; ++i) {
+        ir_instr_func_t *in = vec_get(ins, i);
+        if(in->hdr.type != IR_FUNC) continue;
+        fn_metrics_t *fn = &m->fns[in->ref->idx];
+        fprintf(f, "%s{\"name\": \"%.*s\", ", first ? "" : ", ",
+                (int)in->ref->name_sz, in->ref->name);
+        metrics_json_fn(m, fn, f);
+        fputc('}', f);
+        metrics_add(&total, fn);
+        first = 0;
+    }
+    fputs("], \"total\": {", f);
+    metrics_json_fn(m, &total, f);
+    fputs("}}}\n", f);
+}
+
+static void metrics_json_fn(metrics_t *m, const fn_metrics_t *fn, FILE *f) {
+    fprintf(f, "\"instructions\": %"PRIu64", \"pushes\": %"PRIu64", "
+            "\"pops\": %"PRIu64", \"mem_operands\": %"PRIu64", ",
+            fn->instructions, fn->pushes, fn->pops, fn->mem_operands);
+    if(m->counted)
+        fprintf(f, "\"executed\": %"PRIu64", \"calls\": %"PRIu64", "
+                "\"called\": %"PRIu64, fn->executed, fn->calls, fn->called);
+    else fputs("\"executed\": null, \"calls\": null, \"called\": null", f);
+}
@@ -1,8 +1,11 @@
 #include <parser/parser.h>
+#include <utils/alloc.h>
+#include <utils/trace.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <inttypes.h>
 #include <string.h>
+#include <errno.h>
 
 static ast_node_fn_defn_t *parser_parse_fn_defn(parser_t *);
 static ast_node_stmt_decl_t *parser_parse_stmt_decl(parser_t *);
@@ -11,6 +14,10 @@ static ast_node_stmt_if_t *parser_parse_stmt_if(parser_t *);
 static ast_node_stmt_ret_t *parser_parse_stmt_ret(parser_t *);
 static ast_node_stmt_block_t *parser_parse_stmt_block(parser_t *);
 static int parser_parse_block(parser_t *, vec_t *);
+static int parser_parse_block_stmts(parser_t *, vec_t *);
+static int parser_enter(parser_t *);
+static int parser_node(parser_t *, size_t *, size_t);
+static int parser_too_deep(parser_t *, size_t);
 
 static ast_node_t *parser_parse_expr(parser_t *);
 static ast_node_t *parser_parse_expr_lor(parser_t *);
@@ -26,19 +33,31 @@ static ast_node_t *parser_parse_expr_unary(parser_t *);
 static ast_node_t *parser_parse_expr_postfix(parser_t *);
 
 parser_t *parser_new(lexer_t *lexer) {
-    parser_t *parser = malloc(sizeof(parser_t));
+    parser_t *parser = alloc_malloc(ALLOC_OTHER, sizeof(parser_t));
+    parser_init(parser, lexer);
+    return parser;
+}
+
+void parser_init(parser_t *parser, lexer_t *lexer) {
     parser->lexer = lexer;
     parser->root = NULL;
-    return parser;
+    parser->err = stderr;
+    parser->error = 0;
+    parser->depth = 0;
+    parser->height = 0;
 }
 
 ast_node_tu_t *parser_parse(parser_t *p) {
-    ast_node_tu_t *tu = malloc(sizeof(ast_node_tu_t));
+    ast_node_tu_t *tu = alloc_malloc(ALLOC_AST, sizeof(ast_node_tu_t));
     tu->hdr.type = AST_TU;
     tu->functions = vec_new_free(1, (vec_free_t)ast_free);
+    tu->externs = vec_new_free(1, (vec_free_t)ast_free);
+    tu->ctx = NULL;
 
     ast_node_fn_defn_t *fn;
-    while((fn = parser_parse_fn_defn(p))) vec_push(tu->functions, fn);
+    while((fn = parser_parse_fn(p)))
+        vec_push(fn->hdr.type == AST_FN_DECL ? tu->externs : tu->functions,
+                 fn);
     if(p->error) {
         ast_free((void *)tu);
         return NULL;
@@ -47,15 +66,24 @@ ast_node_tu_t *parser_parse(parser_t *p) {
     return tu;
 }
 
+/* parses the next function definition or extern declaration, NULL at the
+ * end of the input or on errors */
+ast_node_fn_defn_t *parser_parse_fn(parser_t *p) {
+    uint64_t start = trace_begin();
+    ast_node_fn_defn_t *fn = parser_parse_fn_defn(p);
+    if(fn) trace_end("parse", fn->ident->name, fn->ident->name_sz, start);
+    return fn;
+}
+
 void parser_free(parser_t *p) {
     if(p->root) ast_free(p->root);
-    free(p);
+    alloc_free(ALLOC_OTHER, p);
 }
 
 int parser_eat(parser_t *p, enum token_type type) {
     token_t *token = lexer_next(p->lexer);
     if(token->type != type) {
-        fprintf(stderr, "[Error] Expected token '%s' but got '%s'\n",
+        fprintf(p->err, "[Error] Expected token '%s' but got '%s'\n",
                 token_type_str(type), token_type_str(token->type));
         return p->error = 1;
     }
@@ -66,6 +94,7 @@ int parser_eat(parser_t *p, enum token_type type) {
 
 static ast_node_fn_defn_t *parser_parse_fn_defn(parser_t *p) {
     token_t *token = lexer_next(p->lexer);
+    int external = 0;
 
     switch(token->type) {
     default:
@@ -74,16 +103,23 @@ static ast_node_fn_defn_t *parser_parse_fn_defn(parser_t *p) {
         parser_eat(p, TFN);
         __attribute__((fallthrough));
     case TEOF: return NULL;
+    case TEXTERN:
+        if(parser_eat(p, TFN)) return NULL;
+        external = 1;
+        break;
     case TFN: break;
     }
 
     if(parser_eat(p, TIDENTIFIER)) return NULL;
 
-    ast_node_fn_defn_t *node = malloc(sizeof(ast_node_fn_defn_t));
-    node->hdr.type = AST_FN_DEFN;
+    ast_node_fn_defn_t *node = alloc_malloc(ALLOC_AST,
+                                            sizeof(ast_node_fn_defn_t));
+    node->hdr.type = external ? AST_FN_DECL : AST_FN_DEFN;
     node->ident = ast_node_ident_new(token);
     node->arguments = vec_new_free(1, (vec_free_t)ast_free);
     node->body = vec_new_free(1, (vec_free_t)ast_free);
+    node->scope = NULL;
+    node->ref = NULL;
 
     if(parser_eat(p, '(')) goto ret_free;
 
@@ -98,7 +134,7 @@ static ast_node_fn_defn_t *parser_parse_fn_defn(parser_t *p) {
                 if(parser_eat(p, TIDENTIFIER)) goto ret_free;
                 continue;
             } else {
-                fprintf(stderr, "[Error] Expected token 'TCOMMA' or 'TRPAREN' "
+                fprintf(p->err, "[Error] Expected token 'TCOMMA' or 'TRPAREN' "
                         "but got '%s'\n",
                         token_type_str(token->type));
                 p->error = 1;
@@ -106,14 +142,16 @@ static ast_node_fn_defn_t *parser_parse_fn_defn(parser_t *p) {
             }
         }
     } else {
-        fprintf(stderr, "[Error] Expected token 'TIDENTIFIER' or 'TRPAREN' but "
+        fprintf(p->err, "[Error] Expected token 'TIDENTIFIER' or 'TRPAREN' but "
                 "got '%s'\n",
                 token_type_str(token->type));
         p->error = 1;
         goto ret_free;
     }
 
-    if(parser_parse_block(p, node->body)) goto ret_free;
+    /* a declaration ends where the body would start */
+    if(external ? parser_eat(p, ';') : parser_parse_block(p, node->body))
+        goto ret_free;
 
     return node;
 ret_free:
@@ -124,15 +162,24 @@ ret_free:
 static ast_node_stmt_decl_t *parser_parse_stmt_decl(parser_t *p) {
     if(parser_eat(p, TLET)) return NULL;
     if(parser_eat(p, TIDENTIFIER)) return NULL;
-    token_t prev;
-    memcpy(&prev, &p->lexer->token, sizeof(token_t));
-    if(parser_eat(p, '=')) return NULL;
+    /* the name is copied before the next token, which may move the text of
+     * a streamed source */
+    ast_node_ident_t *ident = ast_node_ident_new(&p->lexer->token);
+    if(parser_eat(p, '=')) {
+        ast_free((void *)ident);
+        return NULL;
+    }
 
-    ast_node_stmt_decl_t *node = malloc(sizeof(ast_node_stmt_decl_t));
+    ast_node_stmt_decl_t *node = alloc_malloc(ALLOC_AST,
+                                              sizeof(ast_node_stmt_decl_t));
     node->hdr.type = AST_STMT_DECL;
-    node->ident = ast_node_ident_new(&prev);
+    node->ident = ident;
     node->expr = parser_parse_expr(p);
-    if(!node->expr) goto ret_free;
+    if(!node->expr) {
+        ast_free((void *)ident);
+        alloc_free(ALLOC_AST, node);
+        return NULL;
+    }
     if(parser_eat(p, ';')) goto ret_free;
 
     return node;
@@ -142,11 +189,12 @@ ret_free:
 }
 
 static ast_node_stmt_expr_t *parser_parse_stmt_expr(parser_t *p) {
-    ast_node_stmt_expr_t *node = malloc(sizeof(ast_node_stmt_expr_t));
+    ast_node_stmt_expr_t *node = alloc_malloc(ALLOC_AST,
+                                              sizeof(ast_node_stmt_expr_t));
     node->hdr.type = AST_STMT_EXPR;
     node->expr = parser_parse_expr(p);
     if(!node->expr) {
-        free(node);
+        alloc_free(ALLOC_AST, node);
         return NULL;
     }
     if(parser_eat(p, ';')) goto ret_free;
@@ -160,11 +208,12 @@ ret_free:
 static ast_node_stmt_if_t *parser_parse_stmt_if(parser_t *p) {
     if(parser_eat(p, TIF)) return NULL;
 
-    ast_node_stmt_if_t *node = malloc(sizeof(ast_node_stmt_if_t));
+    ast_node_stmt_if_t *node = alloc_malloc(ALLOC_AST,
+                                            sizeof(ast_node_stmt_if_t));
     node->hdr.type = AST_STMT_IF;
     node->condition = parser_parse_expr(p);
     if(!node->condition) {
-        free(node);
+        alloc_free(ALLOC_AST, node);
         return NULL;
     }
     node->branch_true = vec_new_free(1, (vec_free_t)ast_free);
@@ -176,7 +225,9 @@ static ast_node_stmt_if_t *parser_parse_stmt_if(parser_t *p) {
     case TIF: {
         lexer_unget(p->lexer);
 
+        if(parser_enter(p)) goto ret_free;
         ast_node_stmt_if_t *else_if = parser_parse_stmt_if(p);
+        --p->depth;
         if(!else_if) goto ret_free;
         vec_push(node->branch_false, else_if);
         break;
@@ -201,11 +252,12 @@ ret_free:
 static ast_node_stmt_ret_t *parser_parse_stmt_ret(parser_t *p) {
     if(parser_eat(p, TRETURN)) return NULL;
 
-    ast_node_stmt_ret_t *node = malloc(sizeof(ast_node_stmt_ret_t));
+    ast_node_stmt_ret_t *node = alloc_malloc(ALLOC_AST,
+                                             sizeof(ast_node_stmt_ret_t));
     node->hdr.type = AST_STMT_RET;
     node->expr = parser_parse_expr(p);
     if(!node->expr) {
-        free(node);
+        alloc_free(ALLOC_AST, node);
         return NULL;
     }
     if(parser_eat(p, ';')) goto ret_free;
@@ -217,18 +269,26 @@ ret_free:
 }
 
 static ast_node_stmt_block_t *parser_parse_stmt_block(parser_t *p) {
-    ast_node_stmt_block_t *node = malloc(sizeof(ast_node_stmt_block_t));
+    ast_node_stmt_block_t *node = alloc_malloc(ALLOC_AST,
+                                               sizeof(ast_node_stmt_block_t));
     node->hdr.type = AST_STMT_BLOCK;
     node->stmts = vec_new_free(1, (vec_free_t)ast_free);
     if(parser_parse_block(p, node->stmts)) {
         vec_free(node->stmts);
-        free(node);
+        alloc_free(ALLOC_AST, node);
         return NULL;
     }
     return (void *)node;
 }
 
 static int parser_parse_block(parser_t *p, vec_t *vec) {
+    if(parser_enter(p)) return 1;
+    int ret = parser_parse_block_stmts(p, vec);
+    --p->depth;
+    return ret;
+}
+
+static int parser_parse_block_stmts(parser_t *p, vec_t *vec) {
     {
         int err = 0;
         if((err = parser_eat(p, '{'))) return err;
@@ -281,7 +341,7 @@ static int parser_parse_block(parser_t *p, vec_t *vec) {
         }
 
         default:
-            fprintf(stderr, "[Error] Unexpected token '%s' in code block\n",
+            fprintf(p->err, "[Error] Unexpected token '%s' in code block\n",
                     token_type_str(token->type));
             return p->error = 1;
         }
@@ -289,12 +349,16 @@ static int parser_parse_block(parser_t *p, vec_t *vec) {
 }
 
 static ast_node_t *parser_parse_expr(parser_t *p) {
-    return parser_parse_expr_lor(p);
+    if(parser_enter(p)) return NULL;
+    ast_node_t *node = parser_parse_expr_lor(p);
+    --p->depth;
+    return node;
 }
 
 static inline ast_node_t *parser_parse_expr_lor(parser_t *p) {
     ast_node_t *left = parser_parse_expr_land(p);
     if(!left) return NULL;
+    size_t height = p->height;
     while(lexer_next(p->lexer)->type == TLOR_OP) {
         ast_node_t *right = parser_parse_expr_land(p);
         if(!right) {
@@ -302,14 +366,20 @@ static inline ast_node_t *parser_parse_expr_lor(parser_t *p) {
             return NULL;
         }
         left = (void *)ast_node_expr_binary_new(left, right, EXPR_LOR);
+        if(parser_node(p, &height, p->height)) {
+            ast_free(left);
+            return NULL;
+        }
     }
     lexer_unget(p->lexer);
+    p->height = height;
     return left;
 }
 
 static ast_node_t *parser_parse_expr_land(parser_t *p) {
     ast_node_t *left = parser_parse_expr_bitor(p);
     if(!left) return NULL;
+    size_t height = p->height;
     while(lexer_next(p->lexer)->type == TLAND_OP) {
         ast_node_t *right = parser_parse_expr_bitor(p);
         if(!right) {
@@ -317,14 +387,20 @@ static ast_node_t *parser_parse_expr_land(parser_t *p) {
             return NULL;
         }
         left = (void *)ast_node_expr_binary_new(left, right, EXPR_LAND);
+        if(parser_node(p, &height, p->height)) {
+            ast_free(left);
+            return NULL;
+        }
     }
     lexer_unget(p->lexer);
+    p->height = height;
     return left;
 }
 
 static ast_node_t *parser_parse_expr_bitor(parser_t *p) {
     ast_node_t *left = parser_parse_expr_bitxor(p);
     if(!left) return NULL;
+    size_t height = p->height;
     while(lexer_next(p->lexer)->type == '|') {
         ast_node_t *right = parser_parse_expr_bitxor(p);
         if(!right) {
@@ -332,14 +408,20 @@ static ast_node_t *parser_parse_expr_bitor(parser_t *p) {
             return NULL;
         }
         left = (void *)ast_node_expr_binary_new(left, right, EXPR_BITOR);
+        if(parser_node(p, &height, p->height)) {
+            ast_free(left);
+            return NULL;
+        }
     }
     lexer_unget(p->lexer);
+    p->height = height;
     return left;
 }
 
 static ast_node_t *parser_parse_expr_bitxor(parser_t *p) {
     ast_node_t *left = parser_parse_expr_bitand(p);
     if(!left) return NULL;
+    size_t height = p->height;
     while(lexer_next(p->lexer)->type == '^') {
         ast_node_t *right = parser_parse_expr_bitand(p);
         if(!right) {
@@ -347,14 +429,20 @@ static ast_node_t *parser_parse_expr_bitxor(parser_t *p) {
             return NULL;
         }
         left = (void *)ast_node_expr_binary_new(left, right, EXPR_BITXOR);
+        if(parser_node(p, &height, p->height)) {
+            ast_free(left);
+            return NULL;
+        }
     }
     lexer_unget(p->lexer);
+    p->height = height;
     return left;
 }
 
 static ast_node_t *parser_parse_expr_bitand(parser_t *p) {
     ast_node_t *left = parser_parse_expr_eq(p);
     if(!left) return NULL;
+    size_t height = p->height;
     while(lexer_next(p->lexer)->type == '&') {
         ast_node_t *right = parser_parse_expr_eq(p);
         if(!right) {
@@ -362,8 +450,13 @@ static ast_node_t *parser_parse_expr_bitand(parser_t *p) {
             return NULL;
         }
         left = (void *)ast_node_expr_binary_new(left, right, EXPR_BITAND);
+        if(parser_node(p, &height, p->height)) {
+            ast_free(left);
+            return NULL;
+        }
     }
     lexer_unget(p->lexer);
+    p->height = height;
     return left;
 }
 
@@ -371,6 +464,7 @@ static ast_node_t *parser_parse_expr_eq(parser_t *p) {
     ast_node_t *left = parser_parse_expr_rel(p);
     enum expr_binary_type type;
     if(!left) return NULL;
+    size_t height = p->height;
     for(;;) {
         switch(lexer_next(p->lexer)->type) {
         case TEQ_OP:  type = EXPR_EQ; break;
@@ -378,6 +472,7 @@ static ast_node_t *parser_parse_expr_eq(parser_t *p) {
 
         default:
             lexer_unget(p->lexer);
+            p->height = height;
             return left;
         }
         ast_node_t *right = parser_parse_expr_rel(p);
@@ -386,6 +481,10 @@ static ast_node_t *parser_parse_expr_eq(parser_t *p) {
             return NULL;
         }
         left = (void *)ast_node_expr_binary_new(left, right, type);
+        if(parser_node(p, &height, p->height)) {
+            ast_free(left);
+            return NULL;
+        }
     }
 }
 
@@ -393,6 +492,7 @@ static ast_node_t *parser_parse_expr_rel(parser_t *p) {
     ast_node_t *left = parser_parse_expr_add(p);
     enum expr_binary_type type;
     if(!left) return NULL;
+    size_t height = p->height;
     for(;;) {
         switch(lexer_next(p->lexer)->type) {
         case '<':     type = EXPR_LT; break;
@@ -402,6 +502,7 @@ static ast_node_t *parser_parse_expr_rel(parser_t *p) {
 
         default:
             lexer_unget(p->lexer);
+            p->height = height;
             return left;
         }
         ast_node_t *right = parser_parse_expr_add(p);
@@ -410,6 +511,10 @@ static ast_node_t *parser_parse_expr_rel(parser_t *p) {
             return NULL;
         }
         left = (void *)ast_node_expr_binary_new(left, right, type);
+        if(parser_node(p, &height, p->height)) {
+            ast_free(left);
+            return NULL;
+        }
     }
 }
 
@@ -417,6 +522,7 @@ static ast_node_t *parser_parse_expr_add(parser_t *p) {
     ast_node_t *left = parser_parse_expr_mult(p);
     enum expr_binary_type type;
     if(!left) return NULL;
+    size_t height = p->height;
     for(;;) {
         switch(lexer_next(p->lexer)->type) {
         case '+': type = EXPR_ADD; break;
@@ -424,6 +530,7 @@ static ast_node_t *parser_parse_expr_add(parser_t *p) {
 
         default:
             lexer_unget(p->lexer);
+            p->height = height;
             return left;
         }
         ast_node_t *right = parser_parse_expr_mult(p);
@@ -432,6 +539,10 @@ static ast_node_t *parser_parse_expr_add(parser_t *p) {
             return NULL;
         }
         left = (void *)ast_node_expr_binary_new(left, right, type);
+        if(parser_node(p, &height, p->height)) {
+            ast_free(left);
+            return NULL;
+        }
     }
 }
 
@@ -439,6 +550,7 @@ static ast_node_t *parser_parse_expr_mult(parser_t *p) {
     ast_node_t *left = parser_parse_expr_unary(p);
     enum expr_binary_type type;
     if(!left) return NULL;
+    size_t height = p->height;
     for(;;) {
         switch(lexer_next(p->lexer)->type) {
         case '*': type = EXPR_MULT; break;
@@ -447,6 +559,7 @@ static ast_node_t *parser_parse_expr_mult(parser_t *p) {
 
         default:
             lexer_unget(p->lexer);
+            p->height = height;
             return left;
         }
         ast_node_t *right = parser_parse_expr_unary(p);
@@ -455,6 +568,10 @@ static ast_node_t *parser_parse_expr_mult(parser_t *p) {
             return NULL;
         }
         left = (void *)ast_node_expr_binary_new(left, right, type);
+        if(parser_node(p, &height, p->height)) {
+            ast_free(left);
+            return NULL;
+        }
     }
 }
 
@@ -468,63 +585,117 @@ static ast_node_t *parser_parse_expr_unary(parser_t *p) {
         lexer_unget(p->lexer);
         return parser_parse_expr_postfix(p);
     }
+    if(parser_enter(p)) return NULL;
     ast_node_t *op = parser_parse_expr_unary(p);
+    --p->depth;
     if(!op) return NULL;
 
-    return (void *)ast_node_expr_unary_new(op, type);
+    ast_node_t *node = (void *)ast_node_expr_unary_new(op, type);
+    size_t height = 0;
+    if(parser_node(p, &height, p->height)) {
+        ast_free(node);
+        return NULL;
+    }
+    p->height = height;
+    return node;
 }
 
 /* function calling is the only "postfix" operator */
 static ast_node_t *parser_parse_expr_postfix(parser_t *p) {
     token_t *t = lexer_next(p->lexer);
-    token_t prev;
+    ast_node_ident_t *ident;
 
     switch(t->type) {
-    case TCONSTANT:
-        return (void *)ast_node_const_new(t);
+    case TCONSTANT: {
+        errno = 0;
+        ast_node_const_t *node = ast_node_const_new(t);
+        if(errno)
+            fprintf(p->err, "[Warning] Constant '%.*s' is out of range\n",
+                    (int)t->sz, t->start);
+        p->height = 1;
+        return (void *)node;
+    }
 
     case '(': {
         ast_node_t *expr = parser_parse_expr(p);
+        if(!expr) return NULL;
         parser_eat(p, ')');
         return expr;
     }
 
     default:
-        fprintf(stderr, "[Error] Expected token 'TCONSTANT', 'TIDENTIFIER', or "
+        fprintf(p->err, "[Error] Expected token 'TCONSTANT', 'TIDENTIFIER', or "
                         "'TLPAREN' but got '%s'\n", token_type_str(t->type));
         p->error = 1;
         return NULL;
 
     case TIDENTIFIER:
-        memcpy(&prev, t, sizeof(token_t));
+        /* copied before the next token like in parser_parse_stmt_decl */
+        ident = ast_node_ident_new(t);
         if(lexer_next(p->lexer)->type != '(') {
             lexer_unget(p->lexer);
-            return (void *)ast_node_ident_new(&prev);
+            p->height = 1;
+            return (void *)ident;
         }
         /* this is actually a function call */
         break;
     }
 
-    ast_node_expr_call_t *node = malloc(sizeof(ast_node_expr_call_t));
+    ast_node_expr_call_t *node = alloc_malloc(ALLOC_AST,
+                                              sizeof(ast_node_expr_call_t));
     node->hdr.type = AST_EXPR_CALL;
-    node->ident = ast_node_ident_new(&prev);
+    node->ident = ident;
+    node->ref = NULL;
     node->args = vec_new_free(1, (vec_free_t)ast_free);
 
-    if(lexer_next(p->lexer)->type == ')') return (void *)node;
+    /* of the highest argument */
+    size_t height = 0;
+    if(lexer_next(p->lexer)->type == ')') {
+        p->height = 1;
+        return (void *)node;
+    }
     lexer_unget(p->lexer);
     ast_node_t *expr = parser_parse_expr(p);
     if(!expr) goto ret_free;
     vec_push(node->args, expr);
+    height = p->height;
 
     while(lexer_next(p->lexer)->type != ')') {
         lexer_unget(p->lexer);
         if(parser_eat(p, ',')) goto ret_free;
         if(!(expr = parser_parse_expr(p))) goto ret_free;
         vec_push(node->args, expr);
+        if(p->height > height) height = p->height;
     }
 
+    if(parser_node(p, &height, 0)) goto ret_free;
+    p->height = height;
     return (void *)node;
 ret_free:
     ast_free((void *)node);
     return NULL;
 }
+
+/* enters a block or expression, or returns non-zero if that is too deep */
+static int parser_enter(parser_t *p) {
+    if(!parser_too_deep(p, ++p->depth)) return 0;
+    --p->depth;
+    return 1;
+}
+
+/* the height of a node over children of height and child */
+static int parser_node(parser_t *p, size_t *height, size_t child) {
+    *height = (child > *height ? child : *height) + 1;
+    return parser_too_deep(p, p->depth + *height);
+}
+
+/* the passes over the tree recurse as deep as it is, which is bounded so
+ * they stay within the stack */
+static int parser_too_deep(parser_t *p, size_t depth) {
+    if(depth <= PARSER_MAX_DEPTH) return 0;
+    if(!p->error)
+        fprintf(p->err, "[Error] Code is nested deeper than %d levels\n",
+                PARSER_MAX_DEPTH);
+    p->error = 1;
+    return 1;
+}
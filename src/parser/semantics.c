@@ -1,22 +1,42 @@
 #include <parser/semantics.h>
+#include <utils/alloc.h>
+#include <utils/trace.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void scope_dump(scope_t *, size_t);
+/* initial size of the function and variable tables */
+#define SEMANTICS_TABLE_SZ 64
+
+static void scope_dump(FILE *, scope_t *, size_t);
+static void scope_dump_compact(FILE *, ast_node_ident_t *, scope_t *,
+                               size_t);
 
-static int function_ref_compar(vec_item_t, vec_item_t);
 static int variable_ref_compar(vec_item_t, vec_item_t);
 
-static int semantics_analyze_fn(semantics_ctx_t *, ast_node_fn_defn_t *);
+static size_t name_hash(const char *, size_t);
+static int name_eq(const char *, size_t, const char *, size_t);
+static void function_table_update(semantics_ctx_t *);
+static void function_table_reset(semantics_ctx_t *, size_t);
+static variable_ref_t **variable_slot(semantics_ctx_t *, const char *,
+                                      size_t);
+static void variable_bind(semantics_ctx_t *, variable_ref_t *);
+static void variable_unbind(semantics_ctx_t *, size_t);
+static void variable_table_delete(semantics_ctx_t *, size_t);
+static void variable_table_grow(semantics_ctx_t *);
+
+static void semantics_declare_block(semantics_ctx_t *, scope_t *, vec_t *);
+static int semantics_analyze_scope(semantics_ctx_t *, scope_t *, vec_t *);
 static int semantics_analyze_block(semantics_ctx_t *, scope_t *, vec_t *);
 static int semantics_analyze_stmt(semantics_ctx_t *, scope_t *, ast_node_t *);
 static int semantics_analyze_expr(semantics_ctx_t *, scope_t *, ast_node_t *);
 
 function_ref_t *function_ref_new(char *name, size_t name_sz, size_t num_args) {
-    function_ref_t *ref = malloc(sizeof(function_ref_t));
-    ref->name = malloc(ref->name_sz = name_sz);
+    function_ref_t *ref = alloc_malloc(ALLOC_FUNCTION, sizeof(function_ref_t));
+    ref->name = alloc_malloc(ALLOC_FUNCTION, ref->name_sz = name_sz);
     memcpy(ref->name, name, name_sz);
     ref->num_args = num_args;
+    ref->idx = 0;
+    ref->external = 0;
     return ref;
 }
 
@@ -26,44 +46,121 @@ function_ref_t *function_ref_new_node(ast_node_fn_defn_t *fn) {
 }
 
 void function_ref_free(function_ref_t *ref) {
-    free(ref->name);
-    free(ref);
+    alloc_free(ALLOC_FUNCTION, ref->name);
+    alloc_free(ALLOC_FUNCTION, ref);
 }
 
-static int function_ref_compar(vec_item_t lv, vec_item_t rv) {
-    function_ref_t *l = lv, *r = rv;
-    if(l->name_sz != r->name_sz) return l->name_sz - r->name_sz;
-    else return memcmp(l->name, r->name, l->name_sz);
+function_ref_t *function_ref_add(semantics_ctx_t *ctx, function_ref_t *ref) {
+    /* notices the vector being truncated before it grows again */
+    function_table_update(ctx);
+    ref->idx = ctx->functions->sz;
+    return vec_push(ctx->functions, ref);
 }
 
 function_ref_t *function_ref_find(semantics_ctx_t *ctx,
                                   ast_node_ident_t *ident) {
-    function_ref_t match = (function_ref_t) {
-    .name = ident->name,
-    .name_sz = ident->name_sz,
-    .num_args = 0,
-    };
-    ssize_t idx = vec_index_of(ctx->functions, &match, function_ref_compar);
-    if(idx < 0) return NULL;
-    else return vec_get(ctx->functions, idx);
+    function_table_update(ctx);
+    size_t mask = ctx->fn_table_sz - 1;
+    for(size_t i = name_hash(ident->name, ident->name_sz) & mask;
+        ctx->fn_table[i]; i = (i + 1) & mask) {
+        function_ref_t *ref = vec_get(ctx->functions, ctx->fn_table[i] - 1);
+        if(name_eq(ref->name, ref->name_sz, ident->name, ident->name_sz))
+            return ref;
+    }
+    return NULL;
+}
+
+static size_t name_hash(const char *name, size_t name_sz) {
+    size_t h = 0xcbf29ce484222325u;
+    for(size_t i = 0; i < name_sz; ++i)
+        h = (h ^ (unsigned char)name[i]) * 0x100000001b3u;
+    return h;
+}
+
+static int name_eq(const char *a, size_t a_sz, const char *b, size_t b_sz) {
+    return a_sz == b_sz && !memcmp(a, b, a_sz);
+}
+
+/* indexes the functions added since the last call, the vector is truncated
+ * and filled again by incr so the index starts over if it shrinks */
+static void function_table_update(semantics_ctx_t *ctx) {
+    vec_t *fns = ctx->functions;
+    if(fns->sz < ctx->fn_indexed)
+        function_table_reset(ctx, ctx->fn_table_sz);
+    if(fns->sz * 2 > ctx->fn_table_sz) {
+        size_t sz = ctx->fn_table_sz;
+        while(fns->sz * 2 > sz) sz *= 2;
+        function_table_reset(ctx, sz);
+    }
+
+    size_t mask = ctx->fn_table_sz - 1;
+    for(; ctx->fn_indexed < fns->sz; ++ctx->fn_indexed) {
+        function_ref_t *ref = vec_get(fns, ctx->fn_indexed), *other;
+        size_t i;
+        for(i = name_hash(ref->name, ref->name_sz) & mask; ctx->fn_table[i];
+            i = (i + 1) & mask) {
+            other = vec_get(fns, ctx->fn_table[i] - 1);
+            if(name_eq(other->name, other->name_sz, ref->name, ref->name_sz))
+                break;
+        }
+        /* calls go to the first of several definitions */
+        if(!ctx->fn_table[i]) ctx->fn_table[i] = ctx->fn_indexed + 1;
+    }
+}
+
+static void function_table_reset(semantics_ctx_t *ctx, size_t sz) {
+    if(sz != ctx->fn_table_sz) {
+        alloc_free(ALLOC_FUNCTION, ctx->fn_table);
+        ctx->fn_table = alloc_calloc(ALLOC_FUNCTION, sz, sizeof(size_t));
+        ctx->fn_table_sz = sz;
+    } else memset(ctx->fn_table, 0, sizeof(size_t) * sz);
+    ctx->fn_indexed = 0;
+}
+
+/* adds a function, or returns the one of the same name if either is an extern
+ * declaration, NULL if they do not take the same number of arguments */
+function_ref_t *function_ref_declare(semantics_ctx_t *ctx, char *name,
+                                     size_t name_sz, size_t num_args,
+                                     int external) {
+    ast_node_ident_t ident = { .name = name, .name_sz = name_sz };
+    function_ref_t *ref = function_ref_find(ctx, &ident);
+    /* calls go to the first of several definitions */
+    if(!ref || (!external && !ref->external)) {
+        ref = function_ref_add(ctx, function_ref_new(name, name_sz, num_args));
+        ref->external = external;
+        return ref;
+    }
+    if(ref->num_args != num_args) {
+        fprintf(ctx->err, "[Error] Function '%.*s' is declared with %zu "
+                "arguments and with %zu\n", (int)name_sz, name,
+                ref->num_args, num_args);
+        ctx->error = 1;
+        return NULL;
+    }
+    if(!external) ref->external = 0;
+    return ref;
 }
 
 variable_ref_t *variable_ref_new(char *name, size_t name_sz,
                                  ssize_t bp_offset) {
-    variable_ref_t *ref = malloc(sizeof(variable_ref_t));
-    ref->name = malloc(ref->name_sz = name_sz);
+    variable_ref_t *ref = alloc_malloc(ALLOC_VARIABLE, sizeof(variable_ref_t));
+    ref->name = alloc_malloc(ALLOC_VARIABLE, ref->name_sz = name_sz);
     memcpy(ref->name, name, name_sz);
     ref->bp_offset = bp_offset;
+    ref->scope = NULL;
+    ref->shadows = 0;
     return ref;
 }
 
 variable_ref_t *variable_ref_new_scope(scope_t *scope,
                                        ast_node_ident_t *ident) {
-    return vec_push(
+    ++scope->ctx->num_variables;
+    variable_ref_t *ref = vec_push(
         scope->variables,
-        variable_ref_new(ident->name, ident->name_sz,
-                         -8 * ++scope->variable_count)
+        variable_ref_new(ident->name, ident->name_sz, 0)
     );
+    ref->scope = scope;
+    return ref;
 }
 
 variable_ref_t *variable_ref_new_arg(ast_node_ident_t *ident,
@@ -72,8 +169,8 @@ variable_ref_t *variable_ref_new_arg(ast_node_ident_t *ident,
 }
 
 void variable_ref_free(variable_ref_t *ref) {
-    free(ref->name);
-    free(ref);
+    alloc_free(ALLOC_VARIABLE, ref->name);
+    alloc_free(ALLOC_VARIABLE, ref);
 }
 
 static int variable_ref_compar(vec_item_t lv, vec_item_t rv) {
@@ -99,9 +196,71 @@ retry:
     } else return vec_get(scope->variables, idx);
 }
 
+static variable_ref_t **variable_slot(semantics_ctx_t *ctx, const char *name,
+                                      size_t name_sz) {
+    size_t mask = ctx->var_table_sz - 1, i;
+    for(i = name_hash(name, name_sz) & mask; ctx->var_table[i];
+        i = (i + 1) & mask) {
+        variable_ref_t *ref = ctx->var_table[i];
+        if(name_eq(ref->name, ref->name_sz, name, name_sz)) break;
+    }
+    return &ctx->var_table[i];
+}
+
+/* makes ref the variable its name refers to until variable_unbind */
+static void variable_bind(semantics_ctx_t *ctx, variable_ref_t *ref) {
+    if((ctx->var_table_used + 1) * 2 > ctx->var_table_sz)
+        variable_table_grow(ctx);
+    variable_ref_t **slot = variable_slot(ctx, ref->name, ref->name_sz);
+    if(!*slot) ++ctx->var_table_used;
+    vec_push(ctx->var_undo, ref);
+    vec_push(ctx->var_undo, *slot);
+    *slot = ref;
+}
+
+/* undoes the bindings made after the undo log had mark entries */
+static void variable_unbind(semantics_ctx_t *ctx, size_t mark) {
+    while(ctx->var_undo->sz > mark) {
+        variable_ref_t *prev = vec_pop(ctx->var_undo);
+        variable_ref_t *ref = vec_pop(ctx->var_undo);
+        variable_ref_t **slot = variable_slot(ctx, ref->name, ref->name_sz);
+        if(prev) *slot = prev;
+        else variable_table_delete(ctx, slot - ctx->var_table);
+    }
+}
+
+/* empties slot i and moves back the entries after it which could otherwise
+ * no longer be reached from where they hash to */
+static void variable_table_delete(semantics_ctx_t *ctx, size_t i) {
+    size_t mask = ctx->var_table_sz - 1;
+    --ctx->var_table_used;
+    ctx->var_table[i] = NULL;
+    for(size_t j = (i + 1) & mask; ctx->var_table[j]; j = (j + 1) & mask) {
+        variable_ref_t *ref = ctx->var_table[j];
+        size_t home = name_hash(ref->name, ref->name_sz) & mask;
+        if(((j - home) & mask) >= ((j - i) & mask)) {
+            ctx->var_table[i] = ref;
+            ctx->var_table[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+static void variable_table_grow(semantics_ctx_t *ctx) {
+    variable_ref_t **old = ctx->var_table;
+    size_t old_sz = ctx->var_table_sz;
+    ctx->var_table_sz *= 2;
+    ctx->var_table = alloc_calloc(ALLOC_VARIABLE, ctx->var_table_sz,
+                                  sizeof(variable_ref_t *));
+    for(size_t i = 0; i < old_sz; ++i)
+        if(old[i]) *variable_slot(ctx, old[i]->name, old[i]->name_sz) = old[i];
+    alloc_free(ALLOC_VARIABLE, old);
+}
+
 scope_t *scope_new(semantics_ctx_t *ctx, scope_t *parent) {
-    scope_t *scope = malloc(sizeof(scope_t));
+    scope_t *scope = alloc_malloc(ALLOC_SCOPE, sizeof(scope_t));
     scope->ctx = ctx;
+    ++ctx->num_scopes;
     scope->parent = parent;
     if(parent) {
         scope->variable_count = parent->variable_count;
@@ -113,16 +272,19 @@ scope_t *scope_new(semantics_ctx_t *ctx, scope_t *parent) {
 }
 
 void scope_free(scope_t *scope) {
+    /* children must not remove themselves from the vector being freed */
+    for(size_t i = 0; i < scope->children->sz; ++i)
+        ((scope_t *)vec_get(scope->children, i))->parent = NULL;
     vec_free(scope->children);
     vec_free(scope->variables);
     if(scope->parent) {
         size_t idx = vec_index_of_eq(scope->parent->children, scope);
         vec_delete(scope->parent->children, idx);
     }
-    free(scope);
+    alloc_free(ALLOC_SCOPE, scope);
 }
 
-static void scope_dump(scope_t *scope, size_t n) {
+static void scope_dump(FILE *f, scope_t *scope, size_t n) {
     char pad[2*n+1];
     memset(pad, ' ', 2*n);
     pad[2*n] = '\0';
@@ -131,30 +293,58 @@ static void scope_dump(scope_t *scope, size_t n) {
         variable_ref_t *ref = vec_get(scope->variables, i);
         size_t abs_off = llabs(ref->bp_offset);
         char sign = ref->bp_offset < 0 ? '-' : '+';
-        printf("%s%.*s at [rbp%c%#zx]\n",
-               pad, (int)ref->name_sz, ref->name, sign, abs_off);
+        fprintf(f, "%s%.*s at [rbp%c%#zx]\n",
+                pad, (int)ref->name_sz, ref->name, sign, abs_off);
     }
-    printf("%sSubscopes: {\n", pad);
+    fprintf(f, "%sSubscopes: {\n", pad);
     for(size_t i = 0; i < scope->children->sz; ++i) {
-        scope_dump(vec_get(scope->children, i), n+1);
-        printf("%s,\n", pad);
+        scope_dump(f, vec_get(scope->children, i), n+1);
+        fprintf(f, "%s,\n", pad);
     }
-    printf("%s}\n", pad);
+    fprintf(f, "%s}\n", pad);
+}
+
+/* one variable per line with the function and depth of its scope */
+static void scope_dump_compact(FILE *f, ast_node_ident_t *fn, scope_t *scope,
+                               size_t depth) {
+    for(size_t i = 0; i < scope->variables->sz; ++i) {
+        variable_ref_t *ref = vec_get(scope->variables, i);
+        fprintf(f, "var\t%.*s\t%zu\t%.*s\t%zd\n",
+                (int)fn->name_sz, fn->name, depth,
+                (int)ref->name_sz, ref->name, ref->bp_offset);
+    }
+    for(size_t i = 0; i < scope->children->sz; ++i)
+        scope_dump_compact(f, fn, vec_get(scope->children, i), depth+1);
 }
 
 semantics_ctx_t *semantics_new(void) {
-    semantics_ctx_t *ctx = malloc(sizeof(semantics_ctx_t));
+    semantics_ctx_t *ctx = alloc_malloc(ALLOC_OTHER, sizeof(semantics_ctx_t));
     /* ctx->global = scope_new(ctx, NULL); */
     ctx->functions = vec_new_free(3, (vec_free_t)function_ref_free);
-    vec_push(ctx->functions, function_ref_new("print", 5, 1));
-    vec_push(ctx->functions, function_ref_new("input", 5, 0));
+    ctx->fn_table_sz = SEMANTICS_TABLE_SZ;
+    ctx->fn_table = alloc_calloc(ALLOC_FUNCTION, ctx->fn_table_sz,
+                                 sizeof(size_t));
+    ctx->fn_indexed = 0;
+    ctx->var_table_sz = SEMANTICS_TABLE_SZ;
+    ctx->var_table = alloc_calloc(ALLOC_VARIABLE, ctx->var_table_sz,
+                                  sizeof(variable_ref_t *));
+    ctx->var_table_used = 0;
+    ctx->var_undo = vec_new(16);
+    function_ref_add(ctx, function_ref_new("print", 5, 1));
+    function_ref_add(ctx, function_ref_new("input", 5, 0));
+    ctx->err = stderr;
     ctx->error = 0;
+    ctx->module = 0;
+    ctx->num_scopes = ctx->num_variables = 0;
     return ctx;
 }
 
 void semantics_free(semantics_ctx_t *ctx) {
     vec_free(ctx->functions);
-    free(ctx);
+    alloc_free(ALLOC_FUNCTION, ctx->fn_table);
+    alloc_free(ALLOC_VARIABLE, ctx->var_table);
+    vec_free(ctx->var_undo);
+    alloc_free(ALLOC_OTHER, ctx);
 }
 
 int semantics_analyze(semantics_ctx_t *ctx, ast_node_tu_t *tu) {
@@ -165,28 +355,91 @@ int semantics_analyze(semantics_ctx_t *ctx, ast_node_tu_t *tu) {
      * eachother */
     for(size_t i = 0; i < tu->functions->sz; ++i) {
         ast_node_fn_defn_t *fn = vec_get(tu->functions, i);
-        fn->ref = function_ref_new_node(fn);
-        vec_push(ctx->functions, fn->ref);
+        fn->ref = function_ref_declare(ctx, fn->ident->name,
+                                       fn->ident->name_sz, fn->arguments->sz,
+                                       0);
+    }
+    for(size_t i = 0; i < tu->externs->sz; ++i) {
+        ast_node_fn_defn_t *fn = vec_get(tu->externs, i);
+        if(!(fn->ref = function_ref_declare(ctx, fn->ident->name,
+                                            fn->ident->name_sz,
+                                            fn->arguments->sz, 1)))
+            return ctx->error = 1;
     }
 
     for(size_t i = 0; i < tu->functions->sz; ++i)
         if((ret = semantics_analyze_fn(ctx, vec_get(tu->functions, i))))
             break;
 
+    if(!ret) ret = semantics_check_externs(ctx);
     return ctx->error = ret;
 }
 
-static int semantics_analyze_fn(semantics_ctx_t *ctx, ast_node_fn_defn_t *fn) {
+/* extern functions must be defined in the program unless it is a module */
+int semantics_check_externs(semantics_ctx_t *ctx) {
+    if(ctx->module) return 0;
+    for(size_t i = 0; i < ctx->functions->sz; ++i) {
+        function_ref_t *ref = vec_get(ctx->functions, i);
+        if(!ref->external) continue;
+        fprintf(ctx->err, "[Error] Function '%.*s' is declared extern but "
+                "never defined\n", (int)ref->name_sz, ref->name);
+        return ctx->error = 1;
+    }
+    return 0;
+}
+
+/* the functions called must already be in the context */
+int semantics_analyze_fn(semantics_ctx_t *ctx, ast_node_fn_defn_t *fn) {
+    uint64_t start = trace_begin();
     scope_t *scope = scope_new(ctx, NULL);
     fn->scope = scope;
+    ctx->num_variables += fn->arguments->sz;
     /* add all function arguments to the variable list */
-    for(size_t i = 0; i < fn->arguments->sz; ++i)
-        vec_push(scope->variables,
-                 variable_ref_new_arg(vec_get(fn->arguments, i),
-                                      i, fn->arguments->sz)
-        );
+    for(size_t i = 0; i < fn->arguments->sz; ++i) {
+        ast_node_ident_t *arg = vec_get(fn->arguments, i);
+        arg->ref = vec_push(scope->variables,
+                            variable_ref_new_arg(arg, i, fn->arguments->sz));
+        arg->ref->scope = scope;
+    }
+    /* bound last to first so the first of arguments of the same name is
+     * the one used */
+    size_t mark = ctx->var_undo->sz;
+    for(size_t i = fn->arguments->sz; i-- > 0;)
+        variable_bind(ctx, vec_get(scope->variables, i));
+    semantics_declare_block(ctx, scope, fn->body);
+
+    int ret = semantics_analyze_block(ctx, scope, fn->body);
+    variable_unbind(ctx, mark);
+    trace_end("semantics", fn->ident->name, fn->ident->name_sz, start);
+    return ret;
+}
+
+/* a name refers to the first variable of that name declared anywhere in the
+ * innermost scope declaring one, so the variables of a body are bound before
+ * it is analyzed, a later declaration of the same name in the scope is only
+ * given a slot */
+static void semantics_declare_block(semantics_ctx_t *ctx, scope_t *scope,
+                                    vec_t *body) {
+    for(size_t i = 0; i < body->sz; ++i) {
+        ast_node_stmt_decl_t *stmt = vec_get(body, i);
+        if(stmt->hdr.type != AST_STMT_DECL) continue;
+        variable_ref_t *ref = variable_ref_new_scope(scope, stmt->ident);
+        variable_ref_t *prev = *variable_slot(ctx, ref->name, ref->name_sz);
+        stmt->ident->ref = ref;
+        if(prev && prev->scope == scope) continue;
+        ref->shadows = prev && (prev->bp_offset || prev->shadows);
+        variable_bind(ctx, ref);
+    }
+}
 
-    return semantics_analyze_block(ctx, scope, fn->body);
+/* the variables declared in the body go out of sight after it */
+static int semantics_analyze_scope(semantics_ctx_t *ctx, scope_t *scope,
+                                   vec_t *body) {
+    size_t mark = ctx->var_undo->sz;
+    semantics_declare_block(ctx, scope, body);
+    int ret = semantics_analyze_block(ctx, scope, body);
+    variable_unbind(ctx, mark);
+    return ret;
 }
 
 static int semantics_analyze_block(semantics_ctx_t *ctx, scope_t *scope,
@@ -207,7 +460,11 @@ static int semantics_analyze_stmt(semantics_ctx_t *ctx, scope_t *scope,
         /* analyze expression before adding the new variable */
         if((ret = semantics_analyze_expr(ctx, scope, stmt->expr)))
             goto ret;
-        variable_ref_new_scope(scope, stmt->ident);
+        /* the slot is taken in the order of the declarations, but the
+         * name keeps referring to the first variable of the scope */
+        stmt->ident->ref->bp_offset = -8 * ++scope->variable_count;
+        stmt->ident->ref = *variable_slot(ctx, stmt->ident->name,
+                                          stmt->ident->name_sz);
         break;
     }
 
@@ -223,13 +480,13 @@ static int semantics_analyze_stmt(semantics_ctx_t *ctx, scope_t *scope,
         if((ret = semantics_analyze_expr(ctx, scope, stmt->condition)))
             goto ret;
         stmt->scope_true = scope_new(ctx, scope);
-        if((ret = semantics_analyze_block(ctx, stmt->scope_true,
+        if((ret = semantics_analyze_scope(ctx, stmt->scope_true,
                                           stmt->branch_true)))
             goto ret;
 
         if(stmt->branch_false->sz) {
             stmt->scope_false = scope_new(ctx, scope);
-            if((ret = semantics_analyze_block(ctx, stmt->scope_false,
+            if((ret = semantics_analyze_scope(ctx, stmt->scope_false,
                                               stmt->branch_false)))
                 goto ret;
         }
@@ -247,13 +504,13 @@ static int semantics_analyze_stmt(semantics_ctx_t *ctx, scope_t *scope,
     case AST_STMT_BLOCK: {
         ast_node_stmt_block_t *stmt = (void *)root;
         stmt->scope = scope_new(ctx, scope);
-        if((ret = semantics_analyze_block(ctx, stmt->scope, stmt->stmts)))
+        if((ret = semantics_analyze_scope(ctx, stmt->scope, stmt->stmts)))
             goto ret;
         break;
     }
 
     default:
-        fprintf(stderr, "[Error] Non-statement node type '%d' in a statement"
+        fprintf(ctx->err, "[Error] Non-statement node type '%d' in a statement"
                 "list!\n", root->type);
         ret = ctx->error = 1;
         goto ret;
@@ -287,17 +544,19 @@ static int semantics_analyze_expr(semantics_ctx_t *ctx, scope_t *scope,
         ast_node_expr_call_t *expr = (void *)root;
         function_ref_t *ref;
         if(!(ref = function_ref_find(ctx, expr->ident))) {
-            fprintf(stderr, "[Error] Undefined reference to function '%.*s'\n",
+            fprintf(ctx->err,
+                    "[Error] Undefined reference to function '%.*s'\n",
                     (int)expr->ident->name_sz, expr->ident->name);
             ret = ctx->error = 1;
             goto ret;
         }
         if(expr->args->sz != ref->num_args) {
-            fprintf(stderr, "[Error] Expected %zu arguments, got %zu\n",
+            fprintf(ctx->err, "[Error] Expected %zu arguments, got %zu\n",
                     ref->num_args, expr->args->sz);
             ret = ctx->error = 1;
             goto ret;
         }
+        expr->ref = ref;
         for(size_t i = 0; i < expr->args->sz; ++i)
             if((ret = semantics_analyze_expr(ctx, scope,
                                              vec_get(expr->args, i))))
@@ -307,18 +566,23 @@ static int semantics_analyze_expr(semantics_ctx_t *ctx, scope_t *scope,
 
     case AST_IDENT: {
         ast_node_ident_t *ident = (void *)root;
-        if(!variable_ref_find(scope, ident)) {
-            fprintf(stderr, "[Error] Undefined reference to variable '%.*s'\n",
+        variable_ref_t *ref = *variable_slot(ctx, ident->name,
+                                             ident->name_sz);
+        /* a variable can be used once it or one it shadows is declared */
+        if(!ref || !(ref->bp_offset || ref->shadows)) {
+            fprintf(ctx->err,
+                    "[Error] Undefined reference to variable '%.*s'\n",
                     (int)ident->name_sz, ident->name);
             ret = ctx->error = 1;
             goto ret;
         }
+        ident->ref = ref;
     }
 
     case AST_CONST: break;
 
     default:
-        fprintf(stderr, "[Error] Invalid node type '%d' found in an"
+        fprintf(ctx->err, "[Error] Invalid node type '%d' found in an"
                 "expression!\n", root->type);
         ret = ctx->error = 1;
         goto ret;
@@ -328,19 +592,35 @@ ret:
     return ret;
 }
 
-void semantics_dump_tables(ast_node_tu_t *tu) {
+void semantics_dump_tables(ast_node_tu_t *tu, FILE *f) {
     semantics_ctx_t *ctx = tu->ctx;
 
-    puts("Functions:");
+    fputs("Functions:\n", f);
     for(size_t i = 0; i < ctx->functions->sz; ++i) {
         function_ref_t *ref = vec_get(ctx->functions, i);
-        printf("%.*s[%zu]\n", (int)ref->name_sz, ref->name, ref->num_args);
+        fprintf(f, "%.*s[%zu]\n", (int)ref->name_sz, ref->name,
+                ref->num_args);
+    }
+
+    fputs("\nScopes:\n", f);
+    for(size_t i = 0; i < tu->functions->sz; ++i) {
+        ast_node_fn_defn_t *fn = vec_get(tu->functions, i);
+        fprintf(f, "%.*s:\n", (int)fn->ident->name_sz, fn->ident->name);
+        scope_dump(f, fn->scope, 1);
     }
+}
 
-    puts("\nScopes:");
+/* tab separated lines, "fn name arguments" for every function followed by
+ * "var function depth name offset" for every variable */
+void semantics_dump_compact(ast_node_tu_t *tu, FILE *f) {
+    semantics_ctx_t *ctx = tu->ctx;
+    for(size_t i = 0; i < ctx->functions->sz; ++i) {
+        function_ref_t *ref = vec_get(ctx->functions, i);
+        fprintf(f, "fn\t%.*s\t%zu\n", (int)ref->name_sz, ref->name,
+                ref->num_args);
+    }
     for(size_t i = 0; i < tu->functions->sz; ++i) {
         ast_node_fn_defn_t *fn = vec_get(tu->functions, i);
-        printf("%.*s:\n", (int)fn->ident->name_sz, fn->ident->name);
-        scope_dump(fn->scope, 1);
+        scope_dump_compact(f, fn->ident, fn->scope, 0);
     }
 }
@@ -0,0 +1,917 @@
+#include <parser/x86.h>
+#include <utils/alloc.h>
+#include <utils/trace.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_LABEL SIZE_MAX
+
+/* registers in the order they are encoded */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+
+struct x86_fixup {
+    /** offset of the rel32 field */
+    size_t offset;
+    size_t label;
+};
+
+typedef struct x86_ctx {
+    /** object the runtime is generated into */
+    x86_obj_t *obj;
+    /** function being generated */
+    x86_fn_t *fn;
+    buf_t *text;
+    /** offsets of IR labels in .text, indexed from first_label */
+    size_t *labels;
+    size_t first_label, num_labels;
+    /** struct x86_fixup for jumps to IR labels */
+    buf_t fixups;
+    /** size_t offsets of jumps to the epilogue of the current function */
+    buf_t ret_fixups;
+    FILE *err;
+} x86_ctx_t;
+
+static x86_obj_t *x86_obj_new(size_t, size_t, FILE *);
+static void x86_sym_free(x86_sym_t *);
+static void x86_reloc_free(x86_reloc_t *);
+static void x86_label_range(x86_ctx_t *, ir_instr_t **, size_t);
+static void x86_link_syms(x86_obj_t *, semantics_ctx_t *);
+
+static int x86_generate_rt(x86_ctx_t *, enum runtime);
+static int x86_generate_instr(x86_ctx_t *, ir_instr_t *);
+
+/* raw machine code from a string literal */
+#define EMIT(t, s) buf_push((t), (s), sizeof(s) - 1)
+
+#define BINOP_PRE "\x5b\x58"                 /* pop rbx; pop rax */
+#define UNOP_PRE "\x58"                      /* pop rax */
+#define CMP_PRE BINOP_PRE "\x48\x39\xd8"     /* cmp rax, rbx */
+#define SET_POST "\x48\x0f\xb6\xc0"          /* movzx rax, al */
+#define SAVE "\x50"                          /* push rax */
+
+static inline int fits_i8(int64_t v) {
+    return v >= INT8_MIN && v <= INT8_MAX;
+}
+
+static inline int fits_i32(int64_t v) {
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+/* ModRM (and displacement) for [rbp+disp] with `reg` in the reg field */
+static void x86_emit_rbp(buf_t *t, int reg, int64_t disp) {
+    if(fits_i8(disp)) {
+        buf_push_u8(t, 0x40 | reg<<3 | RBP);
+        buf_push_u8(t, disp);
+    } else {
+        buf_push_u8(t, 0x80 | reg<<3 | RBP);
+        buf_push_u32(t, disp);
+    }
+}
+
+static void x86_emit_push_imm(buf_t *t, int64_t imm) {
+    if(fits_i8(imm)) {
+        buf_push_u8(t, 0x6a);
+        buf_push_u8(t, imm);
+    } else if(fits_i32(imm)) {
+        buf_push_u8(t, 0x68);
+        buf_push_u32(t, imm);
+    } else {
+        /* mov rax, imm64; push rax */
+        EMIT(t, "\x48\xb8");
+        buf_push_u64(t, imm);
+        EMIT(t, SAVE);
+    }
+}
+
+/* add/sub rsp, imm (ext is the /digit of the 0x81/0x83 opcodes) */
+static void x86_emit_rsp_imm(buf_t *t, int ext, int64_t imm) {
+    if(fits_i8(imm)) {
+        EMIT(t, "\x48\x83");
+        buf_push_u8(t, 0xc0 | ext<<3 | RSP);
+        buf_push_u8(t, imm);
+    } else {
+        EMIT(t, "\x48\x81");
+        buf_push_u8(t, 0xc0 | ext<<3 | RSP);
+        buf_push_u32(t, imm);
+    }
+}
+
+static void x86_emit_reloc(x86_ctx_t *ctx, enum x86_reloc_type type,
+                           size_t sym, int64_t addend) {
+    x86_reloc_t *rel = alloc_malloc(ALLOC_X86, sizeof(x86_reloc_t));
+    rel->type = type;
+    rel->sym = sym;
+    rel->addend = addend;
+    rel->offset = buf_push_u32(ctx->text, 0);
+    vec_push(ctx->obj->relocs, rel);
+}
+
+static void x86_emit_reloc64(x86_ctx_t *ctx, size_t sym) {
+    x86_reloc_t *rel = alloc_malloc(ALLOC_X86, sizeof(x86_reloc_t));
+    rel->type = X86_RELOC_64;
+    rel->sym = sym;
+    rel->addend = 0;
+    rel->offset = buf_push_u64(ctx->text, 0);
+    vec_push(ctx->obj->relocs, rel);
+}
+
+static void x86_emit_call(x86_ctx_t *ctx, size_t sym) {
+    buf_push_u8(ctx->text, 0xe8);
+    x86_emit_reloc(ctx, X86_RELOC_PLT32, sym, -4);
+}
+
+/* call to a function whose symbol is only known when linking */
+static void x86_emit_fn_call(x86_ctx_t *ctx, function_ref_t *ref) {
+    buf_push_u8(ctx->text, 0xe8);
+    struct x86_call call = {
+    .offset = buf_push_u32(ctx->text, 0),
+    .ref = ref,
+    };
+    buf_push(&ctx->fn->calls, &call, sizeof call);
+}
+
+/* jmp (op = "\xe9") or jcc (op = "\x0f\x8?") to an IR label */
+static void x86_emit_jump(x86_ctx_t *ctx, const char *op, size_t oplen,
+                          size_t label) {
+    buf_push(ctx->text, op, oplen);
+    struct x86_fixup fix = {
+    .offset = buf_push_u32(ctx->text, 0),
+    .label = label,
+    };
+    buf_push(&ctx->fixups, &fix, sizeof fix);
+}
+
+size_t x86_sym_add(x86_obj_t *obj, const char *name, size_t name_sz,
+                   enum x86_section section, size_t offset, int global) {
+    x86_sym_t *sym = alloc_malloc(ALLOC_X86, sizeof(x86_sym_t));
+    sym->name = alloc_malloc(ALLOC_X86, sym->name_sz = name_sz);
+    memcpy(sym->name, name, name_sz);
+    sym->section = section;
+    sym->offset = offset;
+    sym->size = 0;
+    sym->global = global;
+    vec_push(obj->symbols, sym);
+    return obj->symbols->sz - 1;
+}
+
+ssize_t x86_sym_find(x86_obj_t *obj, const char *name, size_t name_sz) {
+    for(size_t i = 0; i < obj->symbols->sz; ++i) {
+        x86_sym_t *sym = vec_get(obj->symbols, i);
+        if(sym->name_sz == name_sz && !memcmp(sym->name, name, name_sz))
+            return i;
+    }
+    return -1;
+}
+
+static void x86_sym_free(x86_sym_t *sym) {
+    alloc_free(ALLOC_X86, sym->name);
+    alloc_free(ALLOC_X86, sym);
+}
+
+static void x86_reloc_free(x86_reloc_t *rel) {
+    alloc_free(ALLOC_X86, rel);
+}
+
+x86_obj_t *x86_generate(ir_code_t *code, enum runtime rt) {
+    x86_obj_t *obj = NULL;
+    vec_t *fns = vec_new_free(code->ctx->functions->sz,
+                              (vec_free_t)x86_fn_free);
+    ir_instr_t **ins = (ir_instr_t **)code->instructions->items;
+    size_t n = code->instructions->sz;
+
+    for(size_t i = 0, end; i < n; i = end) {
+        for(end = i + 1; end < n && ins[end]->type != IR_FUNC; ++end);
+        x86_fn_t *fn;
+        if(!(fn = x86_generate_fn(ins + i, end - i, code->ctx->err)))
+            goto ret;
+        vec_push(fns, fn);
+    }
+    obj = x86_link(code->ctx, (x86_fn_t **)fns->items, fns->sz, rt);
+
+ret:
+    vec_free(fns);
+    return obj;
+}
+
+/* generates the code of one function, from its FUNC to its LEAVE */
+x86_fn_t *x86_generate_fn(ir_instr_t **ins, size_t n, FILE *err) {
+    if(!n || ins[0]->type != IR_FUNC) {
+        fprintf(err, "[Error] Function code does not start with FUNC\n");
+        return NULL;
+    }
+
+    uint64_t start = trace_begin();
+    x86_fn_t *fn = alloc_malloc(ALLOC_X86, sizeof(x86_fn_t));
+    fn->ref = ((ir_instr_func_t *)ins[0])->ref;
+    buf_init(&fn->text, 16 * n);
+    buf_init(&fn->calls, 4 * sizeof(struct x86_call));
+
+    x86_ctx_t ctx = {
+    .fn = fn,
+    .text = &fn->text,
+    .err = err,
+    };
+    x86_label_range(&ctx, ins, n);
+    ctx.labels = alloc_malloc(ALLOC_X86, sizeof(size_t) * (ctx.num_labels + 1));
+    for(size_t i = 0; i < ctx.num_labels; ++i) ctx.labels[i] = NO_LABEL;
+    buf_init(&ctx.fixups, 16 * sizeof(struct x86_fixup));
+    buf_init(&ctx.ret_fixups, 16 * sizeof(size_t));
+
+    for(size_t i = 0; i < n; ++i)
+        if(x86_generate_instr(&ctx, ins[i]))
+            goto ret_free;
+
+    /* jumps never leave the function, so its code can be moved freely */
+    struct x86_fixup *fix = (void *)ctx.fixups.data;
+    for(size_t i = 0; i < ctx.fixups.sz / sizeof *fix; ++i) {
+        size_t label = fix[i].label - ctx.first_label;
+        if(label >= ctx.num_labels || ctx.labels[label] == NO_LABEL) {
+            fprintf(err, "[Error] Jump to undefined label %zu\n",
+                    fix[i].label);
+            goto ret_free;
+        }
+        buf_set_u32(ctx.text, fix[i].offset,
+                    ctx.labels[label] - (fix[i].offset + 4));
+    }
+
+    alloc_free(ALLOC_X86, ctx.labels);
+    buf_destroy(&ctx.fixups);
+    buf_destroy(&ctx.ret_fixups);
+    trace_end("x86", fn->ref->name, fn->ref->name_sz, start);
+    return fn;
+
+ret_free:
+    alloc_free(ALLOC_X86, ctx.labels);
+    buf_destroy(&ctx.fixups);
+    buf_destroy(&ctx.ret_fixups);
+    x86_fn_free(fn);
+    return NULL;
+}
+
+void x86_fn_free(x86_fn_t *fn) {
+    buf_destroy(&fn->text);
+    buf_destroy(&fn->calls);
+    alloc_free(ALLOC_X86, fn);
+}
+
+/* places the runtime and the functions in one object, the function symbols
+ * are those of the semantic context */
+x86_obj_t *x86_link(semantics_ctx_t *sctx, x86_fn_t **fns, size_t num_fns,
+                    enum runtime rt) {
+    size_t text_sz = 4096;
+    for(size_t i = 0; i < num_fns; ++i) text_sz += fns[i]->text.sz;
+    x86_obj_t *obj = x86_link_begin(sctx, text_sz);
+    for(size_t i = 0; i < num_fns; ++i) x86_link_fn(obj, sctx, fns[i], rt);
+    if(x86_link_end(obj, sctx, rt)) {
+        x86_free(obj);
+        return NULL;
+    }
+    return obj;
+}
+
+/* an object functions are added to one at a time, text_sz is a hint */
+x86_obj_t *x86_link_begin(semantics_ctx_t *sctx, size_t text_sz) {
+    x86_obj_t *obj = x86_obj_new(text_sz, sctx->functions->sz + 8,
+                                 sctx->err);
+    x86_link_syms(obj, sctx);
+    return obj;
+}
+
+/* copies the code of fn at the end of .text, its calls become relocations so
+ * fn can be freed */
+void x86_link_fn(x86_obj_t *obj, semantics_ctx_t *sctx, x86_fn_t *fn,
+                 enum runtime rt) {
+    /* the callees may have been declared since the last function */
+    x86_link_syms(obj, sctx);
+    x86_sym_t *sym = vec_get(obj->symbols, fn->ref->idx);
+    sym->section = X86_SECT_TEXT;
+    sym->offset = buf_push(&obj->text, fn->text.data, fn->text.sz);
+    sym->size = fn->text.sz;
+    /* the functions of a module are called from the others */
+    sym->global = rt == RT_NONE
+               || (sym->name_sz == 4 && !memcmp(sym->name, "main", 4));
+
+    struct x86_call *call = (void *)fn->calls.data;
+    for(size_t j = 0; j < fn->calls.sz / sizeof *call; ++j) {
+        x86_reloc_t *rel = alloc_malloc(ALLOC_X86, sizeof(x86_reloc_t));
+        rel->type = X86_RELOC_PLT32;
+        rel->offset = sym->offset + call[j].offset;
+        rel->sym = call[j].ref->idx;
+        rel->addend = -4;
+        vec_push(obj->relocs, rel);
+    }
+}
+
+/* adds the runtime after the functions */
+int x86_link_end(x86_obj_t *obj, semantics_ctx_t *sctx, enum runtime rt) {
+    x86_link_syms(obj, sctx);
+    x86_ctx_t ctx = {
+    .obj = obj,
+    .text = &obj->text,
+    .err = obj->err,
+    };
+    return x86_generate_rt(&ctx, rt);
+}
+
+/* symbols of functions share indices with their function_ref_t, so they
+ * come before those of the runtime */
+static void x86_link_syms(x86_obj_t *obj, semantics_ctx_t *sctx) {
+    for(size_t i = obj->symbols->sz; i < sctx->functions->sz; ++i) {
+        function_ref_t *ref = vec_get(sctx->functions, i);
+        x86_sym_add(obj, ref->name, ref->name_sz, X86_SECT_UNDEF, 0, 0);
+    }
+}
+
+/* the runtime on its own, to link with the objects of modules */
+x86_obj_t *x86_generate_runtime(enum runtime rt, FILE *err) {
+    x86_obj_t *obj = x86_obj_new(4096, 8, err);
+    /* defined by one of the modules */
+    x86_sym_add(obj, "main", 4, X86_SECT_UNDEF, 0, 1);
+
+    x86_ctx_t ctx = {
+    .obj = obj,
+    .text = &obj->text,
+    .err = obj->err,
+    };
+    if(x86_generate_rt(&ctx, rt)) {
+        x86_free(obj);
+        return NULL;
+    }
+
+    for(size_t i = 0; i < obj->symbols->sz; ++i) {
+        x86_sym_t *sym = vec_get(obj->symbols, i);
+        if((sym->name_sz == 5 && !memcmp(sym->name, "print", 5))
+        || (sym->name_sz == 5 && !memcmp(sym->name, "input", 5)))
+            sym->global = 1;
+    }
+    return obj;
+}
+
+int x86_relocate(x86_obj_t *obj, uint64_t text, uint64_t rodata,
+                 uint64_t bss, x86_resolve_t resolve, void *data) {
+    for(size_t i = 0; i < obj->relocs->sz; ++i) {
+        x86_reloc_t *rel = vec_get(obj->relocs, i);
+        x86_sym_t *sym = vec_get(obj->symbols, rel->sym);
+        uint64_t s;
+
+        switch(sym->section) {
+        case X86_SECT_TEXT: s = text + sym->offset; break;
+        case X86_SECT_RODATA: s = rodata + sym->offset; break;
+        case X86_SECT_BSS: s = bss + sym->offset; break;
+
+        case X86_SECT_UNDEF:
+            if(!resolve || resolve(data, sym, &s)) {
+                fprintf(obj->err, "[Error] Undefined reference to '%.*s'\n",
+                        (int)sym->name_sz, sym->name);
+                return 1;
+            }
+            break;
+        }
+
+        int64_t v = s + rel->addend;
+        switch(rel->type) {
+        case X86_RELOC_PLT32:
+            v -= text + rel->offset;
+            if(!fits_i32(v)) goto overflow;
+            buf_set_u32(&obj->text, rel->offset, v);
+            break;
+
+        case X86_RELOC_32:
+            if((uint64_t)v > UINT32_MAX) goto overflow;
+            buf_set_u32(&obj->text, rel->offset, v);
+            break;
+
+        case X86_RELOC_64:
+            buf_set_u64(&obj->text, rel->offset, v);
+            break;
+        }
+        continue;
+
+overflow:
+        fprintf(obj->err, "[Error] Relocation against '%.*s' out of range\n",
+                (int)sym->name_sz, sym->name);
+        return 1;
+    }
+    return 0;
+}
+
+static x86_obj_t *x86_obj_new(size_t text_sz, size_t num_syms, FILE *err) {
+    x86_obj_t *obj = alloc_malloc(ALLOC_X86, sizeof(x86_obj_t));
+    buf_init(&obj->text, text_sz);
+    buf_init(&obj->rodata, 64);
+    obj->bss_sz = 0;
+    obj->symbols = vec_new_free(num_syms, (vec_free_t)x86_sym_free);
+    obj->relocs = vec_new_free(64, (vec_free_t)x86_reloc_free);
+    obj->err = err;
+    return obj;
+}
+
+void x86_free(x86_obj_t *obj) {
+    buf_destroy(&obj->text);
+    buf_destroy(&obj->rodata);
+    vec_free(obj->symbols);
+    vec_free(obj->relocs);
+    alloc_free(ALLOC_X86, obj);
+}
+
+/* defines a builtin function at the current end of .text */
+static size_t x86_define_builtin(x86_ctx_t *ctx, const char *name) {
+    ssize_t sym = x86_sym_find(ctx->obj, name, strlen(name));
+    if(sym < 0)
+        sym = x86_sym_add(ctx->obj, name, strlen(name), X86_SECT_UNDEF, 0, 0);
+    x86_sym_t *s = vec_get(ctx->obj->symbols, sym);
+    s->section = X86_SECT_TEXT;
+    s->offset = ctx->text->sz;
+    return sym;
+}
+
+static void x86_end_builtin(x86_ctx_t *ctx, size_t sym) {
+    x86_sym_t *s = vec_get(ctx->obj->symbols, sym);
+    s->size = ctx->text->sz - s->offset;
+}
+
+static int x86_generate_rt(x86_ctx_t *ctx, enum runtime rt) {
+    x86_obj_t *obj = ctx->obj;
+    buf_t *t = ctx->text;
+    size_t sym;
+
+    switch(rt) {
+    case RT_LIBC: {
+        size_t pri_int = x86_sym_add(obj, "pri_int", 7, X86_SECT_RODATA,
+                                     buf_push(&obj->rodata, "%lld\n", 6), 0);
+        size_t scn_int = x86_sym_add(obj, "scn_int", 7, X86_SECT_RODATA,
+                                     buf_push(&obj->rodata, "%lld", 5), 0);
+        size_t printf_ = x86_sym_add(obj, "printf", 6, X86_SECT_UNDEF, 0, 1);
+        size_t scanf_ = x86_sym_add(obj, "scanf", 5, X86_SECT_UNDEF, 0, 1);
+
+        sym = x86_define_builtin(ctx, "print");
+        /* push rbp; mov rbp, rsp; and rsp, ~0xf; mov edi, pri_int */
+        EMIT(t, "\x55\x48\x89\xe5\x48\x83\xe4\xf0\xbf");
+        x86_emit_reloc(ctx, X86_RELOC_32, pri_int, 0);
+        /* mov rsi, [rbp+0x10]; xor al, al; call printf */
+        EMIT(t, "\x48\x8b\x75\x10\x30\xc0");
+        x86_emit_call(ctx, printf_);
+        /* xor eax, eax; leave; ret */
+        EMIT(t, "\x31\xc0\xc9\xc3");
+        x86_end_builtin(ctx, sym);
+
+        sym = x86_define_builtin(ctx, "input");
+        /* push rbp; mov rbp, rsp; sub rsp, 0x8; and rsp, ~0xf;
+         * mov edi, scn_int */
+        EMIT(t, "\x55\x48\x89\xe5\x48\x83\xec\x08\x48\x83\xe4\xf0\xbf");
+        x86_emit_reloc(ctx, X86_RELOC_32, scn_int, 0);
+        /* lea rsi, [rbp-0x8]; call scanf */
+        EMIT(t, "\x48\x8d\x75\xf8");
+        x86_emit_call(ctx, scanf_);
+        /* mov rax, [rbp-0x8]; leave; ret */
+        EMIT(t, "\x48\x8b\x45\xf8\xc9\xc3");
+        x86_end_builtin(ctx, sym);
+        break;
+    }
+
+    case RT_SYSCALL: {
+        ssize_t main_ = x86_sym_find(obj, "main", 4);
+        if(main_ < 0) {
+            fprintf(obj->err, "[Error] No main function to start from\n");
+            return 1;
+        }
+
+        /* the output buffered by print, its length then the bytes, and the
+         * input read ahead for input, the position and end then the bytes */
+        size_t out = x86_sym_add(obj, "_start.out", 10, X86_SECT_BSS,
+                                 obj->bss_sz, 0);
+        obj->bss_sz += 8 + RT_BUF_SZ;
+        size_t in = x86_sym_add(obj, "_start.in", 9, X86_SECT_BSS,
+                                obj->bss_sz, 0);
+        obj->bss_sz += 16 + RT_BUF_SZ;
+
+        sym = x86_sym_add(obj, "_start", 6, X86_SECT_TEXT, t->sz, 1);
+        /* xor ebp, ebp; call main */
+        EMIT(t, "\x31\xed");
+        x86_emit_call(ctx, main_);
+        EMIT(t,
+             "\x50"                             /* push rax */
+             "\xe8\x08\x00\x00\x00"             /* call .flush */
+             "\x5f"                             /* pop rdi */
+             "\xb8\x3c\x00\x00\x00"             /* mov eax, 60 (exit) */
+             "\x0f\x05"                         /* syscall */
+        );
+        x86_end_builtin(ctx, sym);
+
+        /* writes the buffered output to stdout, only rsi, rdi, rdx, rax and
+         * the registers of syscall are clobbered */
+        size_t flush = x86_sym_add(obj, "_start.flush", 12, X86_SECT_TEXT,
+                                   t->sz, 0);
+        EMIT(t, "\xbe");                       /* mov esi, .out */
+        x86_emit_reloc(ctx, X86_RELOC_32, out, 0);
+        EMIT(t,
+             "\x48\x8b\x16"                     /* mov rdx, [rsi] */
+             "\x48\xc7\x06\x00\x00\x00\x00"     /* mov qword [rsi], 0 */
+             "\x48\x83\xc6\x08"                 /* add rsi, 8 */
+             /* .loop: */
+             "\x48\x85\xd2"                     /* test rdx, rdx */
+             "\x74\x19"                         /* jz .ret */
+             "\xb8\x01\x00\x00\x00"             /* mov eax, 1 (write) */
+             "\xbf\x01\x00\x00\x00"             /* mov edi, 1 */
+             "\x0f\x05"                         /* syscall */
+             "\x48\x85\xc0"                     /* test rax, rax */
+             "\x7e\x08"                         /* jle .ret */
+             "\x48\x01\xc6"                     /* add rsi, rax */
+             "\x48\x29\xc2"                     /* sub rdx, rax */
+             "\xeb\xe2"                         /* jmp .loop */
+             /* .ret: */
+             "\xc3"                             /* ret */
+        );
+        x86_end_builtin(ctx, flush);
+
+        /* formats the argument backwards from rbp into a stack buffer and
+         * appends it to the output, which is flushed first if it is full */
+        sym = x86_define_builtin(ctx, "print");
+        EMIT(t,
+             "\x55"                             /* push rbp */
+             "\x48\x89\xe5"                     /* mov rbp, rsp */
+             "\x48\x83\xec\x20"                 /* sub rsp, 0x20 */
+             "\x48\x8b\x45\x10"                 /* mov rax, [rbp+0x10] */
+             "\x48\x89\xc1"                     /* mov rcx, rax */
+             "\x48\x8d\x75\xff"                 /* lea rsi, [rbp-0x1] */
+             "\xc6\x06\x0a"                     /* mov byte [rsi], 0xa */
+             "\x41\xb8\x0a\x00\x00\x00"         /* mov r8d, 10 */
+             "\x48\x85\xc0"                     /* test rax, rax */
+             "\x79\x03"                         /* jns .digit */
+             "\x48\xf7\xd8"                     /* neg rax */
+             /* .digit: */
+             "\x31\xd2"                         /* xor edx, edx */
+             "\x49\xf7\xf0"                     /* div r8 */
+             "\x80\xc2\x30"                     /* add dl, '0' */
+             "\x48\xff\xce"                     /* dec rsi */
+             "\x88\x16"                         /* mov [rsi], dl */
+             "\x48\x85\xc0"                     /* test rax, rax */
+             "\x75\xee"                         /* jnz .digit */
+             "\x48\x85\xc9"                     /* test rcx, rcx */
+             "\x79\x06"                         /* jns .buffer */
+             "\x48\xff\xce"                     /* dec rsi */
+             "\xc6\x06\x2d"                     /* mov byte [rsi], '-' */
+             /* .buffer: */
+             "\x48\x89\xea"                     /* mov rdx, rbp */
+             "\x48\x29\xf2"                     /* sub rdx, rsi */
+             "\x41\xb8"                         /* mov r8d, _start.out */
+        );
+        x86_emit_reloc(ctx, X86_RELOC_32, out, 0);
+        EMIT(t,
+             "\x49\x8b\x00"                     /* mov rax, [r8] */
+             "\x48\x01\xd0"                     /* add rax, rdx */
+             "\x48\x3d"                         /* cmp rax, RT_BUF_SZ */
+        );
+        buf_push_u32(t, RT_BUF_SZ);
+        EMIT(t,
+             "\x76\x0c"                         /* jbe .copy */
+             "\x56"                             /* push rsi */
+             "\x52"                             /* push rdx */
+        );
+        x86_emit_call(ctx, flush);
+        EMIT(t,
+             "\x5a"                             /* pop rdx */
+             "\x5e"                             /* pop rsi */
+             "\x48\x89\xd0"                     /* mov rax, rdx */
+             /* .copy: */
+             "\x49\x89\x00"                     /* mov [r8], rax */
+             "\x49\x8d\x7c\x00\x08"             /* lea rdi, [r8+rax+8] */
+             "\x48\x29\xd7"                     /* sub rdi, rdx */
+             "\x48\x89\xd1"                     /* mov rcx, rdx */
+             "\xf3\xa4"                         /* rep movsb */
+             "\x31\xc0"                         /* xor eax, eax */
+             "\xc9\xc3"                         /* leave; ret */
+        );
+        x86_end_builtin(ctx, sym);
+
+        /* reads a decimal integer from stdin, skipping leading whitespace
+         * like scanf, the input is read a buffer at a time after flushing
+         * the output */
+        sym = x86_define_builtin(ctx, "input");
+        EMIT(t,
+             "\x55"                             /* push rbp */
+             "\x48\x89\xe5"                     /* mov rbp, rsp */
+             "\x41\xba"                         /* mov r10d, _start.in */
+        );
+        x86_emit_reloc(ctx, X86_RELOC_32, in, 0);
+        EMIT(t,
+             "\x45\x31\xc0"                     /* xor r8d, r8d */
+             "\x45\x31\xc9"                     /* xor r9d, r9d */
+             /* .skip: */
+             "\xe8\x47\x00\x00\x00"             /* call .getc */
+             "\x85\xc0"                         /* test eax, eax */
+             "\x78\x36"                         /* js .done */
+             "\x3c\x20"                         /* cmp al, ' ' */
+             "\x74\xf3"                         /* je .skip */
+             "\x8d\x48\xf7"                     /* lea ecx, [rax-9] */
+             "\x83\xf9\x04"                     /* cmp ecx, 4 */
+             "\x76\xeb"                         /* jbe .skip */
+             "\x3c\x2d"                         /* cmp al, '-' */
+             "\x75\x08"                         /* jne .plus */
+             "\x41\xb9\x01\x00\x00\x00"         /* mov r9d, 1 */
+             "\xeb\x04"                         /* jmp .next */
+             /* .plus: */
+             "\x3c\x2b"                         /* cmp al, '+' */
+             "\x75\x09"                         /* jne .num */
+             /* .next: */
+             "\xe8\x22\x00\x00\x00"             /* call .getc */
+             "\x85\xc0"                         /* test eax, eax */
+             "\x78\x11"                         /* js .done */
+             /* .num: */
+             "\x83\xe8\x30"                     /* sub eax, '0' */
+             "\x83\xf8\x09"                     /* cmp eax, 9 */
+             "\x77\x09"                         /* ja .done */
+             "\x4d\x6b\xc0\x0a"                 /* imul r8, r8, 10 */
+             "\x49\x01\xc0"                     /* add r8, rax */
+             "\xeb\xe6"                         /* jmp .next */
+             /* .done: */
+             "\x4c\x89\xc0"                     /* mov rax, r8 */
+             "\x45\x85\xc9"                     /* test r9d, r9d */
+             "\x74\x03"                         /* jz .ret */
+             "\x48\xf7\xd8"                     /* neg rax */
+             /* .ret: */
+             "\xc9\xc3"                         /* leave; ret */
+             /* .getc: */
+             "\x49\x8b\x02"                     /* mov rax, [r10] */
+             "\x49\x3b\x42\x08"                 /* cmp rax, [r10+8] */
+             "\x72\x1f"                         /* jb .byte */
+        );
+        x86_emit_call(ctx, flush);
+        EMIT(t,
+             "\x31\xc0"                         /* xor eax, eax (read) */
+             "\x31\xff"                         /* xor edi, edi */
+             "\x49\x8d\x72\x10"                 /* lea rsi, [r10+16] */
+             "\xba"                             /* mov edx, RT_BUF_SZ */
+        );
+        buf_push_u32(t, RT_BUF_SZ);
+        EMIT(t,
+             "\x0f\x05"                         /* syscall */
+             "\x48\x85\xc0"                     /* test rax, rax */
+             "\x7e\x15"                         /* jle .eof */
+             "\x49\x89\x42\x08"                 /* mov [r10+8], rax */
+             "\x31\xc0"                         /* xor eax, eax */
+             /* .byte: */
+             "\x41\x0f\xb6\x4c\x02\x10"         /* movzx ecx, [r10+rax+16] */
+             "\x48\xff\xc0"                     /* inc rax */
+             "\x49\x89\x02"                     /* mov [r10], rax */
+             "\x89\xc8"                         /* mov eax, ecx */
+             "\xc3"                             /* ret */
+             /* .eof: */
+             "\xb8\xff\xff\xff\xff"             /* mov eax, -1 */
+             "\xc3"                             /* ret */
+        );
+        x86_end_builtin(ctx, sym);
+        break;
+    }
+
+    case RT_HOST: {
+        ssize_t main_ = x86_sym_find(obj, "main", 4);
+        if(main_ < 0) {
+            fprintf(obj->err, "[Error] No main function to start from\n");
+            return 1;
+        }
+        /* the host functions may be anywhere in the address space, so they
+         * are called through an absolute address */
+        size_t host_print = x86_sym_add(obj, "dpp_host_print", 14,
+                                        X86_SECT_UNDEF, 0, 1);
+        size_t host_input = x86_sym_add(obj, "dpp_host_input", 14,
+                                        X86_SECT_UNDEF, 0, 1);
+
+        /* generated code does not preserve rbx for its caller */
+        sym = x86_sym_add(obj, "_enter", 6, X86_SECT_TEXT, t->sz, 1);
+        /* push rbx; call main; pop rbx; ret */
+        EMIT(t, "\x53");
+        x86_emit_call(ctx, main_);
+        EMIT(t, "\x5b\xc3");
+        x86_end_builtin(ctx, sym);
+
+        sym = x86_define_builtin(ctx, "print");
+        /* push rbp; mov rbp, rsp; and rsp, ~0xf; mov rdi, [rbp+0x10];
+         * mov rax, dpp_host_print */
+        EMIT(t, "\x55\x48\x89\xe5\x48\x83\xe4\xf0\x48\x8b\x7d\x10\x48\xb8");
+        x86_emit_reloc64(ctx, host_print);
+        /* call rax; xor eax, eax; leave; ret */
+        EMIT(t, "\xff\xd0\x31\xc0\xc9\xc3");
+        x86_end_builtin(ctx, sym);
+
+        sym = x86_define_builtin(ctx, "input");
+        /* push rbp; mov rbp, rsp; and rsp, ~0xf; mov rax, dpp_host_input */
+        EMIT(t, "\x55\x48\x89\xe5\x48\x83\xe4\xf0\x48\xb8");
+        x86_emit_reloc64(ctx, host_input);
+        /* call rax; leave; ret */
+        EMIT(t, "\xff\xd0\xc9\xc3");
+        x86_end_builtin(ctx, sym);
+        break;
+    }
+
+    case RT_NONE: break;
+
+    default:
+        fprintf(obj->err, "[Error] Unsupported runtime '%d'\n", rt);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int x86_generate_instr(x86_ctx_t *ctx, ir_instr_t *in_) {
+    int ret = 0;
+    buf_t *t = ctx->text;
+    union {
+        ir_instr_t *i;
+        ir_instr_data_t *data;
+        ir_instr_func_t *func;
+        ir_instr_if_t *iif;
+        ir_instr_label_t *label;
+    } in = { .i = in_ };
+
+    switch(in.i->type) {
+    case IR_NOP: break;
+
+    case IR_PUSH:
+        if(in.data->variable) {
+            buf_push_u8(t, 0xff);
+            x86_emit_rbp(t, 6, in.data->ref->bp_offset);
+        } else x86_emit_push_imm(t, in.data->imm);
+        break;
+
+    case IR_POP:
+        buf_push_u8(t, 0x8f);
+        x86_emit_rbp(t, 0, in.data->ref->bp_offset);
+        break;
+
+    case IR_ASSIGN:
+        /* pop rax; mov [rbp+off], rax */
+        EMIT(t, UNOP_PRE "\x48\x89");
+        x86_emit_rbp(t, RAX, in.data->ref->bp_offset);
+        break;
+
+    case IR_SAVE:
+        EMIT(t, SAVE);
+        break;
+
+    case IR_SCOPEBEGIN:
+        x86_emit_rsp_imm(t, 5, 8*in.data->imm);
+        break;
+
+    case IR_SCOPEEND:
+        x86_emit_rsp_imm(t, 0, 8*in.data->imm);
+        break;
+
+    case IR_ADD:
+        EMIT(t, BINOP_PRE "\x48\x01\xd8");
+        break;
+
+    case IR_SUB:
+        EMIT(t, BINOP_PRE "\x48\x29\xd8");
+        break;
+
+    case IR_MUL:
+        EMIT(t, BINOP_PRE "\x48\xf7\xe3");
+        break;
+
+    case IR_DIV:
+        /* cqo; idiv rbx */
+        EMIT(t, BINOP_PRE "\x48\x99\x48\xf7\xfb");
+        break;
+
+    case IR_MOD:
+        /* cqo; idiv rbx; mov rax, rdx */
+        EMIT(t, BINOP_PRE "\x48\x99\x48\xf7\xfb\x48\x89\xd0");
+        break;
+
+    case IR_BITOR:
+        EMIT(t, BINOP_PRE "\x48\x09\xd8");
+        break;
+
+    case IR_BITAND:
+        EMIT(t, BINOP_PRE "\x48\x21\xd8");
+        break;
+
+    case IR_BITXOR:
+        EMIT(t, BINOP_PRE "\x48\x31\xd8");
+        break;
+
+    case IR_BITNOT:
+        EMIT(t, UNOP_PRE "\x48\xf7\xd0");
+        break;
+
+    case IR_LNOT:
+        /* test rax, rax; sete al */
+        EMIT(t, UNOP_PRE "\x48\x85\xc0\x0f\x94\xc0" SET_POST);
+        break;
+
+    case IR_CALL:
+        x86_emit_fn_call(ctx, in.func->ref);
+        if(in.func->ref->num_args)
+            x86_emit_rsp_imm(t, 0, 8*in.func->ref->num_args);
+        break;
+
+    case IR_FUNC:
+        ctx->ret_fixups.sz = 0;
+        /* push rbp; mov rbp, rsp */
+        EMIT(t, "\x55\x48\x89\xe5");
+        break;
+
+    case IR_LEAVE: {
+        /* implicit return 0 */
+        EMIT(t, "\x31\xc0");
+        size_t *fix = (void *)ctx->ret_fixups.data;
+        for(size_t i = 0; i < ctx->ret_fixups.sz / sizeof *fix; ++i)
+            buf_set_u32(t, fix[i], t->sz - (fix[i] + 4));
+        /* leave; ret */
+        EMIT(t, "\xc9\xc3");
+        break;
+    }
+
+    case IR_LOR:
+        /* or rax, rbx; test rax, rax; setnz al */
+        EMIT(t, BINOP_PRE "\x48\x09\xd8\x48\x85\xc0\x0f\x95\xc0" SET_POST);
+        break;
+
+    case IR_LAND:
+        /* mul rbx; or rax, rdx; test rax, rax; setnz al */
+        EMIT(t, BINOP_PRE "\x48\xf7\xe3\x48\x09\xd0\x48\x85\xc0\x0f\x95\xc0"
+                SET_POST);
+        break;
+
+    case IR_LT:
+        EMIT(t, CMP_PRE "\x0f\x9c\xc0" SET_POST);
+        break;
+
+    case IR_GT:
+        EMIT(t, CMP_PRE "\x0f\x9f\xc0" SET_POST);
+        break;
+
+    case IR_LEQ:
+        EMIT(t, CMP_PRE "\x0f\x9e\xc0" SET_POST);
+        break;
+
+    case IR_GEQ:
+        EMIT(t, CMP_PRE "\x0f\x9d\xc0" SET_POST);
+        break;
+
+    case IR_EQ:
+        EMIT(t, CMP_PRE "\x0f\x94\xc0" SET_POST);
+        break;
+
+    case IR_NEQ:
+        EMIT(t, CMP_PRE "\x0f\x95\xc0" SET_POST);
+        break;
+
+    case IR_IF:
+        /* pop rax; test rax, rax; jz false_label */
+        EMIT(t, UNOP_PRE "\x48\x85\xc0");
+        x86_emit_jump(ctx, "\x0f\x84", 2, in.iif->false_label);
+        break;
+
+    case IR_LABEL:
+        ctx->labels[in.label->id - ctx->first_label] = t->sz;
+        break;
+
+    case IR_RET: {
+        /* pop rax; jmp .ret */
+        EMIT(t, UNOP_PRE "\xe9");
+        size_t off = buf_push_u32(t, 0);
+        buf_push(&ctx->ret_fixups, &off, sizeof off);
+        break;
+    }
+
+    case IR_JMP:
+        x86_emit_jump(ctx, "\xe9", 1, in.label->id);
+        break;
+
+    default:
+        fprintf(ctx->err, "[Error] Invalid instruction in IR code\n");
+        ret = 1;
+        goto ret;
+    }
+
+ret:
+    return ret;
+}
+
+/* labels are numbered consecutively, so the labels of one function form a
+ * range */
+static void x86_label_range(x86_ctx_t *ctx, ir_instr_t **ins, size_t n) {
+    size_t first = SIZE_MAX, last = 0;
+    for(size_t i = 0; i < n; ++i) {
+        size_t ids[2], num_ids = 0;
+        switch(ins[i]->type) {
+        case IR_LABEL: case IR_JMP:
+            ids[num_ids++] = ((ir_instr_label_t *)ins[i])->id;
+            break;
+        case IR_IF:
+            ids[num_ids++] = ((ir_instr_if_t *)ins[i])->false_label;
+            ids[num_ids++] = ((ir_instr_if_t *)ins[i])->end_label;
+            break;
+        default: break;
+        }
+        for(size_t j = 0; j < num_ids; ++j) {
+            first = ids[j] < first ? ids[j] : first;
+            last = ids[j] > last ? ids[j] : last;
+        }
+    }
+    ctx->first_label = first == SIZE_MAX ? 0 : first;
+    ctx->num_labels = first == SIZE_MAX ? 0 : last - first + 1;
+}
@@ -0,0 +1,251 @@
+#include <report.h>
+#include <utils/alloc.h>
+#include <utils/trace.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+static const char *phase_names[] = {
+[REPORT_READ] = "read",
+[REPORT_PARSE] = "parse",
+[REPORT_SEMANTICS] = "semantics",
+[REPORT_CODE] = "ir",
+[REPORT_INCR] = "incremental",
+[REPORT_ASM] = "assembly",
+[REPORT_C] = "c",
+[REPORT_X86] = "machine code",
+[REPORT_ELF] = "elf",
+[REPORT_WRITE] = "write",
+[REPORT_NASM] = "nasm",
+[REPORT_CC] = "cc",
+[REPORT_LINK] = "link",
+[REPORT_RUN] = "run",
+[REPORT_FREE] = "free",
+};
+
+static const char *counter_names[] = {
+[REPORT_SRC_BYTES] = "source bytes",
+[REPORT_TOKENS] = "tokens",
+[REPORT_AST_NODES] = "ast nodes",
+[REPORT_SCOPES] = "scopes",
+[REPORT_VARIABLES] = "variables",
+[REPORT_IR_INSTRS] = "ir instructions",
+[REPORT_ASM_BYTES] = "assembly bytes",
+[REPORT_TEXT_BYTES] = "machine code bytes",
+[REPORT_OUT_BYTES] = "output bytes",
+};
+
+static const char *alloc_type_names[] = {
+[ALLOC_OTHER] = "other",
+[ALLOC_AST] = "ast",
+[ALLOC_VEC] = "vector",
+[ALLOC_BUF] = "buffer",
+[ALLOC_SCOPE] = "scope",
+[ALLOC_VARIABLE] = "variable",
+[ALLOC_FUNCTION] = "function",
+[ALLOC_IR] = "ir",
+[ALLOC_X86] = "machine code",
+};
+
+static void report_print_time(report_t *, FILE *);
+static void report_print_mem(FILE *);
+static void report_json_time(report_t *, FILE *);
+static void report_json_mem(FILE *);
+static void report_json_count(FILE *, struct alloc_count *);
+static uint64_t report_max_rss(void);
+static double report_rate(double, double);
+static void report_json_key(FILE *, const char *);
+
+void report_init(report_t *r) {
+    pthread_mutex_init(&r->lock, NULL);
+    r->show_time = r->show_mem = r->json = 0;
+    report_reset(r);
+}
+
+void report_destroy(report_t *r) {
+    pthread_mutex_destroy(&r->lock);
+}
+
+void report_reset(report_t *r) {
+    memset(r->time, 0, sizeof r->time);
+    memset(r->counters, 0, sizeof r->counters);
+    r->start = report_now();
+    if(r->show_mem) alloc_reset();
+}
+
+/* monotonic time in milliseconds */
+double report_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* starts a phase, its allocations are counted from here on */
+double report_begin(report_t *r, enum report_phase phase) {
+    if(r && r->show_mem) alloc_phase(phase);
+    return report_now();
+}
+
+/* adds the time since start to a phase, a NULL report is ignored but the
+ * phase is still traced */
+void report_time(report_t *r, enum report_phase phase, double start) {
+    trace_end("phase", phase_names[phase], strlen(phase_names[phase]),
+              start * 1e3);
+    if(!r) return;
+    double ms = report_now() - start;
+    pthread_mutex_lock(&r->lock);
+    r->time[phase] += ms;
+    pthread_mutex_unlock(&r->lock);
+}
+
+void report_count(report_t *r, enum report_counter counter, uint64_t n) {
+    if(!r) return;
+    pthread_mutex_lock(&r->lock);
+    r->counters[counter] += n;
+    pthread_mutex_unlock(&r->lock);
+}
+
+void report_print(report_t *r, FILE *f) {
+    if(r->json) {
+        fputc('{', f);
+        if(r->show_time) report_json_time(r, f);
+        if(r->show_time && r->show_mem) fputs(", ", f);
+        if(r->show_mem) report_json_mem(f);
+        fputs("}\n", f);
+        return;
+    }
+    if(r->show_time) report_print_time(r, f);
+    if(r->show_time && r->show_mem) fputc('\n', f);
+    if(r->show_mem) report_print_mem(f);
+}
+
+static void report_print_time(report_t *r, FILE *f) {
+    double wall = report_now() - r->start, sum = 0;
+    for(size_t i = 0; i < REPORT_NUM_PHASES; ++i) sum += r->time[i];
+    double parse = r->time[REPORT_PARSE];
+
+    fprintf(f, "%-14s %12s %7s\n", "Phase", "Time (ms)", "%");
+    for(size_t i = 0; i < REPORT_NUM_PHASES; ++i) {
+        if(!r->time[i]) continue;
+        fprintf(f, "%-14s %12.3f %6.1f%%", phase_names[i], r->time[i],
+                sum ? 100 * r->time[i] / sum : 0);
+        if(i == REPORT_PARSE)
+            fprintf(f, "  %.1f MB/s, %.0f tokens/s",
+                    report_rate(r->counters[REPORT_SRC_BYTES], parse) / 1e6,
+                    report_rate(r->counters[REPORT_TOKENS], parse));
+        fputc('\n', f);
+    }
+    fprintf(f, "%-14s %12.3f\n", "total", sum);
+    fprintf(f, "%-14s %12.3f\n", "wall", wall);
+    fprintf(f, "%-14s %12.1f MB/s\n", "throughput",
+            report_rate(r->counters[REPORT_SRC_BYTES], sum) / 1e6);
+
+    fprintf(f, "\n%-20s %14s\n", "Counter", "Count");
+    for(size_t i = 0; i < REPORT_NUM_COUNTERS; ++i)
+        fprintf(f, "%-20s %14"PRIu64"\n", counter_names[i], r->counters[i]);
+}
+
+/* kibibytes in the table, bytes in JSON */
+static void report_print_mem(FILE *f) {
+    alloc_stats_t s;
+    alloc_stats(&s);
+
+    fprintf(f, "%-14s %10s %10s %14s %12s\n", "Phase", "Allocs", "Frees",
+            "Bytes (KiB)", "Peak (KiB)");
+    for(size_t i = 0; i < REPORT_NUM_PHASES; ++i) {
+        struct alloc_count *c = &s.phases[i];
+        if(!c->allocs && !c->frees) continue;
+        fprintf(f, "%-14s %10"PRIu64" %10"PRIu64" %14.1f %12.1f\n",
+                phase_names[i], c->allocs, c->frees, c->bytes / 1024.0,
+                c->peak / 1024.0);
+    }
+    fprintf(f, "%-14s %10"PRIu64" %10"PRIu64" %14.1f %12.1f\n", "total",
+            s.total.allocs, s.total.frees, s.total.bytes / 1024.0,
+            s.total.peak / 1024.0);
+
+    fprintf(f, "\n%-14s %10s %10s %14s %12s\n", "Type", "Allocs", "Frees",
+            "Live (KiB)", "Peak (KiB)");
+    for(size_t i = 0; i < ALLOC_NUM_TYPES; ++i) {
+        struct alloc_count *c = &s.types[i];
+        if(!c->allocs && !c->live) continue;
+        fprintf(f, "%-14s %10"PRIu64" %10"PRIu64" %14.1f %12.1f\n",
+                alloc_type_names[i], c->allocs, c->frees, c->live / 1024.0,
+                c->peak / 1024.0);
+    }
+    fprintf(f, "%-14s %49.1f\n", "max rss (KiB)",
+            report_max_rss() / 1024.0);
+}
+
+/* times in milliseconds and rates per second, keys are the names of the
+ * table with spaces replaced by underscores */
+static void report_json_time(report_t *r, FILE *f) {
+    double wall = report_now() - r->start, sum = 0;
+    for(size_t i = 0; i < REPORT_NUM_PHASES; ++i) sum += r->time[i];
+    double parse = r->time[REPORT_PARSE];
+
+    fputs("\"phases_ms\": {", f);
+    for(size_t i = 0; i < REPORT_NUM_PHASES; ++i) {
+        if(i) fputs(", ", f);
+        report_json_key(f, phase_names[i]);
+        fprintf(f, "%.6f", r->time[i]);
+    }
+    fprintf(f, "}, \"total_ms\": %.6f, \"wall_ms\": %.6f, \"counters\": {",
+            sum, wall);
+    for(size_t i = 0; i < REPORT_NUM_COUNTERS; ++i) {
+        if(i) fputs(", ", f);
+        report_json_key(f, counter_names[i]);
+        fprintf(f, "%"PRIu64, r->counters[i]);
+    }
+    fprintf(f, "}, \"rates\": {\"parse_bytes_per_s\": %.1f, "
+            "\"parse_tokens_per_s\": %.1f, \"total_bytes_per_s\": %.1f}",
+            report_rate(r->counters[REPORT_SRC_BYTES], parse),
+            report_rate(r->counters[REPORT_TOKENS], parse),
+            report_rate(r->counters[REPORT_SRC_BYTES], sum));
+}
+
+static void report_json_mem(FILE *f) {
+    alloc_stats_t s;
+    alloc_stats(&s);
+
+    fputs("\"memory\": {\"phases\": {", f);
+    for(size_t i = 0; i < REPORT_NUM_PHASES; ++i) {
+        if(i) fputs(", ", f);
+        report_json_key(f, phase_names[i]);
+        report_json_count(f, &s.phases[i]);
+    }
+    fputs("}, \"types\": {", f);
+    for(size_t i = 0; i < ALLOC_NUM_TYPES; ++i) {
+        if(i) fputs(", ", f);
+        report_json_key(f, alloc_type_names[i]);
+        report_json_count(f, &s.types[i]);
+    }
+    fputs("}, \"total\": ", f);
+    report_json_count(f, &s.total);
+    fprintf(f, ", \"max_rss\": %"PRIu64"}", report_max_rss());
+}
+
+static void report_json_count(FILE *f, struct alloc_count *c) {
+    fprintf(f, "{\"allocs\": %"PRIu64", \"frees\": %"PRIu64", "
+            "\"bytes\": %"PRIu64", \"live\": %"PRIu64", "
+            "\"peak\": %"PRIu64"}", c->allocs, c->frees, c->bytes, c->live,
+            c->peak);
+}
+
+/* high-water mark of the resident memory of the whole process in bytes */
+static uint64_t report_max_rss(void) {
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru)) return 0;
+    return (uint64_t)ru.ru_maxrss * 1024;
+}
+
+/* per second from a count and milliseconds */
+static double report_rate(double n, double ms) {
+    return ms > 0 ? n / ms * 1e3 : 0;
+}
+
+static void report_json_key(FILE *f, const char *name) {
+    fputc('"', f);
+    for(; *name; ++name) fputc(*name == ' ' ? '_' : *name, f);
+    fputs("\": ", f);
+}
@@ -0,0 +1,406 @@
+#include <server.h>
+#include <command.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct server_cache_entry {
+    uint64_t hash;
+    struct server_request req;
+    /** source code, NULL for unused entries */
+    char *src;
+    struct server_response res;
+    /** output followed by diagnostics */
+    unsigned char *data;
+} server_cache_entry_t;
+
+typedef struct server {
+    /** kept between requests so its buffers are reused */
+    dpp_t *dpp;
+    /** linked executable of the current request */
+    buf_t exe;
+    server_cache_entry_t cache[SERVER_CACHE_SZ];
+    size_t requests, hits;
+    /** every connection has a thread, but one request is compiled at a
+     * time, the lock protects all of the above */
+    pthread_mutex_t lock;
+    /** connections being served, idle is signalled when it drops to 0 */
+    size_t active;
+    pthread_cond_t idle;
+} server_t;
+
+struct server_conn {
+    server_t *s;
+    int fd;
+};
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void server_signal(int);
+static void *server_conn(void *);
+static int server_handle(server_t *, int);
+static server_cache_entry_t *server_compile(server_t *, struct server_request *,
+                                            const unsigned char *, uint64_t);
+static int server_link(const unsigned char *, size_t, buf_t *);
+static uint64_t server_hash(struct server_request *, const unsigned char *);
+
+static int read_full(int, void *, size_t);
+static int write_full(int, const void *, size_t);
+static int unix_addr(struct sockaddr_un *, const char *);
+
+int server_run(const char *path) {
+    int ret = 1, fd;
+    struct sockaddr_un addr;
+    if(unix_addr(&addr, path)) return 1;
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        fprintf(stderr, "[Error] socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    /* replace a socket left behind by an earlier server, but nothing else */
+    struct stat st;
+    if(!stat(path, &st) && S_ISSOCK(st.st_mode)) unlink(path);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+        fprintf(stderr, "[Error] bind: %s\n", strerror(errno));
+        goto ret_close;
+    }
+    if(listen(fd, 16) == -1) {
+        fprintf(stderr, "[Error] listen: %s\n", strerror(errno));
+        goto ret_unlink;
+    }
+
+    /* no SA_RESTART so accept is interrupted */
+    struct sigaction sa = { .sa_handler = server_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    /* a client going away must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    server_t s = { .requests = 0, .hits = 0, .active = 0 };
+    if(!(s.dpp = dpp_new())) {
+        fprintf(stderr, "[Error] Failed to create compiler context\n");
+        goto ret_unlink;
+    }
+    buf_init(&s.exe, 4096);
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.idle, NULL);
+    /* the signals are left to the thread which accepts */
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+
+    fprintf(stderr, "[Info] Listening on %s\n", path);
+    while(!server_stop) {
+        int conn;
+        if((conn = accept(fd, NULL, NULL)) == -1) {
+            if(errno == EINTR) continue;
+            fprintf(stderr, "[Error] accept: %s\n", strerror(errno));
+            break;
+        }
+        /* a client which stops sending or reading is dropped */
+        struct timeval tv = { .tv_sec = SERVER_TIMEOUT, .tv_usec = 0 };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+
+        struct server_conn *c = malloc(sizeof(struct server_conn));
+        c->s = &s;
+        c->fd = conn;
+        pthread_t thread;
+        pthread_mutex_lock(&s.lock);
+        ++s.active;
+        pthread_mutex_unlock(&s.lock);
+        pthread_sigmask(SIG_BLOCK, &block, &old);
+        int err = pthread_create(&thread, NULL, server_conn, c);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if(err) {
+            fprintf(stderr, "[Error] pthread_create: %s\n", strerror(err));
+            server_conn(c);
+        } else pthread_detach(thread);
+    }
+
+    /* the connections end within the timeout */
+    pthread_mutex_lock(&s.lock);
+    while(s.active) pthread_cond_wait(&s.idle, &s.lock);
+    pthread_mutex_unlock(&s.lock);
+    fprintf(stderr, "[Info] Served %zu requests, %zu from cache\n",
+            s.requests, s.hits);
+    ret = 0;
+
+    for(size_t i = 0; i < SERVER_CACHE_SZ; ++i) {
+        free(s.cache[i].src);
+        free(s.cache[i].data);
+    }
+    pthread_cond_destroy(&s.idle);
+    pthread_mutex_destroy(&s.lock);
+    buf_destroy(&s.exe);
+    dpp_free(s.dpp);
+ret_unlink:
+    unlink(path);
+ret_close:
+    close(fd);
+    return ret;
+}
+
+static void server_signal(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
+
+static void *server_conn(void *data) {
+    struct server_conn *c = data;
+    server_t *s = c->s;
+    server_handle(s, c->fd);
+    close(c->fd);
+    free(c);
+    pthread_mutex_lock(&s->lock);
+    if(!--s->active) pthread_cond_signal(&s->idle);
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/* serves requests until the client closes the connection, only compiling
+ * holds the lock so a slow client does not hold up the others */
+static int server_handle(server_t *s, int fd) {
+    struct server_request req;
+    struct server_response res;
+    /* source of the current request, then its response */
+    buf_t src, out;
+    int r, ret = 1;
+    buf_init(&src, 4096);
+    buf_init(&out, 4096);
+    while(!(r = read_full(fd, &req, sizeof req))) {
+        if(req.magic != SERVER_MAGIC || req.output > DPP_OUTPUT_ASM
+        || req.runtime > DPP_RUNTIME_SYSCALL || req.src_sz > SERVER_MAX_SRC) {
+            fprintf(stderr, "[Error] Invalid request\n");
+            goto ret;
+        }
+
+        buf_reserve(&src, req.src_sz);
+        if(read_full(fd, src.data, req.src_sz)) goto ret;
+        src.sz = req.src_sz;
+
+        pthread_mutex_lock(&s->lock);
+        ++s->requests;
+        /* answer repeated requests without compiling again */
+        uint64_t hash = server_hash(&req, src.data);
+        server_cache_entry_t *e = &s->cache[hash % SERVER_CACHE_SZ];
+        if(e->src && e->hash == hash && e->req.output == req.output
+        && e->req.runtime == req.runtime && e->req.src_sz == req.src_sz
+        && !memcmp(e->src, src.data, req.src_sz))
+            ++s->hits;
+        else e = server_compile(s, &req, src.data, hash);
+        /* the entry may be replaced once the lock is released */
+        res = e->res;
+        out.sz = 0;
+        buf_push(&out, e->data, res.out_sz + res.diag_sz);
+        pthread_mutex_unlock(&s->lock);
+
+        if(write_full(fd, &res, sizeof res)
+        || write_full(fd, out.data, out.sz))
+            goto ret;
+    }
+    ret = r < 0;
+
+ret:
+    buf_destroy(&src);
+    buf_destroy(&out);
+    return ret;
+}
+
+static server_cache_entry_t *server_compile(server_t *s,
+                                            struct server_request *req,
+                                            const unsigned char *src,
+                                            uint64_t hash) {
+    server_cache_entry_t *e = &s->cache[hash % SERVER_CACHE_SZ];
+    free(e->src);
+    free(e->data);
+    e->hash = hash;
+    e->req = *req;
+    e->src = malloc(req->src_sz + 1);
+    memcpy(e->src, src, req->src_sz);
+
+    /* executables using libc are compiled to an object and linked */
+    int link = req->output == DPP_OUTPUT_EXEC
+            && req->runtime == DPP_RUNTIME_LIBC;
+    int status = dpp_compile(s->dpp, e->src, req->src_sz,
+                             link ? DPP_OUTPUT_OBJ : req->output,
+                             req->runtime);
+
+    size_t out_sz, diag_sz;
+    const unsigned char *out = dpp_output(s->dpp, &out_sz);
+    const char *diag = dpp_diagnostics(s->dpp, &diag_sz);
+    static const char link_err[] = "[Error] Linking failed\n";
+    if(!status && link) {
+        if((status = server_link(out, out_sz, &s->exe))) {
+            diag = link_err;
+            diag_sz = sizeof link_err - 1;
+        }
+        out = s->exe.data;
+        out_sz = s->exe.sz;
+    }
+    if(status) out_sz = 0;
+
+    e->res = (struct server_response){
+    .magic = SERVER_MAGIC,
+    .status = status,
+    .out_sz = out_sz,
+    .diag_sz = diag_sz,
+    };
+    e->data = malloc(out_sz + diag_sz + 1);
+    if(out_sz) memcpy(e->data, out, out_sz);
+    memcpy(e->data + out_sz, diag, diag_sz);
+    return e;
+}
+
+/* links an object file using GCC, like the command line driver does */
+static int server_link(const unsigned char *obj, size_t sz, buf_t *exe) {
+    int ret = 1, fd;
+    char obj_path[] = P_tmpdir "/dpp_XXXXXX";
+    char exe_path[] = P_tmpdir "/dpp_XXXXXX";
+    if((fd = mkstemp(obj_path)) == -1) {
+        fprintf(stderr, "[Error] mkstemp: %s\n", strerror(errno));
+        return 1;
+    }
+    int fail = write_full(fd, obj, sz);
+    close(fd);
+    if(fail) goto ret_obj;
+
+    if((fd = mkstemp(exe_path)) == -1) {
+        fprintf(stderr, "[Error] mkstemp: %s\n", strerror(errno));
+        goto ret_obj;
+    }
+    close(fd);
+
+    char *argv[] = { "gcc", "-no-pie", "-o", exe_path, obj_path, NULL };
+    if(command_run(argv, -1, stderr)) goto ret_exe;
+
+    if((fd = open(exe_path, O_RDONLY)) == -1) {
+        fprintf(stderr, "[Error] %s: %s\n", exe_path,
+                strerror(errno));
+        goto ret_exe;
+    }
+    struct stat st;
+    if(!fstat(fd, &st)) {
+        buf_reserve(exe, st.st_size);
+        ret = read_full(fd, exe->data, st.st_size) != 0;
+        exe->sz = ret ? 0 : (size_t)st.st_size;
+    }
+    close(fd);
+
+ret_exe:
+    unlink(exe_path);
+ret_obj:
+    unlink(obj_path);
+    return ret;
+}
+
+/* FNV-1a of the options and source */
+static uint64_t server_hash(struct server_request *req,
+                            const unsigned char *src) {
+    uint64_t h = 0xcbf29ce484222325u;
+    h = (h ^ req->output) * 0x100000001b3u;
+    h = (h ^ req->runtime) * 0x100000001b3u;
+    for(size_t i = 0; i < req->src_sz; ++i)
+        h = (h ^ src[i]) * 0x100000001b3u;
+    return h;
+}
+
+int client_connect(const char *path, FILE *err) {
+    int fd;
+    struct sockaddr_un addr;
+    if(unix_addr(&addr, path)) return -1;
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        fprintf(err, "[Error] socket: %s\n", strerror(errno));
+        return -1;
+    }
+    if(connect(fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+        fprintf(err, "[Error] %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* sends a compile request and receives the output into out, diagnostics are
+ * written to err */
+int client_compile(int fd, enum dpp_output output, enum dpp_runtime rt,
+                   const void *src, size_t sz, buf_t *out, FILE *err) {
+    struct server_request req = {
+    .magic = SERVER_MAGIC,
+    .output = output,
+    .runtime = rt,
+    .src_sz = sz,
+    };
+    struct server_response res;
+    if(write_full(fd, &req, sizeof req) || write_full(fd, src, sz)
+    || read_full(fd, &res, sizeof res) || res.magic != SERVER_MAGIC) {
+        fprintf(err, "[Error] Failed to communicate with the server\n");
+        return 1;
+    }
+
+    out->sz = 0;
+    buf_reserve(out, res.out_sz + res.diag_sz);
+    if(read_full(fd, out->data, res.out_sz + res.diag_sz)) {
+        fprintf(err, "[Error] Failed to communicate with the server\n");
+        return 1;
+    }
+    fwrite(out->data + res.out_sz, 1, res.diag_sz, err);
+    out->sz = res.out_sz;
+    return res.status != 0;
+}
+
+/* returns 1 on EOF before any data and -1 on errors */
+static int read_full(int fd, void *data, size_t sz) {
+    for(size_t off = 0; off < sz;) {
+        ssize_t n = read(fd, (char *)data + off, sz - off);
+        if(n == 0) return off ? -1 : 1;
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                fprintf(stderr, "[Error] read: Timed out\n");
+            else fprintf(stderr, "[Error] read: %s\n", strerror(errno));
+            return -1;
+        }
+        off += n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *data, size_t sz) {
+    for(size_t off = 0; off < sz;) {
+        ssize_t n = write(fd, (const char *)data + off, sz - off);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                fprintf(stderr, "[Error] write: Timed out\n");
+            else fprintf(stderr, "[Error] write: %s\n", strerror(errno));
+            return 1;
+        }
+        off += n;
+    }
+    return 0;
+}
+
+static int unix_addr(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof addr->sun_path) {
+        fprintf(stderr, "[Error] Socket path '%s' is too long\n", path);
+        return 1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file
+ * @copydoc utils/alloc.h
+ */
+#include <utils/alloc.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the counters are shared by all threads, the phase is per thread, tracking
+ * is only turned on before any other thread starts */
+int alloc_tracking;
+static alloc_stats_t alloc_counters;
+static __thread unsigned alloc_cur_phase;
+
+static void alloc_add(enum alloc_type, size_t);
+static void alloc_sub(enum alloc_type, size_t);
+static void alloc_max(uint64_t *, uint64_t);
+
+void alloc_track(void) {
+    alloc_tracking = 1;
+}
+
+void alloc_phase(unsigned phase) {
+    alloc_cur_phase = phase < ALLOC_MAX_PHASES ? phase : 0;
+}
+
+void alloc_stats(alloc_stats_t *stats) {
+    uint64_t *dst = (void *)stats, *src = (void *)&alloc_counters;
+    for(size_t i = 0; i < sizeof *stats / sizeof(uint64_t); ++i)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+void alloc_reset(void) {
+    alloc_stats_t *s = &alloc_counters;
+    memset(s->phases, 0, sizeof s->phases);
+    for(size_t i = 0; i <= ALLOC_NUM_TYPES; ++i) {
+        /* total follows the types */
+        struct alloc_count *c = i < ALLOC_NUM_TYPES ? &s->types[i]
+                                                    : &s->total;
+        c->allocs = c->frees = c->bytes = 0;
+        c->peak = __atomic_load_n(&c->live, __ATOMIC_RELAXED);
+    }
+}
+
+void *alloc_malloc_tracked(enum alloc_type type, size_t sz) {
+    void *p = malloc(sz);
+    if(p) alloc_add(type, malloc_usable_size(p));
+    return p;
+}
+
+void *alloc_calloc_tracked(enum alloc_type type, size_t n, size_t sz) {
+    void *p = calloc(n, sz);
+    if(p) alloc_add(type, malloc_usable_size(p));
+    return p;
+}
+
+void *alloc_realloc_tracked(enum alloc_type type, void *p, size_t sz) {
+    size_t old = p ? malloc_usable_size(p) : 0;
+    void *q = realloc(p, sz);
+    if(!q) return NULL;
+    if(p) alloc_sub(type, old);
+    alloc_add(type, malloc_usable_size(q));
+    return q;
+}
+
+char *alloc_strndup(enum alloc_type type, const char *s, size_t sz) {
+    char *p = alloc_malloc(type, sz + 1);
+    memcpy(p, s, sz);
+    p[sz] = '\0';
+    return p;
+}
+
+void alloc_free_tracked(enum alloc_type type, void *p) {
+    if(p) alloc_sub(type, malloc_usable_size(p));
+    free(p);
+}
+
+static void alloc_add(enum alloc_type type, size_t sz) {
+    struct alloc_count *t = &alloc_counters.types[type],
+                       *p = &alloc_counters.phases[alloc_cur_phase],
+                       *all = &alloc_counters.total;
+    uint64_t live;
+
+    __atomic_add_fetch(&t->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&t->bytes, sz, __ATOMIC_RELAXED);
+    alloc_max(&t->peak, __atomic_add_fetch(&t->live, sz, __ATOMIC_RELAXED));
+
+    __atomic_add_fetch(&all->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&all->bytes, sz, __ATOMIC_RELAXED);
+    live = __atomic_add_fetch(&all->live, sz, __ATOMIC_RELAXED);
+    alloc_max(&all->peak, live);
+
+    __atomic_add_fetch(&p->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p->bytes, sz, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->live, live, __ATOMIC_RELAXED);
+    alloc_max(&p->peak, live);
+}
+
+static void alloc_sub(enum alloc_type type, size_t sz) {
+    struct alloc_count *t = &alloc_counters.types[type],
+                       *p = &alloc_counters.phases[alloc_cur_phase],
+                       *all = &alloc_counters.total;
+
+    __atomic_add_fetch(&t->frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&t->live, sz, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&all->frees, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p->frees, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->live,
+                     __atomic_sub_fetch(&all->live, sz, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+}
+
+/* raises the peak to at least v */
+static void alloc_max(uint64_t *peak, uint64_t v) {
+    uint64_t cur = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while(cur < v && !__atomic_compare_exchange_n(peak, &cur, v, 1,
+                                                  __ATOMIC_RELAXED,
+                                                  __ATOMIC_RELAXED));
+}
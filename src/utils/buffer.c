@@ -0,0 +1,70 @@
+/**
+ * @file
+ * @copydoc utils/buffer.h
+ */
+#include <utils/buffer.h>
+#include <utils/alloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+buf_t *buf_init(buf_t *b, size_t n) {
+    b->data = alloc_malloc(ALLOC_BUF, n ? n : 1);
+    b->sz = 0;
+    b->capacity = n ? n : 1;
+    return b;
+}
+
+void buf_destroy(buf_t *b) {
+    alloc_free(ALLOC_BUF, b->data);
+    b->data = NULL;
+    b->sz = b->capacity = 0;
+}
+
+size_t buf_reserve(buf_t *b, size_t n) {
+    if(b->capacity >= n) return b->capacity;
+    size_t cap = b->capacity ? b->capacity : 1;
+    while(cap < n) cap = (cap*3 + 1)>>1;
+    b->data = alloc_realloc(ALLOC_BUF, b->data, b->capacity = cap);
+    return b->capacity;
+}
+
+size_t buf_push(buf_t *b, const void *data, size_t sz) {
+    size_t off = b->sz;
+    buf_reserve(b, b->sz + sz);
+    if(data) memcpy(b->data + off, data, sz);
+    else memset(b->data + off, 0, sz);
+    b->sz += sz;
+    return off;
+}
+
+size_t buf_align(buf_t *b, size_t align) {
+    size_t pad = (align - (b->sz & (align - 1))) & (align - 1);
+    buf_push(b, NULL, pad);
+    return b->sz;
+}
+
+size_t buf_push_u8(buf_t *b, uint8_t c) {
+    if(b->sz == b->capacity) buf_reserve(b, b->sz + 1);
+    b->data[b->sz] = c;
+    return b->sz++;
+}
+
+size_t buf_push_u32(buf_t *b, uint32_t v) {
+    size_t off = buf_push(b, NULL, 4);
+    buf_set_u32(b, off, v);
+    return off;
+}
+
+size_t buf_push_u64(buf_t *b, uint64_t v) {
+    size_t off = buf_push(b, NULL, 8);
+    buf_set_u64(b, off, v);
+    return off;
+}
+
+void buf_set_u32(buf_t *b, size_t off, uint32_t v) {
+    for(size_t i = 0; i < 4; ++i) b->data[off + i] = v >> 8*i;
+}
+
+void buf_set_u64(buf_t *b, size_t off, uint64_t v) {
+    for(size_t i = 0; i < 8; ++i) b->data[off + i] = v >> 8*i;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file
+ * @copydoc utils/trace.h
+ */
+#include <utils/trace.h>
+#include <utils/buffer.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* events are complete ("X") events, formatted when they end and separated
+ * by commas */
+int trace_enabled;
+static buf_t trace_events;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned trace_num_threads;
+static __thread unsigned trace_tid;
+
+static void trace_push_str(buf_t *, const char *, size_t);
+
+void trace_enable(void) {
+    buf_init(&trace_events, 4096);
+    trace_enabled = 1;
+}
+
+uint64_t trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+void trace_event(const char *cat, const char *name, size_t name_sz,
+                 uint64_t start) {
+    uint64_t end = trace_clock();
+    char num[96];
+
+    pthread_mutex_lock(&trace_lock);
+    /* threads are numbered in the order they first record an event */
+    if(!trace_tid) trace_tid = ++trace_num_threads;
+
+    if(trace_events.sz) buf_push_u8(&trace_events, ',');
+    buf_push(&trace_events, "\n{\"name\":", 9);
+    trace_push_str(&trace_events, name, name_sz);
+    buf_push(&trace_events, ",\"cat\":", 7);
+    trace_push_str(&trace_events, cat, strlen(cat));
+    buf_push(&trace_events, num,
+             snprintf(num, sizeof num, ",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                      "\"pid\":%ld,\"tid\":%u}", (unsigned long long)start,
+                      (unsigned long long)(end - start), (long)getpid(),
+                      trace_tid));
+    pthread_mutex_unlock(&trace_lock);
+}
+
+int trace_write(FILE *f) {
+    pthread_mutex_lock(&trace_lock);
+    fputs("{\"traceEvents\":[", f);
+    fwrite(trace_events.data, 1, trace_events.sz, f);
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", f);
+    pthread_mutex_unlock(&trace_lock);
+    return ferror(f);
+}
+
+void trace_reset(void) {
+    pthread_mutex_lock(&trace_lock);
+    trace_events.sz = 0;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/* appends a JSON string */
+static void trace_push_str(buf_t *b, const char *s, size_t sz) {
+    buf_push_u8(b, '"');
+    for(size_t i = 0; i < sz; ++i) {
+        unsigned char c = s[i];
+        if(c == '"' || c == '\\') {
+            buf_push_u8(b, '\\');
+            buf_push_u8(b, c);
+        } else if(c < 0x20) {
+            char esc[7];
+            snprintf(esc, sizeof esc, "\\u%04x", c);
+            buf_push(b, esc, 6);
+        } else buf_push_u8(b, c);
+    }
+    buf_push_u8(b, '"');
+}
@@ -33,6 +33,7 @@
  * @copydoc utils/vector.h
  */
 #include <utils/vector.h>
+#include <utils/alloc.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,7 +43,7 @@ static inline void vec_print_str(FILE *, vec_item_t);
 static inline void vec_print_ptr(FILE *, vec_item_t);
 
 inline vec_t *vec_init(vec_t *vec, size_t n) {
-    vec->items = malloc(n*sizeof(vec_item_t));
+    vec->items = alloc_malloc(ALLOC_VEC, n*sizeof(vec_item_t));
     vec->free_fn = NULL;
     vec->sz = 0;
     vec->capacity = n;
@@ -51,7 +52,7 @@ inline vec_t *vec_init(vec_t *vec, size_t n) {
 }
 
 inline vec_t *vec_new(size_t n) {
-    vec_t *vec = malloc(sizeof(vec_t));
+    vec_t *vec = alloc_malloc(ALLOC_VEC, sizeof(vec_t));
     return vec_init(vec, n);
 }
 
@@ -62,38 +63,38 @@ inline vec_t *vec_init_free(vec_t *vec, size_t n, vec_free_t fn) {
 }
 
 inline vec_t *vec_new_free(size_t n, vec_free_t fn) {
-    vec_t *vec = malloc(sizeof(vec_t));
+    vec_t *vec = alloc_malloc(ALLOC_VEC, sizeof(vec_t));
     return vec_init_free(vec, n, fn);
 }
 
 inline vec_t *vec_init_copy(vec_t *dst, vec_t *src) {
     dst->capacity = dst->sz = src->sz;
     dst->free_fn = src->free_fn;
-    dst->items = malloc(sizeof(vec_item_t)*dst->capacity);
+    dst->items = alloc_malloc(ALLOC_VEC, sizeof(vec_item_t)*dst->capacity);
     memcpy(dst->items, src->items, sizeof(vec_item_t)*dst->sz);
     return dst;
 }
 
 inline vec_t *vec_new_copy(vec_t *src) {
-    vec_t *dst = malloc(sizeof(vec_t));
+    vec_t *dst = alloc_malloc(ALLOC_VEC, sizeof(vec_t));
     return vec_init_copy(dst, src);
 }
 
 inline void vec_free(vec_t *vec) {
     vec_destroy(vec);
-    free(vec);
+    alloc_free(ALLOC_VEC, vec);
 }
 
 inline void vec_destroy(vec_t *vec) {
     if(vec->free_fn)
         for(size_t i = 0; i < vec->sz; ++i)
             vec->free_fn(vec->items[i]);
-    free(vec->items);
+    alloc_free(ALLOC_VEC, vec->items);
 }
 
 inline vec_item_t vec_push(vec_t *vec, vec_item_t item) {
     if(++vec->sz > vec->capacity)
-        vec->items = realloc(vec->items, sizeof(vec_item_t)
+        vec->items = alloc_realloc(ALLOC_VEC, vec->items, sizeof(vec_item_t)
                              * (vec->capacity = (vec->capacity*3 + 1)>>1));
     return vec->items[vec->sz-1] = item;
 }
@@ -110,7 +111,7 @@ inline void vec_pop_free(vec_t *vec) {
 
 inline vec_item_t vec_insert(vec_t *vec, size_t idx, vec_item_t item) {
     if(++vec->sz > vec->capacity)
-        vec->items = realloc(vec->items, sizeof(vec_item_t)
+        vec->items = alloc_realloc(ALLOC_VEC, vec->items, sizeof(vec_item_t)
                              * (vec->capacity = (vec->capacity*3 + 1)>>1));
     memmove(vec->items + idx + 1, vec->items + idx,
             sizeof(vec_item_t) * (vec->sz-1-idx));
@@ -166,7 +167,8 @@ inline size_t vec_shrink(vec_t *vec, size_t n) {
     if(vec->free_fn && vec->sz > n)
         for(size_t i = n; i < vec->sz; ++i)
             vec->free_fn(vec->items[i]);
-    if(vec->capacity > n) vec->items = realloc(vec->items, vec->capacity = n);
+    if(vec->capacity > n)
+        vec->items = alloc_realloc(ALLOC_VEC, vec->items, vec->capacity = n);
     return vec->capacity;
 }
 
@@ -3,7 +3,7 @@
 %token IDENTIFIER CONSTANT
 %token LEQ_OP GEQ_OP EQ_OP NEQ_OP LAND_OP LOR_OP
 
-%token LET IF ELSE FN RETURN
+%token LET IF ELSE FN RETURN EXTERN
 
 %start translation_unit
 
@@ -147,9 +147,19 @@ fn_definition
 	| FN IDENTIFIER '(' argument_list ')' block_statement
 	;
 
-translation_unit
+fn_declaration
+	: EXTERN FN IDENTIFIER '(' ')' ';'
+	| EXTERN FN IDENTIFIER '(' argument_list ')' ';'
+	;
+
+external_declaration
 	: fn_definition
-	| translation_unit fn_definition
+	| fn_declaration
+	;
+
+translation_unit
+	: external_declaration
+	| translation_unit external_declaration
 	;
 
 %%